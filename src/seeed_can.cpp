@@ -14,18 +14,82 @@
  */
 
 #include "seeed_can.h"
+#include "seeed_can_capture.h"
+#include "seeed_can_change.h"
+#include "seeed_can_limit.h"
+#include "seeed_can_mailbox.h"
+#include "seeed_can_responder.h"
+
+// Interrupt work put off until a thread's MCP2515 sequence is over (see mcpDeferIsr)
+#define CAN_DEFER_IRQ 0x01
+#define CAN_DEFER_POLL 0x02
+
+#ifdef SEEED_CAN_RTOS
+// Driver thread signals
+#define CAN_SIG_IRQ 0x01
+#define CAN_SIG_POLL 0x02
+#define CAN_SIG_SUBMIT 0x04
+#endif
 
 SEEED_CAN::SEEED_CAN(PinName ncs, PinName irq, PinName mosi, PinName miso, PinName clk, int spiBitrate)
-    : _spi(mosi, miso, clk), _can(_spi, ncs, irq), _irqpin(irq) {
+    : _spi(mosi, miso, clk),
+      _can(_spi, ncs, irq),
+      _spiHz(spiBitrate),
+      _openUs(0),
+      _irqpin(irq),
+      _irqHandled(0),
+      _irqStatus(0),
+      _deferred(0),
+      _rxPriority(false),
+      _rxAdaptive(false),
+      _rxPolling(false),
+      _rxChange(NULL),
+      _rxMailboxes(NULL),
+      _rxCapture(NULL),
+      _rxResponder(NULL),
+      _txLimit(NULL),
+      _rxBatchLost(0) {
+  _rxHwOverflows[0] = _rxHwOverflows[1] = 0;
+  memset(&_rxModeStats, 0, sizeof(_rxModeStats));
+#ifdef SEEED_CAN_RTOS
+  _thread = NULL;
+  _txPending = false;
+  _txNumParked = 0;
+#endif
   // Make sure CS is high
   _can.ncs = 1;
   // Set up the spi interface
   _can.spi.format(8, 3);
   _can.spi.frequency(spiBitrate);
+  _can.onUnlock.attach(this, &SEEED_CAN::runDeferred);
   _irqpin.fall(this, &SEEED_CAN::call_irq);
 }
 
-int SEEED_CAN::open(int canBitrate, Mode mode) { return mcpInit(&_can, (uint32_t)canBitrate, (CANMode)mode); }
+int SEEED_CAN::open(int canBitrate, Mode mode) {
+  uint32_t start = us_ticker_read();
+  int ok = mcpInit(&_can, (uint32_t)canBitrate, (CANMode)mode);
+  _openUs = us_ticker_read() - start;
+  return ok;
+}
+
+int SEEED_CAN::open(const SEEED_CANConfig &config) {
+  if (!config._valid) {
+    return 0;
+  }
+  uint32_t start = us_ticker_read();
+  int ok = mcpInitImage(&_can, &config._image);
+  _openUs = us_ticker_read() - start;
+  return ok;
+}
+
+void SEEED_CAN::snapshot(SEEED_CANConfig &config) {
+  MCP_Lock lock(&_can);
+  config._image = _can.shadow;
+  config._image.dirty = 0;
+  config._valid = (_can.bitRate != 0);  // Not opened yet, there is no bit timing to capture
+}
+
+unsigned int SEEED_CAN::openTime(void) { return _openUs; }
 
 void SEEED_CAN::monitor(bool silent) { mcpMonitor(&_can, silent); }
 
@@ -33,9 +97,537 @@ int SEEED_CAN::mode(Mode mode) { return mcpMode(&_can, (CANMode)mode); }
 
 int SEEED_CAN::frequency(int canBitRate) { return mcpInit(&_can, (uint32_t)canBitRate, (CANMode)Normal); }
 
-int SEEED_CAN::read(SEEED_CANMessage &msg) { return mcpCanRead(&_can, &msg); }
+int SEEED_CAN::bitRate(void) { return (int)_can.bitRate; }
+
+int SEEED_CAN::checkReset(void) { return mcpCheckReset(&_can); }
+
+int SEEED_CAN::spiFrequency(void) { return (int)_spiHz; }
+
+int SEEED_CAN::tuneSpi(int maxHz, int frames, SpiStep steps[]) {
+  static const uint32_t stepHz[CAN_SPI_STEPS] = {1000000, 2000000, 4000000, 5000000, 8000000, 10000000};
+  MCP_Lock lock(&_can);
+  int selected = -1;
+  int passed = -1;
+
+  for (int i = 0; (i < CAN_SPI_STEPS) && (stepHz[i] <= (uint32_t)maxHz); i++) {
+    SpiStep step;
+    step.hz = stepHz[i];
+    _can.spi.frequency(step.hz);
+    bool ok = spiStep(step, frames);
+    if (steps) {
+      steps[i] = step;
+    }
+    if (!ok) {
+      break;
+    }
+    selected = passed;
+    passed = i;
+  }
+  if ((passed == CAN_SPI_STEPS - 1) || (passed == 0)) {
+    selected = passed;  // Nothing above the MCP2515's maximum to test against, or nothing below 1 MHz to fall back to
+  }
+  if (selected >= 0) {
+    _spiHz = stepHz[selected];
+  }
+  _can.spi.frequency(_spiHz);
+  mcpReset(&_can);  // Leave no test patterns or loopback configuration behind
+  mcpShadowReset(&_can);
+  _can.bitRate = 0;  // Not opened: the loopback bit rate and any reservation are gone with the reset
+  _can.txReserved = 0;
+  return (selected >= 0) ? (int)_spiHz : 0;
+}
+
+bool SEEED_CAN::spiStep(SpiStep &step, int frames) {
+  uint32_t spiUs = 0;
+  uint32_t timed = 0;
+  uint32_t lfsr = 0xACE1u ^ step.hz;
+
+  step.errors = 0;
+  step.frameUs = 0;
+  step.passed = false;
+  mcpReset(&_can);
+  mcpShadowReset(&_can);
+  for (uint8_t seed = 0; seed < 8; seed++) {
+    step.errors += mcpRegisterTest(&_can, seed);
+  }
+  // Loopback mode keeps the test frames off the bus, make sure the MCP2515 really is in it. Filters match IDE even
+  // when their mask is clear, so one of RXB1's must be extended for the extended test frames to come back.
+  if (step.errors || !mcpInit(&_can, 1000000, _M_LOOPBACK) || !mcpInitFilter(&_can, 2, 0, true) ||
+      ((mcpRead(&_can, MCP_CANSTAT) & MODE_MASK) != MODE_LOOPBACK)) {
+    step.errors += step.errors ? 0 : 1;  // A failed mode change is a misread CANSTAT
+    return false;
+  }
+  for (int f = 0; f < frames; f++) {
+    SEEED_CANMessage out;
+    SEEED_CANMessage in;
+    out.format = (f & 1) ? CANExtended : CANStandard;
+    for (uint32_t i = 0; i < 8; i++) {  // Galois LFSR, different frames at each step
+      lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400u);
+      out.data[i] = (uint8_t)lfsr;
+    }
+    out.id = ((lfsr << 13) ^ f) & ((out.format == CANExtended) ? 0x1FFFFFFF : 0x7FF);
+    uint32_t start = us_ticker_read();
+    if (!mcpCanWrite(&_can, out)) {
+      step.errors++;
+      continue;
+    }
+    uint32_t loaded = us_ticker_read();
+    while (!(mcpReceiveStatus(&_can) & MCP_RXSTAT_RXB_MASK) && ((us_ticker_read() - loaded) < 2000)) {
+    }
+    uint32_t received = us_ticker_read();
+    if (!mcpCanRead(&_can, &in) || (in.id != out.id) || (in.format != out.format) || (in.type != out.type) ||
+        (in.len != out.len) || memcmp(in.data, out.data, 8)) {
+      step.errors++;
+      continue;
+    }
+    spiUs += (loaded - start) + (us_ticker_read() - received);
+    timed++;
+  }
+  step.frameUs = timed ? (spiUs / timed) : 0;
+  step.passed = (step.errors == 0);
+  return step.passed;
+}
+
+int SEEED_CAN::autoBaud(Mode mode, int dwellMs, const int rates[], int count, BaudStep steps[]) {
+  static const int likely[CAN_BAUD_RATES] = {500000, 250000, 125000, 1000000, 100000,
+                                             50000,  83333,  33333,  20000,   10000};
+  MCP_Lock lock(&_can);
+  uint8_t cnf[CAN_BAUD_RATES][3];
+  uint32_t hz[CAN_BAUD_RATES];
+  uint32_t start = us_ticker_read();
+  int first = -1;
+  int found = -1;
+
+  if (!rates) {
+    rates = likely;
+    count = CAN_BAUD_RATES;
+  }
+  count = (count > CAN_BAUD_RATES) ? CAN_BAUD_RATES : count;
+  for (int i = 0; i < count; i++) {  // No SPI traffic, so switching between candidates is just a CNF burst
+    hz[i] = mcpBitTiming((uint32_t)rates[i], cnf[i]);
+    first = ((first < 0) && hz[i]) ? i : first;
+  }
+  // The reset clears the old masks, filters and transmit buffers, each candidate then leaves Configuration mode for
+  // Listen Only and comes back to it itself
+  if ((first >= 0) && mcpInit(&_can, hz[first], _M_CONFIG)) {
+    for (int i = 0; (i < count) && (found < 0); i++) {
+      BaudStep step;
+      memset(&step, 0, sizeof(step));
+      step.hz = hz[i];
+      if (hz[i] && mcpMode(&_can, _M_CONFIG)) {  // CNF1..3 can only be written in Configuration mode
+        mcpShadowSet(&_can, MCP_CNF3, cnf[i], sizeof(cnf[i]));
+        _can.bitRate = hz[i];
+        if (mcpShadowFlush(&_can) && mcpMode(&_can, _M_MONITOR) && baudStep(step, (uint32_t)dwellMs * 1000)) {
+          found = i;
+        }
+      }
+      if (steps) {
+        steps[i] = step;
+      }
+    }
+  }
+  if ((found < 0) || !mcpMode(&_can, (CANMode)mode)) {
+    mcpReset(&_can);  // Leave no candidate bit rate behind
+    mcpShadowReset(&_can);
+    _can.bitRate = 0;
+    found = -1;
+  }
+  _openUs = us_ticker_read() - start;
+  return (found >= 0) ? (int)hz[found] : 0;
+}
+
+bool SEEED_CAN::baudStep(BaudStep &step, uint32_t dwellUs) {
+  uint8_t regs[CAN_FRAME_REGS];
+  uint32_t start = us_ticker_read();
+
+  mcpClearInterrupts(&_can, MCP_RX_INTS | MCP_MERRF);  // Frames and errors seen at the previous bit rate
+  do {
+    uint8_t flags = (uint8_t)mcpInterruptStatus(&_can);
+    if (flags & MCP_MERRF) {
+      mcpClearInterrupts(&_can, MCP_MERRF);
+      step.errors++;
+    }
+    for (uint8_t num = 0; num < 2; num++) {
+      if (flags & (MCP_RX0IF << num)) {
+        mcpCanReadRaw(&_can, num, regs);  // Only the CRC check matters, reading just frees the buffer
+        step.frames++;
+      }
+    }
+    step.dwellUs = us_ticker_read() - start;
+    if (step.frames >= CAN_BAUD_FRAMES) {
+      return true;
+    }
+    if (!step.frames && (step.errors >= CAN_BAUD_ERRORS)) {
+      return false;
+    }
+  } while (step.dwellUs < dwellUs);
+  return step.frames > step.errors;
+}
+
+int SEEED_CAN::read(SEEED_CANMessage &msg) {
+  if (read(msg, RxControl) || read(msg, RxBulk)) {
+    return 1;
+  }
+  if (_rxPriority || _rxAdaptive) {
+    return 0;  // The MCP2515 is emptied by the interrupt (or poller)
+  }
+  while (mcpCanRead(&_can, &msg)) {
+    SEEED_CANMailboxes *boxes = _rxMailboxes;
+    SEEED_CANChangeFilter *filter = _rxChange;
+    if (boxes || _rxResponder) {
+      SEEED_CANFrame frame;
+      frame.pack(msg);
+      if (answer(frame) || (boxes && boxes->update(frame, us_ticker_read()))) {
+        continue;
+      }
+    }
+    if (!filter || filter->pass(msg)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void SEEED_CAN::changeFilter(SEEED_CANChangeFilter *filter) { _rxChange = filter; }
+
+void SEEED_CAN::mailboxes(SEEED_CANMailboxes *boxes) { _rxMailboxes = boxes; }
+
+void SEEED_CAN::capture(SEEED_CANCapture *ring) { _rxCapture = ring; }
+
+int SEEED_CAN::responder(SEEED_CANResponder *table, int hot, int txBuf) {
+  SEEED_CANResponder *old = _rxResponder;
+
+  _rxResponder = NULL;
+  if (old) {
+    for (uint32_t i = 0; i < CAN_RESPONDERS; i++) {
+      if (old->_entries[i].txBuf >= 0) {
+        releaseTxBuffer(old->_entries[i].txBuf);
+        old->_entries[i].txBuf = -1;
+      }
+    }
+  }
+  if (!table) {
+    return 1;
+  }
+  int ok = (hot < 0);
+  if ((hot >= 0) && (hot < CAN_RESPONDERS) && (table->_entries[hot].key != 0xFFFFFFFF)) {  // A registered entry
+    SEEED_CANResponder::Entry &e = table->_entries[hot];
+    SEEED_CANMessage msg(e.key & CAN_FRAME_ID_MASK, (e.key & CAN_FRAME_IDE) ? CANExtended : CANStandard);
+    __disable_irq();
+    memcpy(msg.data, e.data, 8);
+    msg.len = e.len;
+    e.dirty = false;
+    __enable_irq();
+    msg.type = CANData;
+    int last = (txBuf < 0) ? 0 : txBuf;
+    for (int buf = (txBuf < 0) ? 2 : txBuf; (buf >= last) && (buf <= 2) && !ok; buf--) {
+      // A buffer reserved by someone else (e.g. a cyclic schedule) is never taken over
+      if (reserveTxBuffer(buf, msg)) {
+        e.txBuf = (int8_t)buf;
+        ok = 1;
+      }
+    }
+  }
+  _rxResponder = table;
+  return ok;
+}
+
+bool SEEED_CAN::answer(const SEEED_CANFrame &frame) {
+  SEEED_CANResponder *table = _rxResponder;
+  if (!table || !(frame.ident & CAN_FRAME_RTR)) {
+    return false;
+  }
+  SEEED_CANResponder::Entry *e = table->lookup(frame.ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE));
+  if (!e) {
+    return false;
+  }
+  SEEED_CANMessage msg(frame.id(), frame.format());
+  __disable_irq();  // A consistent copy of the answer, update() may be half way through
+  memcpy(msg.data, e->data, 8);
+  msg.len = e->len;
+  bool dirty = e->dirty;
+  e->dirty = false;
+  __enable_irq();
+  msg.type = CANData;
+  bool sent;
+  if (e->txBuf < 0) {
+    sent = mcpCanWriteEncoded(&_can, &e->hdr, msg.data, msg.len, CANData);
+  } else if (dirty) {  // Header (the length may have changed) and data, then RTS
+    sent = mcpTxReserve(&_can, e->txBuf, &msg) && mcpTxLoadData(&_can, e->txBuf, NULL, 0);
+    e->dirty = !sent;
+  } else {  // The buffer already holds the answer
+    sent = mcpTxLoadData(&_can, e->txBuf, NULL, 0);
+  }
+  sent ? e->served++ : e->missed++;
+  return true;
+}
+
+void SEEED_CAN::priority(bool enable) {
+  _rxPriority = enable;
+  mcpRxRollover(&_can, !enable);
+  if (enable) {
+    mcpSetInterruptBits(&_can, MCP_RX_INTS, MCP_RX_INTS);
+    _irqpin.disable_irq();
+    drainRx();  // Anything received before now would never raise another falling edge
+    _irqpin.enable_irq();
+  }
+}
+
+void SEEED_CAN::adaptive(bool enable, uint32_t highRate, uint32_t lowRate, uint32_t pollUs) {
+  _irqpin.disable_irq();
+  _rxPoller.detach();
+  bool wasPolling = _rxPolling;
+  _rxHighRate = highRate;
+  _rxLowRate = (lowRate < highRate) ? lowRate : highRate;
+  _rxPollUs = pollUs;
+  _rxRateStart = us_ticker_read();
+  _rxRateFrames = 0;
+  _rxAdaptive = enable;
+  _rxPolling = false;
+  _rxModeStats.polling = false;
+  if (enable || wasPolling) {  // Undo the masking done when polling started
+    mcpSetInterruptBits(&_can, MCP_RX_INTS, MCP_RX_INTS);
+  }
+  if (enable) {
+    drainRx();
+  }
+  _irqpin.enable_irq();
+}
+
+SEEED_CAN::RxModeStats SEEED_CAN::rxModeStats(void) {
+  RxModeStats stats;
+  __disable_irq();
+  stats = _rxModeStats;
+  __enable_irq();
+  return stats;
+}
+
+bool SEEED_CAN::rxRate(uint32_t frames) {
+  uint32_t now = us_ticker_read();
+  uint32_t elapsed = now - _rxRateStart;
+  _rxRateFrames += frames;
+  if (elapsed < CAN_RX_RATE_WINDOW) {
+    return false;
+  }
+  _rxModeStats.rate = (uint32_t)(((uint64_t)_rxRateFrames * 1000000) / elapsed);
+  _rxRateStart = now;
+  _rxRateFrames = 0;
+  return true;
+}
+
+void SEEED_CAN::pollRx(void) {
+#ifdef SEEED_CAN_RTOS
+  if (_thread) {
+    _thread->signal_set(CAN_SIG_POLL);
+    return;
+  }
+#endif
+  if (mcpDeferIsr(&_can)) {
+    _deferred |= CAN_DEFER_POLL;
+    return;
+  }
+  servicePoll();
+}
+
+void SEEED_CAN::servicePoll(void) {
+  uint32_t delivered;
+  uint32_t frames = drainRx(&delivered);
+  _rxModeStats.polledFrames += frames;
+  if (rxRate(frames) && (_rxModeStats.rate < _rxLowRate)) {
+    // Traffic has subsided, go back to one interrupt per frame
+    _rxPoller.detach();
+    _rxPolling = false;
+    _rxModeStats.polling = false;
+    _rxModeStats.toIrq++;
+    mcpSetInterruptBits(&_can, MCP_RX_INTS, MCP_RX_INTS);  // Pending RXnIF will assert the interrupt line again
+  }
+  if (delivered) {
+    _callback_irq.call();
+  }
+}
+
+int SEEED_CAN::read(SEEED_CANMessage &msg, RxClass rxClass) {
+  SEEED_CANFrame frame;
+  if (!(rxClass == RxControl ? _rxControl.pop(frame) : _rxBulk.pop(frame))) {
+    return 0;
+  }
+  frame.unpack(msg);
+  return 1;
+}
+
+int SEEED_CAN::readBatch(SEEED_CANMessage msgs[], int max, unsigned int *lost) {
+  SEEED_CANFrame frame;
+  int n = 0;
+
+  while ((n < max) && (_rxControl.pop(frame) || _rxBulk.pop(frame))) {
+    frame.unpack(msgs[n++]);
+  }
+  if (!(_rxPriority || _rxAdaptive) && (n < max)) {  // Otherwise the MCP2515 is emptied by the interrupt (or poller)
+    MCP_Lock lock(&_can);
+    uint8_t regs[CAN_FRAME_REGS];
+    uint8_t status;
+    SEEED_CANMailboxes *boxes = _rxMailboxes;
+    SEEED_CANChangeFilter *filter = _rxChange;
+
+    // RXB0 holds the older message when both are full, RXB1 stays for the next call if there is no room for it
+    while ((n < max) && ((status = mcpReceiveStatus(&_can)) & MCP_RXSTAT_RXB_MASK)) {
+      for (uint8_t num = 0; (num < 2) && (n < max); num++) {
+        if (!(status & (MCP_RXSTAT_RXB0 << num))) {
+          continue;
+        }
+        mcpCanReadRaw(&_can, num, regs);
+        frame.fromRegs(regs);
+        uint32_t now = (boxes || filter) ? us_ticker_read() : 0;
+        if (answer(frame) || (boxes && boxes->update(frame, now)) || (filter && !filter->pass(frame, now))) {
+          continue;
+        }
+        frame.unpack(msgs[n++]);
+      }
+    }
+    uint8_t ovr = mcpRxOverflow(&_can);
+    if (ovr & MCP_EFLG_RX0OVR) {
+      _rxHwOverflows[RxControl]++;
+    }
+    if (ovr & MCP_EFLG_RX1OVR) {
+      _rxHwOverflows[RxBulk]++;
+    }
+  }
+  if (lost) {
+    uint32_t total = rxOverflows(RxControl) + rxOverflows(RxBulk);
+    *lost = total - _rxBatchLost;
+    _rxBatchLost = total;
+  }
+  return n;
+}
+
+unsigned int SEEED_CAN::rxOverflows(RxClass rxClass) {
+  return _rxHwOverflows[rxClass] + (rxClass == RxControl ? _rxControl.overflows() : _rxBulk.overflows());
+}
+
+int SEEED_CAN::write(SEEED_CANMessage msg) { return (transmit(msg) > 0) ? 1 : 0; }
+
+// 1 if written, 0 if no transmit buffer was free, -1 if the limiter held the message back
+int SEEED_CAN::transmit(const SEEED_CANMessage &msg) {
+  if (!admit(msg)) {
+    return -1;
+  }
+  if (!mcpCanWrite(&_can, msg)) {
+    refund(msg);
+    return 0;
+  }
+  return 1;
+}
+
+void SEEED_CAN::limiter(SEEED_CANRateLimit *limit) {
+  if (limit && !limit->bitRate()) {
+    limit->bitRate(_can.bitRate);
+  }
+  _txLimit = limit;
+}
+
+bool SEEED_CAN::admit(const CAN_Message &msg) {
+  SEEED_CANRateLimit *limit = _txLimit;
+  return !limit || limit->admit(msg);
+}
+
+void SEEED_CAN::refund(const CAN_Message &msg) {
+  SEEED_CANRateLimit *limit = _txLimit;
+  if (limit) {
+    limit->refund(msg);
+  }
+}
+
+SEEED_CANHeader SEEED_CAN::prepare(int canId, CANFormat format) {
+  SEEED_CANHeader hdr;
+  mcpEncodeId(&hdr, format, (uint32_t)canId);
+  return hdr;
+}
+
+int SEEED_CAN::write(const SEEED_CANHeader &hdr, const char *data, char len, CANType type) {
+  SEEED_CANMessage msg;
+
+  if (_txLimit) {  // Only the CAN Id, format, type and length matter to the limiter
+    uint8_t regs[CAN_FRAME_REGS] = {0};
+    memcpy(regs, &hdr, sizeof(hdr));
+    uint32_t ident = SEEED_CANFrame::identFromRegs(regs);
+    msg.id = ident & CAN_FRAME_ID_MASK;
+    msg.format = (ident & CAN_FRAME_IDE) ? CANExtended : CANStandard;
+    msg.type = type;
+    msg.len = (uint8_t)len;
+    if (!admit(msg)) {
+      return 0;
+    }
+  }
+  if (!mcpCanWriteEncoded(&_can, &hdr, (const uint8_t *)data, (uint8_t)len, type)) {
+    refund(msg);
+    return 0;
+  }
+  return 1;
+}
+
+int SEEED_CAN::load(const SEEED_CANMessage &msg) {
+  SEEED_CANHeader hdr;
+  if (!admit(msg)) {
+    return -1;
+  }
+  mcpEncodeId(&hdr, msg.format, msg.id);
+  int num = mcpCanLoad(&_can, &hdr, msg.data, msg.len, msg.type);
+  if (num < 0) {
+    refund(msg);
+  }
+  return num;
+}
+
+int SEEED_CAN::readRaw(uint8_t regs[CAN_FRAME_REGS]) {
+  MCP_Lock lock(&_can);
+  uint8_t status = mcpReceiveStatus(&_can);
+  if (!(status & MCP_RXSTAT_RXB_MASK)) {
+    return 0;
+  }
+  return mcpCanReadRaw(&_can, (status & MCP_RXSTAT_RXB0) ? 0 : 1, regs);
+}
+
+int SEEED_CAN::loadRaw(const uint8_t regs[CAN_FRAME_REGS]) {
+  SEEED_CANMessage msg;
+
+  if (_txLimit) {
+    uint32_t ident = SEEED_CANFrame::identFromRegs(regs);
+    msg.id = ident & CAN_FRAME_ID_MASK;
+    msg.format = (ident & CAN_FRAME_IDE) ? CANExtended : CANStandard;
+    msg.type = (regs[4] & MCP_TXB_RTR_M) ? CANRemote : CANData;
+    msg.len = regs[4] & MCP_DLC_MASK;
+    if (!admit(msg)) {
+      return -1;
+    }
+  }
+  int num = mcpCanLoadRaw(&_can, regs);
+  if (num < 0) {
+    refund(msg);
+  }
+  return num;
+}
+
+unsigned char SEEED_CAN::status(void) { return mcpStatus(&_can); }
+
+unsigned char SEEED_CAN::txStatus(int txBuf) { return mcpTxControl(&_can, (uint8_t)txBuf); }
+
+void SEEED_CAN::abort(int txBuf) { mcpTxAbort(&_can, (uint8_t)txBuf); }
+
+int SEEED_CAN::reserveTxBuffer(int txBuf, const SEEED_CANMessage &msg) {
+  MCP_Lock lock(&_can);  // Nobody else may reserve the buffer between the check and the reservation
+  if ((txBuf < 0) || (txBuf > 2) || (_can.txReserved & (1 << txBuf))) {
+    return 0;  // Another owner's header is never written over
+  }
+  return mcpTxReserve(&_can, (uint8_t)txBuf, &msg);
+}
 
-int SEEED_CAN::write(SEEED_CANMessage msg) { return mcpCanWrite(&_can, msg); }
+void SEEED_CAN::releaseTxBuffer(int txBuf) { mcpTxRelease(&_can, (uint8_t)txBuf); }
+
+int SEEED_CAN::updateTxBuffer(int txBuf, const char *data, int len) {
+  return mcpTxLoadData(&_can, (uint8_t)txBuf, (const uint8_t *)data, (uint8_t)len);
+}
+
+bool SEEED_CAN::isrBlocked(void) { return (__get_IPSR() != 0) && _can.lockDepth; }
 
 int SEEED_CAN::mask(int maskNum, int canId, CANFormat format) { return mcpInitMask(&_can, maskNum, canId, format); }
 
@@ -54,14 +646,331 @@ unsigned char SEEED_CAN::errorFlags(void) { return mcpErrorFlags(&_can); }
 void SEEED_CAN::attach(void (*fptr)(void), IrqType event) {
   if (fptr) {
     _callback_irq.attach(fptr);
-    mcpSetInterrupts(&_can, (CANIrqs)event);
+    setInterrupts(event);
   } else {
-    mcpSetInterrupts(&_can, (CANIrqs)SEEED_CAN::None);
+    setInterrupts(SEEED_CAN::None);
+  }
+}
+
+void SEEED_CAN::setInterrupts(IrqType event) {
+  mcpSetInterrupts(&_can, (CANIrqs)event);
+  mcpSetInterruptBits(&_can, _irqHandled, _irqHandled);  // Sources with a handler of their own stay enabled
+  if (_rxPolling) {  // The receive buffers are being polled
+    mcpSetInterruptBits(&_can, MCP_RX_INTS, 0);
+  } else if (_rxPriority || _rxAdaptive) {  // The receive queues still need their interrupts
+    mcpSetInterruptBits(&_can, MCP_RX_INTS, MCP_RX_INTS);
+  }
+}
+
+void SEEED_CAN::call_irq(void) {
+  MCP_PROFILE(_P_CALL_IRQ);
+#ifdef SEEED_CAN_RTOS
+  if (_thread) {
+    _thread->signal_set(CAN_SIG_IRQ);  // The interrupt line stays low until the driver thread has serviced it
+    return;
+  }
+#endif
+  if (mcpDeferIsr(&_can)) {
+    _deferred |= CAN_DEFER_IRQ;  // Serviced by the interrupted thread once its sequence is over
+    return;
+  }
+  serviceIrq();
+}
+
+void SEEED_CAN::runDeferred(void) {
+  __disable_irq();
+  uint8_t work = _deferred;
+  _deferred = 0;
+  __enable_irq();
+  if (work & CAN_DEFER_IRQ) {
+    serviceIrq();
+  }
+  if (work & CAN_DEFER_POLL) {
+    servicePoll();
+  }
+}
+
+void SEEED_CAN::serviceIrq(void) {
+  uint8_t reported = 0;  // Receive flags passed to the functions on the last pass
+
+  for (uint32_t pass = 0; pass < CAN_IRQ_PASSES; pass++) {
+    uint16_t status = mcpInterruptStatus(&_can);
+    uint8_t pending = (uint8_t)status & _can.shadow.regs[MCP_CANINTE];
+    if ((pending & MCP_RX_INTS) == reported) {
+      // Only read() clears the receive flags: a function that leaves the messages for later is not called again
+      pending &= ~reported;
+    }
+    if (!pending) {
+      break;
+    }
+    _irqStatus = status;
+    if (pending & ~MCP_RX_INTS) {
+      // Cleared before the handlers run, so an event raised meanwhile sets its flag again for the next pass
+      mcpClearInterrupts(&_can, pending & ~MCP_RX_INTS);
+    }
+    bool legacy = false;
+    if ((pending & MCP_RX_INTS) && (_rxPriority || _rxAdaptive)) {
+      uint32_t delivered;
+      uint32_t frames = drainRx(&delivered);
+      if (_rxAdaptive && !_rxPolling) {
+        _rxModeStats.irqFrames += frames;
+        if (rxRate(frames) && (_rxModeStats.rate > _rxHighRate)) {
+          // Interrupt entry now costs more than the frames themselves, mask RX interrupts and poll instead
+          mcpSetInterruptBits(&_can, MCP_RX_INTS, 0);
+          _rxPolling = true;
+          _rxModeStats.polling = true;
+          _rxModeStats.toPolling++;
+          _rxPoller.attach_us(this, &SEEED_CAN::pollRx, _rxPollUs);
+        }
+      }
+      legacy = (delivered != 0);  // Not when everything received was suppressed by the on-change filter
+      pending &= ~MCP_RX_INTS;
+    }
+    for (uint32_t bit = 0; bit < CAN_IRQ_SOURCES; bit++) {
+      if (!(pending & (1 << bit))) {
+        continue;
+      }
+      if (_irqHandled & (1 << bit)) {
+        _irqHandlers[bit].call();
+      } else {
+        legacy = true;
+      }
+    }
+    if (legacy) {
+      _callback_irq.call();
+    }
+    if (pending & MCP_RX_INTS) {  // Left in pending by direct reads only, the receive queues take them out above
+      reported = pending & MCP_RX_INTS;
+    }
+    if (_irqpin.read()) {
+      break;  // The MCP2515 has released the interrupt line, the next event brings a new falling edge
+    }
   }
 }
 
-void SEEED_CAN::call_irq(void) { _callback_irq.call(); }
+int SEEED_CAN::handle(IrqType source, void (*fptr)(void)) {
+  if ((source < Rx0Fill) || (source > MsgError)) {
+    return 0;
+  }
+  uint32_t bit = source - Rx0Fill;
+  if (fptr) {
+    _irqHandlers[bit].attach(fptr);
+    enableSource(bit);
+    return 1;
+  }
+  __disable_irq();
+  _irqHandled &= ~(1 << bit);
+  __enable_irq();
+  if (!((1 << bit) & MCP_RX_INTS) || !(_rxPriority || _rxAdaptive)) {  // The receive queues still need their interrupts
+    mcpSetInterruptBits(&_can, 1 << bit, 0);
+  }
+  return 1;
+}
+
+void SEEED_CAN::enableSource(uint32_t bit) {
+  __disable_irq();
+  _irqHandled |= (1 << bit);
+  __enable_irq();
+  if (!(_rxPolling && ((1 << bit) & MCP_RX_INTS))) {  // The receive buffers may be being polled
+    mcpSetInterruptBits(&_can, 1 << bit, 1 << bit);
+  }
+}
+
+uint32_t SEEED_CAN::drainRx(uint32_t *delivered) {
+  uint8_t regs[CAN_FRAME_REGS];
+  SEEED_CANFrame frame;
+  uint8_t status;
+  uint32_t frames = 0;
+  uint32_t passed = 0;
+  SEEED_CANChangeFilter *filter = _rxChange;
+  SEEED_CANMailboxes *boxes = _rxMailboxes;
+  SEEED_CANCapture *ring = _rxCapture;
+
+  // RX_STATUS reports on RXB0 whenever it holds a message, so control traffic is always taken first
+  while ((status = mcpReceiveStatus(&_can)) & MCP_RXSTAT_RXB_MASK) {
+    uint8_t num = (status & MCP_RXSTAT_RXB0) ? 0 : 1;
+    if (ring) {  // Straight into the ring, decoded by the consumer
+      SEEED_CANRawFrame *raw = ring->claim();
+      frames++;
+      if (!raw) {
+        mcpCanReadRaw(&_can, num, regs);  // Lost, but the receive buffer must still be freed
+        continue;
+      }
+      mcpCanReadRaw(&_can, num, raw->regs);
+      raw->rxStatus = status;
+      raw->stampUs = us_ticker_read();
+      ring->commit();
+      passed++;
+      if (status & MCP_RXSTAT_RTR) {
+        frame.fromRegs(raw->regs);
+        answer(frame);
+      }
+      continue;
+    }
+    mcpCanReadRaw(&_can, num, regs);
+    frame.fromRegs(regs);
+    frame.filhit = status & MCP_RXSTAT_RXF_MASK;
+    uint32_t now = us_ticker_read();
+    frames++;
+    if (answer(frame) || (boxes && boxes->update(frame, now)) || (filter && !filter->pass(frame, now))) {
+      continue;
+    }
+    frame.stamp = (uint16_t)(now / 1000);
+    num ? _rxBulk.push(frame) : _rxControl.push(frame);
+    passed++;
+  }
+  uint8_t ovr = mcpRxOverflow(&_can);
+  if (ovr & MCP_EFLG_RX0OVR) {
+    _rxHwOverflows[RxControl]++;
+  }
+  if (ovr & MCP_EFLG_RX1OVR) {
+    _rxHwOverflows[RxBulk]++;
+  }
+  if (delivered) {
+    *delivered = passed;
+  }
+  return frames;
+}
 
 int SEEED_CAN::interrupts(IrqType type) { return mcpInterruptType(&_can, (CANIrqs)type); }
 
 unsigned char SEEED_CAN::interruptFlags(void) { return mcpInterruptFlags(&_can); }
+
+#ifdef SEEED_CAN_RTOS
+int SEEED_CAN::startThread(osPriority priority, uint32_t stackSize) {
+  if (_thread) {
+    return 0;
+  }
+  _thread = new Thread(&SEEED_CAN::threadEntry, this, priority, stackSize);
+  _thread->signal_set(CAN_SIG_IRQ);  // Service anything that is already pending
+  return 1;
+}
+
+int SEEED_CAN::submit(const SEEED_CANMessage &msg) {
+  if (!_thread) {
+    return write(msg);
+  }
+  SEEED_CANFrame frame;
+  frame.pack(msg);
+  if (!_txSubmit.push(frame)) {
+    return 0;
+  }
+  _thread->signal_set(CAN_SIG_SUBMIT);
+  return 1;
+}
+
+unsigned int SEEED_CAN::submitOverflows(void) { return _txSubmit.overflows(); }
+
+void SEEED_CAN::threadEntry(void const *argument) { ((SEEED_CAN *)argument)->threadMain(); }
+
+void SEEED_CAN::threadMain(void) {
+  while (true) {
+    // With a message waiting for a free TX buffer or its rate limit, check again every millisecond
+    osEvent evt = Thread::signal_wait(0, (_txPending || _txNumParked) ? 1 : osWaitForever);
+    int32_t signals = (evt.status == osEventSignal) ? evt.value.signals : 0;
+    if (signals & CAN_SIG_IRQ) {
+      serviceIrq();
+    }
+    if (signals & CAN_SIG_POLL) {
+      servicePoll();
+    }
+    serviceSubmit();
+  }
+}
+
+void SEEED_CAN::serviceSubmit(void) {
+  SEEED_CANMessage msg;
+  uint32_t kept = 0;
+  bool busy = false;
+
+  // Parked messages first, oldest first. One behind a message with the same CAN Id that is still parked stays parked
+  for (uint32_t i = 0; i < _txNumParked; i++) {
+    int sent = -1;
+    if (!busy && !parked(_txParked[i], kept)) {
+      _txParked[i].unpack(msg);
+      sent = transmit(msg);
+      busy = (sent == 0);
+    }
+    if (sent <= 0) {
+      _txParked[kept++] = _txParked[i];
+    }
+  }
+  _txNumParked = kept;
+  while (!busy && (_txPending || _txSubmit.pop(_txPendingFrame))) {
+    _txPending = true;
+    int sent = -1;
+    if (!parked(_txPendingFrame, _txNumParked)) {
+      _txPendingFrame.unpack(msg);
+      sent = transmit(msg);
+    }
+    if (sent == 0) {
+      return;  // All TX buffers busy, keep the message for the next attempt
+    }
+    if (sent < 0) {  // Throttled: park it so that other CAN Ids can go ahead
+      if (_txNumParked >= CAN_TX_PARKED) {
+        return;  // Nowhere to park it, it holds up the queue until a parked message has gone
+      }
+      _txParked[_txNumParked++] = _txPendingFrame;
+    }
+    _txPending = false;
+  }
+}
+
+bool SEEED_CAN::parked(const SEEED_CANFrame &frame, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    if (((_txParked[i].ident ^ frame.ident) & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE)) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+static const uint8_t configModes[] = {MODE_NORMAL,     MODE_SLEEP,  MODE_LOOPBACK,
+                                     MODE_LISTENONLY, MODE_CONFIG, MODE_CONFIG};
+
+SEEED_CANConfig::SEEED_CANConfig(int canBitrate, SEEED_CAN::Mode mode) {
+  memset(&_image, 0, sizeof(_image));  // Masks and Filters of 0 accept every message
+  _image.rxbCtrl[0] = MCP_RXB_RX_STDEXT | MCP_RXB_BUKT_MASK;
+  _image.rxbCtrl[1] = MCP_RXB_RX_STDEXT;
+  _image.mode = configModes[mode];
+  frequency(canBitrate);
+}
+
+int SEEED_CANConfig::frequency(int canBitRate) {
+  _valid = (mcpBitTiming((uint32_t)canBitRate, &_image.regs[MCP_CNF3]) != 0);
+  return _valid ? 1 : 0;
+}
+
+void SEEED_CANConfig::mode(SEEED_CAN::Mode mode) { _image.mode = configModes[mode]; }
+
+int SEEED_CANConfig::mask(int maskNum, int canId, CANFormat format) {
+  uint8_t mask[2] = {MCP_RXM0SIDH, MCP_RXM1SIDH};
+
+  if ((maskNum < 0) || (maskNum > 1)) {
+    return 0;
+  }
+  mcpEncodeId((CANid *)&_image.regs[mask[maskNum]], format, (uint32_t)canId);
+  return 1;
+}
+
+int SEEED_CANConfig::filter(int filterNum, int canId, CANFormat format) {
+  uint8_t filter[6] = {MCP_RXF0SIDH, MCP_RXF1SIDH, MCP_RXF2SIDH, MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
+
+  if ((filterNum < 0) || (filterNum > 5)) {
+    return 0;
+  }
+  mcpEncodeId((CANid *)&_image.regs[filter[filterNum]], format, (uint32_t)canId);
+  return 1;
+}
+
+void SEEED_CANConfig::interrupts(SEEED_CAN::IrqType event) {
+  uint8_t which[] = {MCP_NO_INTS, MCP_ALL_INTS, MCP_RX_INTS, MCP_TX_INTS, MCP_RX0IF, MCP_RX1IF,
+                     MCP_TX0IF,   MCP_TX1IF,    MCP_TX2IF,   MCP_ERRIF,   MCP_WAKIF, MCP_MERRF};
+
+  _image.regs[MCP_CANINTE] = which[event];
+}
+
+void SEEED_CANConfig::rollover(bool enable) {
+  _image.rxbCtrl[0] = (_image.rxbCtrl[0] & ~MCP_RXB_BUKT_MASK) | (enable ? MCP_RXB_BUKT_MASK : 0);
+}
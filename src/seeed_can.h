@@ -17,10 +17,59 @@
 #define _SEEED_CAN_H_
 
 #include "seeed_can_api.h"
+#include "seeed_can_queue.h"
 
 // if print debug information
 #define DEBUG
 
+// Depth of the software receive queues used in priority receive mode (powers of two)
+#ifndef CAN_RX_CONTROL_QUEUE
+#define CAN_RX_CONTROL_QUEUE 8
+#endif
+#ifndef CAN_RX_BULK_QUEUE
+#define CAN_RX_BULK_QUEUE 16
+#endif
+
+// Depth of the lock free transmit submission queue used by SEEED_CAN::submit() (power of two, SEEED_CAN_RTOS only)
+#ifndef CAN_TX_SUBMIT_QUEUE
+#define CAN_TX_SUBMIT_QUEUE 32
+#endif
+
+// Messages given to SEEED_CAN::submit() that the driver thread can set aside while their rate limit holds them back,
+// so that other CAN Ids are not held up behind them (SEEED_CAN_RTOS only)
+#ifndef CAN_TX_PARKED
+#define CAN_TX_PARKED 4
+#endif
+
+// Frame rate measurement window of the adaptive receive mode (microseconds)
+#ifndef CAN_RX_RATE_WINDOW
+#define CAN_RX_RATE_WINDOW 10000
+#endif
+
+// Number of SPI clock frequencies tried by SEEED_CAN::tuneSpi() (1, 2, 4, 5, 8 and 10 MHz)
+#define CAN_SPI_STEPS 6
+
+// Most candidate bit rates tried by SEEED_CAN::autoBaud(), also the length of its default list
+#define CAN_BAUD_RATES 10
+
+// Frames received without an error that lock SEEED_CAN::autoBaud() onto a bit rate
+#ifndef CAN_BAUD_FRAMES
+#define CAN_BAUD_FRAMES 2
+#endif
+
+// Message errors, with no frame received, after which SEEED_CAN::autoBaud() gives up on a bit rate early
+#ifndef CAN_BAUD_ERRORS
+#define CAN_BAUD_ERRORS 3
+#endif
+
+// Number of interrupt sources with their own handler (the CANINTF bits)
+#define CAN_IRQ_SOURCES 8
+
+// Most passes the interrupt service routine makes while the MCP2515 keeps its interrupt line asserted
+#ifndef CAN_IRQ_PASSES
+#define CAN_IRQ_PASSES 8
+#endif
+
 /**
  * CANMessage class
  */
@@ -61,8 +110,26 @@ class SEEED_CANMessage : public CAN_Message {
   }
 };
 
+/**
+ * CAN Id pre-encoded as the MCP2515's TXBnSIDH, TXBnSIDL, TXBnEID8 and TXBnEID0 registers, see SEEED_CAN::prepare().
+ */
+typedef CANid SEEED_CANHeader;
+
+class SEEED_CANConfig;
+class SEEED_CANChangeFilter;
+class SEEED_CANMailboxes;
+class SEEED_CANCapture;
+class SEEED_CANResponder;
+class SEEED_CANRateLimit;
+
 /**
  * A can bus client, used for communicating with Seeed Studios' CAN-BUS Arduino Shield.
+ *
+ * The MCP2515 is used from its interrupt handler (and the adaptive receive mode's poller) as well as by the calls the
+ * application makes. An interrupt that arrives while the application, or another thread, is part way through an SPI
+ * transaction or sequence is never serviced on top of it: the interrupted code services it, attached functions
+ * included, as soon as its sequence is over. With SEEED_CAN_RTOS and a driver thread (startThread()) interrupts are
+ * always serviced by the driver thread.
  */
 class SEEED_CAN {
  public:
@@ -97,6 +164,32 @@ class SEEED_CAN {
    */
   int open(int canBitrate = 100000, Mode mode = Normal);
 
+  /**
+   * Open the Seeed Studios CAN-BUS Shield with a complete, precomputed, configuration.
+   *
+   * The MCP2515 is reset, the bit timing, Masks, Filters and interrupt sources are written in three bursts, followed
+   * by one write for each receive buffer control register that differs from its reset value (RXB0CTRL with the default
+   * rollover), and the configuration's mode is entered directly, so there is no bit timing search and only a single
+   * mode change.
+   *
+   * @param config The configuration, built with SEEED_CANConfig or captured by snapshot().
+   *
+   * @returns 1 if successful, 0 if the configuration's bit rate could not be set (nothing is done) or the mode change
+   * failed
+   */
+  int open(const SEEED_CANConfig &config);
+
+  /**
+   * Capture the current configuration (bit timing, Masks, Filters, receive buffer control, interrupt sources and mode)
+   * for a later open(const SEEED_CANConfig &).
+   */
+  void snapshot(SEEED_CANConfig &config);
+
+  /**
+   * Returns how long the last open() took, from the reset to the MCP2515 entering its mode, in microseconds.
+   */
+  unsigned int openTime(void);
+
   /**
    * Puts or removes the Seeed Studios CAN-BUS shield into or from silent monitoring mode.
    *
@@ -127,6 +220,91 @@ class SEEED_CAN {
    */
   int frequency(int canBitRate);
 
+  /**
+   * Returns the CAN bus bit rate actually configured (the closest the MCP2515 can get to the requested rate), 0 before
+   * open() or frequency().
+   */
+  int bitRate(void);
+
+  /**
+   * Check whether the MCP2515 has been reset unexpectedly (e.g. by a brown-out) and if so restore its configuration.
+   *
+   * The Masks, Filters, bit rate, interrupt sources and receive buffer settings are kept in a RAM shadow, so they are
+   * written back in a few burst transfers and the operation mode is entered again. Transmit buffers reserved with
+   * reserveTxBuffer() get the header and data last loaded into them back, so their owners (e.g. SEEED_CANCyclic) carry
+   * on sending the right frames.
+   *
+   * @returns 1 if a reset was detected (and the configuration restored), 0 otherwise
+   */
+  int checkReset(void);
+
+  /**
+   * Results of one SPI clock frequency tried by tuneSpi()
+   */
+  struct SpiStep {
+    uint32_t hz;       // SPI clock frequency
+    uint32_t errors;   // Register bits read back wrong plus loopback frames lost or corrupted
+    uint32_t frameUs;  // Average SPI time to load one 8 byte frame and read it back, in microseconds
+    bool passed;       // Every check at this frequency passed
+  };
+
+  /**
+   * Find the fastest SPI clock frequency that works reliably with this board's wiring.
+   *
+   * The SPI clock is stepped up from 1 MHz towards maxHz. At each step test patterns are written to and read back
+   * from the TX buffers, Filters and Masks, then frames are sent in Loopback mode and checked when they come back.
+   * Stepping stops at the first failure and, for margin, the step below the fastest one that passed is kept (10 MHz,
+   * the MCP2515's limit, is kept as it is). The MCP2515 is reset and left in Configuration mode, so call this before
+   * open() and before setting Masks, Filters or interrupts.
+   *
+   * @param maxHz Highest SPI clock frequency to try, @b default: @p 10000000 (10 MHz).
+   * @param frames Number of loopback frames sent at each step, @b default: @p 32.
+   * @param steps Optional array of CAN_SPI_STEPS entries filled with the result of each step tried.
+   *
+   * @returns the SPI clock frequency selected, 0 if even 1 MHz failed (the original frequency is then restored)
+   */
+  int tuneSpi(int maxHz = 10000000, int frames = 32, SpiStep steps[] = NULL);
+
+  /**
+   * Returns the SPI clock frequency in use.
+   */
+  int spiFrequency(void);
+
+  /**
+   * Results of one bit rate tried by autoBaud()
+   */
+  struct BaudStep {
+    uint32_t hz;       // Bit rate actually configured
+    uint32_t frames;   // Frames received
+    uint32_t errors;   // Message errors (MERRF) seen
+    uint32_t dwellUs;  // Time spent listening at this bit rate, in microseconds
+  };
+
+  /**
+   * Detect the bit rate of a running CAN bus without disturbing it, then open() the shield at that rate.
+   *
+   * The MCP2515 is reset and put in Listen Only mode, which never transmits, not even error frames or acknowledges, so
+   * a wrong guess cannot upset the bus. The CNF values of every candidate are worked out before listening starts and
+   * each candidate then costs only a three byte CNF burst. A candidate is accepted as soon as CAN_BAUD_FRAMES frames
+   * have been received, abandoned as soon as CAN_BAUD_ERRORS message errors have been seen without a frame, and
+   * otherwise accepted at the end of its dwell time only if it received more frames than errors. List the candidates
+   * most likely first: on a busy bus the right rate locks within a few frames and a wrong one is left within a few
+   * bit errors. openTime() reports the total detection time.
+   *
+   * Call this instead of open(), before setting Masks, Filters or interrupts. It needs other nodes to be transmitting:
+   * a silent bus, or one whose only other node waits for an acknowledge, is not detected.
+   *
+   * @param mode The operation mode entered once the bit rate is found, @b default: @p Normal.
+   * @param dwellMs Longest time spent listening at each bit rate, @b default: @p 100 ms.
+   * @param rates Candidate bit rates, @b default: @p 500k, 250k, 125k, 1M, 100k, 50k, 83.3k, 33.3k, 20k and 10k.
+   * @param count Number of candidates in rates, only the first CAN_BAUD_RATES are tried.
+   * @param steps Optional array of CAN_BAUD_RATES entries filled with the result of each bit rate tried.
+   *
+   * @returns the bit rate found, 0 if none was found (the MCP2515 is then left reset, in Configuration mode)
+   */
+  int autoBaud(Mode mode = Normal, int dwellMs = 100, const int rates[] = NULL, int count = 0,
+               BaudStep steps[] = NULL);
+
   /**
    * Read a CAN bus message from the MCP2515 (if one has been received)
    *
@@ -136,6 +314,139 @@ class SEEED_CAN {
    */
   int read(SEEED_CANMessage &msg);
 
+  /**
+   * Read every CAN bus message currently available, up to max, in one call.
+   *
+   * The software queues are emptied first, control before bulk. Outside priority and adaptive receive mode both
+   * receive buffers are then read under a single lock, with one RX_STATUS instruction serving both buffers when it
+   * reports that both are full. The on-change filter and mailboxes apply as they do to read().
+   *
+   * @param msgs The messages read.
+   * @param max Size of msgs.
+   * @param lost Optional, set to the number of messages lost to receive buffer or queue overflows since the last
+   * readBatch() (see rxOverflows()).
+   *
+   * @returns the number of messages read
+   */
+  int readBatch(SEEED_CANMessage msgs[], int max, unsigned int *lost = NULL);
+
+  /**
+   * Pass received messages through an on-change filter (NULL to remove it).
+   *
+   * Messages the filter suppresses are discarded as soon as they are read from the MCP2515: read() skips them and, in
+   * priority and adaptive receive mode, they never take up space in the software queues and an interrupt or poll whose
+   * messages were all suppressed does not call the attached function.
+   *
+   * @param filter The filter, which must outlive its use here.
+   */
+  void changeFilter(SEEED_CANChangeFilter *filter);
+
+  /**
+   * Deliver the messages of the CAN Ids registered with a set of latest-value mailboxes to those mailboxes (NULL to
+   * stop).
+   *
+   * Each such message overwrites its CAN Id's mailbox as soon as it is read from the MCP2515 (in the receive interrupt
+   * in priority and adaptive receive mode) and is not returned by read(). Other messages are not affected.
+   *
+   * @param boxes The mailboxes, which must outlive their use here.
+   */
+  void mailboxes(SEEED_CANMailboxes *boxes);
+
+  /**
+   * Capture received messages raw into a ring, decoding them later on the consumer side (NULL to stop).
+   *
+   * In priority and adaptive receive mode the receive interrupt (or poller) then only reads each message's RX_STATUS
+   * byte and register image into the ring and time stamps it. Captured messages bypass the on-change filter, the
+   * mailboxes and the software queues, so read() does not return them; decode them with SEEED_CANCapture::read().
+   *
+   * @param ring The ring, which must outlive its use here.
+   */
+  void capture(SEEED_CANCapture *ring);
+
+  /**
+   * Answer remote frames automatically from a responder table (NULL to stop).
+   *
+   * A received remote frame whose CAN Id has an entry in the table is answered at once with the entry's data frame
+   * and is not returned by read() or readBatch(). In priority and adaptive receive mode the answer is sent by the
+   * receive interrupt (or poller), and captured remote frames are answered as well as captured.
+   *
+   * @param table The table, which must outlive its use here.
+   * @param hot Optional entry handle given a reserved transmit buffer: its header and data are preloaded, so a request
+   * is answered with a status read and an RTS instruction unless update() has changed the data since, @b default:
+   * @p -1 (none).
+   * @param txBuf The transmit buffer (0 through 2) reserved for hot, which must not be reserved already, @b default:
+   * @p -1 (the highest numbered transmit buffer that is not reserved).
+   *
+   * @returns 1 if successful, 0 if no transmit buffer could be reserved for hot (the table is still attached)
+   */
+  int responder(SEEED_CANResponder *table, int hot = -1, int txBuf = -1);
+
+  enum RxClass { RxControl = 0, RxBulk };
+
+  /**
+   * Enable or disable the priority receive mode.
+   *
+   * In priority mode RXB0 no longer rolls over into RXB1. Frames accepted by Filters 0 and 1 (Mask 0) land in RXB0 and
+   * are treated as control traffic, frames accepted by Filters 2 through 5 (Mask 1) land in RXB1 and are treated as
+   * bulk traffic. The receive interrupt empties RXB0 before RXB1 into two separate software queues (sizes set by
+   * CAN_RX_CONTROL_QUEUE and CAN_RX_BULK_QUEUE) and then calls any attached function.
+   *
+   * @param enable true to enter priority mode, false to return to direct reads with rollover.
+   */
+  void priority(bool enable);
+
+  /**
+   * Read a CAN bus message of one class only (priority receive mode).
+   *
+   * @param msg A CANMessage to read to.
+   * @param rxClass @p SEEED_CAN::RxControl or @p SEEED_CAN::RxBulk.
+   *
+   * @returns 1 if a message of that class was waiting, 0 otherwise
+   */
+  int read(SEEED_CANMessage &msg, RxClass rxClass);
+
+  /**
+   * Returns the number of messages of a class lost in priority receive mode, or seen lost by readBatch(), either
+   * because the MCP2515's receive buffer overflowed (RXnOVR) or because the software queue was full.
+   *
+   * @param rxClass @p SEEED_CAN::RxControl or @p SEEED_CAN::RxBulk.
+   */
+  unsigned int rxOverflows(RxClass rxClass);
+
+  /**
+   * Enable or disable the adaptive (interrupt / polling) receive mode.
+   *
+   * Received messages are moved into the software queues (see priority()). While the measured frame rate stays below
+   * highRate every message raises an interrupt. Once it goes above highRate the receive interrupts are masked in
+   * CANINTE and both receive buffers are polled every pollUs instead, until the rate falls below lowRate again. The
+   * MCP2515 only holds two messages, so pollUs must be shorter than two frames at the highest rate expected (about
+   * 460 us for 8 data bytes at 500 kbit/s) or messages are lost, see rxOverflows().
+   * Any attached function is called after each interrupt or poll that received messages.
+   *
+   * @param enable true to enter adaptive mode, false to return to interrupt only operation.
+   * @param highRate Frames per second above which to switch to polling, @b default: @p 2000.
+   * @param lowRate Frames per second below which to switch back to interrupts, @b default: @p 500.
+   * @param pollUs Polling interval in microseconds, @b default: @p 1000.
+   */
+  void adaptive(bool enable, uint32_t highRate = 2000, uint32_t lowRate = 500, uint32_t pollUs = 1000);
+
+  /**
+   * Adaptive receive mode counters
+   */
+  struct RxModeStats {
+    uint32_t irqFrames;     // Messages received in interrupt mode
+    uint32_t polledFrames;  // Messages received in polling mode
+    uint32_t toPolling;     // Number of switches from interrupts to polling
+    uint32_t toIrq;         // Number of switches from polling to interrupts
+    uint32_t rate;          // Last measured frame rate (frames per second)
+    bool polling;           // Currently polling
+  };
+
+  /**
+   * Returns the adaptive receive mode counters.
+   */
+  RxModeStats rxModeStats(void);
+
   /**
    * Write a CAN bus message to the MCP2515 (if there is a free message buffer)
    *
@@ -145,6 +456,166 @@ class SEEED_CAN {
    */
   int write(SEEED_CANMessage msg);
 
+  /**
+   * Hold transmitted messages to per CAN Id rate limits and a bus load budget (NULL to stop).
+   *
+   * write(), load() and loadRaw() fail for a message over its limit as if no transmit buffer were free; messages
+   * given to submit() are kept by the driver thread until they are within their limit, in order for each CAN Id,
+   * while messages with other CAN Ids go ahead of them (up to CAN_TX_PARKED held back messages). A limiter created
+   * without a bit rate takes bitRate().
+   *
+   * @param limit The limiter, which must outlive its use here.
+   */
+  void limiter(SEEED_CANRateLimit *limit);
+
+  /**
+   * Encode a CAN Id once, for repeated use with write(const SEEED_CANHeader &, ...).
+   *
+   * @param canId The 11 or 29 bit CAN Id.
+   * @param format CANStandard or CANExtended, @b default: @p CANStandard.
+   *
+   * @returns the encoded header
+   */
+  SEEED_CANHeader prepare(int canId, CANFormat format = CANStandard);
+
+  /**
+   * Write a CAN bus message using a CAN Id encoded by prepare() (if there is a free message buffer)
+   *
+   * @param hdr The pre-encoded CAN Id.
+   * @param data The data bytes.
+   * @param len Number of data bytes, @b default: @p 8.
+   * @param type CANData or CANRemote, @b default: @p CANData.
+   *
+   * @returns 1 if write was successful, 0 if write failed,
+   */
+  int write(const SEEED_CANHeader &hdr, const char *data, char len = 8, CANType type = CANData);
+
+  /**
+   * Write a CAN bus message and report which transmit buffer it was loaded into.
+   *
+   * @param msg The CANMessage to write.
+   *
+   * @returns the transmit buffer (0 through 2) sending the message, -1 if there was no free buffer
+   */
+  int load(const SEEED_CANMessage &msg);
+
+  /**
+   * Read the next received message as the MCP2515's raw RXBn register image, RXB0 first, without decoding it.
+   *
+   * Not for use in priority or adaptive receive mode, where the interrupt empties the receive buffers.
+   *
+   * @param regs CAN_FRAME_REGS bytes: SIDH, SIDL, EID8, EID0, DLC, D0..D7.
+   *
+   * @returns 1 if a message was read, 0 if none was waiting
+   */
+  int readRaw(uint8_t regs[CAN_FRAME_REGS]);
+
+  /**
+   * Load a raw TXBn register image (SIDH..D7, only the DLC data bytes are transferred) into a free transmit buffer
+   * and request transmission.
+   *
+   * @returns the transmit buffer (0 through 2) sending the message, -1 if there was no free buffer
+   */
+  int loadRaw(const uint8_t regs[CAN_FRAME_REGS]);
+
+  /**
+   * Returns the MCP2515's quick status (READ STATUS instruction)
+   *
+   * @returns
+   * @b Bit_7 - TX2IF, @b Bit_6 - TXB2CTRL.TXREQ, @b Bit_5 - TX1IF, @b Bit_4 - TXB1CTRL.TXREQ,
+   * @n @b Bit_3 - TX0IF, @b Bit_2 - TXB0CTRL.TXREQ, @b Bit_1 - RX1IF, @b Bit_0 - RX0IF.
+   */
+  unsigned char status(void);
+
+  /**
+   * Returns the control register of a transmit buffer (0 through 2)
+   *
+   * @returns
+   * @b Bit_6 - ABTF: Message Aborted Flag, @b Bit_5 - MLOA: Message Lost Arbitration,
+   * @n @b Bit_4 - TXERR: Transmission Error Detected, @b Bit_3 - TXREQ: Message Transmit Request,
+   * @n @b Bit_1..0 - TXP: Transmit Buffer Priority.
+   */
+  unsigned char txStatus(int txBuf);
+
+  /**
+   * Abort the pending transmission of a transmit buffer (0 through 2)
+   */
+  void abort(int txBuf);
+
+  /**
+   * Reserve one of the MCP2515's transmit buffers (0 through 2) for a single message.
+   *
+   * The message header (CAN Id, format, type and length) is loaded once. write() stops using the buffer and
+   * updateTxBuffer() only has to transfer the data bytes before requesting transmission.
+   *
+   * @param txBuf The transmit buffer to reserve.
+   * @param msg The message whose header (and initial data) is preloaded.
+   *
+   * @returns 1 if the buffer was reserved, 0 if the buffer number is invalid, the buffer is already reserved (its owner
+   * must release it before another header can be loaded) or a frame queued by write() is still pending in it
+   */
+  int reserveTxBuffer(int txBuf, const SEEED_CANMessage &msg);
+
+  /**
+   * Return a transmit buffer reserved by reserveTxBuffer() to write().
+   *
+   * @param txBuf The transmit buffer to release.
+   */
+  void releaseTxBuffer(int txBuf);
+
+  /**
+   * Load new data bytes into a reserved transmit buffer and request transmission.
+   *
+   * @param txBuf The reserved transmit buffer.
+   * @param data The new data bytes, or NULL to resend the data already in the buffer.
+   * @param len Number of data bytes to load (the DLC loaded by reserveTxBuffer() is not changed).
+   *
+   * @returns 1 if transmission was requested, 0 if the buffer is not reserved or the previous frame is still pending
+   */
+  int updateTxBuffer(int txBuf, const char *data, int len);
+
+  /**
+   * From an interrupt handler (e.g. a Ticker) that wants to call write() or updateTxBuffer(): the interrupted code is
+   * part way through an MCP2515 sequence, which the handler's own SPI transactions would corrupt.
+   *
+   * @returns true if so, the handler must try again later; false if it may go ahead (always false outside interrupt
+   * handlers)
+   */
+  bool isrBlocked(void);
+
+#ifdef SEEED_CAN_RTOS
+  /**
+   * Start a driver thread that owns the MCP2515 (SEEED_CAN_RTOS builds only).
+   *
+   * From then on the interrupt handler only signals the thread: receive queues, polling and attached functions all
+   * run in the driver thread, and messages given to submit() are written by it. Calls made directly from other threads
+   * (read(), write(), mask() etc.) remain safe, each one holds the MCP2515 for the whole of its SPI sequence.
+   *
+   * @param priority Thread priority, @b default: @p osPriorityAboveNormal.
+   * @param stackSize Thread stack size in bytes, @b default: @p DEFAULT_STACK_SIZE.
+   *
+   * @returns 1 if the thread was started, 0 if it was already running
+   */
+  int startThread(osPriority priority = osPriorityAboveNormal, uint32_t stackSize = DEFAULT_STACK_SIZE);
+
+  /**
+   * Queue a CAN bus message for the driver thread to write (SEEED_CAN_RTOS builds only).
+   *
+   * Safe from any number of threads and from interrupt handlers; the queue is lock free. Without a driver thread the
+   * message is written straight away.
+   *
+   * @param msg The CANMessage to write.
+   *
+   * @returns 1 if the message was queued (or written), 0 if the queue was full
+   */
+  int submit(const SEEED_CANMessage &msg);
+
+  /**
+   * Returns the number of messages rejected by submit() because the queue was full.
+   */
+  unsigned int submitOverflows(void);
+#endif
+
   /**
    * Configure one of the Accpetance Masks (0 or 1)
    *
@@ -286,16 +757,53 @@ class SEEED_CAN {
    */
   template <typename T>
   void attach(T *tptr, void (T::*mptr)(void), IrqType event = RxAny) {
-    _callback_irq.attach(tptr, mptr);
-    mcpSetInterrupts(&_can, (CANIrqs)event);
     if ((mptr != NULL) && (tptr != NULL)) {
       _callback_irq.attach(tptr, mptr);
-      mcpSetInterrupts(&_can, (CANIrqs)event);
+      setInterrupts(event);
     } else {
-      mcpSetInterrupts(&_can, (CANIrqs)SEEED_CAN::None);
+      setInterrupts(SEEED_CAN::None);
     }
   }
 
+  /**
+   * Attach a function to a single interrupt source and enable that source.
+   *
+   * Each pass of the interrupt service routine reads CANINTF and EFLG in one burst, clears every pending flag except
+   * RX0IF and RX1IF (reading the receive buffer clears those) with one bit modify, and then calls the handler of each
+   * pending source in CANINTF bit order. Sources without a handler of their own call the function attached by
+   * attach(). Passes repeat until the MCP2515 releases its interrupt line, so events raised while the handlers run are
+   * not missed. In priority and adaptive receive mode the receive sources are serviced by the software queues instead.
+   *
+   * @param source @p SEEED_CAN::Rx0Fill, @p Rx1Full, @p Tx0Free, @p Tx1Free, @p Tx2Free, @p Error, @p Wake or
+   * @p MsgError.
+   * @param fptr A pointer to a void function, or NULL to remove the handler and disable the source.
+   *
+   * @returns 1 if successful, 0 if source is not a single interrupt source
+   */
+  int handle(IrqType source, void (*fptr)(void));
+
+  /**
+   * Attach a member function to a single interrupt source, see handle(IrqType, void (*)(void)).
+   */
+  template <typename T>
+  int handle(IrqType source, T *tptr, void (T::*mptr)(void)) {
+    if ((source < Rx0Fill) || (source > MsgError)) {
+      return 0;
+    }
+    if ((tptr == NULL) || (mptr == NULL)) {
+      return handle(source, (void (*)(void))NULL);
+    }
+    _irqHandlers[source - Rx0Fill].attach(tptr, mptr);
+    enableSource(source - Rx0Fill);
+    return 1;
+  }
+
+  /**
+   * Returns CANINTF (bits 7..0) and EFLG (bits 15..8) as read by the current, or last, pass of the interrupt service
+   * routine, so that handlers do not need to read them again.
+   */
+  unsigned int irqStatus(void) { return _irqStatus; }
+
   void call_irq(void);
 
   /**
@@ -335,10 +843,128 @@ class SEEED_CAN {
   unsigned char interruptFlags(void);
 
  protected:
+  void setInterrupts(IrqType event);
+  void enableSource(uint32_t bit);
+  void serviceIrq(void);
+  uint32_t drainRx(uint32_t *delivered = NULL);
+  bool rxRate(uint32_t frames);
+  bool spiStep(SpiStep &step, int frames);
+  bool baudStep(BaudStep &step, uint32_t dwellUs);
+  bool answer(const SEEED_CANFrame &frame);
+  bool admit(const CAN_Message &msg);
+  void refund(const CAN_Message &msg);
+  int transmit(const SEEED_CANMessage &msg);
+  void pollRx(void);
+  void servicePoll(void);
+  void runDeferred(void);
+#ifdef SEEED_CAN_RTOS
+  static void threadEntry(void const *argument);
+  void threadMain(void);
+  void serviceSubmit(void);
+  bool parked(const SEEED_CANFrame &frame, uint32_t n);
+#endif
+
   SPI _spi;
   mcp_can_t _can;
+  uint32_t _spiHz;
+  uint32_t _openUs;
   InterruptIn _irqpin;
   FunctionPointer _callback_irq;
+  FunctionPointer _irqHandlers[CAN_IRQ_SOURCES];
+  uint8_t _irqHandled;  // Bit n set: CANINTF bit n has a handler of its own
+  volatile uint16_t _irqStatus;
+  volatile uint8_t _deferred;  // CAN_DEFER_ bits: interrupt work waiting for a thread's MCP2515 sequence to end
+  bool _rxPriority;
+  bool _rxAdaptive;
+  volatile bool _rxPolling;
+  uint32_t _rxHighRate;
+  uint32_t _rxLowRate;
+  uint32_t _rxPollUs;
+  uint32_t _rxRateStart;
+  uint32_t _rxRateFrames;
+  RxModeStats _rxModeStats;
+  Ticker _rxPoller;
+  SEEED_CANChangeFilter *volatile _rxChange;
+  SEEED_CANMailboxes *volatile _rxMailboxes;
+  SEEED_CANCapture *volatile _rxCapture;
+  SEEED_CANResponder *volatile _rxResponder;
+  SEEED_CANRateLimit *volatile _txLimit;
+#ifdef SEEED_CAN_RTOS
+  Thread *_thread;
+  SEEED_CANSubmitQueue<CAN_TX_SUBMIT_QUEUE> _txSubmit;
+  SEEED_CANFrame _txPendingFrame;
+  bool _txPending;
+  SEEED_CANFrame _txParked[CAN_TX_PARKED];  // Throttled by the limiter, oldest first
+  uint32_t _txNumParked;
+#endif
+  SEEED_CANQueue<CAN_RX_CONTROL_QUEUE> _rxControl;
+  SEEED_CANQueue<CAN_RX_BULK_QUEUE> _rxBulk;
+  volatile uint32_t _rxHwOverflows[2];
+  uint32_t _rxBatchLost;  // Overflows already reported by readBatch()
+};
+
+/**
+ * A complete MCP2515 configuration image for SEEED_CAN::open(const SEEED_CANConfig &).
+ *
+ * Everything, including the bit timing search, is worked out when the image is built, e.g. once at start up or as a
+ * global object, so opening only has to copy it to the MCP2515. The defaults match SEEED_CAN::open(int, Mode): all
+ * messages accepted, rollover from RXB0 into RXB1, no interrupt sources.
+ */
+class SEEED_CANConfig {
+ public:
+  /**
+   * Create a configuration image.
+   *
+   * @param canBitrate CAN Bus Clock frequency, @b default: @p 100000 (100 kHz).
+   * @param mode The operation mode entered by open(), @b default: @p SEEED_CAN::Normal.
+   */
+  SEEED_CANConfig(int canBitrate = 100000, SEEED_CAN::Mode mode = SEEED_CAN::Normal);
+
+  /**
+   * Set the CAN bus frequency (Bit Rate)
+   *
+   * @returns 1 if the bit rate can be set, 0 otherwise (the configuration is then invalid until a bit rate is set)
+   */
+  int frequency(int canBitRate);
+
+  /**
+   * Returns true if the configuration holds a bit timing, false if the last bit rate given could not be set
+   */
+  bool valid(void) const { return _valid; }
+
+  /**
+   * Set the operation mode entered by open()
+   */
+  void mode(SEEED_CAN::Mode mode);
+
+  /**
+   * Set one of the Acceptance Masks (0 or 1), see SEEED_CAN::mask()
+   *
+   * @returns 1 if maskNum is valid, 0 otherwise
+   */
+  int mask(int maskNum, int canId, CANFormat format = CANStandard);
+
+  /**
+   * Set one of the Acceptance Filters (0 through 5), see SEEED_CAN::filter()
+   *
+   * @returns 1 if filterNum is valid, 0 otherwise
+   */
+  int filter(int filterNum, int canId, CANFormat format = CANStandard);
+
+  /**
+   * Set the interrupt sources, see SEEED_CAN::attach()
+   */
+  void interrupts(SEEED_CAN::IrqType event);
+
+  /**
+   * Enable or disable rollover of messages from a full RXB0 into RXB1
+   */
+  void rollover(bool enable);
+
+ protected:
+  friend class SEEED_CAN;
+  MCP_Shadow _image;
+  bool _valid;  // _image holds a bit timing, SEEED_CAN::open() refuses the configuration otherwise
 };
 
 #endif  // SEEED_CAN_H
@@ -0,0 +1,225 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_analyser.h"
+
+#define CAN_CRC15_POLY 0x4599
+#define CAN_FREE_KEY 0xFFFFFFFF
+
+// Bits that are never stuffed: CRC delimiter, ACK slot, ACK delimiter, 7 bit EOF and the 3 bit intermission
+#define CAN_TAIL_BITS 13
+
+/**
+ * Walks the stuffed part of a frame (SOF to the end of the CRC) bit by bit, computing the CRC and counting the stuff
+ * bits the transmitter would insert.
+ */
+struct CANBitStream {
+  uint16_t crc;
+  uint8_t last;
+  uint8_t run;
+  uint32_t stuff;
+
+  CANBitStream() : crc(0), last(2), run(0), stuff(0) {}
+
+  void put(uint32_t value, uint32_t n, bool addToCrc) {
+    while (n--) {
+      uint8_t bit = (value >> n) & 1;
+      if (addToCrc) {
+        bool crcNext = bit ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7FFF;
+        if (crcNext) {
+          crc ^= CAN_CRC15_POLY;
+        }
+      }
+      if (bit == last) {
+        if (++run == 5) {  // The stuff bit is the complement and starts the next run
+          stuff++;
+          last = !bit;
+          run = 1;
+        }
+      } else {
+        last = bit;
+        run = 1;
+      }
+    }
+  }
+};
+
+SEEED_CANAnalyser::SEEED_CANAnalyser(uint32_t bitRate, Stuffing stuffing, uint32_t windowUs)
+    : _bitRate(bitRate), _stuffing(stuffing), _windowUs(windowUs) {
+  reset();
+}
+
+void SEEED_CANAnalyser::bitRate(uint32_t bitRate) { _bitRate = bitRate; }
+
+void SEEED_CANAnalyser::reset(void) {
+  _windowBits = 0;
+  _load = 0;
+  _peakLoad = 0;
+  _untracked = 0;
+  _started = false;
+  for (uint32_t i = 0; i < CAN_ANALYSER_IDS; i++) {
+    _entries[i].key = CAN_FREE_KEY;
+  }
+}
+
+uint32_t SEEED_CANAnalyser::frameBits(const CAN_Message &msg, Stuffing stuffing) {
+  uint32_t dlc = msg.len & 0x0F;
+  uint32_t n = (msg.type == CANRemote) ? 0 : ((dlc > 8) ? 8 : dlc);
+  // SOF, arbitration, control, data and CRC fields: everything the stuffing rule applies to
+  uint32_t stuffed = ((msg.format == CANExtended) ? 54 : 34) + 8 * n;
+
+  if (stuffing == NoStuffing) {
+    return stuffed + CAN_TAIL_BITS;
+  }
+  if (stuffing == WorstCase) {
+    return stuffed + (stuffed - 1) / 4 + CAN_TAIL_BITS;
+  }
+  CANBitStream bits;
+  uint32_t rtr = (msg.type == CANRemote) ? 1 : 0;
+  bits.put(0, 1, true);  // SOF
+  if (msg.format == CANExtended) {
+    bits.put(msg.id >> 18, 11, true);      // Base identifier
+    bits.put(3, 2, true);                  // SRR, IDE
+    bits.put(msg.id & 0x3FFFF, 18, true);  // Identifier extension
+    bits.put(rtr << 2, 3, true);           // RTR, r1, r0
+  } else {
+    bits.put(msg.id & 0x7FF, 11, true);  // Identifier
+    bits.put(rtr << 2, 3, true);         // RTR, IDE, r0
+  }
+  bits.put(dlc, 4, true);
+  for (uint32_t i = 0; i < n; i++) {
+    bits.put(msg.data[i], 8, true);
+  }
+  bits.put(bits.crc, 15, false);
+  return stuffed + bits.stuff + CAN_TAIL_BITS;
+}
+
+uint32_t SEEED_CANAnalyser::add(const CAN_Message &msg, uint32_t stampUs) {
+  uint32_t bits = frameBits(msg, _stuffing);
+
+  if (!_started) {
+    _windowStart = stampUs;
+    _started = true;
+  }
+  closeWindows(stampUs);
+  _windowBits += bits;
+
+  Entry *e = lookup((msg.id & CAN_FRAME_ID_MASK) | ((msg.format == CANExtended) ? CAN_FRAME_IDE : 0));
+  if (!e) {
+    _untracked++;
+    return bits;
+  }
+  if (e->frames) {
+    uint32_t interval = stampUs - e->lastStamp;
+    if (e->frames == 1) {
+      e->period = interval;
+      e->minInterval = interval;
+      e->maxInterval = interval;
+    } else {
+      // Exponentially weighted averages (1/8) keep the cost per frame constant
+      int32_t error = (int32_t)(interval - e->period);
+      e->period = (uint32_t)((int32_t)e->period + error / 8);
+      uint32_t deviation = (error < 0) ? -error : error;
+      e->jitter = (uint32_t)((int32_t)e->jitter + ((int32_t)deviation - (int32_t)e->jitter) / 8);
+      e->minInterval = (interval < e->minInterval) ? interval : e->minInterval;
+      e->maxInterval = (interval > e->maxInterval) ? interval : e->maxInterval;
+    }
+  }
+  e->lastStamp = stampUs;
+  e->frames++;
+  e->bits += bits;
+  e->windowBits += bits;
+  return bits;
+}
+
+uint32_t SEEED_CANAnalyser::load(void) {
+  if (_started) {
+    closeWindows(us_ticker_read());
+  }
+  return _load;
+}
+
+void SEEED_CANAnalyser::closeWindows(uint32_t now) {
+  uint32_t elapsed = now - _windowStart;
+  if (elapsed < _windowUs) {
+    return;
+  }
+  bool idle = elapsed >= 2 * _windowUs;  // Nothing at all was seen during the windows after this one
+  uint64_t capacity = (uint64_t)_bitRate * _windowUs;
+  _load = capacity ? (uint32_t)(((uint64_t)_windowBits * 1000000000ULL) / capacity) : 0;
+  _peakLoad = (_load > _peakLoad) ? _load : _peakLoad;  // The window just closed counts even if idle ones followed
+  _load = idle ? 0 : _load;
+  for (uint32_t i = 0; i < CAN_ANALYSER_IDS; i++) {
+    if (_entries[i].key != CAN_FREE_KEY) {
+      _entries[i].lastWindowBits = idle ? 0 : _entries[i].windowBits;
+      _entries[i].windowBits = 0;
+    }
+  }
+  _windowBits = 0;
+  _windowStart += (elapsed / _windowUs) * _windowUs;
+}
+
+SEEED_CANAnalyser::Entry *SEEED_CANAnalyser::lookup(uint32_t key) {
+  uint32_t h = (key ^ (key >> 7) ^ (key >> 15)) & (CAN_ANALYSER_IDS - 1);
+  for (uint32_t i = 0; i < CAN_ANALYSER_IDS; i++) {
+    Entry &e = _entries[(h + i) & (CAN_ANALYSER_IDS - 1)];
+    if (e.key == key) {
+      return &e;
+    }
+    if (e.key == CAN_FREE_KEY) {
+      memset(&e, 0, sizeof(e));
+      e.key = key;
+      return &e;
+    }
+  }
+  return NULL;
+}
+
+bool SEEED_CANAnalyser::find(uint32_t id, CANFormat format, IdStats &stats) {
+  uint32_t key = (id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0);
+  uint32_t h = (key ^ (key >> 7) ^ (key >> 15)) & (CAN_ANALYSER_IDS - 1);
+  for (uint32_t i = 0; i < CAN_ANALYSER_IDS; i++) {
+    Entry &e = _entries[(h + i) & (CAN_ANALYSER_IDS - 1)];
+    if (e.key == key) {
+      copy(e, stats);
+      return true;
+    }
+    if (e.key == CAN_FREE_KEY) {
+      break;
+    }
+  }
+  return false;
+}
+
+bool SEEED_CANAnalyser::entry(int n, IdStats &stats) {
+  if ((n < 0) || (n >= CAN_ANALYSER_IDS) || (_entries[n].key == CAN_FREE_KEY)) {
+    return false;
+  }
+  copy(_entries[n], stats);
+  return true;
+}
+
+void SEEED_CANAnalyser::copy(const Entry &e, IdStats &stats) {
+  stats.id = e.key & CAN_FRAME_ID_MASK;
+  stats.format = (e.key & CAN_FRAME_IDE) ? CANExtended : CANStandard;
+  stats.frames = e.frames;
+  stats.bits = e.bits;
+  stats.bandwidth = (uint32_t)(((uint64_t)e.lastWindowBits * 1000000) / _windowUs);
+  stats.period = e.period;
+  stats.jitter = e.jitter;
+  stats.minInterval = e.minInterval;
+  stats.maxInterval = e.maxInterval;
+}
@@ -0,0 +1,153 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_ANALYSER_H_
+#define _SEEED_CAN_ANALYSER_H_
+
+#include "seeed_can.h"
+
+// Number of distinct CAN Ids tracked by SEEED_CANAnalyser (power of two)
+#ifndef CAN_ANALYSER_IDS
+#define CAN_ANALYSER_IDS 64
+#endif
+
+/**
+ * Bus load and per CAN Id bandwidth analyser.
+ *
+ * Feed it every frame (e.g. straight after SEEED_CAN::read()). Each frame's on-wire length, from SOF to the end of the
+ * intermission, is worked out either exactly (the real CRC is computed and the stuff bits counted) or as the worst
+ * case, and added to the current measurement window. Closed windows give the bus load and each tracked CAN Id's
+ * bandwidth; the gaps between frames of the same CAN Id give its period and jitter.
+ */
+class SEEED_CANAnalyser {
+ public:
+  enum Stuffing { Exact = 0, WorstCase, NoStuffing };
+
+  /**
+   * Per CAN Id statistics, times in microseconds
+   */
+  struct IdStats {
+    uint32_t id;
+    CANFormat format;
+    uint32_t frames;       // Frames seen
+    uint32_t bits;         // Bits used on the bus, in total
+    uint32_t bandwidth;    // Bits per second in the last complete window
+    uint32_t period;       // Average time between frames
+    uint32_t jitter;       // Average deviation of the time between frames from the period
+    uint32_t minInterval;  // Shortest time between frames
+    uint32_t maxInterval;  // Longest time between frames
+  };
+
+  /**
+   * Create an analyser.
+   *
+   * @param bitRate The CAN bus bit rate, e.g. SEEED_CAN::bitRate().
+   * @param stuffing How to count stuff bits, @b default: @p SEEED_CANAnalyser::Exact.
+   * @param windowUs Measurement window in microseconds, @b default: @p 100000.
+   */
+  SEEED_CANAnalyser(uint32_t bitRate, Stuffing stuffing = Exact, uint32_t windowUs = 100000);
+
+  /**
+   * Change the bit rate used to turn bits into bus load.
+   */
+  void bitRate(uint32_t bitRate);
+
+  /**
+   * Account for one frame.
+   *
+   * @param msg The frame.
+   * @param stampUs When it was received (or sent), in microseconds (us_ticker_read() time base).
+   *
+   * @returns the frame's length on the bus in bits
+   */
+  uint32_t add(const CAN_Message &msg, uint32_t stampUs);
+
+  /**
+   * Account for one frame received now.
+   */
+  uint32_t add(const CAN_Message &msg) { return add(msg, us_ticker_read()); }
+
+  /**
+   * Returns the bus load of the last complete window in tenths of a percent (0 to 1000).
+   */
+  uint32_t load(void);
+
+  /**
+   * Returns the highest bus load of any window so far in tenths of a percent.
+   */
+  uint32_t peakLoad(void) { return _peakLoad; }
+
+  /**
+   * Copy the statistics of a tracked CAN Id.
+   *
+   * @returns true if the CAN Id is tracked
+   */
+  bool find(uint32_t id, CANFormat format, IdStats &stats);
+
+  /**
+   * Copy the statistics of the n-th tracked CAN Id (0 to CAN_ANALYSER_IDS - 1), to list them all.
+   *
+   * @returns true if slot n holds a CAN Id
+   */
+  bool entry(int n, IdStats &stats);
+
+  /**
+   * Returns the number of frames whose CAN Id could not be tracked because the table was full.
+   */
+  uint32_t untracked(void) { return _untracked; }
+
+  /**
+   * Forget all statistics.
+   */
+  void reset(void);
+
+  /**
+   * Returns the length of a frame on the bus in bits, including the 3 bit intermission.
+   */
+  static uint32_t frameBits(const CAN_Message &msg, Stuffing stuffing = Exact);
+
+ protected:
+  struct Entry {
+    uint32_t key;  // CAN Id | CAN_FRAME_IDE, 0xFFFFFFFF when free
+    uint32_t frames;
+    uint32_t bits;
+    uint32_t windowBits;
+    uint32_t lastWindowBits;
+    uint32_t lastStamp;
+    uint32_t period;
+    uint32_t jitter;
+    uint32_t minInterval;
+    uint32_t maxInterval;
+  };
+
+  Entry *lookup(uint32_t key);
+  void closeWindows(uint32_t now);
+  void copy(const Entry &e, IdStats &stats);
+
+  uint32_t _bitRate;
+  Stuffing _stuffing;
+  uint32_t _windowUs;
+  uint32_t _windowStart;
+  uint32_t _windowBits;
+  uint32_t _load;
+  uint32_t _peakLoad;
+  uint32_t _untracked;
+  bool _started;
+  Entry _entries[CAN_ANALYSER_IDS];
+
+  static_assert((CAN_ANALYSER_IDS & (CAN_ANALYSER_IDS - 1)) == 0, "CAN_ANALYSER_IDS must be a power of two");
+};
+
+#endif  // SEEED_CAN_ANALYSER_H
@@ -15,56 +15,59 @@
 
 #include "seeed_can_api.h"
 
+static void mcpRxControl(mcp_can_t *obj, const uint8_t num, const uint8_t value);
+
 uint8_t mcpInit(mcp_can_t *obj, const uint32_t bitRate, const CANMode mode) {
-  union {         // Access CANMsg as:
-    CANMsg x;     // the organised struct
-    uint8_t y[];  // or contiguous memory array
+  MCP_Lock lock(obj);  // Keep other threads out until the whole sequence is done
+  union {                       // Access CANMsg as:
+    CANMsg x;                   // the organised struct
+    uint8_t y[sizeof(CANMsg)];  // or contiguous memory array
   };
-  uint8_t maskFilt[8] = {MCP_RXM0SIDH, MCP_RXM1SIDH, MCP_RXF0SIDH, MCP_RXF1SIDH,
-                         MCP_RXF2SIDH, MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
-  uint8_t canBufCtrl[5] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL, MCP_RXB0CTRL, MCP_RXB1CTRL};
+  uint8_t canBufCtrl[3] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL};
   uint8_t canBuffer[3] = {MCP_TXB0CTRL + 1, MCP_TXB1CTRL + 1, MCP_TXB2CTRL + 1};
 
 #ifdef DEBUG
   printf("Reseting MCP2515\r\n");
 #endif
   mcpReset(obj);
-  for (uint32_t i = 0; i < 8; i++) {  // Clear all CAN id masks and filters
-    mcpWriteId(obj, maskFilt[i], NULL, NULL);
-  }
-  for (uint32_t i = 0; i < 5; i++) {  // Clear all CAN buffer control registers
-    mcpWrite(obj, canBufCtrl[i], NULL);
+  mcpShadowReset(obj);                // All CAN id masks and filters are cleared by the first flush
+  obj->txReserved = 0;                // The reset cleared the headers of reserved TX buffers
+  for (uint32_t i = 0; i < 3; i++) {  // Clear all CAN TX buffer control registers
+    mcpWrite(obj, canBufCtrl[i], 0);
   }
-  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = NULL;  // Initialise empty CAN message buffer
+  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = 0;     // Initialise empty CAN message buffer
   for (uint32_t i = 0; i < 3; i++) {                     // Clear all CAN TX buffers
     mcpWriteMultiple(obj, canBuffer[i], y, sizeof(x));   // using empty CAN message (as an array)
   }
   // enable both receive-buffers, using filters to receive messages with std. and ext. identifiers that meet the filter
   // criteria and enable rollover from RXB0 to RXB1 if RXB0 is full
-  mcpBitModify(obj, MCP_RXB0CTRL, MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK, MCP_RXB_RX_STDEXT | MCP_RXB_BUKT_MASK);
-  mcpBitModify(obj, MCP_RXB1CTRL, MCP_RXB_RX_MASK, MCP_RXB_RX_STDEXT);
+  mcpRxControl(obj, 0, MCP_RXB_RX_STDEXT | MCP_RXB_BUKT_MASK);
+  mcpRxControl(obj, 1, MCP_RXB_RX_STDEXT);
 #ifdef DEBUG
   printf("Setting bit rate\r\n");
 #endif
-  if (!mcpSetBitRate(obj, bitRate)) {  // set baudrate
+  if (!mcpSetBitRate(obj, bitRate)) {  // set baudrate, masks and filters
     return 0;
   }
-  return mcpSetMode(obj, mode) ? 1 : 0;  // set Normal mode and return
+  return mcpMode(obj, (mode == _M_RESET) ? _M_CONFIG : mode);  // CANMode to REQOP bits, the reset is already done
 }
 
 uint8_t mcpSetMode(mcp_can_t *obj, const uint8_t newmode) {
+  MCP_PROFILE(_P_SET_MODE);
+  MCP_Lock lock(obj);
   mcpBitModify(obj, MCP_CANCTRL, MODE_MASK, newmode);
-  for (uint32_t i = 0; i < 10; i++) {
+  for (uint32_t i = 0; i < 200; i++) {  // Leaving Configuration mode only takes 11 recessive bit times
     if ((mcpRead(obj, MCP_CANSTAT) & MODE_MASK) == newmode) {
+      obj->shadow.mode = newmode;
 #ifdef DEBUG
-      printf("Successfully entered mode: %02x time: %dms\r\n", newmode, i);
+      printf("Successfully entered mode: %02x time: %dus\r\n", newmode, i * 50);
       printf("CANCTRL:%02x CANSTAT:%02x TXB0:%02x TXB1:%02x TXB2:%02x\r\n", mcpRead(obj, MCP_CANCTRL),
              mcpRead(obj, MCP_CANSTAT), mcpRead(obj, MCP_TXB0CTRL), mcpRead(obj, MCP_TXB1CTRL),
              mcpRead(obj, MCP_TXB2CTRL));
 #endif
       return 1;
     }
-    wait_ms(1);
+    wait_us(50);
   }
 #ifdef DEBUG
   printf("Failed to enter mode: %02x\r\n", newmode);
@@ -74,6 +77,125 @@ uint8_t mcpSetMode(mcp_can_t *obj, const uint8_t newmode) {
   return 0;
 }
 
+// Shadow bits of the Filter (0x00-0x0B, 0x10-0x1B) and Mask (0x20-0x27) registers
+static const uint64_t shadowIds = 0x000000FF0FFF0FFFULL;
+
+void mcpShadowReset(mcp_can_t *obj) {
+  memset(&obj->shadow, 0, sizeof(obj->shadow));  // CNF3..1, CANINTE and RXBnCTRL all reset to 0
+  obj->shadow.mode = MODE_CONFIG;
+  obj->shadow.dirty = shadowIds;  // Filters and Masks are undefined after a reset
+}
+
+void mcpShadowSet(mcp_can_t *obj, const uint8_t address, const uint8_t values[], const uint8_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t a = address + i;
+    if (obj->shadow.regs[a] != values[i]) {
+      obj->shadow.regs[a] = values[i];
+      obj->shadow.dirty |= 1ULL << a;
+    }
+  }
+}
+
+uint8_t mcpShadowFlush(mcp_can_t *obj) {
+  MCP_Lock lock(obj);
+  uint8_t initialMode = obj->shadow.mode;
+
+  if (!obj->shadow.dirty) {
+    return 1;  // Nothing changed, no need to leave the current mode
+  }
+  if ((initialMode != MODE_CONFIG) && !mcpSetMode(obj, MODE_CONFIG)) {
+    return 0;
+  }
+  for (uint32_t a = 0; a < MCP_SHADOW_SIZE; a++) {
+    if (!(obj->shadow.dirty & (1ULL << a))) {
+      continue;
+    }
+    // Extend the burst over clean bytes when that is cheaper than a new transaction (2 bytes of overhead); the
+    // unshadowed registers between the blocks are 4 bytes wide so a burst never crosses them
+    uint32_t end = a;
+    for (uint32_t b = a + 1; (b < MCP_SHADOW_SIZE) && (b <= end + 3); b++) {
+      end = (obj->shadow.dirty & (1ULL << b)) ? b : end;
+    }
+    mcpWriteMultiple(obj, a, &obj->shadow.regs[a], end - a + 1);
+    a = end;
+  }
+  obj->shadow.dirty = 0;
+  return ((initialMode == MODE_CONFIG) || mcpSetMode(obj, initialMode)) ? 1 : 0;
+}
+
+/**
+ * Write every shadowed register, the MCP2515 must be in Configuration mode. RXBnCTRL is skipped when it still holds its
+ * reset value.
+ */
+static void mcpShadowWriteAll(mcp_can_t *obj, const bool afterReset) {
+  uint8_t rxCtrl[2] = {MCP_RXB0CTRL, MCP_RXB1CTRL};
+
+  mcpWriteMultiple(obj, MCP_RXF0SIDH, &obj->shadow.regs[MCP_RXF0SIDH], 12);  // Filters 0-2
+  mcpWriteMultiple(obj, MCP_RXF3SIDH, &obj->shadow.regs[MCP_RXF3SIDH], 12);  // Filters 3-5
+  mcpWriteMultiple(obj, MCP_RXM0SIDH, &obj->shadow.regs[MCP_RXM0SIDH], 12);  // Masks, CNF3..1 and CANINTE
+  for (uint32_t i = 0; i < 2; i++) {
+    if (!afterReset || obj->shadow.rxbCtrl[i]) {
+      mcpWrite(obj, rxCtrl[i], obj->shadow.rxbCtrl[i]);
+    }
+  }
+  obj->shadow.dirty = 0;
+}
+
+uint8_t mcpShadowRestore(mcp_can_t *obj) {
+  MCP_Lock lock(obj);
+  uint8_t initialMode = obj->shadow.mode;
+
+  if (!mcpSetMode(obj, MODE_CONFIG)) {
+    return 0;
+  }
+  mcpShadowWriteAll(obj, false);
+  return mcpSetMode(obj, initialMode);
+}
+
+uint8_t mcpInitImage(mcp_can_t *obj, const MCP_Shadow *image) {
+  MCP_Lock lock(obj);
+
+  mcpReset(obj);  // Leaves the MCP2515 in Configuration mode, TX buffers idle and RXBnCTRL cleared
+  obj->shadow = *image;
+  obj->shadow.mode = MODE_CONFIG;
+  obj->txReserved = 0;
+  obj->bitRate = mcpTimingRate(&image->regs[MCP_CNF3]);
+  mcpShadowWriteAll(obj, true);
+  return mcpSetMode(obj, image->mode);  // The only mode change
+}
+
+uint8_t mcpCheckReset(mcp_can_t *obj) {
+  MCP_Lock lock(obj);
+  uint8_t opmod = mcpRead(obj, MCP_CANSTAT) & MODE_MASK;
+  if ((opmod != MODE_POWERUP) && ((obj->shadow.mode == MODE_CONFIG) || (opmod != MODE_CONFIG))) {
+    return 0;
+  }
+#ifdef DEBUG
+  printf("MCP2515 was reset, restoring its configuration\r\n");
+#endif
+  uint8_t txCtrl[3] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL};
+  uint8_t bufferCommand[] = {MCP_WRITE_TX0, MCP_WRITE_TX1, MCP_WRITE_TX2};
+  for (uint32_t i = 0; i < 3; i++) {  // Their owners go on sending RTS, and expect the frames they loaded
+    if (obj->txReserved & (1 << i)) {
+      mcpWrite(obj, txCtrl[i], 0);  // Drop an RTS sent since the reset, before leaving Configuration mode
+      mcpWriteBuffer(obj, bufferCommand[i], obj->shadow.txImage[i], sizeof(obj->shadow.txImage[i]));
+    }
+  }
+  mcpShadowRestore(obj);
+  return 1;
+}
+
+/**
+ * Write RXBnCTRL unless it already holds the value
+ */
+static void mcpRxControl(mcp_can_t *obj, const uint8_t num, const uint8_t value) {
+  uint8_t rxCtrl[2] = {MCP_RXB0CTRL, MCP_RXB1CTRL};
+  if (obj->shadow.rxbCtrl[num] != value) {
+    mcpWrite(obj, rxCtrl[num], value);
+    obj->shadow.rxbCtrl[num] = value;
+  }
+}
+
 /**
  * Set the CAN bus bitrate
  *
@@ -112,10 +234,10 @@ static const uint8_t timing_pts[18][2] = {
     {0x7, 0x7},  // 25, 68.0%
 };
 
-uint8_t mcpSetBitRate(mcp_can_t *obj, const uint32_t bitRate) {
-  union {         // Access CANtiming as:
-    CANtiming x;  // the organised struct
-    uint8_t y[];  // or contiguous memory array
+uint32_t mcpBitTiming(const uint32_t bitRate, uint8_t cnf[]) {
+  union {                          // Access CANtiming as:
+    CANtiming x;                   // the organised struct
+    uint8_t y[sizeof(CANtiming)];  // or contiguous memory array
   };
   uint32_t bestBRP = 0;
   uint32_t bestTQU = 0;
@@ -123,15 +245,7 @@ uint8_t mcpSetBitRate(mcp_can_t *obj, const uint32_t bitRate) {
   uint32_t minBRP = (MCP_CLOCK_FREQ / (2 * MCP_MAX_TIME_QUANTA * bitRate));
   uint32_t maxBRP = (MCP_CLOCK_FREQ / (2 * MCP_MIN_TIME_QUANTA * bitRate));
 
-#ifdef DEBUG
-  printf("Setting configuration mode\r\n");
-#endif
-  uint8_t initialMode = mcpRead(obj, MCP_CANCTRL) & MODE_MASK;  // Store the current operation mode
-  if (!mcpSetMode(obj, MODE_CONFIG)) {                          // Go into configuration mode
-    return 0;
-  }
-
-  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = NULL;  // Initialise CANtiming (btlmode, sjw and sam all = 0)
+  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = 0;  // Initialise CANtiming (btlmode, sjw and sam all = 0)
   if ((bitRate < CAN_MIN_RATE) || (bitRate > CAN_MAX_RATE)) {
 #ifdef DEBUG
     printf("FAILED!! The requested Bit Rate is too high or too low: %d\r\n", bitRate);
@@ -156,7 +270,7 @@ uint8_t mcpSetBitRate(mcp_can_t *obj, const uint32_t bitRate) {
   x.brp = (bestBRP - 1);
   x.prseg = (timing_pts[bestTQU - 8][0]);
   x.phseg1 = (timing_pts[bestTQU - 8][1]);
-  mcpWriteMultiple(obj, MCP_CNF3, y, sizeof(x));  // Copy CANtiming to the MCP2515 (as an array)
+  memcpy(cnf, y, sizeof(x));  // CANtiming as an array
 #ifdef DEBUG
   printf("minBRP %d maxBRP %d\r\n", minBRP, maxBRP);
   printf("Bitrate: %d\tactualBitRate: %d\t Error: %1.2f percent.\r\n", bitRate, bestCanRate,
@@ -164,29 +278,54 @@ uint8_t mcpSetBitRate(mcp_can_t *obj, const uint32_t bitRate) {
   printf("TimeQuanta: %d\tbitRatePrescaler: %d\tSamplePoint: %2.2f percent\r\n", bestTQU, bestBRP,
          100 * (float)(3 + x.prseg + x.phseg1) / (float)bestTQU);
   printf("Syncseg: 1\tPropSeg: %d\tPhaseSeg1: %d\tPhaseSeg2: %d\r\n", (x.prseg + 1), (x.phseg1 + 1), (x.phseg1 + 1));
-  printf("Setting normal mode\r\n");
 #endif
-  return (mcpSetMode(obj, initialMode)) ? 1 : 0;  // desired bit rate set enter normal mode and return
+  return bestCanRate;
 }
 
-void mcpWriteId(mcp_can_t *obj, const uint8_t mcp_addr, const uint8_t ext, const uint32_t id) {
-  union {         // Access CANid as:
-    CANid x;      // the organised struct
-    uint8_t y[];  // or contiguous memory array
-  };
+uint32_t mcpTimingRate(const uint8_t cnf[]) {
+  uint32_t brp = (cnf[2] & 0x3F) + 1;
+  uint32_t prseg = (cnf[1] & 0x07) + 1;
+  uint32_t phseg1 = ((cnf[1] >> 3) & 0x07) + 1;
+  uint32_t phseg2 = (cnf[1] & 0x80) ? ((cnf[0] & 0x07) + 1) : ((phseg1 > 2) ? phseg1 : 2);  // BTLMODE
+  return MCP_CLOCK_FREQ / (2 * brp * (1 + prseg + phseg1 + phseg2));
+}
+
+uint8_t mcpSetBitRate(mcp_can_t *obj, const uint32_t bitRate) {
+  MCP_Lock lock(obj);
+  uint8_t cnf[3];
+  uint32_t canRate = mcpBitTiming(bitRate, cnf);
+
+  if (!canRate) {
+    return 0;
+  }
+  mcpShadowSet(obj, MCP_CNF3, cnf, sizeof(cnf));  // The timing goes to the MCP2515 with the next flush
+  obj->bitRate = canRate;                          // Remember the bit rate actually achieved
+  return mcpShadowFlush(obj);  // Passes through configuration mode only if the timing (or a mask or filter) changed
+}
 
-  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = NULL;  // Initialise CANid structure
-  x.ide = ext;                                           // Extended Identifier Flag
-  if (x.ide == CANExtended) {
-    x.sid10_3 = (uint8_t)(id >> 21);          // SID10..3
-    x.sid2_0 = (uint8_t)(id >> 18) & 0x07;    // SID2..0
-    x.eid17_16 = (uint8_t)(id >> 16) & 0x03;  // EID17..16
-    x.eid15_8 = (uint8_t)(id >> 8);           // EID15..8
-    x.eid7_0 = (uint8_t)id;                   // EID7..0
+void mcpEncodeId(CANid *hdr, const uint8_t ext, const uint32_t id) {
+  uint8_t *y = (uint8_t *)hdr;  // Whole bytes rather than bitfield stores, it is 4 stores either way
+  if (ext == CANExtended) {
+    y[0] = (uint8_t)(id >> 21);                                                      // SID10..3
+    y[1] = (uint8_t)(((id >> 13) & 0xE0) | MCP_TXB_EXIDE_M | ((id >> 16) & 0x03));  // SID2..0, EXIDE, EID17..16
+    y[2] = (uint8_t)(id >> 8);                                                       // EID15..8
+    y[3] = (uint8_t)id;                                                              // EID7..0
   } else {
-    x.sid10_3 = (uint8_t)(id >> 3);   // SID10..3
-    x.sid2_0 = (uint8_t)(id & 0x07);  // SID2..0
+    y[0] = (uint8_t)(id >> 3);  // SID10..3
+    y[1] = (uint8_t)(id << 5);  // SID2..0
+    y[2] = 0;
+    y[3] = 0;
   }
+}
+
+void mcpWriteId(mcp_can_t *obj, const uint8_t mcp_addr, const uint8_t ext, const uint32_t id) {
+  union {                      // Access CANid as:
+    CANid x;                   // the organised struct
+    uint8_t y[sizeof(CANid)];  // or contiguous memory array
+  };
+
+  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = 0;  // Initialise CANid structure
+  mcpEncodeId(&x, ext, id);
 #ifdef DEBUG
   printf("sizeof CanIdStruct: %d bytes\r\n", sizeof(x));
   printf("sid10_3: %x\r\n", x.sid10_3);
@@ -200,52 +339,74 @@ void mcpWriteId(mcp_can_t *obj, const uint8_t mcp_addr, const uint8_t ext, const
   mcpWriteMultiple(obj, mcp_addr, y, sizeof(x));  // Copy CANid to the MCP2515 (as an array)
 }
 
-uint8_t mcpCanWrite(mcp_can_t *obj, CAN_Message msg) {
-  union {         // Access CANMsg as:
-    CANMsg x;     // the organised struct
-    uint8_t y[];  // or contiguous memory array
-  };
+// The write entry points call each other's bodies rather than each other, so a message is timed by one profiling point
+static int8_t mcpLoadRaw(mcp_can_t *obj, const uint8_t regs[]) {
+  MCP_Lock lock(obj);
   uint8_t bufferCommand[] = {MCP_WRITE_TX0, MCP_WRITE_TX1, MCP_WRITE_TX2};
   uint8_t rtsCommand[] = {MCP_RTS_TX0, MCP_RTS_TX1, MCP_RTS_TX2};
   uint8_t status = mcpStatus(obj);
   uint32_t num = 0;
-  // Check if there is a free message buffer
-  if (!(status & MCP_STAT_TX0REQ)) {  // TX Message Buffer 0 free?
+  // Check if there is a free message buffer (reserved buffers are left to their owner)
+  if (!(status & MCP_STAT_TX0REQ) && !(obj->txReserved & 0x01)) {  // TX Message Buffer 0 free?
     num = 0;
-  } else if (!(status & MCP_STAT_TX1REQ)) {  // TX Message Buffer 1 free?
+  } else if (!(status & MCP_STAT_TX1REQ) && !(obj->txReserved & 0x02)) {  // TX Message Buffer 1 free?
     num = 1;
-  } else if (!(status & MCP_STAT_TX2REQ)) {  // TX Message Buffer 2 free?
+  } else if (!(status & MCP_STAT_TX2REQ) && !(obj->txReserved & 0x04)) {  // TX Message Buffer 2 free?
     num = 2;
   } else {
-    return 0;  // No free transmit buffers in the MCP2515 CAN controller chip
-  }
-  // populate CANMsg structure
-  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = NULL;  // Initialise CANMsg structure
-  x.id.ide = msg.format;                                 // Extended Identifier Flag
-  if (x.id.ide == CANExtended) {
-    x.id.sid10_3 = (uint8_t)(msg.id >> 21);          // SID10..3
-    x.id.sid2_0 = (uint8_t)(msg.id >> 18) & 0x07;    // SID2..0
-    x.id.eid17_16 = (uint8_t)(msg.id >> 16) & 0x03;  // EID17..16
-    x.id.eid15_8 = (uint8_t)(msg.id >> 8);           // EID15..8
-    x.id.eid7_0 = (uint8_t)msg.id;                   // EID7..0
-  } else {
-    x.id.sid10_3 = (uint8_t)(msg.id >> 3);   // SID10..3
-    x.id.sid2_0 = (uint8_t)(msg.id & 0x07);  // SID2..0
-  }
-  x.dlc = msg.len & 0x0f;           // Number of bytes in can message
-  x.ertr = msg.type;                // Data or remote message
-  memcpy(x.data, msg.data, x.dlc);  // Get the Data bytes
-                                    // write CANmsg to the specified TX buffer 'num'
-  mcpWriteBuffer(obj, bufferCommand[num], y,
-                 sizeof(x));  // Write the message ,CANMsg, to the MCP2515's Tx buffer 'num' (as an array)
+    return -1;  // No free transmit buffers in the MCP2515 CAN controller chip
+  }
+  uint8_t dlc = regs[4] & MCP_DLC_MASK;
+  uint8_t n = (dlc > 8) ? 8 : dlc;
+  mcpWriteBuffer(obj, bufferCommand[num], (uint8_t *)regs, 5 + n);  // Header and the data bytes actually used
   mcpBufferRTS(obj, rtsCommand[num]);
-  return 1;  // Indicate that message has been transmitted
+  return (int8_t)num;  // Indicate which buffer the message is being transmitted from
+}
+
+static int8_t mcpLoad(mcp_can_t *obj, const CANid *hdr, const uint8_t data[], const uint8_t len, const uint8_t rtr) {
+  union {                       // Access CANMsg as:
+    CANMsg x;                   // the organised struct
+    uint8_t y[sizeof(CANMsg)];  // or contiguous memory array
+  };
+  // populate CANMsg structure, only the header and the data bytes actually used are sent to the MCP2515
+  uint8_t dlc = len & 0x0f;
+  x.id = *hdr;                                // Pre-encoded SIDH, SIDL, EID8 and EID0
+  y[4] = 0;                                   // Initialise DLC register
+  x.dlc = dlc;                                // Number of bytes in can message
+  x.ertr = rtr;                               // Data or remote message
+  memcpy(x.data, data, (dlc > 8) ? 8 : dlc);  // Get the Data bytes
+  return mcpLoadRaw(obj, y);
+}
+
+uint8_t mcpCanWrite(mcp_can_t *obj, CAN_Message msg) {
+  MCP_PROFILE(_P_CAN_WRITE);
+  CANid hdr;
+  mcpEncodeId(&hdr, msg.format, msg.id);
+  return (mcpLoad(obj, &hdr, msg.data, msg.len, msg.type) < 0) ? 0 : 1;
+}
+
+uint8_t mcpCanWriteEncoded(mcp_can_t *obj, const CANid *hdr, const uint8_t data[], const uint8_t len,
+                           const uint8_t rtr) {
+  MCP_PROFILE(_P_CAN_WRITE_ENCODED);
+  return (mcpLoad(obj, hdr, data, len, rtr) < 0) ? 0 : 1;
+}
+
+int8_t mcpCanLoad(mcp_can_t *obj, const CANid *hdr, const uint8_t data[], const uint8_t len, const uint8_t rtr) {
+  MCP_PROFILE(_P_CAN_LOAD);
+  return mcpLoad(obj, hdr, data, len, rtr);
+}
+
+int8_t mcpCanLoadRaw(mcp_can_t *obj, const uint8_t regs[]) {
+  MCP_PROFILE(_P_CAN_LOAD_RAW);
+  return mcpLoadRaw(obj, regs);
 }
 
 uint8_t mcpCanRead(mcp_can_t *obj, CAN_Message *msg) {
-  union {         // Access CANMsg as:
-    CANMsg x;     // the organised struct
-    uint8_t y[];  // or contiguous memory array
+  MCP_PROFILE(_P_CAN_READ);
+  MCP_Lock lock(obj);
+  union {                       // Access CANMsg as:
+    CANMsg x;                   // the organised struct
+    uint8_t y[sizeof(CANMsg)];  // or contiguous memory array
   };
   uint8_t bufferCommand[] = {MCP_READ_RX0, MCP_READ_RX1};
   uint8_t status = mcpReceiveStatus(obj);
@@ -258,8 +419,7 @@ uint8_t mcpCanRead(mcp_can_t *obj, CAN_Message *msg) {
   } else {
     return 0;  // No messages waiting
   }
-  mcpReadBuffer(obj, bufferCommand[0], y, sizeof(x));                 // Read the message into CANMsg (as an array)
-  mcpBitModify(obj, MCP_CANINTF, (!num ? MCP_RX0IF : MCP_RX1IF), 0);  // Free the message buffer
+  mcpReadBuffer(obj, bufferCommand[num], y, sizeof(x));  // Read the message into CANMsg, this also clears RXnIF
 #ifdef DEBUG
   printf("sizeof CanMsgStruct: %d bytes\r\n", sizeof(x));
   printf("sizeof CanMsgArray: %d bytes\r\n", sizeof(y));
@@ -284,11 +444,107 @@ uint8_t mcpCanRead(mcp_can_t *obj, CAN_Message *msg) {
   }
   msg->len = x.dlc;                                             // Number of bytes in CAN message
   msg->type = (status & MCP_RXSTAT_RTR) ? CANRemote : CANData;  // Determine if a Remote or Data message type
-  memcpy(msg->data, x.data, x.dlc);                             // Get the Data bytes
+  memcpy(msg->data, x.data, (x.dlc > 8) ? 8 : x.dlc);           // Get the Data bytes (a DLC over 8 means 8)
   return 1;                                                     // Indicate that message has been retrieved
 }
 
+uint8_t mcpCanReadRaw(mcp_can_t *obj, const uint8_t num, uint8_t regs[]) {
+  uint8_t bufferCommand[] = {MCP_READ_RX0, MCP_READ_RX1};
+
+  if (num > 1) {
+    return 0;
+  }
+  mcpReadBuffer(obj, bufferCommand[num], regs, sizeof(CANMsg));  // RXnIF is cleared when CS goes high
+  return 1;
+}
+
+void mcpRxRollover(mcp_can_t *obj, const bool enable) {
+  mcpRxControl(obj, 0, (obj->shadow.rxbCtrl[0] & ~MCP_RXB_BUKT_MASK) | (enable ? MCP_RXB_BUKT_MASK : 0));
+}
+
+uint8_t mcpRxOverflow(mcp_can_t *obj) {
+  MCP_Lock lock(obj);
+  uint8_t ovr = mcpRead(obj, MCP_EFLG) & (MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR);
+  if (ovr) {
+    mcpBitModify(obj, MCP_EFLG, ovr, 0);  // RXnOVR must be reset by the MCU
+  }
+  return ovr;
+}
+
+static const uint8_t txReqBits[3] = {MCP_STAT_TX0REQ, MCP_STAT_TX1REQ, MCP_STAT_TX2REQ};
+
+uint8_t mcpTxReserve(mcp_can_t *obj, const uint8_t num, const CAN_Message *msg) {
+  MCP_Lock lock(obj);
+  union {                       // Access CANMsg as:
+    CANMsg x;                   // the organised struct
+    uint8_t y[sizeof(CANMsg)];  // or contiguous memory array
+  };
+  uint8_t bufferCommand[] = {MCP_WRITE_TX0, MCP_WRITE_TX1, MCP_WRITE_TX2};
+
+  if (num > 2) {
+#ifdef DEBUG
+    printf("Trying to reserve an invalid TX buffer: %d\r\n", num);
+#endif
+    return 0;
+  }
+  // Keep mcpCanWrite away from the buffer from now on, but give up if a message it queued is still pending
+  uint8_t held = obj->txReserved & (1 << num);
+  obj->txReserved |= (1 << num);
+  if (mcpStatus(obj) & txReqBits[num]) {
+    obj->txReserved = (obj->txReserved & ~(1 << num)) | held;  // An existing reservation is left as it was
+    return 0;
+  }
+  for (uint32_t i = 0; i < sizeof(x); i++) y[i] = 0;  // Initialise CANMsg structure
+  mcpEncodeId(&x.id, msg->format, msg->id);
+  x.dlc = msg->len & 0x0f;  // Number of bytes in can message
+  x.ertr = msg->type;       // Data or remote message
+  memcpy(x.data, msg->data, 8);
+  mcpWriteBuffer(obj, bufferCommand[num], y, sizeof(x));  // Header and initial data
+  memcpy(obj->shadow.txImage[num], y, sizeof(x));
+  return 1;
+}
+
+void mcpTxRelease(mcp_can_t *obj, const uint8_t num) {
+  if (num < 3) {
+    obj->txReserved &= ~(1 << num);
+  }
+}
+
+uint8_t mcpTxLoadData(mcp_can_t *obj, const uint8_t num, const uint8_t data[], const uint8_t len) {
+  MCP_Lock lock(obj);
+  uint8_t dataCommand[] = {MCP_WRITE_TX0_DATA, MCP_WRITE_TX1_DATA, MCP_WRITE_TX2_DATA};
+  uint8_t rtsCommand[] = {MCP_RTS_TX0, MCP_RTS_TX1, MCP_RTS_TX2};
+
+  if ((num > 2) || !(obj->txReserved & (1 << num))) {
+    return 0;
+  }
+  if (mcpStatus(obj) & txReqBits[num]) {  // Previous frame from this buffer has not gone out yet
+    return 0;
+  }
+  if (data && len) {
+    mcpWriteBuffer(obj, dataCommand[num], (uint8_t *)data, (len > 8) ? 8 : len);
+    memcpy(&obj->shadow.txImage[num][5], data, (len > 8) ? 8 : len);
+  }
+  mcpBufferRTS(obj, rtsCommand[num]);
+  return 1;
+}
+
+uint8_t mcpTxControl(mcp_can_t *obj, const uint8_t num) {
+  uint8_t txCtrl[] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL};
+
+  return (num > 2) ? 0 : mcpRead(obj, txCtrl[num]);
+}
+
+void mcpTxAbort(mcp_can_t *obj, const uint8_t num) {
+  uint8_t txCtrl[] = {MCP_TXB0CTRL, MCP_TXB1CTRL, MCP_TXB2CTRL};
+
+  if (num < 3) {
+    mcpBitModify(obj, txCtrl[num], MCP_TXB_TXREQ_M, 0);  // ABTF is set once the buffer has really been aborted
+  }
+}
+
 uint8_t mcpInitMask(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext) {
+  MCP_Lock lock(obj);
   uint8_t mask[2] = {MCP_RXM0SIDH, MCP_RXM1SIDH};
 
   if (num > 1) {
@@ -300,12 +556,10 @@ uint8_t mcpInitMask(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext) {
 #ifdef DEBUG
   printf("Begin to set Mask!!\r\n");
 #endif
-  uint8_t initialMode = mcpRead(obj, MCP_CANCTRL) & MODE_MASK;  // Store the current operation mode
-  if (!mcpSetMode(obj, MODE_CONFIG)) {
-    return 0;
-  }
-  mcpWriteId(obj, mask[num], ext, ulData);
-  if (!mcpSetMode(obj, initialMode)) {
+  CANid id;
+  mcpEncodeId(&id, ext, ulData);
+  mcpShadowSet(obj, mask[num], (const uint8_t *)&id, sizeof(id));
+  if (!mcpShadowFlush(obj)) {
     return 0;
   }
 #ifdef DEBUG
@@ -315,6 +569,7 @@ uint8_t mcpInitMask(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext) {
 }
 
 uint8_t mcpInitFilter(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext) {
+  MCP_Lock lock(obj);
   uint8_t filter[6] = {MCP_RXF0SIDH, MCP_RXF1SIDH, MCP_RXF2SIDH, MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
 
   if (num > 5) {
@@ -326,12 +581,10 @@ uint8_t mcpInitFilter(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext) {
 #ifdef DEBUG
   printf("Begin to set Filter!!\r\n");
 #endif
-  uint8_t initialMode = mcpRead(obj, MCP_CANCTRL) & MODE_MASK;  // Store the current operation mode
-  if (!mcpSetMode(obj, MODE_CONFIG)) {
-    return 0;
-  }
-  mcpWriteId(obj, filter[num], ext, ulData);
-  if (!mcpSetMode(obj, initialMode)) {
+  CANid id;
+  mcpEncodeId(&id, ext, ulData);
+  mcpShadowSet(obj, filter[num], (const uint8_t *)&id, sizeof(id));
+  if (!mcpShadowFlush(obj)) {
     return 0;
   }
 #ifdef DEBUG
@@ -340,6 +593,38 @@ uint8_t mcpInitFilter(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext) {
   return 1;
 }
 
+uint32_t mcpRegisterTest(mcp_can_t *obj, const uint8_t seed) {
+  MCP_Lock lock(obj);
+  // Writable bits of a TX buffer image (SIDH..D7), an Acceptance Filter and an Acceptance Mask (SIDH..EID0)
+  static const uint8_t txBits[13] = {0xFF, 0xEB, 0xFF, 0xFF, 0x4F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  static const uint8_t filtBits[4] = {0xFF, 0xEB, 0xFF, 0xFF};
+  static const uint8_t maskBits[4] = {0xFF, 0xE3, 0xFF, 0xFF};
+  static const uint8_t fixed[4] = {0x00, 0xFF, 0x55, 0xAA};
+  const uint8_t blocks[] = {MCP_TXB0CTRL + 1, MCP_TXB1CTRL + 1, MCP_TXB2CTRL + 1, MCP_RXF0SIDH, MCP_RXF3SIDH,
+                            MCP_RXM0SIDH};
+  const uint8_t sizes[] = {13, 13, 13, 12, 12, 8};
+  uint8_t out[13];
+  uint8_t in[13];
+  uint32_t errors = 0;
+
+  if (!mcpSetMode(obj, MODE_CONFIG)) {  // Filters and Masks can only be written in Configuration mode
+    return 0xFFFFFFFF;
+  }
+  for (uint32_t b = 0; b < sizeof(blocks); b++) {
+    for (uint32_t i = 0; i < sizes[b]; i++) {  // Fixed patterns, then a sequence that shows up shifted bits
+      out[i] = (seed < 4) ? fixed[seed] : (uint8_t)(seed + (b + i) * 0x3B);
+    }
+    mcpWriteMultiple(obj, blocks[b], out, sizes[b]);
+    mcpReadMultiple(obj, blocks[b], in, sizes[b]);
+    for (uint32_t i = 0; i < sizes[b]; i++) {
+      uint8_t bits = (b < 3) ? txBits[i] : ((b < 5) ? filtBits[i & 3] : maskBits[i & 3]);
+      errors += __builtin_popcount((out[i] ^ in[i]) & bits);
+    }
+  }
+  obj->shadow.dirty |= shadowIds;  // The Filters and Masks now hold test patterns
+  return errors;
+}
+
 uint8_t mcpErrorType(mcp_can_t *obj, const CANFlags type) {
   uint8_t which[] = {MCP_EFLG_ALLMASK, MCP_EFLG_ERRORMASK, MCP_EFLG_WARNMASK, MCP_EFLG_RX1OVR,
                      MCP_EFLG_RX0OVR,  MCP_EFLG_TXBO,      MCP_EFLG_TXEP,     MCP_EFLG_RXEP,
@@ -359,10 +644,12 @@ void mcpMonitor(mcp_can_t *obj, const bool silent) {
 }
 
 uint8_t mcpMode(mcp_can_t *obj, const CANMode mode) {
+  MCP_Lock lock(obj);
   uint8_t which[] = {MODE_NORMAL, MODE_SLEEP, MODE_LOOPBACK, MODE_LISTENONLY, MODE_CONFIG, MODE_CONFIG};
 
   if (mode == _M_RESET) {
     mcpReset(obj);
+    mcpShadowReset(obj);
   }
   if (mcpSetMode(obj, which[mode])) {
     return 1;
@@ -374,14 +661,32 @@ void mcpSetInterrupts(mcp_can_t *obj, const CANIrqs irqSet) {
   uint8_t which[] = {MCP_NO_INTS, MCP_ALL_INTS, MCP_RX_INTS, MCP_TX_INTS, MCP_RX0IF, MCP_RX1IF,
                      MCP_TX0IF,   MCP_TX1IF,    MCP_TX2IF,   MCP_ERRIF,   MCP_WAKIF, MCP_MERRF};
 
-  mcpWrite(obj, MCP_CANINTE, which[irqSet]);
+  mcpSetInterruptBits(obj, 0xFF, which[irqSet]);
+}
+
+void mcpSetInterruptBits(mcp_can_t *obj, const uint8_t mask, const uint8_t bits) {
+  __disable_irq();  // Also called from interrupt handlers, keep CANINTE and its shadow in step
+  uint8_t inte = (obj->shadow.regs[MCP_CANINTE] & ~mask) | (bits & mask);
+  if (inte != obj->shadow.regs[MCP_CANINTE]) {
+    mcpWrite(obj, MCP_CANINTE, inte);
+    obj->shadow.regs[MCP_CANINTE] = inte;
+  }
+  __enable_irq();
 }
 
 uint8_t mcpInterruptType(mcp_can_t *obj, const CANIrqs irqFlag) {
   uint8_t which[] = {MCP_NO_INTS, MCP_ALL_INTS, MCP_RX_INTS, MCP_TX_INTS, MCP_RX0IF, MCP_RX1IF,
                      MCP_TX0IF,   MCP_TX1IF,    MCP_TX2IF,   MCP_ERRIF,   MCP_WAKIF, MCP_MERRF};
 
-  return (mcpRead(obj, MCP_EFLG) & which[irqFlag]) ? 1 : 0;
+  return (mcpRead(obj, MCP_CANINTF) & which[irqFlag]) ? 1 : 0;
+}
+
+uint8_t mcpInterruptFlags(mcp_can_t *obj) { return (mcpRead(obj, MCP_CANINTF)); }
+
+uint16_t mcpInterruptStatus(mcp_can_t *obj) {
+  uint8_t regs[2];
+  mcpReadMultiple(obj, MCP_CANINTF, regs, 2);  // EFLG follows CANINTF
+  return (uint16_t)(regs[0] | (regs[1] << 8));
 }
 
-uint8_t mcpInterruptFlags(mcp_can_t *obj) { return (mcpRead(obj, MCP_EFLG)); }
+void mcpClearInterrupts(mcp_can_t *obj, const uint8_t flags) { mcpBitModify(obj, MCP_CANINTF, flags, 0); }
@@ -153,6 +153,52 @@ uint8_t mcpSetMode(mcp_can_t *obj, const uint8_t newmode);
  */
 uint8_t mcpSetBitRate(mcp_can_t *obj, const uint32_t bitRate);
 
+/**
+ * Work out the CNF3, CNF2 and CNF1 values for a bit rate (no SPI traffic), returns the bit rate achieved or 0
+ */
+uint32_t mcpBitTiming(const uint32_t bitRate, uint8_t cnf[]);
+
+/**
+ * Return the bit rate given by CNF3, CNF2 and CNF1 values
+ */
+uint32_t mcpTimingRate(const uint8_t cnf[]);
+
+/**
+ * Load the shadow with the MCP2515's reset values (call after mcpReset), Masks and Filters are marked dirty
+ */
+void mcpShadowReset(mcp_can_t *obj);
+
+/**
+ * Record new values for shadowed registers (Filters, Masks, CNF3..1), only bytes that change are marked dirty
+ */
+void mcpShadowSet(mcp_can_t *obj, const uint8_t address, const uint8_t values[], const uint8_t n);
+
+/**
+ * Write the dirty shadowed registers, in as few bursts as possible, passing through Configuration mode if needed
+ */
+uint8_t mcpShadowFlush(mcp_can_t *obj);
+
+/**
+ * Write the whole shadow back to the MCP2515 and return to the last operation mode
+ */
+uint8_t mcpShadowRestore(mcp_can_t *obj);
+
+/**
+ * Reset the MCP2515 and apply a complete configuration image in a few burst writes and a single mode change
+ */
+uint8_t mcpInitImage(mcp_can_t *obj, const MCP_Shadow *image);
+
+/**
+ * Detect an unexpected reset (the MCP2515 reports power-up, or Configuration mode when it should not) and restore the
+ * shadow and the frames of reserved TX buffers
+ */
+uint8_t mcpCheckReset(mcp_can_t *obj);
+
+/**
+ * Encode a CAN id as the MCP2515's SIDH, SIDL, EID8 and EID0 registers
+ */
+void mcpEncodeId(CANid *hdr, const uint8_t ext, const uint32_t id);
+
 /**
  * Write a CAN id
  */
@@ -163,11 +209,73 @@ void mcpWriteId(mcp_can_t *obj, const uint8_t mcp_addr, const uint8_t ext, const
  */
 uint8_t mcpCanRead(mcp_can_t *obj, CAN_Message *msg);
 
+/**
+ * Read the 13 byte register image (SIDH..D7) of receive buffer 0 or 1 and free the buffer
+ */
+uint8_t mcpCanReadRaw(mcp_can_t *obj, const uint8_t num, uint8_t regs[]);
+
+/**
+ * Enable (or disable) rollover of messages from a full RXB0 into RXB1
+ */
+void mcpRxRollover(mcp_can_t *obj, const bool enable);
+
+/**
+ * Return and clear the receive buffer overflow flags (MCP_EFLG_RX0OVR, MCP_EFLG_RX1OVR)
+ */
+uint8_t mcpRxOverflow(mcp_can_t *obj);
+
 /**
  * Write a CAN message
  */
 uint8_t mcpCanWrite(mcp_can_t *obj, CAN_Message msg);
 
+/**
+ * Write a CAN message whose id was already encoded by mcpEncodeId
+ */
+uint8_t mcpCanWriteEncoded(mcp_can_t *obj, const CANid *hdr, const uint8_t data[], const uint8_t len,
+                           const uint8_t rtr);
+
+/**
+ * Load a CAN message (id encoded by mcpEncodeId) into a free transmit buffer and request transmission
+ *
+ * Returns the transmit buffer used (0-2), or -1 if none was free
+ */
+int8_t mcpCanLoad(mcp_can_t *obj, const CANid *hdr, const uint8_t data[], const uint8_t len, const uint8_t rtr);
+
+/**
+ * Load a 13 byte TXBn register image (SIDH..D7) into a free transmit buffer and request transmission
+ *
+ * Returns the transmit buffer used (0-2), or -1 if none was free
+ */
+int8_t mcpCanLoadRaw(mcp_can_t *obj, const uint8_t regs[]);
+
+/**
+ * Return the TXBnCTRL register of transmit buffer 0-2
+ */
+uint8_t mcpTxControl(mcp_can_t *obj, const uint8_t num);
+
+/**
+ * Abort a pending transmission
+ */
+void mcpTxAbort(mcp_can_t *obj, const uint8_t num);
+
+/**
+ * Reserve a transmit buffer (0-2) for a single message and preload its header (SIDH..DLC)
+ *
+ * Fails, leaving the buffer (reserved or not) as it was, while the buffer's transmission is pending
+ */
+uint8_t mcpTxReserve(mcp_can_t *obj, const uint8_t num, const CAN_Message *msg);
+
+/**
+ * Return a reserved transmit buffer to mcpCanWrite
+ */
+void mcpTxRelease(mcp_can_t *obj, const uint8_t num);
+
+/**
+ * Load only the data bytes (from TXBnD0) of a reserved transmit buffer and request transmission
+ */
+uint8_t mcpTxLoadData(mcp_can_t *obj, const uint8_t num, const uint8_t data[], const uint8_t len);
+
 /**
  * Initialise an Acceptance Mask
  */
@@ -178,6 +286,12 @@ uint8_t mcpInitMask(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext);
  */
 uint8_t mcpInitFilter(mcp_can_t *obj, uint8_t num, uint32_t ulData, bool ext);
 
+/**
+ * Write test patterns (seed 0-3: 0x00, 0xFF, 0x55, 0xAA, otherwise a varying sequence) to the TX buffers, Filters and
+ * Masks and read them back, leaving the MCP2515 in Configuration mode. Returns the number of bits read back wrong.
+ */
+uint32_t mcpRegisterTest(mcp_can_t *obj, const uint8_t seed);
+
 /**
  * Report on the specified errors and warnings
  */
@@ -213,6 +327,11 @@ uint8_t mcpMode(mcp_can_t *obj, const CANMode mode);
  */
 void mcpSetInterrupts(mcp_can_t *obj, const CANIrqs irqSet);
 
+/**
+ * Change only the interrupt sources selected by mask (MCP_RX0IF etc.)
+ */
+void mcpSetInterruptBits(mcp_can_t *obj, const uint8_t mask, const uint8_t bits);
+
 /**
  * Report on the specified interrupt causes
  */
@@ -223,6 +342,18 @@ uint8_t mcpInterruptType(mcp_can_t *obj, const CANIrqs irqFlag);
  */
 uint8_t mcpInterruptFlags(mcp_can_t *obj);
 
+/**
+ * Read CANINTF and EFLG (0x2C and 0x2D) in a single burst
+ *
+ * @returns CANINTF in bits 7..0, EFLG in bits 15..8
+ */
+uint16_t mcpInterruptStatus(mcp_can_t *obj);
+
+/**
+ * Clear interrupt flags (MCP_RX0IF etc.) with a single bit modify
+ */
+void mcpClearInterrupts(mcp_can_t *obj, const uint8_t flags);
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,272 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_async.h"
+
+SEEED_CANAsync::SEEED_CANAsync(SEEED_CAN &can) : _can(can), _queue(NULL), _reads(NULL), _busy(false) {
+  _inflight[0] = _inflight[1] = _inflight[2] = NULL;
+}
+
+int SEEED_CANAsync::write(SEEED_CANRequest &req, const SEEED_CANMessage &msg, SEEED_CANRequest::Completion done,
+                          uint32_t timeoutUs) {
+  req.op = SEEED_CANRequest::Write;
+  req.msg = msg;
+  req.timeoutUs = timeoutUs;
+  req.done = done;
+  return submit(req);
+}
+
+int SEEED_CANAsync::read(SEEED_CANRequest &req, SEEED_CANRequest::Completion done, uint32_t timeoutUs) {
+  req.op = SEEED_CANRequest::Read;
+  req.timeoutUs = timeoutUs;
+  req.done = done;
+  return submit(req);
+}
+
+int SEEED_CANAsync::mask(SEEED_CANRequest &req, int maskNum, int canId, CANFormat format,
+                         SEEED_CANRequest::Completion done) {
+  req.op = SEEED_CANRequest::Mask;
+  req.num = maskNum;
+  req.value = canId;
+  req.format = format;
+  req.timeoutUs = 0;
+  req.done = done;
+  return submit(req);
+}
+
+int SEEED_CANAsync::filter(SEEED_CANRequest &req, int filterNum, int canId, CANFormat format,
+                           SEEED_CANRequest::Completion done) {
+  req.op = SEEED_CANRequest::Filter;
+  req.num = filterNum;
+  req.value = canId;
+  req.format = format;
+  req.timeoutUs = 0;
+  req.done = done;
+  return submit(req);
+}
+
+int SEEED_CANAsync::mode(SEEED_CANRequest &req, SEEED_CAN::Mode mode, SEEED_CANRequest::Completion done) {
+  req.op = SEEED_CANRequest::Mode;
+  req.num = mode;
+  req.timeoutUs = 0;
+  req.done = done;
+  return submit(req);
+}
+
+int SEEED_CANAsync::frequency(SEEED_CANRequest &req, int canBitRate, SEEED_CANRequest::Completion done) {
+  req.op = SEEED_CANRequest::Frequency;
+  req.value = canBitRate;
+  req.timeoutUs = 0;
+  req.done = done;
+  return submit(req);
+}
+
+int SEEED_CANAsync::submit(SEEED_CANRequest &req) {
+  __disable_irq();  // process() may be running from the Ticker
+  if (outstanding(&req)) {
+    __enable_irq();
+    return 0;
+  }
+  req.result = SEEED_CANRequest::Pending;
+  req.eflg = 0;
+  req.txBuf = -1;
+  req._cancel = false;
+  req._started = us_ticker_read();
+  append((req.op == SEEED_CANRequest::Read) ? &_reads : &_queue, &req);
+  __enable_irq();
+  return 1;
+}
+
+void SEEED_CANAsync::cancel(SEEED_CANRequest &req) {
+  __disable_irq();
+  if (outstanding(&req)) {
+    req._cancel = true;
+  }
+  __enable_irq();
+}
+
+void SEEED_CANAsync::start(uint32_t tickUs) { _ticker.attach_us(this, &SEEED_CANAsync::tick, tickUs); }
+
+void SEEED_CANAsync::stop(void) { _ticker.detach(); }
+
+void SEEED_CANAsync::tick(void) {
+  if (!_can.isrBlocked()) {  // Otherwise the main loop is part way through an MCP2515 sequence, try on the next tick
+    process();
+  }
+}
+
+uint32_t SEEED_CANAsync::process(void) {
+  if (_busy) {
+    return 1;
+  }
+  _busy = true;
+  uint32_t now = us_ticker_read();
+  processWrites(now);
+  processQueue(now);
+  processReads(now);
+  uint32_t count = 0;
+  __disable_irq();
+  for (SEEED_CANRequest *r = _queue; r; r = r->_next) count++;
+  for (SEEED_CANRequest *r = _reads; r; r = r->_next) count++;
+  for (uint32_t i = 0; i < 3; i++) count += _inflight[i] ? 1 : 0;
+  __enable_irq();
+  _busy = false;
+  return count;
+}
+
+void SEEED_CANAsync::processWrites(uint32_t now) {
+  if (!_inflight[0] && !_inflight[1] && !_inflight[2]) {
+    return;
+  }
+  uint8_t txReq[] = {MCP_STAT_TX0REQ, MCP_STAT_TX1REQ, MCP_STAT_TX2REQ};
+  uint8_t status = _can.status();  // One transaction covers TXREQ of all three buffers
+  uint8_t eflg = _can.errorFlags();
+  for (uint32_t i = 0; i < 3; i++) {
+    SEEED_CANRequest *req = _inflight[i];
+    if (!req) {
+      continue;
+    }
+    if (!(status & txReq[i])) {
+      // Transmission finished, ABTF tells a real transmission from an abort
+      bool aborted = _can.txStatus(i) & MCP_TXB_ABTF_M;
+      _inflight[i] = NULL;
+      req->eflg = aborted ? eflg : 0;
+      complete(req, aborted ? (req->_cancel ? SEEED_CANRequest::Aborted : SEEED_CANRequest::Failed)
+                            : SEEED_CANRequest::Sent);
+    } else if ((eflg & MCP_EFLG_TXBO) || req->_cancel || expired(req, now)) {
+      req->_cancel = true;
+      _can.abort(i);  // Completes as Aborted (or Failed when bus-off) once the MCP2515 has set ABTF
+      if (eflg & MCP_EFLG_TXBO) {
+        req->_cancel = false;
+      }
+    }
+  }
+}
+
+void SEEED_CANAsync::processQueue(uint32_t now) {
+  while (_queue) {
+    SEEED_CANRequest *req = _queue;
+    if (req->_cancel || ((req->op == SEEED_CANRequest::Write) && expired(req, now))) {
+      __disable_irq();
+      unlink(&_queue, req);
+      __enable_irq();
+      complete(req, SEEED_CANRequest::Aborted);
+      continue;
+    }
+    if (((req->op == SEEED_CANRequest::Mode) || (req->op == SEEED_CANRequest::Frequency)) && __get_IPSR()) {
+      return;  // Polls the MCP2515 for milliseconds: waits, in order, for a process() call from thread context
+    }
+    int ok = 0;
+    switch (req->op) {
+      case SEEED_CANRequest::Write: {
+        int txBuf = _can.load(req->msg);
+        if (txBuf < 0) {
+          return;  // No free transmit buffer, keep submission order and try again next time
+        }
+        __disable_irq();
+        unlink(&_queue, req);
+        __enable_irq();
+        req->txBuf = txBuf;
+        SEEED_CANRequest *previous = _inflight[txBuf];
+        _inflight[txBuf] = req;
+        if (previous) {
+          // Its frame went out after processWrites() looked, the buffer was only free because TXREQ had cleared. The
+          // new TXREQ has cleared ABTF, so an abort that was asked for is all there is to go on.
+          complete(previous, previous->_cancel ? SEEED_CANRequest::Aborted : SEEED_CANRequest::Sent);
+        }
+        continue;
+      }
+      case SEEED_CANRequest::Mask:
+        ok = _can.mask(req->num, req->value, req->format);
+        break;
+      case SEEED_CANRequest::Filter:
+        ok = _can.filter(req->num, req->value, req->format);
+        break;
+      case SEEED_CANRequest::Mode:
+        ok = _can.mode((SEEED_CAN::Mode)req->num);
+        break;
+      case SEEED_CANRequest::Frequency:
+        ok = _can.frequency(req->value);
+        break;
+      default:
+        break;
+    }
+    __disable_irq();
+    unlink(&_queue, req);
+    __enable_irq();
+    req->eflg = ok ? 0 : _can.errorFlags();
+    complete(req, ok ? SEEED_CANRequest::Done : SEEED_CANRequest::Failed);
+  }
+}
+
+void SEEED_CANAsync::processReads(uint32_t now) {
+  while (_reads) {
+    SEEED_CANRequest *req = _reads;
+    if (req->_cancel || expired(req, now)) {
+      __disable_irq();
+      unlink(&_reads, req);
+      __enable_irq();
+      complete(req, req->_cancel ? SEEED_CANRequest::Aborted : SEEED_CANRequest::Timeout);
+      continue;
+    }
+    if (!_can.read(req->msg)) {
+      return;
+    }
+    __disable_irq();
+    unlink(&_reads, req);
+    __enable_irq();
+    complete(req, SEEED_CANRequest::Received);
+  }
+}
+
+void SEEED_CANAsync::complete(SEEED_CANRequest *req, SEEED_CANRequest::Result result) {
+  req->result = result;
+  req->_next = NULL;
+  if (req->done) {
+    req->done(req);  // The request may be submitted again from here
+  }
+}
+
+bool SEEED_CANAsync::expired(SEEED_CANRequest *req, uint32_t now) {
+  return req->timeoutUs && ((now - req->_started) >= req->timeoutUs);
+}
+
+bool SEEED_CANAsync::outstanding(SEEED_CANRequest *req) {
+  for (SEEED_CANRequest *r = _queue; r; r = r->_next) {
+    if (r == req) return true;
+  }
+  for (SEEED_CANRequest *r = _reads; r; r = r->_next) {
+    if (r == req) return true;
+  }
+  return (_inflight[0] == req) || (_inflight[1] == req) || (_inflight[2] == req);
+}
+
+void SEEED_CANAsync::append(SEEED_CANRequest **list, SEEED_CANRequest *req) {
+  req->_next = NULL;
+  while (*list) {
+    list = &(*list)->_next;
+  }
+  *list = req;
+}
+
+void SEEED_CANAsync::unlink(SEEED_CANRequest **list, SEEED_CANRequest *req) {
+  while (*list) {
+    if (*list == req) {
+      *list = req->_next;
+      return;
+    }
+    list = &(*list)->_next;
+  }
+}
@@ -0,0 +1,173 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_ASYNC_H_
+#define _SEEED_CAN_ASYNC_H_
+
+#include "seeed_can.h"
+
+class SEEED_CANAsync;
+
+/**
+ * One asynchronous CAN operation.
+ *
+ * Requests are owned by the caller and must stay valid until their completion function has been called; the engine
+ * only links them into its lists, nothing is allocated.
+ */
+class SEEED_CANRequest {
+ public:
+  enum Op { Write = 0, Read, Mask, Filter, Mode, Frequency };
+  enum Result {
+    Pending = 0,  // Not completed yet
+    Sent,         // Write: the message was transmitted
+    Received,     // Read: msg holds the received message
+    Done,         // Mask, Filter, Mode or Frequency was applied
+    Aborted,      // Write: transmission was aborted (timeout or SEEED_CANAsync::cancel())
+    Failed,       // Bus-off, or the configuration change was refused, see eflg
+    Timeout       // Read: nothing arrived in time
+  };
+
+  typedef void (*Completion)(SEEED_CANRequest *req);
+
+  SEEED_CANRequest() : result(Pending), eflg(0), txBuf(-1), context(NULL), _next(NULL) {}
+
+  Op op;
+  SEEED_CANMessage msg;  // Write: message to send, Read: received message
+  int num;               // Mask or Filter number, Mode
+  int value;             // Mask or Filter CAN Id, Frequency bit rate
+  CANFormat format;      // Mask or Filter format
+  uint32_t timeoutUs;    // 0 waits for ever
+  Completion done;       // Called once, with result set, from SEEED_CANAsync::process()
+  Result result;
+  uint8_t eflg;   // Snapshot of the MCP2515's EFLG register when the request failed or was aborted
+  int8_t txBuf;   // Write: transmit buffer used
+  void *context;  // Free for the caller
+
+ protected:
+  friend class SEEED_CANAsync;
+  SEEED_CANRequest *_next;
+  uint32_t _started;
+  bool _cancel;
+};
+
+/**
+ * Completion based asynchronous front end for SEEED_CAN.
+ *
+ * Reads, writes and configuration changes are submitted as SEEED_CANRequest objects and run by process(), which
+ * delivers each outcome through the request's completion function. Up to three writes are in flight in the MCP2515 at
+ * any time, further writes and configuration changes wait in submission order. process() can be called from the
+ * application's main loop or from a Ticker started with start(); either way it must be the only user of the SEEED_CAN
+ * interface while requests are outstanding. Mode and Frequency requests wait for the MCP2515 for up to milliseconds,
+ * so they are only carried out by a process() call from thread context: with only the Ticker running they stay at the
+ * head of the queue.
+ */
+class SEEED_CANAsync {
+ public:
+  SEEED_CANAsync(SEEED_CAN &can);
+
+  /**
+   * Submit a write request.
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int write(SEEED_CANRequest &req, const SEEED_CANMessage &msg, SEEED_CANRequest::Completion done,
+            uint32_t timeoutUs = 0);
+
+  /**
+   * Submit a read request, completed with the next message received.
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int read(SEEED_CANRequest &req, SEEED_CANRequest::Completion done, uint32_t timeoutUs = 0);
+
+  /**
+   * Submit an Acceptance Mask change (see SEEED_CAN::mask()).
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int mask(SEEED_CANRequest &req, int maskNum, int canId, CANFormat format, SEEED_CANRequest::Completion done);
+
+  /**
+   * Submit an Acceptance Filter change (see SEEED_CAN::filter()).
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int filter(SEEED_CANRequest &req, int filterNum, int canId, CANFormat format, SEEED_CANRequest::Completion done);
+
+  /**
+   * Submit an operation mode change (see SEEED_CAN::mode()), carried out by process() from thread context only.
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int mode(SEEED_CANRequest &req, SEEED_CAN::Mode mode, SEEED_CANRequest::Completion done);
+
+  /**
+   * Submit a bit rate change (see SEEED_CAN::frequency()), carried out by process() from thread context only.
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int frequency(SEEED_CANRequest &req, int canBitRate, SEEED_CANRequest::Completion done);
+
+  /**
+   * Submit a prepared request (op and its parameters already filled in).
+   *
+   * @returns 1 if submitted, 0 if the request is already outstanding
+   */
+  int submit(SEEED_CANRequest &req);
+
+  /**
+   * Cancel a request. A write already in the MCP2515 is aborted and completes as Aborted, anything else completes as
+   * Aborted on the next process().
+   */
+  void cancel(SEEED_CANRequest &req);
+
+  /**
+   * Advance all outstanding requests and call the completion functions of those that finished.
+   *
+   * @returns the number of requests still outstanding
+   */
+  uint32_t process(void);
+
+  /**
+   * Call process() from a Ticker every tickUs microseconds, skipping ticks that find the main loop part way through
+   * an MCP2515 sequence (SEEED_CAN::isrBlocked()).
+   */
+  void start(uint32_t tickUs = 1000);
+
+  /**
+   * Stop the Ticker started by start().
+   */
+  void stop(void);
+
+ protected:
+  void tick(void);
+  static void append(SEEED_CANRequest **list, SEEED_CANRequest *req);
+  static void unlink(SEEED_CANRequest **list, SEEED_CANRequest *req);
+  bool outstanding(SEEED_CANRequest *req);
+  void complete(SEEED_CANRequest *req, SEEED_CANRequest::Result result);
+  bool expired(SEEED_CANRequest *req, uint32_t now);
+  void processWrites(uint32_t now);
+  void processQueue(uint32_t now);
+  void processReads(uint32_t now);
+
+  SEEED_CAN &_can;
+  Ticker _ticker;
+  SEEED_CANRequest *_inflight[3];  // Writes loaded into TX buffers 0-2
+  SEEED_CANRequest *_queue;        // Writes and configuration changes, in submission order
+  SEEED_CANRequest *_reads;        // Read requests, in submission order
+  bool _busy;                      // Guards against process() being re-entered from a completion function
+};
+
+#endif  // SEEED_CAN_ASYNC_H
@@ -0,0 +1,331 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_bridge.h"
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+// Bit rates of the S0 to S8 commands
+static const uint32_t slcanRates[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000};
+
+static bool parseHex(const uint8_t text[], uint32_t digits, uint32_t &value) {
+  value = 0;
+  for (uint32_t i = 0; i < digits; i++) {
+    uint8_t c = text[i];
+    if ((c >= '0') && (c <= '9')) {
+      value = (value << 4) | (c - '0');
+    } else if ((c >= 'A') && (c <= 'F')) {
+      value = (value << 4) | (c - 'A' + 10);
+    } else if ((c >= 'a') && (c <= 'f')) {
+      value = (value << 4) | (c - 'a' + 10);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint32_t putHex(uint8_t text[], uint32_t value, uint32_t digits) {
+  for (uint32_t i = 0; i < digits; i++) {
+    text[i] = hexDigits[(value >> (4 * (digits - 1 - i))) & 0x0F];
+  }
+  return digits;
+}
+
+static void putLe32(uint8_t bytes[], uint32_t value) {
+  bytes[0] = (uint8_t)value;
+  bytes[1] = (uint8_t)(value >> 8);
+  bytes[2] = (uint8_t)(value >> 16);
+  bytes[3] = (uint8_t)(value >> 24);
+}
+
+SEEED_CANBridge::SEEED_CANBridge()
+    : _fn(NULL),
+      _context(NULL),
+      _cmdLen(0),
+      _cmdOverflow(false),
+      _bitRate(100000),
+      _open(false),
+      _listen(false),
+      _stamps(false),
+      _binary(false),
+      _fill(0),
+      _batch(-1),
+      _seq(0),
+      _outPos(0),
+      _overrun(false),
+      _overflows(0),
+      _reported(0) {
+  _len[0] = _len[1] = 0;
+}
+
+void SEEED_CANBridge::attach(Handler fn, void *context) {
+  _fn = fn;
+  _context = context;
+}
+
+void SEEED_CANBridge::input(const uint8_t data[], uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t c = data[i];
+    if (c == '\r') {
+      if (_cmdOverflow) {
+        reply("\a");
+      } else {
+        command();
+      }
+      _cmdLen = 0;
+      _cmdOverflow = false;
+    } else if (c == '\n') {
+      continue;  // Some terminals send CR LF
+    } else if (_cmdLen < CAN_BRIDGE_COMMAND) {
+      _cmd[_cmdLen++] = c;
+    } else {
+      _cmdOverflow = true;
+    }
+  }
+}
+
+void SEEED_CANBridge::command(void) {
+  const uint8_t *c = _cmd;
+  uint32_t n = _cmdLen;
+  bool ok = false;
+
+  if (!n) {
+    reply("\r");
+    return;
+  }
+  switch (c[0]) {
+    case 'S':
+      if ((n == 2) && !_open && (c[1] >= '0') && (c[1] <= '8')) {
+        _bitRate = slcanRates[c[1] - '0'];
+        ok = true;
+      }
+      break;
+    case 'O':
+    case 'L':
+      if ((n == 1) && !_open && _fn && _fn((c[0] == 'O') ? Open : Listen, NULL, _bitRate, _context)) {
+        _open = true;
+        _listen = (c[0] == 'L');
+        ok = true;
+      }
+      break;
+    case 'C':
+      if ((n == 1) && _open) {
+        _fn(Close, NULL, _bitRate, _context);
+        _open = false;
+        ok = true;
+      }
+      break;
+    case 't':
+    case 'T':
+    case 'r':
+    case 'R': {
+      bool ext = (c[0] == 'T') || (c[0] == 'R');
+      bool rtr = (c[0] == 'r') || (c[0] == 'R');
+      uint32_t digits = ext ? 8 : 3;
+      uint32_t id;
+      uint32_t dlc;
+      SEEED_CANFrame frame;
+      if (!_open || _listen || (n < digits + 2) || !parseHex(&c[1], digits, id) ||
+          !parseHex(&c[1 + digits], 1, dlc) || (dlc > 8) || (id > (ext ? 0x1FFFFFFFUL : 0x7FFUL)) ||
+          (n != digits + 2 + (rtr ? 0 : 2 * dlc))) {
+        break;
+      }
+      memset(&frame, 0, sizeof(frame));
+      frame.ident = id | (ext ? CAN_FRAME_IDE : 0) | (rtr ? CAN_FRAME_RTR : 0);
+      frame.dlc = (uint8_t)dlc;
+      ok = true;
+      for (uint32_t i = 0; !rtr && (i < dlc); i++) {
+        uint32_t byte;
+        ok = ok && parseHex(&c[digits + 2 + 2 * i], 2, byte);
+        frame.data[i] = (uint8_t)byte;
+      }
+      if (ok && _fn(Transmit, &frame, _bitRate, _context)) {
+        reply(ext ? "Z\r" : "z\r");
+        return;
+      }
+      ok = false;
+      break;
+    }
+    case 'V':
+      if (n == 1) {
+        reply("V0101\r");
+        return;
+      }
+      break;
+    case 'N':
+      if (n == 1) {
+        reply("N0001\r");
+        return;
+      }
+      break;
+    case 'F':
+      if ((n == 1) && _open) {
+        uint8_t text[4] = {'F', 0, 0, '\r'};
+        uint32_t flags = (uint32_t)_fn(Status, NULL, _bitRate, _context);
+        if (_overflows != _reported) {
+          flags |= SLCAN_DATA_OVERRUN;
+          _reported = _overflows;
+        }
+        putHex(&text[1], flags, 2);
+        append(text, sizeof(text), false);
+        return;
+      }
+      break;
+    case 'Z':
+    case 'B':
+      if ((n == 2) && ((c[1] == '0') || (c[1] == '1'))) {
+        if (c[0] == 'Z') {
+          _stamps = (c[1] == '1');
+        } else {
+          _binary = (c[1] == '1');
+        }
+        ok = true;
+      }
+      break;
+    default:
+      break;
+  }
+  reply(ok ? "\r" : "\a");
+}
+
+bool SEEED_CANBridge::reply(const char *text) { return append((const uint8_t *)text, strlen(text), false); }
+
+bool SEEED_CANBridge::frame(const SEEED_CANFrame &frame, uint32_t stampUs) {
+  uint8_t rec[32];
+  uint32_t n = 0;
+  bool ext = frame.ident & CAN_FRAME_IDE;
+  bool rtr = frame.ident & CAN_FRAME_RTR;
+  uint32_t len = rtr ? 0 : ((frame.dlc > 8) ? 8 : frame.dlc);
+
+  if (!_open) {
+    return false;
+  }
+  if (_binary) {
+    putLe32(&rec[0], stampUs);
+    putLe32(&rec[4], frame.ident);
+    rec[8] = frame.dlc;
+    memcpy(&rec[9], frame.data, len);
+    n = 9 + len;
+  } else {
+    rec[n++] = ext ? (rtr ? 'R' : 'T') : (rtr ? 'r' : 't');
+    n += putHex(&rec[n], frame.ident & CAN_FRAME_ID_MASK, ext ? 8 : 3);
+    n += putHex(&rec[n], frame.dlc, 1);
+    for (uint32_t i = 0; i < len; i++) {
+      n += putHex(&rec[n], frame.data[i], 2);
+    }
+    if (_stamps) {
+      n += putHex(&rec[n], (stampUs / 1000) % 60000, 4);  // SLCAN time stamps are milliseconds, wrapping each minute
+    }
+    rec[n++] = '\r';
+  }
+  if (!append(rec, n, _binary)) {
+    _overflows++;
+    _overrun = true;
+    return false;
+  }
+  return true;
+}
+
+uint32_t SEEED_CANBridge::forward(void) {
+  SEEED_CANFrame f;
+  uint32_t n = 0;
+
+  if (!_fn || !_open) {
+    return 0;
+  }
+  while (_fn(Receive, &f, _bitRate, _context)) {
+    frame(f, us_ticker_read());
+    n++;
+  }
+  return n;
+}
+
+bool SEEED_CANBridge::append(const uint8_t data[], uint32_t n, bool record) {
+  __disable_irq();  // frame() may be called from an interrupt handler
+  uint8_t *buf = _buf[_fill];
+  if (!record || ((_batch >= 0) && (buf[_batch + 2] == 0xFF))) {
+    closeBatch();
+  }
+  // A record also needs room for its batch's header (if the batch is new) and checksum
+  uint32_t need = n + (record ? (((_batch < 0) ? CAN_BRIDGE_HEADER : 0) + CAN_BRIDGE_TRAILER) : 0);
+  if ((_len[_fill] + need) > CAN_BRIDGE_BUFFER) {
+    if (!swap()) {
+      __enable_irq();
+      return false;
+    }
+    buf = _buf[_fill];
+  }
+  if (record) {
+    if (_batch < 0) {
+      _batch = (int32_t)_len[_fill];
+      buf[_batch] = CAN_BRIDGE_SYNC0;
+      buf[_batch + 1] = CAN_BRIDGE_SYNC1;
+      buf[_batch + 2] = 0;
+      buf[_batch + 3] = _overrun ? CAN_BRIDGE_OVERRUN : 0;
+      putLe32(&buf[_batch + 4], _seq);
+      _len[_fill] += CAN_BRIDGE_HEADER;
+      _overrun = false;
+    }
+    buf[_batch + 2]++;
+    _seq++;
+  }
+  memcpy(&buf[_len[_fill]], data, n);
+  _len[_fill] += n;
+  __enable_irq();
+  return true;
+}
+
+void SEEED_CANBridge::closeBatch(void) {
+  if (_batch < 0) {
+    return;
+  }
+  uint8_t *buf = _buf[_fill];
+  uint32_t sum1 = 0;
+  uint32_t sum2 = 0;
+  for (uint32_t i = (uint32_t)_batch; i < _len[_fill]; i++) {
+    sum1 = (sum1 + buf[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  buf[_len[_fill]++] = (uint8_t)sum1;
+  buf[_len[_fill]++] = (uint8_t)sum2;
+  _batch = -1;
+}
+
+bool SEEED_CANBridge::swap(void) {
+  if (_len[_fill ^ 1]) {
+    return false;  // The output buffer is still being transmitted
+  }
+  closeBatch();
+  _fill ^= 1;
+  return true;
+}
+
+uint32_t SEEED_CANBridge::pending(const uint8_t *&data) {
+  __disable_irq();
+  if (!_len[_fill ^ 1] && _len[_fill]) {
+    swap();
+  }
+  data = _buf[_fill ^ 1];
+  uint32_t n = _len[_fill ^ 1];
+  __enable_irq();
+  return n;
+}
+
+void SEEED_CANBridge::sent(void) {
+  __disable_irq();
+  _len[_fill ^ 1] = 0;
+  __enable_irq();
+}
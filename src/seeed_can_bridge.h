@@ -0,0 +1,189 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_BRIDGE_H_
+#define _SEEED_CAN_BRIDGE_H_
+
+#include "seeed_can_frame.h"
+
+class SEEED_CAN;
+
+// Size of each of the two output buffers (one is transmitted while the other fills)
+#ifndef CAN_BRIDGE_BUFFER
+#define CAN_BRIDGE_BUFFER 256
+#endif
+
+// Longest command accepted from the host, excluding the carriage return
+#define CAN_BRIDGE_COMMAND 31
+
+// Binary batch: 0xA5, 0x5A, frame count, flags, sequence number of the first frame (4 bytes), records, Fletcher-16
+#define CAN_BRIDGE_SYNC0 0xA5
+#define CAN_BRIDGE_SYNC1 0x5A
+#define CAN_BRIDGE_HEADER 8
+#define CAN_BRIDGE_TRAILER 2
+#define CAN_BRIDGE_OVERRUN 0x01  // Batch flag: frames were dropped before this batch
+
+// SLCAN status flags (F command), returned by a Handler's Status request
+#define SLCAN_ERROR_WARNING 0x04
+#define SLCAN_DATA_OVERRUN 0x08
+#define SLCAN_ERROR_PASSIVE 0x20
+#define SLCAN_BUS_ERROR 0x80
+
+/**
+ * Serial bridge between a CAN interface and a PC, speaking the SLCAN (Lawicel) protocol.
+ *
+ * Commands from the host are fed to input(). Frames for the host are given to frame() (or read from the attached CAN
+ * interface by forward()) and encoded into one of two output buffers while the other is being transmitted: pending()
+ * hands out a complete buffer, e.g. to start a DMA transfer, and sent() returns it once the transfer is done. pump()
+ * does all of this for any serial object with readable(), getc(), writeable() and putc(), such as RawSerial, or a
+ * pseudo-terminal wrapper on a Linux host.
+ *
+ * Supported commands: Sn (bit rate 0 to 8), O, L, C, tiiildd.., Tiiiiiiiildd.., riiil, Riiiiiiiil, V, N, F and Zn
+ * (time stamps), answered with CR or BEL (error) as usual. The extension Bn selects, with B1, a binary framing for the
+ * frames sent to the host: frames are packed into batches, each made of an 8 byte header (CAN_BRIDGE_SYNC0,
+ * CAN_BRIDGE_SYNC1, frame count, flags, little endian sequence number of the first frame), one record per frame (a
+ * little endian 32-bit time stamp in microseconds, the little endian SEEED_CANFrame::ident, the DLC and the data
+ * bytes) and the two Fletcher-16 sums (first sum first) of the header and records. Replies to commands stay in ASCII
+ * between batches.
+ *
+ * The protocol only talks to the CAN interface through a Handler, so it builds and runs without the MCP2515 driver,
+ * e.g. on a Linux host against a pseudo-terminal. attach(SEEED_CAN &) (seeed_can_bridge_can.cpp) supplies the handler
+ * for a SEEED_CAN.
+ */
+class SEEED_CANBridge {
+ public:
+  enum Request { Open = 0, Listen, Close, Transmit, Status, Receive };
+
+  /**
+   * Carries out a request: Open or Listen (listen only) the CAN bus at bitRate, Close it, Transmit a frame, return
+   * the SLCAN Status flags, or Receive the next frame waiting for the host into *frame.
+   *
+   * @returns 1 (or the Status flags) if successful, 0 otherwise (for Receive, if no frame is waiting)
+   */
+  typedef int (*Handler)(Request request, SEEED_CANFrame *frame, uint32_t bitRate, void *context);
+
+  SEEED_CANBridge();
+
+  /**
+   * Bridge a SEEED_CAN interface (defined in seeed_can_bridge_can.cpp, with the SEEED_CAN driver).
+   */
+  void attach(SEEED_CAN &can);
+
+  /**
+   * Bridge any other CAN interface, or a test double, through a request handler.
+   */
+  void attach(Handler fn, void *context = NULL);
+
+  /**
+   * Process bytes received from the host.
+   */
+  void input(const uint8_t data[], uint32_t n);
+
+  /**
+   * Queue a frame for the host, safe from interrupt handlers.
+   *
+   * @param frame The frame.
+   * @param stampUs When it was received, in microseconds (us_ticker_read() time base).
+   *
+   * @returns true if queued, false if the bridge is closed or both output buffers are full (the frame is then dropped
+   * and counted by overflows())
+   */
+  bool frame(const SEEED_CANFrame &frame, uint32_t stampUs);
+
+  /**
+   * Queue every frame waiting in the attached CAN interface (the handler's Receive requests) for the host.
+   *
+   * @returns the number of frames read
+   */
+  uint32_t forward(void);
+
+  /**
+   * Get the next output buffer to transmit. The same buffer is returned until sent() is called.
+   *
+   * @param data Set to the buffer.
+   *
+   * @returns the number of bytes to transmit, 0 if there is nothing to send
+   */
+  uint32_t pending(const uint8_t *&data);
+
+  /**
+   * Release the buffer returned by pending() once it has been transmitted.
+   */
+  void sent(void);
+
+  /**
+   * Move bytes between a serial port and the bridge: read the host's commands, forward() received frames and write
+   * as much output as the port accepts without blocking.
+   */
+  template <class SerialT>
+  void pump(SerialT &serial) {
+    const uint8_t *data;
+
+    while (serial.readable()) {
+      uint8_t c = (uint8_t)serial.getc();
+      input(&c, 1);
+    }
+    forward();
+    uint32_t n = pending(data);
+    while ((_outPos < n) && serial.writeable()) {
+      serial.putc(data[_outPos++]);
+    }
+    if (n && (_outPos == n)) {
+      _outPos = 0;
+      sent();
+    }
+  }
+
+  /**
+   * Returns true while the binary framing is selected.
+   */
+  bool binary(void) { return _binary; }
+
+  /**
+   * Returns the number of frames dropped because both output buffers were full.
+   */
+  uint32_t overflows(void) { return _overflows; }
+
+ protected:
+  static int canHandler(Request request, SEEED_CANFrame *frame, uint32_t bitRate, void *context);
+
+  void command(void);
+  bool reply(const char *text);
+  bool append(const uint8_t data[], uint32_t n, bool record);
+  void closeBatch(void);
+  bool swap(void);
+
+  Handler _fn;
+  void *_context;
+  uint8_t _cmd[CAN_BRIDGE_COMMAND + 1];
+  uint32_t _cmdLen;
+  bool _cmdOverflow;
+  uint32_t _bitRate;
+  bool _open;
+  bool _listen;
+  bool _stamps;
+  volatile bool _binary;
+  uint8_t _buf[2][CAN_BRIDGE_BUFFER];
+  uint32_t _len[2];
+  uint32_t _fill;    // Buffer being filled, the other one is the output buffer
+  int32_t _batch;    // Offset of the open binary batch in the fill buffer, -1 if none
+  uint32_t _seq;     // Sequence number of the next frame
+  uint32_t _outPos;  // Bytes of the output buffer written by pump()
+  bool _overrun;     // Frames dropped since the last batch was opened
+  uint32_t _overflows;
+  uint32_t _reported;  // _overflows when the F command last reported a data overrun
+};
+
+#endif  // SEEED_CAN_BRIDGE_H
@@ -0,0 +1,53 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SEEED_CAN side of the SLCAN bridge, kept apart from the protocol so that seeed_can_bridge.cpp builds without the
+// driver
+
+#include "seeed_can.h"
+#include "seeed_can_bridge.h"
+
+void SEEED_CANBridge::attach(SEEED_CAN &can) { attach(&SEEED_CANBridge::canHandler, &can); }
+
+int SEEED_CANBridge::canHandler(Request request, SEEED_CANFrame *frame, uint32_t bitRate, void *context) {
+  SEEED_CAN *can = (SEEED_CAN *)context;
+  SEEED_CANMessage msg;
+  switch (request) {
+    case Open:
+      return can->open((int)bitRate, SEEED_CAN::Normal);
+    case Listen:
+      return can->open((int)bitRate, SEEED_CAN::Monitor);
+    case Close:
+      return can->mode(SEEED_CAN::Config);
+    case Transmit:
+      frame->unpack(msg);
+      return can->write(msg);
+    case Status: {
+      uint8_t eflg = can->errorFlags();
+      return ((eflg & MCP_EFLG_EWARN) ? SLCAN_ERROR_WARNING : 0) |
+             ((eflg & (MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR)) ? SLCAN_DATA_OVERRUN : 0) |
+             ((eflg & (MCP_EFLG_RXEP | MCP_EFLG_TXEP)) ? SLCAN_ERROR_PASSIVE : 0) |
+             ((eflg & MCP_EFLG_TXBO) ? SLCAN_BUS_ERROR : 0);
+    }
+    case Receive:
+      if (!can->read(msg)) {
+        return 0;
+      }
+      frame->pack(msg);
+      return 1;
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,60 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_capture.h"
+
+bool SEEED_CANCapture::pop(SEEED_CANRawFrame &raw) {
+  uint32_t tail = _tail;
+  if (tail == _head) {
+    return false;
+  }
+  __DMB();
+  raw = _frames[tail & (CAN_CAPTURE_DEPTH - 1)];
+  __DMB();
+  _tail = tail + 1;  // Hand the slot back only once the frame has been copied out
+  return true;
+}
+
+uint32_t SEEED_CANCapture::read(SEEED_CANFrame frames[], uint32_t n) {
+  uint32_t tail = _tail;
+  uint32_t waiting = _head - tail;  // Frames committed after this are left for the next call
+
+  n = (n < waiting) ? n : waiting;
+  __DMB();  // The slots are read only after their head was seen
+  for (uint32_t i = 0; i < n; i++) {
+    _frames[(tail + i) & (CAN_CAPTURE_DEPTH - 1)].decode(frames[i]);
+  }
+  __DMB();
+  _tail = tail + n;  // Free the slots once, for the whole batch
+  return n;
+}
+
+uint32_t SEEED_CANCapture::read(SEEED_CANMessage msgs[], uint32_t n, uint8_t filhit[]) {
+  uint32_t tail = _tail;
+  uint32_t waiting = _head - tail;
+
+  n = (n < waiting) ? n : waiting;
+  __DMB();
+  for (uint32_t i = 0; i < n; i++) {
+    const SEEED_CANRawFrame &raw = _frames[(tail + i) & (CAN_CAPTURE_DEPTH - 1)];
+    raw.decode(msgs[i]);
+    if (filhit) {
+      filhit[i] = raw.filhit();
+    }
+  }
+  __DMB();
+  _tail = tail + n;
+  return n;
+}
@@ -0,0 +1,144 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_CAPTURE_H_
+#define _SEEED_CAN_CAPTURE_H_
+
+#include "seeed_can.h"
+
+// Number of raw frames held by one SEEED_CANCapture (power of two)
+#ifndef CAN_CAPTURE_DEPTH
+#define CAN_CAPTURE_DEPTH 64
+#endif
+
+/**
+ * A received frame exactly as the MCP2515 delivered it, 20 bytes.
+ */
+struct SEEED_CANRawFrame {
+  uint32_t stampUs;              // When it was read, in microseconds (us_ticker_read() time base)
+  uint8_t rxStatus;              // RX_STATUS byte: receive buffer, frame type and filter hit
+  uint8_t regs[CAN_FRAME_REGS];  // RXBn register image: SIDH, SIDL, EID8, EID0, DLC, D0..D7
+  uint8_t reserved[2];
+
+  /**
+   * Return the acceptance filter that accepted the frame (RX_STATUS bits 2..0).
+   */
+  uint8_t filhit(void) const { return rxStatus & MCP_RXSTAT_RXF_MASK; }
+
+  /**
+   * Decode into a SEEED_CANFrame, with the filter hit and a millisecond time stamp.
+   */
+  void decode(SEEED_CANFrame &frame) const {
+    frame.fromRegs(regs);
+    frame.filhit = filhit();
+    frame.stamp = (uint16_t)(stampUs / 1000);
+  }
+
+  /**
+   * Decode into a CAN_Message (or SEEED_CANMessage).
+   */
+  void decode(CAN_Message &msg) const {
+    uint32_t ident = SEEED_CANFrame::identFromRegs(regs);
+    uint8_t dlc = regs[4] & MCP_DLC_MASK;
+    msg.id = ident & CAN_FRAME_ID_MASK;
+    msg.format = (ident & CAN_FRAME_IDE) ? CANExtended : CANStandard;
+    msg.type = (ident & CAN_FRAME_RTR) ? CANRemote : CANData;
+    msg.len = (dlc > 8) ? 8 : dlc;
+    memcpy(msg.data, &regs[5], 8);
+  }
+};
+
+static_assert(sizeof(SEEED_CANRawFrame) == 20, "SEEED_CANRawFrame must stay 20 bytes");
+
+/**
+ * Ring of raw received frames, for capturing bursts with the least work in the receive interrupt.
+ *
+ * Attached to a SEEED_CAN with SEEED_CAN::capture(), the receive interrupt (or poller) of the priority and adaptive
+ * receive modes reads each frame's RX_STATUS byte and RXBn register image straight into the next ring slot and time
+ * stamps it, nothing more: the frame is not decoded, and on-change filters, mailboxes and the software receive queues
+ * are bypassed. The consumer decodes later, in bulk, with read(), or takes the raw images with pop().
+ *
+ * One producer and one consumer may use the ring without locking. A full ring drops the new frame (its receive buffer
+ * is still freed) and counts it as an overflow.
+ */
+class SEEED_CANCapture {
+ public:
+  SEEED_CANCapture() : _head(0), _tail(0), _overflows(0) {}
+
+  /**
+   * Producer side: return the next free slot, NULL if the ring is full (counted as an overflow).
+   */
+  SEEED_CANRawFrame *claim(void) {
+    if ((_head - _tail) >= CAN_CAPTURE_DEPTH) {
+      _overflows++;
+      return NULL;
+    }
+    __DMB();  // The consumer's last copy out of the slot must be done before it is written again
+    return &_frames[_head & (CAN_CAPTURE_DEPTH - 1)];
+  }
+
+  /**
+   * Producer side: publish the slot returned by claim() once it is filled in.
+   */
+  void commit(void) {
+    __DMB();
+    _head = _head + 1;  // Publish only once the frame is complete
+  }
+
+  /**
+   * Remove the oldest raw frame without decoding it.
+   *
+   * @returns true if a frame was removed, false if the ring was empty
+   */
+  bool pop(SEEED_CANRawFrame &raw);
+
+  /**
+   * Remove and decode up to n frames into SEEED_CANFrames.
+   *
+   * @returns the number of frames decoded
+   */
+  uint32_t read(SEEED_CANFrame frames[], uint32_t n);
+
+  /**
+   * Remove and decode up to n frames into SEEED_CANMessages.
+   *
+   * @param msgs The messages.
+   * @param n Size of msgs.
+   * @param filhit Optional array of n entries set to the acceptance filter that accepted each message.
+   *
+   * @returns the number of messages decoded
+   */
+  uint32_t read(SEEED_CANMessage msgs[], uint32_t n, uint8_t filhit[] = NULL);
+
+  /**
+   * Returns the number of frames waiting.
+   */
+  uint32_t count(void) const { return _head - _tail; }
+
+  /**
+   * Returns the number of frames dropped because the ring was full.
+   */
+  uint32_t overflows(void) const { return _overflows; }
+
+ protected:
+  SEEED_CANRawFrame _frames[CAN_CAPTURE_DEPTH];
+  volatile uint32_t _head;
+  volatile uint32_t _tail;
+  volatile uint32_t _overflows;
+
+  static_assert((CAN_CAPTURE_DEPTH & (CAN_CAPTURE_DEPTH - 1)) == 0, "CAN_CAPTURE_DEPTH must be a power of two");
+};
+
+#endif  // SEEED_CAN_CAPTURE_H
@@ -0,0 +1,104 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_change.h"
+
+#define CAN_FREE_KEY 0xFFFFFFFF
+
+SEEED_CANChangeFilter::SEEED_CANChangeFilter() { clear(); }
+
+void SEEED_CANChangeFilter::clear(void) {
+  __disable_irq();  // pass() may run in the receive interrupt
+  memset(_entries, 0, sizeof(_entries));
+  for (int i = 0; i < CAN_CHANGE_IDS; i++) {
+    _entries[i].key = CAN_FREE_KEY;
+  }
+  _suppressed = 0;
+  __enable_irq();
+}
+
+SEEED_CANChangeFilter::Entry *SEEED_CANChangeFilter::find(uint32_t key) {
+  uint32_t h = (key ^ (key >> 7) ^ (key >> 15)) & (CAN_CHANGE_IDS - 1);
+  for (uint32_t i = 0; i < CAN_CHANGE_IDS; i++) {
+    Entry &e = _entries[(h + i) & (CAN_CHANGE_IDS - 1)];
+    if ((e.key == key) || (e.key == CAN_FREE_KEY)) {
+      return &e;
+    }
+  }
+  return NULL;
+}
+
+int SEEED_CANChangeFilter::subscribe(uint32_t id, CANFormat format, uint32_t everyN, uint32_t timeoutUs) {
+  uint32_t key = (id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0);
+
+  __disable_irq();
+  Entry *e = find(key);
+  if (!e) {
+    __enable_irq();
+    return 0;
+  }
+  if (e->key == CAN_FREE_KEY) {
+    memset(e, 0, sizeof(*e));
+    e->dlc = 0xFF;  // The first frame is always a change
+  }
+  e->everyN = everyN;
+  e->timeoutUs = timeoutUs;
+  e->key = key;
+  __enable_irq();
+  return 1;
+}
+
+bool SEEED_CANChangeFilter::pass(const SEEED_CANFrame &frame, uint32_t stampUs) {
+  if (frame.ident & CAN_FRAME_RTR) {
+    return true;
+  }
+  Entry *e = find(frame.ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE));
+  if (!e || (e->key == CAN_FREE_KEY)) {
+    return true;
+  }
+  uint8_t len = (frame.dlc > 8) ? 8 : frame.dlc;
+  if ((frame.dlc != e->dlc) || memcmp(frame.data, e->data, len)) {
+    e->dlc = frame.dlc;
+    memcpy(e->data, frame.data, len);
+    e->stats.changes++;
+  } else if (!(e->everyN && (e->repeats + 1 >= e->everyN)) &&
+             !(e->timeoutUs && ((uint32_t)(stampUs - e->lastUs) >= e->timeoutUs))) {
+    e->repeats++;
+    e->stats.suppressed++;
+    _suppressed++;
+    return false;
+  }
+  e->repeats = 0;
+  e->lastUs = stampUs;
+  e->stats.delivered++;
+  return true;
+}
+
+bool SEEED_CANChangeFilter::pass(const CAN_Message &msg) {
+  SEEED_CANFrame frame;
+  frame.pack(msg);
+  return pass(frame, us_ticker_read());
+}
+
+bool SEEED_CANChangeFilter::stats(uint32_t id, CANFormat format, Stats &stats) {
+  Entry *e = find((id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0));
+  if (!e || (e->key == CAN_FREE_KEY)) {
+    return false;
+  }
+  __disable_irq();
+  stats = e->stats;
+  __enable_irq();
+  return true;
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_CHANGE_H_
+#define _SEEED_CAN_CHANGE_H_
+
+#include "seeed_can.h"
+
+// Number of CAN Ids a SEEED_CANChangeFilter can subscribe to (power of two)
+#ifndef CAN_CHANGE_IDS
+#define CAN_CHANGE_IDS 32
+#endif
+
+/**
+ * On-change delivery filter.
+ *
+ * Remembers the last payload and DLC of each subscribed CAN Id and suppresses frames that repeat it, optionally still
+ * letting every N-th repeat through or one once a timeout has passed since the last frame delivered. Frames of CAN Ids
+ * that are not subscribed, and remote frames, always pass.
+ *
+ * Attach it to a SEEED_CAN with SEEED_CAN::changeFilter() so that suppressed frames never reach read() (or, in priority
+ * and adaptive receive mode, the software queues), or call pass() directly.
+ */
+class SEEED_CANChangeFilter {
+ public:
+  /**
+   * Per CAN Id counters
+   */
+  struct Stats {
+    uint32_t delivered;   // Frames passed on
+    uint32_t suppressed;  // Repeats held back
+    uint32_t changes;     // Frames whose payload or DLC differed from the previous one
+  };
+
+  SEEED_CANChangeFilter();
+
+  /**
+   * Subscribe to a CAN Id (or change the settings of one already subscribed).
+   *
+   * @param id The 11 or 29 bit CAN Id.
+   * @param format CANStandard or CANExtended.
+   * @param everyN Deliver every N-th repeat of an unchanged payload, @b default: @p 0 (never).
+   * @param timeoutUs Deliver a repeat once this many microseconds have passed since the last frame delivered,
+   * @b default: @p 0 (never).
+   *
+   * @returns 1 if subscribed, 0 if the table is full
+   */
+  int subscribe(uint32_t id, CANFormat format, uint32_t everyN = 0, uint32_t timeoutUs = 0);
+
+  /**
+   * Forget all subscriptions and counters.
+   */
+  void clear(void);
+
+  /**
+   * Decide whether a received frame is delivered.
+   *
+   * @param frame The frame.
+   * @param stampUs When it was received, in microseconds (us_ticker_read() time base).
+   *
+   * @returns true to deliver the frame, false if it repeats the last payload and is suppressed
+   */
+  bool pass(const SEEED_CANFrame &frame, uint32_t stampUs);
+
+  /**
+   * Decide whether a CAN_Message received now is delivered, see pass(const SEEED_CANFrame &, uint32_t).
+   */
+  bool pass(const CAN_Message &msg);
+
+  /**
+   * Copy the counters of a subscribed CAN Id.
+   *
+   * @returns true if the CAN Id is subscribed
+   */
+  bool stats(uint32_t id, CANFormat format, Stats &stats);
+
+  /**
+   * Returns the number of frames suppressed, over all CAN Ids.
+   */
+  uint32_t suppressed(void) { return _suppressed; }
+
+ protected:
+  struct Entry {
+    uint32_t key;  // CAN Id | CAN_FRAME_IDE, 0xFFFFFFFF when free
+    uint8_t dlc;   // Of the last frame, 0xFF before the first one
+    uint8_t data[8];
+    uint32_t repeats;  // Repeats suppressed since the last frame delivered
+    uint32_t everyN;
+    uint32_t timeoutUs;
+    uint32_t lastUs;  // When the last frame was delivered
+    Stats stats;
+  };
+
+  Entry *find(uint32_t key);
+
+  Entry _entries[CAN_CHANGE_IDS];
+  uint32_t _suppressed;
+
+  static_assert((CAN_CHANGE_IDS & (CAN_CHANGE_IDS - 1)) == 0, "CAN_CHANGE_IDS must be a power of two");
+};
+
+#endif  // SEEED_CAN_CHANGE_H
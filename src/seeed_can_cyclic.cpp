@@ -0,0 +1,162 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_cyclic.h"
+
+SEEED_CANCyclic::SEEED_CANCyclic(SEEED_CAN &can, uint32_t tickUs, uint32_t fastPeriodUs)
+    : _can(can), _tickUs(tickUs), _fastPeriodUs(fastPeriodUs) {
+  for (uint32_t i = 0; i < CAN_CYCLIC_MAX; i++) {
+    _entries[i].used = false;
+    _entries[i].txBuf = -1;
+  }
+}
+
+SEEED_CANCyclic::~SEEED_CANCyclic() {
+  stop();
+  for (int i = 0; i < CAN_CYCLIC_MAX; i++) {
+    remove(i);
+  }
+}
+
+int SEEED_CANCyclic::add(const SEEED_CANMessage &msg, uint32_t periodUs) {
+  bool taken[3] = {true, false, false};  // TX buffer 0 always stays with write()
+  int handle = -1;
+
+  for (int i = 0; i < CAN_CYCLIC_MAX; i++) {
+    if (_entries[i].used) {
+      if (_entries[i].txBuf >= 0) {
+        taken[_entries[i].txBuf] = true;
+      }
+    } else if (handle < 0) {
+      handle = i;
+    }
+  }
+  if (handle < 0) {
+    return -1;
+  }
+  Entry &e = _entries[handle];
+  e.msg = msg;
+  e.period = periodUs;
+  e.due = us_ticker_read() + _tickUs;
+  e.txBuf = -1;
+  e.dirty = false;
+  memset(&e.stats, 0, sizeof(e.stats));
+  e.stats.jitterMin = 0xFFFFFFFF;
+  if (periodUs <= _fastPeriodUs) {
+    for (int b = 2; b > 0; b--) {  // Highest numbered buffer wins arbitration between equal priorities
+      if (!taken[b] && _can.reserveTxBuffer(b, msg)) {  // Fails for a buffer reserved elsewhere, e.g. a responder
+        e.txBuf = b;
+        break;
+      }
+    }
+  }
+  e.used = true;
+  return handle;
+}
+
+void SEEED_CANCyclic::remove(int handle) {
+  if ((handle < 0) || (handle >= CAN_CYCLIC_MAX) || !_entries[handle].used) {
+    return;
+  }
+  _entries[handle].used = false;
+  if (_entries[handle].txBuf >= 0) {
+    _can.releaseTxBuffer(_entries[handle].txBuf);
+    _entries[handle].txBuf = -1;
+  }
+}
+
+int SEEED_CANCyclic::update(int handle, const char *data) {
+  if ((handle < 0) || (handle >= CAN_CYCLIC_MAX) || !_entries[handle].used) {
+    return 0;
+  }
+  Entry &e = _entries[handle];
+  uint8_t len = (e.msg.len > 8) ? 8 : e.msg.len;  // A DLC of 9 to 15 still carries 8 data bytes
+  __disable_irq();  // tick() runs from the Ticker interrupt
+  memcpy(e.msg.data, data, len);
+  e.dirty = true;
+  __enable_irq();
+  return 1;
+}
+
+void SEEED_CANCyclic::start(void) {
+  uint32_t now = us_ticker_read();
+  for (int i = 0; i < CAN_CYCLIC_MAX; i++) {
+    _entries[i].due = now + _tickUs;
+  }
+  _ticker.attach_us(this, &SEEED_CANCyclic::tick, _tickUs);
+}
+
+void SEEED_CANCyclic::stop(void) { _ticker.detach(); }
+
+int SEEED_CANCyclic::txBuffer(int handle) {
+  if ((handle < 0) || (handle >= CAN_CYCLIC_MAX) || !_entries[handle].used) {
+    return -1;
+  }
+  return _entries[handle].txBuf;
+}
+
+SEEED_CANCyclic::Stats SEEED_CANCyclic::stats(int handle) {
+  Stats s;
+  memset(&s, 0, sizeof(s));
+  if ((handle >= 0) && (handle < CAN_CYCLIC_MAX) && _entries[handle].used) {
+    __disable_irq();
+    s = _entries[handle].stats;
+    __enable_irq();
+  }
+  return s;
+}
+
+void SEEED_CANCyclic::tick(void) {
+  uint32_t now = us_ticker_read();
+  bool blocked = _can.isrBlocked();  // The main loop is part way through its own MCP2515 sequence
+  for (int i = 0; i < CAN_CYCLIC_MAX; i++) {
+    Entry &e = _entries[i];
+    if (e.used && ((int32_t)(now - e.due) >= 0)) {
+      if (blocked) {
+        e.stats.busy++;  // Retried on the next tick
+      } else {
+        send(e, now);
+      }
+    }
+  }
+}
+
+void SEEED_CANCyclic::send(Entry &e, uint32_t now) {
+  int ok;
+  if (e.txBuf >= 0) {
+    // Header is already in the buffer, only transfer the data bytes if they changed
+    ok = _can.updateTxBuffer(e.txBuf, e.dirty ? (const char *)e.msg.data : NULL, e.dirty ? e.msg.len : 0);
+  } else {
+#ifdef SEEED_CAN_RTOS
+    ok = _can.submit(e.msg);  // Other threads may be half way through write()
+#else
+    ok = _can.write(e.msg);
+#endif
+  }
+  if (!ok) {
+    e.stats.busy++;  // Leave 'due' alone so the frame is retried on the next tick
+    return;
+  }
+  uint32_t jitter = now - e.due;
+  e.dirty = false;
+  e.stats.sent++;
+  e.stats.jitterSum += jitter;
+  e.stats.jitterMin = (jitter < e.stats.jitterMin) ? jitter : e.stats.jitterMin;
+  e.stats.jitterMax = (jitter > e.stats.jitterMax) ? jitter : e.stats.jitterMax;
+  e.due += e.period;
+  if ((int32_t)(now - e.due) >= 0) {  // Fell more than a whole period behind, don't burst to catch up
+    e.due = now + e.period;
+  }
+}
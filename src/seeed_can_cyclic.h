@@ -0,0 +1,123 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_CYCLIC_H_
+#define _SEEED_CAN_CYCLIC_H_
+
+#include "seeed_can.h"
+
+// Maximum number of cyclic messages handled by one scheduler
+#define CAN_CYCLIC_MAX 8
+
+/**
+ * Periodic transmit scheduler.
+ *
+ * High rate messages get a transmit buffer of their own: the header is loaded once by SEEED_CAN::reserveTxBuffer()
+ * and each period only the data bytes (if they changed) are loaded before RTS. Low rate messages, or any message once
+ * TX buffers 1 and 2 are taken, go through the shared SEEED_CAN::write() path. TX buffer 0 is always left to write().
+ */
+class SEEED_CANCyclic {
+ public:
+  /**
+   * Timing statistics of one cyclic message, all times in microseconds.
+   */
+  struct Stats {
+    uint32_t sent;       // Number of frames handed to the MCP2515
+    uint32_t busy;       // Number of ticks where the frame could not be queued yet (retried on the next tick)
+    uint32_t jitterMin;  // Smallest delay between the due time and the actual transmit request
+    uint32_t jitterMax;  // Largest delay between the due time and the actual transmit request
+    uint32_t jitterSum;  // Sum of delays, jitterSum / sent is the mean
+  };
+
+  /**
+   * Create a scheduler for a SEEED_CAN interface.
+   *
+   * @param can The (opened) CAN interface to transmit on.
+   * @param tickUs Scheduler resolution in microseconds, @b default: @p 1000.
+   * @param fastPeriodUs Messages with this period or shorter get a dedicated TX buffer, @b default: @p 10000.
+   */
+  SEEED_CANCyclic(SEEED_CAN &can, uint32_t tickUs = 1000, uint32_t fastPeriodUs = 10000);
+
+  ~SEEED_CANCyclic();
+
+  /**
+   * Add a cyclic message.
+   *
+   * @param msg The message to send, its data can be changed later with update().
+   * @param periodUs The transmission period in microseconds.
+   *
+   * @returns a handle (0 or more) for the message, -1 if the scheduler is full
+   */
+  int add(const SEEED_CANMessage &msg, uint32_t periodUs);
+
+  /**
+   * Remove a cyclic message, releasing its dedicated TX buffer if it had one.
+   *
+   * @param handle The handle returned by add().
+   */
+  void remove(int handle);
+
+  /**
+   * Change the data bytes sent from the next period on.
+   *
+   * @param handle The handle returned by add().
+   * @param data The new data bytes (as many as the message length given to add(), at most 8).
+   *
+   * @returns 1 if updated, 0 if the handle is invalid
+   */
+  int update(int handle, const char *data);
+
+  /**
+   * Start sending; the first frame of each message is due one tick after start().
+   */
+  void start(void);
+
+  /**
+   * Stop sending.
+   */
+  void stop(void);
+
+  /**
+   * Returns 0-2 if the message has a dedicated TX buffer, -1 if it uses the shared write() path.
+   */
+  int txBuffer(int handle);
+
+  /**
+   * Returns the timing statistics of a cyclic message.
+   */
+  Stats stats(int handle);
+
+ protected:
+  struct Entry {
+    SEEED_CANMessage msg;
+    uint32_t period;
+    uint32_t due;
+    int8_t txBuf;
+    bool used;
+    bool dirty;
+    Stats stats;
+  };
+
+  void tick(void);
+  void send(Entry &e, uint32_t now);
+
+  SEEED_CAN &_can;
+  Ticker _ticker;
+  uint32_t _tickUs;
+  uint32_t _fastPeriodUs;
+  Entry _entries[CAN_CYCLIC_MAX];
+};
+
+#endif  // SEEED_CAN_CYCLIC_H
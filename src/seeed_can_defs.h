@@ -85,6 +85,9 @@ extern "C" {
 #define MCP_WRITE_TX0 0x40
 #define MCP_WRITE_TX1 0x42
 #define MCP_WRITE_TX2 0x44
+#define MCP_WRITE_TX0_DATA 0x41  // Load TX buffer starting at TXB0D0
+#define MCP_WRITE_TX1_DATA 0x43  // Load TX buffer starting at TXB1D0
+#define MCP_WRITE_TX2_DATA 0x45  // Load TX buffer starting at TXB2D0
 
 #define MCP_RTS_TX0 0x81
 #define MCP_RTS_TX1 0x82
@@ -124,6 +127,7 @@ extern "C" {
 
 #define MCP_TXB_RTR_M 0x40 /* In TXBnDLC                   */
 #define MCP_RXB_IDE_M 0x08 /* In RXBnSIDL                  */
+#define MCP_RXB_SRR_M 0x10 /* In RXBnSIDL                  */
 #define MCP_RXB_RTR_M 0x40 /* In RXBnDLC                   */
 
 /**
@@ -192,6 +196,7 @@ extern "C" {
 #define MODE_CONFIG (4 << 5)
 #define MODE_POWERUP (7 << 5)
 #define MODE_MASK (7 << 5)
+#define MCP_CANCTRL_RESET (MODE_CONFIG | CLKOUT_ENABLE | CLKOUT_PS8)  // CANCTRL after a reset
 
 /**
  * Bit Rate timing
@@ -0,0 +1,131 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_FRAME_H_
+#define _SEEED_CAN_FRAME_H_
+
+#include "seeed_can_api.h"
+
+// Bit layout of SEEED_CANFrame::ident
+#define CAN_FRAME_ID_MASK 0x1FFFFFFF  // Bits 28..0: 11 or 29 bit identifier
+#define CAN_FRAME_IDE (1UL << 29)     // Extended Identifier Flag
+#define CAN_FRAME_RTR (1UL << 30)     // Remote Transmit Request Flag
+
+// Size of an MCP2515 TXBn/RXBn register image (SIDH, SIDL, EID8, EID0, DLC, D0..D7)
+#define CAN_FRAME_REGS 13
+
+/**
+ * Compact CAN frame, 16 bytes, for queues, logs and mailboxes.
+ *
+ * The identifier and the IDE/RTR flags share one 32-bit word, the DLC and filter hit share a second word with a 16-bit
+ * time stamp, and the data bytes start on an 8 byte boundary so that a frame can be copied with two double-word moves.
+ */
+struct __attribute__((aligned(8))) SEEED_CANFrame {
+  uint32_t ident;   // Identifier and CAN_FRAME_IDE / CAN_FRAME_RTR flags
+  uint8_t dlc;      // Data Length Counter (0..8)
+  uint8_t filhit;   // Acceptance filter that accepted the frame (RX_STATUS bits 2..0), 0 for transmitted frames
+  uint16_t stamp;   // Free running time stamp, units chosen by the producer
+  uint8_t data[8];  // CAN Message Data Bytes 0-7
+
+  /**
+   * Return the 11 or 29 bit identifier.
+   */
+  uint32_t id(void) const { return ident & CAN_FRAME_ID_MASK; }
+
+  /**
+   * Return the frame format, CANStandard or CANExtended.
+   */
+  CANFormat format(void) const { return (ident & CAN_FRAME_IDE) ? CANExtended : CANStandard; }
+
+  /**
+   * Return the frame type, CANData or CANRemote.
+   */
+  CANType type(void) const { return (ident & CAN_FRAME_RTR) ? CANRemote : CANData; }
+
+  /**
+   * Fill the frame from a CAN_Message (or SEEED_CANMessage).
+   */
+  void pack(const CAN_Message &msg) {
+    ident = (msg.id & CAN_FRAME_ID_MASK) | (msg.format == CANExtended ? CAN_FRAME_IDE : 0) |
+            (msg.type == CANRemote ? CAN_FRAME_RTR : 0);
+    dlc = msg.len & 0x0F;
+    filhit = 0;
+    stamp = 0;
+    memcpy(data, msg.data, 8);
+  }
+
+  /**
+   * Copy the frame into a CAN_Message (or SEEED_CANMessage).
+   */
+  void unpack(CAN_Message &msg) const {
+    msg.id = id();
+    msg.format = format();
+    msg.type = type();
+    msg.len = dlc;
+    memcpy(msg.data, data, 8);
+  }
+
+  /**
+   * Fill the frame from an RXBn register image as read by MCP_READ_RX0/MCP_READ_RX1.
+   *
+   * A standard remote frame is flagged by SRR in RXBnSIDL, an extended remote frame by RTR in RXBnDLC.
+   */
+  void fromRegs(const uint8_t regs[CAN_FRAME_REGS]) {
+    ident = identFromRegs(regs);
+    dlc = regs[4] & MCP_DLC_MASK;
+    dlc = (dlc > 8) ? 8 : dlc;
+    memcpy(data, &regs[5], 8);
+  }
+
+  /**
+   * Return the identifier and CAN_FRAME_IDE / CAN_FRAME_RTR flags of an RXBn register image.
+   */
+  static uint32_t identFromRegs(const uint8_t regs[CAN_FRAME_REGS]) {
+    uint32_t i;
+    if (regs[1] & MCP_RXB_IDE_M) {
+      i = ((uint32_t)regs[0] << 21) | ((uint32_t)(regs[1] & 0xE0) << 13) | ((uint32_t)(regs[1] & 0x03) << 16) |
+          ((uint32_t)regs[2] << 8) | regs[3] | CAN_FRAME_IDE;
+      i |= (regs[4] & MCP_RXB_RTR_M) ? CAN_FRAME_RTR : 0;
+    } else {
+      i = ((uint32_t)regs[0] << 3) | (regs[1] >> 5);
+      i |= (regs[1] & MCP_RXB_SRR_M) ? CAN_FRAME_RTR : 0;
+    }
+    return i;
+  }
+
+  /**
+   * Write the frame as a TXBn register image suitable for MCP_WRITE_TX0..2.
+   */
+  void toRegs(uint8_t regs[CAN_FRAME_REGS]) const {
+    uint32_t i = id();
+    if (ident & CAN_FRAME_IDE) {
+      regs[0] = (uint8_t)(i >> 21);                                                      // SID10..3
+      regs[1] = (uint8_t)(((i >> 13) & 0xE0) | MCP_TXB_EXIDE_M | ((i >> 16) & 0x03));  // SID2..0, EXIDE, EID17..16
+      regs[2] = (uint8_t)(i >> 8);                                                       // EID15..8
+      regs[3] = (uint8_t)i;                                                              // EID7..0
+    } else {
+      regs[0] = (uint8_t)(i >> 3);  // SID10..3
+      regs[1] = (uint8_t)(i << 5);  // SID2..0
+      regs[2] = 0;
+      regs[3] = 0;
+    }
+    regs[4] = dlc | ((ident & CAN_FRAME_RTR) ? MCP_TXB_RTR_M : 0);
+    memcpy(&regs[5], data, 8);
+  }
+};
+
+static_assert(sizeof(SEEED_CANFrame) == 16, "SEEED_CANFrame must stay 16 bytes");
+
+#endif  // SEEED_CAN_FRAME_H
@@ -0,0 +1,247 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_gateway.h"
+
+SEEED_CANGateway::SEEED_CANGateway() : _numChannels(0), _pending(0), _busy(false) {
+  memset(_channels, 0, sizeof(_channels));
+  memset(_routes, 0, sizeof(_routes));
+}
+
+SEEED_CANGateway::~SEEED_CANGateway() { stop(); }
+
+int SEEED_CANGateway::addChannel(SEEED_CAN &can) {
+  if (_numChannels >= CAN_GATEWAY_CHANNELS) {
+    return -1;
+  }
+  _channels[_numChannels].can = &can;
+  return (int)_numChannels++;
+}
+
+int SEEED_CANGateway::addRoute(int src, uint32_t id, uint32_t mask, CANFormat format, uint32_t dstChannels) {
+  uint32_t all = (1UL << _numChannels) - 1;
+
+  if ((src < 0) || ((uint32_t)src >= _numChannels) || !dstChannels || (dstChannels & ~all)) {
+    return -1;
+  }
+  for (int i = 0; i < CAN_GATEWAY_ROUTES; i++) {
+    Route &r = _routes[i];
+    if (r.used) {
+      continue;
+    }
+    __disable_irq();  // Frames are routed from the receive interrupts
+    memset(&r, 0, sizeof(r));
+    r.src = (uint8_t)src;
+    r.dst = (uint8_t)dstChannels;
+    r.key = (id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0);
+    r.mask = mask & CAN_FRAME_ID_MASK;
+    r.stats.latencyMin = 0xFFFFFFFF;
+    r.used = true;
+    __enable_irq();
+    return i;
+  }
+  return -1;
+}
+
+int SEEED_CANGateway::rewrite(int route, uint32_t newId, uint32_t idMask) {
+  if ((route < 0) || (route >= CAN_GATEWAY_ROUTES) || !_routes[route].used) {
+    return 0;
+  }
+  __disable_irq();
+  _routes[route].newId = newId & idMask & CAN_FRAME_ID_MASK;
+  _routes[route].idMask = idMask & CAN_FRAME_ID_MASK;
+  __enable_irq();
+  return 1;
+}
+
+int SEEED_CANGateway::transform(int route, Transform fn, void *context) {
+  if ((route < 0) || (route >= CAN_GATEWAY_ROUTES) || !_routes[route].used) {
+    return 0;
+  }
+  __disable_irq();
+  _routes[route].fn = fn;
+  _routes[route].context = context;
+  __enable_irq();
+  return 1;
+}
+
+void SEEED_CANGateway::removeRoute(int route) {
+  if ((route >= 0) && (route < CAN_GATEWAY_ROUTES)) {
+    _routes[route].used = false;  // Frames of this route still in a backlog are sent but no longer counted
+  }
+}
+
+SEEED_CANGateway::RouteStats SEEED_CANGateway::stats(int route) {
+  RouteStats s;
+  memset(&s, 0, sizeof(s));
+  if ((route >= 0) && (route < CAN_GATEWAY_ROUTES) && _routes[route].used) {
+    __disable_irq();
+    s = _routes[route].stats;
+    __enable_irq();
+  }
+  return s;
+}
+
+uint32_t SEEED_CANGateway::unrouted(int channel) {
+  return ((channel >= 0) && ((uint32_t)channel < _numChannels)) ? _channels[channel].unrouted : 0;
+}
+
+void SEEED_CANGateway::start(uint32_t tickUs) {
+  static void (SEEED_CANGateway::*const irqs[CAN_GATEWAY_CHANNELS])(void) = {
+      &SEEED_CANGateway::irq0, &SEEED_CANGateway::irq1, &SEEED_CANGateway::irq2, &SEEED_CANGateway::irq3};
+
+  for (uint32_t ch = 0; ch < _numChannels; ch++) {
+    _channels[ch].can->attach(this, irqs[ch], SEEED_CAN::RxAny);
+  }
+  _ticker.attach_us(this, &SEEED_CANGateway::tick, tickUs);
+  process();  // Frames received before now would never raise another falling edge
+}
+
+void SEEED_CANGateway::stop(void) {
+  _ticker.detach();
+  for (uint32_t ch = 0; ch < _numChannels; ch++) {
+    _channels[ch].can->attach((void (*)(void))NULL);
+  }
+}
+
+void SEEED_CANGateway::process(void) { service((1UL << _numChannels) - 1); }
+
+void SEEED_CANGateway::irq0(void) { service(0x01); }
+
+void SEEED_CANGateway::irq1(void) { service(0x02); }
+
+void SEEED_CANGateway::irq2(void) { service(0x04); }
+
+void SEEED_CANGateway::irq3(void) { service(0x08); }
+
+void SEEED_CANGateway::tick(void) { service(0); }
+
+void SEEED_CANGateway::service(uint32_t channels) {
+  __disable_irq();
+  _pending |= channels;
+  if (_busy) {  // The service() already running picks the channels up before it returns
+    __enable_irq();
+    return;
+  }
+  _busy = true;
+  do {
+    uint32_t todo = _pending;
+    _pending = 0;
+    __enable_irq();
+    for (uint32_t ch = 0; ch < _numChannels; ch++) {
+      flush(ch);
+    }
+    for (uint32_t ch = 0; ch < _numChannels; ch++) {
+      if (todo & (1UL << ch)) {
+        receive(ch);
+      }
+    }
+    __disable_irq();
+  } while (_pending);
+  _busy = false;
+  __enable_irq();
+}
+
+void SEEED_CANGateway::receive(uint32_t ch) {
+  Channel &c = _channels[ch];
+  uint8_t regs[CAN_FRAME_REGS];
+
+  while (c.can->readRaw(regs)) {
+    uint32_t stamp = us_ticker_read();
+    uint32_t ident = SEEED_CANFrame::identFromRegs(regs);
+    uint32_t key = ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE);
+    int i = 0;
+    while ((i < CAN_GATEWAY_ROUTES) && !(_routes[i].used && (_routes[i].src == ch) &&
+                                         !((key ^ _routes[i].key) & (_routes[i].mask | CAN_FRAME_IDE)))) {
+      i++;
+    }
+    if (i == CAN_GATEWAY_ROUTES) {
+      c.unrouted++;
+      continue;
+    }
+    Route &r = _routes[i];
+    r.stats.matched++;
+    if (ident & CAN_FRAME_RTR) {
+      regs[4] |= MCP_TXB_RTR_M;  // RXBnSIDL flags a standard remote frame with SRR, TXBnDLC always uses RTR
+    }
+    uint32_t id = (key & ~r.idMask) | r.newId;
+    if (r.fn) {
+      SEEED_CANFrame frame;
+      frame.fromRegs(regs);
+      frame.ident = (frame.ident & ~CAN_FRAME_ID_MASK) | (id & CAN_FRAME_ID_MASK);
+      frame.filhit = 0;
+      frame.stamp = 0;
+      if (!r.fn(frame, r.context)) {
+        r.stats.dropped++;
+        continue;
+      }
+      frame.toRegs(regs);
+    } else if (r.idMask) {
+      mcpEncodeId((CANid *)regs, (ident & CAN_FRAME_IDE) ? CANExtended : CANStandard, id & CAN_FRAME_ID_MASK);
+    }
+    forward(i, regs, stamp);
+  }
+}
+
+void SEEED_CANGateway::forward(uint32_t route, uint8_t regs[CAN_FRAME_REGS], uint32_t stamp) {
+  Route &r = _routes[route];
+
+  for (uint32_t d = 0; d < _numChannels; d++) {
+    if (!(r.dst & (1UL << d))) {
+      continue;
+    }
+    Channel &c = _channels[d];
+    if (flush(d) && (c.can->loadRaw(regs) >= 0)) {  // Frames already waiting for this destination go first
+      count(r, stamp);
+      continue;
+    }
+    if ((c.head - c.tail) >= CAN_GATEWAY_BACKLOG) {
+      r.stats.dropped++;
+      continue;
+    }
+    Pending &p = c.backlog[c.head % CAN_GATEWAY_BACKLOG];
+    memcpy(p.regs, regs, CAN_FRAME_REGS);
+    p.route = (uint8_t)route;
+    p.stamp = stamp;
+    c.head++;
+  }
+}
+
+bool SEEED_CANGateway::flush(uint32_t ch) {
+  Channel &c = _channels[ch];
+
+  if (c.can->isrBlocked()) {  // The main loop is part way through its own sequence on this destination
+    return false;
+  }
+  while (c.tail != c.head) {
+    Pending &p = c.backlog[c.tail % CAN_GATEWAY_BACKLOG];
+    if (c.can->loadRaw(p.regs) < 0) {
+      return false;
+    }
+    if (_routes[p.route].used) {
+      count(_routes[p.route], p.stamp);
+    }
+    c.tail++;
+  }
+  return true;
+}
+
+void SEEED_CANGateway::count(Route &r, uint32_t stamp) {
+  uint32_t latency = us_ticker_read() - stamp;
+  r.stats.forwarded++;
+  r.stats.latencySum += latency;
+  r.stats.latencyMin = (latency < r.stats.latencyMin) ? latency : r.stats.latencyMin;
+  r.stats.latencyMax = (latency > r.stats.latencyMax) ? latency : r.stats.latencyMax;
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_GATEWAY_H_
+#define _SEEED_CAN_GATEWAY_H_
+
+#include "seeed_can.h"
+
+// Maximum number of CAN interfaces bridged by one gateway (each has its own interrupt entry point)
+#define CAN_GATEWAY_CHANNELS 4
+
+// Maximum number of routes
+#ifndef CAN_GATEWAY_ROUTES
+#define CAN_GATEWAY_ROUTES 32
+#endif
+
+// Frames held per destination while all of its transmit buffers are busy
+#ifndef CAN_GATEWAY_BACKLOG
+#define CAN_GATEWAY_BACKLOG 8
+#endif
+
+/**
+ * Multi-channel CAN gateway.
+ *
+ * Frames received on one SEEED_CAN interface are matched against a routing table and forwarded to one or more other
+ * interfaces. Forwarding happens in the receive interrupt (or the driver thread, see SEEED_CAN::startThread()): the
+ * receive buffer's register image is read once and loaded as it is into a transmit buffer of each destination, only
+ * the identifier bytes are re-encoded when a route rewrites the CAN Id. Routes with a transform function get the frame
+ * as a SEEED_CANFrame. When a destination has no free transmit buffer, or the main loop is part way through an
+ * MCP2515 sequence on it (SEEED_CAN::isrBlocked()), the image waits in a small backlog which is retried on every
+ * interrupt and Ticker tick.
+ *
+ * The interfaces must be opened in the plain receive mode (not priority() or adaptive()); start() attaches the gateway
+ * to their receive interrupts. The check above only covers the destination's own MCP2515: while the gateway runs,
+ * interfaces that share one SPI bus must not be used from thread context at all.
+ */
+class SEEED_CANGateway {
+ public:
+  /**
+   * Payload transform, may change any part of the frame.
+   *
+   * @returns true to forward the frame, false to drop it
+   */
+  typedef bool (*Transform)(SEEED_CANFrame &frame, void *context);
+
+  /**
+   * Statistics of one route, times in microseconds
+   */
+  struct RouteStats {
+    uint32_t matched;     // Frames that matched the route
+    uint32_t forwarded;   // Frames loaded into a destination's transmit buffer (one per destination)
+    uint32_t dropped;     // Frames lost to a full backlog or dropped by the transform
+    uint32_t latencyMin;  // Shortest time from reading a frame to loading it for transmission
+    uint32_t latencyMax;  // Longest time from reading a frame to loading it for transmission
+    uint32_t latencySum;  // Sum of forwarding times, latencySum / forwarded is the mean
+  };
+
+  SEEED_CANGateway();
+
+  ~SEEED_CANGateway();
+
+  /**
+   * Add a CAN interface.
+   *
+   * @returns the channel number (0 to CAN_GATEWAY_CHANNELS - 1), -1 if there are already CAN_GATEWAY_CHANNELS
+   */
+  int addChannel(SEEED_CAN &can);
+
+  /**
+   * Add a route. The first route that matches a frame decides where it goes.
+   *
+   * @param src The channel the frames are received on.
+   * @param id CAN Id to match.
+   * @param mask Only CAN Id bits set in the mask are compared (0 matches every frame of that format).
+   * @param format CANStandard or CANExtended frames.
+   * @param dstChannels Destinations, bit n set forwards to channel n.
+   *
+   * @returns a route handle (0 or more), -1 if the routing table is full or a channel is invalid
+   */
+  int addRoute(int src, uint32_t id, uint32_t mask, CANFormat format, uint32_t dstChannels);
+
+  /**
+   * Rewrite the CAN Id of frames forwarded by a route: id = (id & ~idMask) | (newId & idMask).
+   *
+   * @returns 1 if set, 0 if the handle is invalid
+   */
+  int rewrite(int route, uint32_t newId, uint32_t idMask = CAN_FRAME_ID_MASK);
+
+  /**
+   * Pass the frames forwarded by a route through a transform function (NULL to remove it).
+   *
+   * @returns 1 if set, 0 if the handle is invalid
+   */
+  int transform(int route, Transform fn, void *context = NULL);
+
+  /**
+   * Remove a route.
+   */
+  void removeRoute(int route);
+
+  /**
+   * Returns the statistics of a route.
+   */
+  RouteStats stats(int route);
+
+  /**
+   * Returns the number of frames received on a channel that matched no route.
+   */
+  uint32_t unrouted(int channel);
+
+  /**
+   * Attach the gateway to the receive interrupts of every channel and retry the backlogs every tickUs microseconds.
+   */
+  void start(uint32_t tickUs = 1000);
+
+  /**
+   * Detach the gateway from the interrupts and stop the Ticker.
+   */
+  void stop(void);
+
+  /**
+   * Forward everything waiting on every channel, for use without start() (e.g. from the main loop).
+   */
+  void process(void);
+
+ protected:
+  struct Route {
+    bool used;
+    uint8_t src;
+    uint8_t dst;
+    uint32_t key;  // CAN Id | CAN_FRAME_IDE
+    uint32_t mask;
+    uint32_t newId;
+    uint32_t idMask;
+    Transform fn;
+    void *context;
+    RouteStats stats;
+  };
+
+  struct Pending {
+    uint8_t regs[CAN_FRAME_REGS];  // TXBn register image
+    uint8_t route;
+    uint32_t stamp;  // When it was read
+  };
+
+  struct Channel {
+    SEEED_CAN *can;
+    uint32_t unrouted;
+    Pending backlog[CAN_GATEWAY_BACKLOG];
+    uint32_t head;
+    uint32_t tail;
+  };
+
+  void irq0(void);
+  void irq1(void);
+  void irq2(void);
+  void irq3(void);
+  void tick(void);
+  void service(uint32_t channels);
+  void receive(uint32_t ch);
+  void forward(uint32_t route, uint8_t regs[CAN_FRAME_REGS], uint32_t stamp);
+  bool flush(uint32_t ch);
+  void count(Route &r, uint32_t stamp);
+
+  Channel _channels[CAN_GATEWAY_CHANNELS];
+  uint32_t _numChannels;
+  Route _routes[CAN_GATEWAY_ROUTES];
+  Ticker _ticker;
+  volatile uint32_t _pending;  // Channels waiting to be serviced
+  volatile bool _busy;         // service() is running, others leave their channels in _pending
+};
+
+#endif  // SEEED_CAN_GATEWAY_H
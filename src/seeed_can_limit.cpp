@@ -0,0 +1,141 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_limit.h"
+
+#define CAN_TOKEN 1000000ULL   // One frame, or one bit, in bucket units
+#define CAN_LONGEST_FRAME 160  // Bits in the longest frame, extended with 8 data bytes and worst case stuffing
+
+SEEED_CANRateLimit::SEEED_CANRateLimit(uint32_t bitRate, SEEED_CANAnalyser::Stuffing stuffing)
+    : _bitRate(bitRate), _stuffing(stuffing), _load(0), _burstUs(0), _numRules(0), _admitted(0) {
+  memset(_rules, 0, sizeof(_rules));
+  memset(&_budget, 0, sizeof(_budget));
+}
+
+void SEEED_CANRateLimit::bitRate(uint32_t bitRate) {
+  _bitRate = bitRate;
+  budget(_load, _burstUs);
+}
+
+int SEEED_CANRateLimit::limit(uint32_t first, uint32_t last, CANFormat format, uint32_t rate, uint32_t burst) {
+  uint32_t ide = (format == CANExtended) ? CAN_FRAME_IDE : 0;
+
+  if (_numRules >= CAN_RATE_RULES) {
+    return -1;
+  }
+  Rule &r = _rules[_numRules];
+  r.first = (first & CAN_FRAME_ID_MASK) | ide;
+  r.last = (last & CAN_FRAME_ID_MASK) | ide;
+  r.bucket.rate = rate;
+  r.bucket.capacity = (uint64_t)((burst < 1) ? 1 : burst) * CAN_TOKEN;
+  r.bucket.tokens = r.bucket.capacity;
+  r.bucket.stamp = us_ticker_read();
+  r.bucket.throttled = 0;
+  __disable_irq();  // admit() may be scanning the rules
+  _numRules++;
+  __enable_irq();
+  return (int)_numRules - 1;
+}
+
+void SEEED_CANRateLimit::budget(uint32_t load, uint32_t burstUs) {
+  uint32_t rate = (uint32_t)(((uint64_t)_bitRate * ((load > 1000) ? 1000 : load)) / 1000);
+  uint64_t capacity = (uint64_t)burstUs * rate;
+
+  _load = load;
+  _burstUs = burstUs;
+  if (rate && (capacity < CAN_LONGEST_FRAME * CAN_TOKEN)) {
+    capacity = CAN_LONGEST_FRAME * CAN_TOKEN;  // Otherwise long frames could never be sent
+  }
+  __disable_irq();
+  _budget.rate = rate;
+  _budget.capacity = capacity;
+  _budget.tokens = capacity;
+  _budget.stamp = us_ticker_read();
+  __enable_irq();
+}
+
+bool SEEED_CANRateLimit::refill(Bucket &b, uint32_t nowUs, uint64_t cost) {
+  uint64_t room = b.capacity - b.tokens;
+  uint64_t add = (uint64_t)(nowUs - b.stamp) * b.rate;  // nowUs is read with interrupts off, never before the stamp
+
+  b.stamp = nowUs;
+  b.tokens = (add >= room) ? b.capacity : (b.tokens + add);
+  if (b.tokens < cost) {
+    b.throttled++;
+    return false;
+  }
+  return true;
+}
+
+SEEED_CANRateLimit::Bucket *SEEED_CANRateLimit::match(const CAN_Message &msg) {
+  uint32_t key = (msg.id & CAN_FRAME_ID_MASK) | ((msg.format == CANExtended) ? CAN_FRAME_IDE : 0);
+
+  for (uint32_t i = 0; i < _numRules; i++) {
+    if ((key >= _rules[i].first) && (key <= _rules[i].last)) {
+      return &_rules[i].bucket;
+    }
+  }
+  return NULL;
+}
+
+bool SEEED_CANRateLimit::admit(const CAN_Message &msg) {
+  Bucket *rule = match(msg);
+  uint64_t bits = _budget.capacity ? SEEED_CANAnalyser::frameBits(msg, _stuffing) * CAN_TOKEN : 0;
+
+  __disable_irq();  // Several threads, and interrupt handlers, may be writing
+  uint32_t nowUs = us_ticker_read();
+  bool ok = (!rule || refill(*rule, nowUs, CAN_TOKEN)) && (!_budget.capacity || refill(_budget, nowUs, bits));
+  if (ok) {  // Tokens are only taken once both the rule and the budget allow the frame
+    if (rule) {
+      rule->tokens -= CAN_TOKEN;
+    }
+    _budget.tokens -= bits;
+    _admitted++;
+  }
+  __enable_irq();
+  return ok;
+}
+
+void SEEED_CANRateLimit::refund(const CAN_Message &msg) {
+  Bucket *rule = match(msg);
+  uint64_t bits = _budget.capacity ? SEEED_CANAnalyser::frameBits(msg, _stuffing) * CAN_TOKEN : 0;
+
+  __disable_irq();
+  if (rule) {
+    rule->tokens = ((rule->capacity - rule->tokens) < CAN_TOKEN) ? rule->capacity : (rule->tokens + CAN_TOKEN);
+  }
+  _budget.tokens = ((_budget.capacity - _budget.tokens) < bits) ? _budget.capacity : (_budget.tokens + bits);
+  _admitted--;
+  __enable_irq();
+}
+
+uint32_t SEEED_CANRateLimit::throttled(int rule) {
+  return ((rule < 0) || ((uint32_t)rule >= _numRules)) ? 0 : _rules[rule].bucket.throttled;
+}
+
+void SEEED_CANRateLimit::reset(void) {
+  __disable_irq();
+  uint32_t now = us_ticker_read();
+  for (uint32_t i = 0; i < _numRules; i++) {
+    _rules[i].bucket.tokens = _rules[i].bucket.capacity;
+    _rules[i].bucket.stamp = now;
+    _rules[i].bucket.throttled = 0;
+  }
+  _budget.tokens = _budget.capacity;
+  _budget.stamp = now;
+  _budget.throttled = 0;
+  _admitted = 0;
+  __enable_irq();
+}
@@ -0,0 +1,148 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_LIMIT_H_
+#define _SEEED_CAN_LIMIT_H_
+
+#include "seeed_can_analyser.h"
+
+// Most rate limit rules in one SEEED_CANRateLimit
+#ifndef CAN_RATE_RULES
+#define CAN_RATE_RULES 8
+#endif
+
+/**
+ * Transmit rate limits: token buckets per CAN Id range plus a bus load budget.
+ *
+ * Each rule gives a range of CAN Ids a sustained rate in frames per second and a burst allowance. The budget caps the
+ * share of the bus all admitted frames may use, each frame costing its length in bits (SEEED_CANAnalyser::frameBits(),
+ * worst case stuffing by default) at the configured bit rate. A frame is admitted only if the first rule covering its
+ * CAN Id and the budget both have tokens, which it then takes; frames no rule covers are only held to the budget.
+ * Checking a frame costs the same whatever its history: one pass over at most CAN_RATE_RULES rules and two bucket
+ * refills.
+ *
+ * Attached to a SEEED_CAN with SEEED_CAN::limiter(), write(), load() and loadRaw() reject frames that are over their
+ * limit, exactly as if every transmit buffer were busy, while messages given to submit() are delayed instead: the
+ * driver thread keeps them and tries again every millisecond. Remote frame answers (SEEED_CAN::responder()) are not
+ * limited.
+ */
+class SEEED_CANRateLimit {
+ public:
+  /**
+   * Create a limiter with no rules and no budget.
+   *
+   * @param bitRate The CAN bus bit rate, 0 to take SEEED_CAN::bitRate() when attached, @b default: @p 0.
+   * @param stuffing How to count stuff bits against the budget, @b default: @p SEEED_CANAnalyser::WorstCase.
+   */
+  SEEED_CANRateLimit(uint32_t bitRate = 0, SEEED_CANAnalyser::Stuffing stuffing = SEEED_CANAnalyser::WorstCase);
+
+  /**
+   * Change the bit rate the budget is worked out from.
+   */
+  void bitRate(uint32_t bitRate);
+
+  /**
+   * Returns the bit rate the budget is worked out from.
+   */
+  uint32_t bitRate(void) { return _bitRate; }
+
+  /**
+   * Add a token bucket for a range of CAN Ids. Rules are checked in the order they were added.
+   *
+   * @param first The lowest CAN Id of the range.
+   * @param last The highest CAN Id of the range, the same as first for a single CAN Id.
+   * @param format CANStandard or CANExtended.
+   * @param rate Sustained rate in frames per second.
+   * @param burst Frames that may be sent back to back after a quiet spell, at least 1.
+   *
+   * @returns the rule handle (0 or more), -1 if CAN_RATE_RULES are already in use
+   */
+  int limit(uint32_t first, uint32_t last, CANFormat format, uint32_t rate, uint32_t burst = 1);
+
+  /**
+   * Set the bus load budget.
+   *
+   * @param load Highest bus load in tenths of a percent (as SEEED_CANAnalyser::load()), 0 for no budget.
+   * @param burstUs Bus time that may be used back to back after a quiet spell, @b default: @p 10000.
+   */
+  void budget(uint32_t load, uint32_t burstUs = 10000);
+
+  /**
+   * Check a frame against its rule and the budget, and take the tokens if it is admitted.
+   *
+   * The time is read with interrupts disabled, so the buckets are always refilled in time order. A quiet spell of up to
+   * 71 minutes (the us_ticker_read() wrap) counts in full.
+   *
+   * @param msg The frame.
+   *
+   * @returns true if the frame may be sent, false if it is over a limit (and counted as throttled)
+   */
+  bool admit(const CAN_Message &msg);
+
+  /**
+   * Give back the tokens of an admitted frame that could not be sent after all, e.g. because no transmit buffer was
+   * free.
+   */
+  void refund(const CAN_Message &msg);
+
+  /**
+   * Returns the number of frames a rule has throttled.
+   */
+  uint32_t throttled(int rule);
+
+  /**
+   * Returns the number of frames throttled by the bus load budget.
+   */
+  uint32_t overBudget(void) { return _budget.throttled; }
+
+  /**
+   * Returns the number of frames admitted.
+   */
+  uint32_t admitted(void) { return _admitted; }
+
+  /**
+   * Refill every bucket and clear the counters.
+   */
+  void reset(void);
+
+ protected:
+  struct Bucket {
+    uint64_t tokens;    // Units of 1/1000000 frame (rules) or bit (budget)
+    uint64_t capacity;  // 0: no limit
+    uint32_t rate;      // Frames or bits per second
+    uint32_t stamp;     // Time of the last refill
+    uint32_t throttled;
+  };
+
+  struct Rule {
+    uint32_t first;  // CAN Id | CAN_FRAME_IDE
+    uint32_t last;
+    Bucket bucket;
+  };
+
+  Bucket *match(const CAN_Message &msg);
+  static bool refill(Bucket &b, uint32_t nowUs, uint64_t cost);
+
+  uint32_t _bitRate;
+  SEEED_CANAnalyser::Stuffing _stuffing;
+  uint32_t _load;
+  uint32_t _burstUs;
+  Rule _rules[CAN_RATE_RULES];
+  uint32_t _numRules;
+  Bucket _budget;
+  uint32_t _admitted;
+};
+
+#endif  // SEEED_CAN_LIMIT_H
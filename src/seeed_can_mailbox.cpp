@@ -0,0 +1,114 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_mailbox.h"
+
+#define CAN_FREE_KEY 0xFFFFFFFF
+
+SEEED_CANMailboxes::SEEED_CANMailboxes() {
+  memset(_boxes, 0, sizeof(_boxes));
+  for (int i = 0; i < CAN_MAILBOXES; i++) {
+    _boxes[i].key = CAN_FREE_KEY;
+  }
+}
+
+SEEED_CANMailboxes::Box *SEEED_CANMailboxes::lookup(uint32_t key) {
+  uint32_t h = (key ^ (key >> 7) ^ (key >> 15)) & (CAN_MAILBOXES - 1);
+  for (uint32_t i = 0; i < CAN_MAILBOXES; i++) {
+    Box &b = _boxes[(h + i) & (CAN_MAILBOXES - 1)];
+    if ((b.key == key) || (b.key == CAN_FREE_KEY)) {
+      return &b;
+    }
+  }
+  return NULL;
+}
+
+int SEEED_CANMailboxes::add(uint32_t id, CANFormat format) {
+  uint32_t key = (id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0);
+
+  __disable_irq();  // The receive interrupt probes the same table
+  Box *b = lookup(key);
+  if (b) {
+    b->key = key;
+  }
+  __enable_irq();
+  return b ? (int)(b - _boxes) : -1;
+}
+
+int SEEED_CANMailboxes::find(uint32_t id, CANFormat format) {
+  Box *b = lookup((id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0));
+  return (b && (b->key != CAN_FREE_KEY)) ? (int)(b - _boxes) : -1;
+}
+
+bool SEEED_CANMailboxes::update(const SEEED_CANFrame &frame, uint32_t stampUs) {
+  Box *b = lookup(frame.ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE));
+  if (!b || (b->key == CAN_FREE_KEY)) {
+    return false;
+  }
+  uint32_t seq = b->seq;
+  b->seq = seq + 1;
+  __DMB();  // Readers must see the odd sequence number before any part of the new frame
+  b->frame = frame;
+  b->stamp = stampUs;
+  __DMB();
+  b->seq = seq + 2;
+  return true;
+}
+
+uint32_t SEEED_CANMailboxes::read(int mailbox, SEEED_CANFrame &frame, uint32_t *stampUs) {
+  if ((mailbox < 0) || (mailbox >= CAN_MAILBOXES)) {
+    return 0;
+  }
+  Box &b = _boxes[mailbox];
+  SEEED_CANFrame copy;
+  uint32_t stamp;
+  for (int attempt = 0; attempt < CAN_MAILBOX_RETRIES; attempt++) {
+    uint32_t seq = b.seq;
+    if (!(seq & 1)) {
+      __DMB();
+      copy = b.frame;
+      stamp = b.stamp;
+      __DMB();
+      if (b.seq == seq) {
+        if (seq) {
+          frame = copy;
+          if (stampUs) {
+            *stampUs = stamp;
+          }
+        }
+        return seq / 2;
+      }
+    }
+#ifdef SEEED_CAN_RTOS
+    if (!__get_IPSR()) {
+      Thread::yield();  // Let a preempted writer thread finish its update
+    }
+#endif
+  }
+  return 0;
+}
+
+uint32_t SEEED_CANMailboxes::read(int mailbox, CAN_Message &msg, uint32_t *stampUs) {
+  SEEED_CANFrame frame;
+  uint32_t seq = read(mailbox, frame, stampUs);
+  if (seq) {
+    frame.unpack(msg);
+  }
+  return seq;
+}
+
+uint32_t SEEED_CANMailboxes::sequence(int mailbox) {
+  return ((mailbox >= 0) && (mailbox < CAN_MAILBOXES)) ? _boxes[mailbox].seq / 2 : 0;
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_MAILBOX_H_
+#define _SEEED_CAN_MAILBOX_H_
+
+#include "seeed_can.h"
+
+// Number of CAN Ids held by one SEEED_CANMailboxes (power of two)
+#ifndef CAN_MAILBOXES
+#define CAN_MAILBOXES 32
+#endif
+
+// Number of times SEEED_CANMailboxes::read() tries for a consistent copy of a mailbox before it gives up
+#ifndef CAN_MAILBOX_RETRIES
+#define CAN_MAILBOX_RETRIES 16
+#endif
+
+/**
+ * Latest-value mailboxes, one per registered CAN Id.
+ *
+ * The receive path overwrites a CAN Id's mailbox with every new frame instead of queueing it, so readers always get
+ * the newest frame and never have to drain a backlog. Each mailbox is a seqlock: the single writer (the receive
+ * interrupt or the driver thread) makes its sequence number odd while it copies the frame in and even again when it
+ * is done, and readers copy the frame out and retry if the sequence number was odd or changed meanwhile. The writer
+ * never waits for a reader.
+ *
+ * Attach the mailboxes to a SEEED_CAN with SEEED_CAN::mailboxes(), or call update() from your own receive code.
+ */
+class SEEED_CANMailboxes {
+ public:
+  SEEED_CANMailboxes();
+
+  /**
+   * Register a CAN Id.
+   *
+   * @param id The 11 or 29 bit CAN Id.
+   * @param format CANStandard or CANExtended, @b default: @p CANStandard.
+   *
+   * @returns the mailbox handle (0 or more, the same one if the CAN Id is already registered), -1 if all mailboxes
+   * are in use
+   */
+  int add(uint32_t id, CANFormat format = CANStandard);
+
+  /**
+   * Returns the mailbox handle of a registered CAN Id, -1 if it is not registered.
+   */
+  int find(uint32_t id, CANFormat format = CANStandard);
+
+  /**
+   * Store a received frame in its CAN Id's mailbox (writer side, a single writer only).
+   *
+   * @param frame The frame.
+   * @param stampUs When it was received, in microseconds (us_ticker_read() time base).
+   *
+   * @returns true if the CAN Id has a mailbox, false if the frame was not stored
+   */
+  bool update(const SEEED_CANFrame &frame, uint32_t stampUs);
+
+  /**
+   * Read the newest frame in a mailbox, from any thread.
+   *
+   * The copy is retried while the writer is part way through an update, up to CAN_MAILBOX_RETRIES times. In
+   * SEEED_CAN_RTOS builds a thread yields between attempts, so that a writer thread it preempted can finish. A writer
+   * that stays busy (e.g. one preempted by the interrupt handler calling read()) makes read() give up rather than spin
+   * for ever.
+   *
+   * @param mailbox The mailbox handle.
+   * @param frame The frame, unchanged if none was read.
+   * @param stampUs Optional, when the frame was received.
+   *
+   * @returns the mailbox's update sequence number (1 for the first frame, one more for each frame after it), 0 if
+   * no frame has been stored yet, the handle is invalid or the mailbox was still being updated (sequence() is then
+   * non-zero, try again later)
+   */
+  uint32_t read(int mailbox, SEEED_CANFrame &frame, uint32_t *stampUs = NULL);
+
+  /**
+   * Read the newest frame in a mailbox as a CAN_Message, see read(int, SEEED_CANFrame &, uint32_t *).
+   */
+  uint32_t read(int mailbox, CAN_Message &msg, uint32_t *stampUs = NULL);
+
+  /**
+   * Returns a mailbox's update sequence number without reading it, e.g. to poll for a fresh frame.
+   */
+  uint32_t sequence(int mailbox);
+
+ protected:
+  struct Box {
+    volatile uint32_t seq;  // Twice the number of updates, odd while an update is in progress
+    uint32_t key;           // CAN Id | CAN_FRAME_IDE, 0xFFFFFFFF when free
+    uint32_t stamp;
+    SEEED_CANFrame frame;
+  };
+
+  Box *lookup(uint32_t key);
+
+  Box _boxes[CAN_MAILBOXES];
+
+  static_assert((CAN_MAILBOXES & (CAN_MAILBOXES - 1)) == 0, "CAN_MAILBOXES must be a power of two");
+};
+
+#endif  // SEEED_CAN_MAILBOX_H
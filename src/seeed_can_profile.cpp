@@ -0,0 +1,97 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_profile.h"
+
+#ifdef SEEED_CAN_PROFILE
+
+static MCP_Profile profiles[_P_POINTS];
+static uint32_t clockCost;  // Ticks between two back to back clock reads
+
+static const char *const profileNames[_P_POINTS] = {
+    "mcpCanRead", "mcpCanWrite",   "mcpCanWriteEncoded", "mcpCanLoad",         "mcpCanLoadRaw",
+    "mcpSetMode", "mcpReadBuffer", "mcpWriteBuffer",     "SEEED_CAN::call_irq"};
+
+static struct MCP_ProfileStart {
+  MCP_ProfileStart() { mcpProfileReset(); }
+} profileStart;  // Counting starts before main()
+
+uint32_t mcpProfileHz(void) {
+#if defined(__linux__)
+  return 1000000000;
+#elif defined(DWT) && defined(__CORTEX_M) && (__CORTEX_M >= 3)
+  return SystemCoreClock;
+#else
+  return 1000000;
+#endif
+}
+
+void mcpProfileRecord(const CANProfilePoint point, const uint32_t ticks) {
+  uint32_t t = (ticks > clockCost) ? (ticks - clockCost) : 0;
+  uint32_t bucket = t ? (31 - __builtin_clz(t)) : 0;
+
+  __disable_irq();  // The interrupt handler records into the same points
+  MCP_Profile &p = profiles[point];
+  p.min = (!p.calls || (t < p.min)) ? t : p.min;
+  p.max = (t > p.max) ? t : p.max;
+  p.total += t;
+  p.calls++;
+  p.histogram[bucket]++;
+  __enable_irq();
+}
+
+void mcpProfileRead(const CANProfilePoint point, MCP_Profile *stats) {
+  __disable_irq();
+  *stats = profiles[point];
+  __enable_irq();
+}
+
+void mcpProfileReset(void) {
+#if !defined(__linux__) && defined(DWT) && defined(__CORTEX_M) && (__CORTEX_M >= 3)
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+  uint32_t best = 0xFFFFFFFF;
+  for (uint32_t i = 0; i < 8; i++) {
+    uint32_t start = mcpProfileClock();
+    uint32_t t = mcpProfileClock() - start;
+    best = (t < best) ? t : best;
+  }
+  __disable_irq();
+  memset(profiles, 0, sizeof(profiles));
+  clockCost = best;
+  __enable_irq();
+}
+
+void mcpProfileDump(void) {
+  printf("Profile clock: %u Hz, clock read cost %u ticks removed\r\n", (unsigned)mcpProfileHz(), (unsigned)clockCost);
+  for (uint32_t i = 0; i < _P_POINTS; i++) {
+    MCP_Profile p;
+    mcpProfileRead((CANProfilePoint)i, &p);
+    if (!p.calls) {
+      continue;
+    }
+    printf("%-20s calls %u min %u mean %u max %u\r\n", profileNames[i], (unsigned)p.calls, (unsigned)p.min,
+           (unsigned)(p.total / p.calls), (unsigned)p.max);
+    for (uint32_t b = 0; b < CAN_PROFILE_BUCKETS; b++) {
+      if (p.histogram[b]) {
+        printf("  %10u..%-10u %u\r\n", (unsigned)(b ? (1UL << b) : 0), (unsigned)((2UL << b) - 1),
+               (unsigned)p.histogram[b]);
+      }
+    }
+  }
+}
+
+#endif  // SEEED_CAN_PROFILE
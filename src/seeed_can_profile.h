@@ -0,0 +1,124 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_PROFILE_H_
+#define _SEEED_CAN_PROFILE_H_
+
+#include "seeed_can_defs.h"
+
+// Define SEEED_CAN_PROFILE to time the driver's hot paths (see mcpProfileDump), without it the hooks compile to nothing
+#ifdef SEEED_CAN_PROFILE
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+// Histogram buckets per profiling point: bucket n counts the calls that took 2^n to 2^(n+1) - 1 clock ticks
+#define CAN_PROFILE_BUCKETS 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum MCP_Profile_Points {
+  _P_CAN_READ,           // mcpCanRead
+  _P_CAN_WRITE,          // mcpCanWrite (SEEED_CAN::write of a CANMessage)
+  _P_CAN_WRITE_ENCODED,  // mcpCanWriteEncoded (SEEED_CAN::write of a prepared header)
+  _P_CAN_LOAD,           // mcpCanLoad (SEEED_CAN::load)
+  _P_CAN_LOAD_RAW,       // mcpCanLoadRaw (SEEED_CAN::loadRaw)
+  _P_SET_MODE,           // mcpSetMode
+  _P_READ_BUFFER,        // mcpReadBuffer
+  _P_WRITE_BUFFER,       // mcpWriteBuffer
+  _P_CALL_IRQ,           // SEEED_CAN::call_irq
+  _P_POINTS
+};
+typedef MCP_Profile_Points CANProfilePoint;
+
+/**
+ * Timings of one profiling point, in clock ticks (see mcpProfileHz)
+ */
+struct MCP_Profile {
+  uint32_t calls;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;                           // Sum of all the calls, mean = total / calls
+  uint32_t histogram[CAN_PROFILE_BUCKETS];  // Log2 scale, see CAN_PROFILE_BUCKETS
+};
+
+/**
+ * Read the profiling clock: the DWT cycle counter on Cortex-M3 and above, a steady nanosecond clock on Linux, the
+ * microsecond ticker anywhere else
+ */
+static inline uint32_t mcpProfileClock(void) {
+#if defined(__linux__)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+#elif defined(DWT) && defined(__CORTEX_M) && (__CORTEX_M >= 3)
+  return DWT->CYCCNT;
+#else
+  return us_ticker_read();
+#endif
+}
+
+/**
+ * Returns the frequency of the profiling clock in Hz
+ */
+uint32_t mcpProfileHz(void);
+
+/**
+ * Add one call to a profiling point (the cost of reading the clock is taken off first)
+ */
+void mcpProfileRecord(const CANProfilePoint point, const uint32_t ticks);
+
+/**
+ * Copy the timings of a profiling point
+ */
+void mcpProfileRead(const CANProfilePoint point, MCP_Profile *stats);
+
+/**
+ * Clear every profiling point, start the cycle counter and measure the cost of reading the clock
+ */
+void mcpProfileReset(void);
+
+/**
+ * Print calls, min, mean and max and the non-empty histogram buckets of every profiling point
+ */
+void mcpProfileDump(void);
+
+#ifdef __cplusplus
+};
+
+/**
+ * Times its own lifetime into a profiling point
+ */
+class MCP_ProfileScope {
+ public:
+  MCP_ProfileScope(CANProfilePoint point) : _point(point), _start(mcpProfileClock()) {}
+  ~MCP_ProfileScope() { mcpProfileRecord(_point, mcpProfileClock() - _start); }
+
+ private:
+  CANProfilePoint _point;
+  uint32_t _start;
+};
+#endif
+
+#define MCP_PROFILE(point) MCP_ProfileScope mcpProfileScope(point)
+
+#else
+#define MCP_PROFILE(point)
+#endif  // SEEED_CAN_PROFILE
+
+#endif  // SEEED_CAN_PROFILE_H
@@ -0,0 +1,173 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_QUEUE_H_
+#define _SEEED_CAN_QUEUE_H_
+
+#include "seeed_can_frame.h"
+
+/**
+ * Fixed size ring of SEEED_CANFrames.
+ *
+ * One producer (normally the CAN interrupt) and one consumer may use the queue without locking. N must be a power of
+ * two; a full queue drops the new frame and counts it as an overflow.
+ */
+template <uint32_t N>
+class SEEED_CANQueue {
+ public:
+  SEEED_CANQueue() : _head(0), _tail(0), _overflows(0) {}
+
+  /**
+   * Append a frame.
+   *
+   * @returns true if queued, false if the queue was full
+   */
+  bool push(const SEEED_CANFrame &frame) {
+    uint32_t head = _head;
+    if ((head - _tail) >= N) {
+      _overflows++;
+      return false;
+    }
+    _frames[head & (N - 1)] = frame;
+    __DMB();
+    _head = head + 1;  // Publish only once the frame is complete
+    return true;
+  }
+
+  /**
+   * Remove the oldest frame.
+   *
+   * @returns true if a frame was removed, false if the queue was empty
+   */
+  bool pop(SEEED_CANFrame &frame) {
+    uint32_t tail = _tail;
+    if (tail == _head) {
+      return false;
+    }
+    __DMB();
+    frame = _frames[tail & (N - 1)];
+    __DMB();
+    _tail = tail + 1;  // Hand the slot back only once the frame has been copied out
+    return true;
+  }
+
+  /**
+   * Returns the number of frames waiting.
+   */
+  uint32_t count(void) const { return _head - _tail; }
+
+  /**
+   * Returns true if no frames are waiting.
+   */
+  bool empty(void) const { return _head == _tail; }
+
+  /**
+   * Returns the number of frames dropped because the queue was full.
+   */
+  uint32_t overflows(void) const { return _overflows; }
+
+ protected:
+  SEEED_CANFrame _frames[N];
+  volatile uint32_t _head;
+  volatile uint32_t _tail;
+  volatile uint32_t _overflows;
+
+  static_assert((N != 0) && ((N & (N - 1)) == 0), "SEEED_CANQueue size must be a power of two");
+};
+
+#ifdef SEEED_CAN_RTOS
+/**
+ * Fixed size, lock free, multiple producer / single consumer ring of SEEED_CANFrames.
+ *
+ * Each slot carries a sequence number: producers claim a position with a compare-and-swap and publish the slot by
+ * advancing its sequence number, so threads and interrupt handlers can push concurrently without a mutex. N must be a
+ * power of two.
+ */
+template <uint32_t N>
+class SEEED_CANSubmitQueue {
+ public:
+  SEEED_CANSubmitQueue() : _enqueue(0), _dequeue(0), _overflows(0) {
+    for (uint32_t i = 0; i < N; i++) {
+      _slots[i].seq = i;
+    }
+  }
+
+  /**
+   * Append a frame, safe from any thread or interrupt handler.
+   *
+   * @returns true if queued, false if the queue was full
+   */
+  bool push(const SEEED_CANFrame &frame) {
+    uint32_t pos = _enqueue;
+    Slot *slot;
+    for (;;) {
+      slot = &_slots[pos & (N - 1)];
+      int32_t dif = (int32_t)(slot->seq - pos);
+      if (dif == 0) {
+        if (core_util_atomic_cas_u32((uint32_t *)&_enqueue, &pos, pos + 1)) {
+          break;  // Position claimed
+        }
+      } else if (dif < 0) {
+        core_util_atomic_incr_u32((uint32_t *)&_overflows, 1);
+        return false;  // The consumer has not freed this slot yet
+      } else {
+        pos = _enqueue;
+      }
+    }
+    slot->frame = frame;
+    __DMB();
+    slot->seq = pos + 1;
+    return true;
+  }
+
+  /**
+   * Remove the oldest frame, from the single consumer only.
+   *
+   * @returns true if a frame was removed, false if the queue was empty
+   */
+  bool pop(SEEED_CANFrame &frame) {
+    Slot &slot = _slots[_dequeue & (N - 1)];
+    if (slot.seq != _dequeue + 1) {
+      return false;
+    }
+    __DMB();
+    frame = slot.frame;
+    __DMB();
+    slot.seq = _dequeue + N;
+    _dequeue++;
+    return true;
+  }
+
+  /**
+   * Returns the number of frames dropped because the queue was full.
+   */
+  uint32_t overflows(void) const { return _overflows; }
+
+ protected:
+  struct Slot {
+    SEEED_CANFrame frame;
+    volatile uint32_t seq;
+  };
+
+  Slot _slots[N];
+  volatile uint32_t _enqueue;
+  uint32_t _dequeue;
+  volatile uint32_t _overflows;
+
+  static_assert((N != 0) && ((N & (N - 1)) == 0), "SEEED_CANSubmitQueue size must be a power of two");
+};
+#endif
+
+#endif  // SEEED_CAN_QUEUE_H
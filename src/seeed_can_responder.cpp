@@ -0,0 +1,80 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_responder.h"
+
+#define CAN_FREE_KEY 0xFFFFFFFF
+
+SEEED_CANResponder::SEEED_CANResponder() {
+  memset(_entries, 0, sizeof(_entries));
+  for (int i = 0; i < CAN_RESPONDERS; i++) {
+    _entries[i].key = CAN_FREE_KEY;
+    _entries[i].txBuf = -1;
+  }
+}
+
+SEEED_CANResponder::Entry *SEEED_CANResponder::lookup(uint32_t key) {
+  for (uint32_t i = 0; i < CAN_RESPONDERS; i++) {
+    if (_entries[i].key == key) {
+      return &_entries[i];
+    }
+  }
+  return NULL;
+}
+
+int SEEED_CANResponder::add(uint32_t id, CANFormat format, const char *data, int len) {
+  uint32_t key = (id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0);
+  Entry *e = lookup(key);
+
+  if (!e) {
+    e = lookup(CAN_FREE_KEY);
+    if (!e) {
+      return -1;
+    }
+    mcpEncodeId(&e->hdr, format, id);
+  }
+  update((int)(e - _entries), data, len);
+  __disable_irq();  // The receive interrupt probes the same table
+  e->key = key;
+  __enable_irq();
+  return (int)(e - _entries);
+}
+
+int SEEED_CANResponder::update(int handle, const char *data, int len) {
+  if ((handle < 0) || (handle >= CAN_RESPONDERS)) {
+    return 0;
+  }
+  Entry &e = _entries[handle];
+  len = (len < 0) ? 0 : ((len > 8) ? 8 : len);
+  __disable_irq();  // The receive path must never send half an update
+  memcpy(e.data, data, len);
+  e.len = (uint8_t)len;
+  e.dirty = true;
+  __enable_irq();
+  return 1;
+}
+
+int SEEED_CANResponder::find(uint32_t id, CANFormat format) {
+  Entry *e = lookup((id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0));
+  return e ? (int)(e - _entries) : -1;
+}
+
+uint32_t SEEED_CANResponder::served(int handle) {
+  return ((handle < 0) || (handle >= CAN_RESPONDERS)) ? 0 : _entries[handle].served;
+}
+
+uint32_t SEEED_CANResponder::missed(int handle) {
+  return ((handle < 0) || (handle >= CAN_RESPONDERS)) ? 0 : _entries[handle].missed;
+}
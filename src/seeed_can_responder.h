@@ -0,0 +1,93 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_RESPONDER_H_
+#define _SEEED_CAN_RESPONDER_H_
+
+#include "seeed_can.h"
+
+// Number of CAN Ids answered by one SEEED_CANResponder
+#ifndef CAN_RESPONDERS
+#define CAN_RESPONDERS 8
+#endif
+
+/**
+ * Table of automatic answers to remote frames.
+ *
+ * Each entry holds a CAN Id, with its header encoded once by add(), and the data frame sent back whenever a remote
+ * frame with that CAN Id is received. The application keeps the payloads current with update(). Attached to a
+ * SEEED_CAN with SEEED_CAN::responder(), remote frames are answered by the receive path itself (the receive interrupt
+ * in priority and adaptive receive mode) instead of after a round trip through the application, and one entry can be
+ * given a reserved transmit buffer so that answering it usually takes only a status read and an RTS instruction.
+ */
+class SEEED_CANResponder {
+ public:
+  SEEED_CANResponder();
+
+  /**
+   * Register a CAN Id and its initial answer.
+   *
+   * @param id The 11 or 29 bit CAN Id.
+   * @param format CANStandard or CANExtended.
+   * @param data The data bytes of the answer.
+   * @param len Number of data bytes.
+   *
+   * @returns the entry handle (0 or more, the same one if the CAN Id is already registered), -1 if all entries are in
+   * use
+   */
+  int add(uint32_t id, CANFormat format, const char *data, int len);
+
+  /**
+   * Replace the answer of an entry, from any thread (not from an interrupt handler that can preempt the receive path).
+   *
+   * @returns 1 if successful, 0 if the handle is invalid
+   */
+  int update(int handle, const char *data, int len);
+
+  /**
+   * Returns the entry handle of a registered CAN Id, -1 if it is not registered.
+   */
+  int find(uint32_t id, CANFormat format = CANStandard);
+
+  /**
+   * Returns the number of remote frames an entry has answered.
+   */
+  uint32_t served(int handle);
+
+  /**
+   * Returns the number of remote frames an entry could not answer because no transmit buffer was free.
+   */
+  uint32_t missed(int handle);
+
+ protected:
+  friend class SEEED_CAN;
+
+  struct Entry {
+    uint32_t key;  // CAN Id | CAN_FRAME_IDE, 0xFFFFFFFF when free
+    SEEED_CANHeader hdr;
+    uint8_t data[8];
+    uint8_t len;
+    volatile bool dirty;  // Data changed since it was loaded into the reserved transmit buffer
+    int8_t txBuf;         // Reserved transmit buffer, -1 for none
+    uint32_t served;
+    uint32_t missed;
+  };
+
+  Entry *lookup(uint32_t key);
+
+  Entry _entries[CAN_RESPONDERS];
+};
+
+#endif  // SEEED_CAN_RESPONDER_H
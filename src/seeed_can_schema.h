@@ -0,0 +1,286 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_SCHEMA_H_
+#define _SEEED_CAN_SCHEMA_H_
+
+#include "seeed_can_signals.h"
+
+/*
+ * Compile-time message schemas.
+ *
+ * A schema names a message's CAN Id, format and DLC and lists its signals as SEEED_CANSignal types. Everything about
+ * the layout is a constant expression, so packing is a handful of shifts, masks and ORs on one 64-bit data word and
+ * overlapping or out of range signals are compile errors:
+ *
+ *   typedef SEEED_CANSignal<0, 16> Rpm;                                       // Intel, unsigned, bits 0..15
+ *   typedef SEEED_CANSignal<23, 12, SEEED_CANSignals::Motorola, true> Torque;  // Motorola, signed, MSB at bit 23
+ *   typedef SEEED_CANSchema<0x123, CANStandard, 4, Rpm, Torque> EngineStatus;
+ *
+ *   uint8_t regs[CAN_FRAME_REGS];
+ *   EngineStatus::encode(regs, EngineStatus::pack(rpm, torque));
+ *   can.loadRaw(regs);
+ *   ...
+ *   int32_t t = EngineStatus::unpack<1>(EngineStatus::word(msg.data));
+ *
+ * The data word holds data byte n in bits 8n + 7 .. 8n, the order of the DBC's Intel bit numbering.
+ */
+
+struct SEEED_CANSchemaBits {
+  /**
+   * Reverse the byte order of a 64-bit word (a constant expression, compilers emit a single byte swap instruction).
+   */
+  static constexpr uint64_t bswap(uint64_t x) {
+    return ((x & 0x00000000000000FFULL) << 56) | ((x & 0x000000000000FF00ULL) << 40) |
+           ((x & 0x0000000000FF0000ULL) << 24) | ((x & 0x00000000FF000000ULL) << 8) |
+           ((x & 0x000000FF00000000ULL) >> 8) | ((x & 0x0000FF0000000000ULL) >> 24) |
+           ((x & 0x00FF000000000000ULL) >> 40) | ((x & 0xFF00000000000000ULL) >> 56);
+  }
+
+  static constexpr uint64_t any(void) { return 0; }
+
+  template <class... Words>
+  static constexpr uint64_t any(uint64_t word, Words... rest) {
+    return word | any(rest...);
+  }
+};
+
+/**
+ * Raw value type of a signal: the narrowest of int32_t, uint32_t, int64_t and uint64_t that holds it.
+ */
+template <bool Signed, bool Wide>
+struct SEEED_CANRaw;
+
+template <>
+struct SEEED_CANRaw<false, false> {
+  typedef uint32_t type;
+};
+
+template <>
+struct SEEED_CANRaw<true, false> {
+  typedef int32_t type;
+};
+
+template <>
+struct SEEED_CANRaw<false, true> {
+  typedef uint64_t type;
+};
+
+template <>
+struct SEEED_CANRaw<true, true> {
+  typedef int64_t type;
+};
+
+/**
+ * One signal's layout, with the same start bit convention as SEEED_CANSignals::add().
+ *
+ * @param StartBit DBC start bit (0 to 63).
+ * @param Length Length in bits (1 to 64).
+ * @param Order @p SEEED_CANSignals::Intel (default) or @p SEEED_CANSignals::Motorola.
+ * @param Signed true for two's complement signals, @b default: @p false.
+ */
+template <uint8_t StartBit, uint8_t Length, SEEED_CANSignals::ByteOrder Order = SEEED_CANSignals::Intel,
+          bool Signed = false>
+struct SEEED_CANSignal {
+  static_assert((StartBit < 64) && (Length >= 1) && (Length <= 64), "signal start bit or length out of range");
+
+  typedef typename SEEED_CANRaw<Signed, (Length > 32)>::type Raw;
+
+  static constexpr bool motorola = (Order == SEEED_CANSignals::Motorola);
+  // Least significant bit in the data word (byte swapped for Motorola signals)
+  static constexpr int lsb = motorola ? (7 - StartBit / 8) * 8 + StartBit % 8 - (Length - 1) : StartBit;
+  static_assert((lsb >= 0) && (lsb + Length <= 64), "signal runs off the end of the 8 data bytes");
+
+  static constexpr uint64_t mask = (Length == 64) ? ~0ULL : ((1ULL << Length) - 1);
+  // Data word bits occupied by the signal
+  static constexpr uint64_t bits = motorola ? SEEED_CANSchemaBits::bswap(mask << lsb) : (mask << lsb);
+  // Data bytes needed to carry the signal
+  static constexpr uint8_t minLen = motorola ? (8 - lsb / 8) : ((lsb + Length + 7) / 8);
+
+  /**
+   * Returns the data word with only this signal's bits set to raw.
+   */
+  static constexpr uint64_t insert(Raw raw) {
+    return motorola ? SEEED_CANSchemaBits::bswap(((uint64_t)raw & mask) << lsb) : (((uint64_t)raw & mask) << lsb);
+  }
+
+  /**
+   * Returns the signal's raw value from a data word, sign extended for signed signals.
+   */
+  static constexpr Raw extract(uint64_t word) {
+    return Signed ? (Raw)((int64_t)(field(word) << (64 - Length)) >> (64 - Length)) : (Raw)field(word);
+  }
+
+ private:
+  static constexpr uint64_t field(uint64_t word) {
+    return ((motorola ? SEEED_CANSchemaBits::bswap(word) : word) >> lsb) & mask;
+  }
+};
+
+/**
+ * Merged layout of a schema's signals, for the compile-time checks.
+ */
+template <class... Signals>
+struct SEEED_CANSchemaLayout;
+
+template <>
+struct SEEED_CANSchemaLayout<> {
+  static constexpr uint64_t bits = 0;
+  static constexpr bool disjoint = true;
+  static constexpr uint8_t minLen = 0;
+};
+
+template <class Signal, class... Rest>
+struct SEEED_CANSchemaLayout<Signal, Rest...> {
+  typedef SEEED_CANSchemaLayout<Rest...> Next;
+  static constexpr uint64_t bits = Signal::bits | Next::bits;
+  static constexpr bool disjoint = Next::disjoint && !(Signal::bits & Next::bits);
+  static constexpr uint8_t minLen = (Signal::minLen > Next::minLen) ? Signal::minLen : Next::minLen;
+};
+
+/**
+ * The N-th type of a list.
+ */
+template <unsigned N, class Signal, class... Rest>
+struct SEEED_CANSchemaAt {
+  typedef typename SEEED_CANSchemaAt<N - 1, Rest...>::type type;
+};
+
+template <class Signal, class... Rest>
+struct SEEED_CANSchemaAt<0, Signal, Rest...> {
+  typedef Signal type;
+};
+
+/**
+ * A message's compile-time schema.
+ *
+ * @param Id The 11 or 29 bit CAN Id.
+ * @param Format CANStandard or CANExtended.
+ * @param Dlc Data Length Counter (0 to 8).
+ * @param Signals The message's SEEED_CANSignal types, in the order pack() takes their raw values.
+ */
+template <uint32_t Id, CANFormat Format, uint8_t Dlc, class... Signals>
+struct SEEED_CANSchema {
+  static_assert(Id <= ((Format == CANExtended) ? 0x1FFFFFFFUL : 0x7FFUL), "CAN Id out of range for its format");
+  static_assert(Dlc <= 8, "DLC out of range");
+  static_assert(SEEED_CANSchemaLayout<Signals...>::disjoint, "signals overlap");
+  static_assert(SEEED_CANSchemaLayout<Signals...>::minLen <= Dlc, "a signal lies beyond the DLC");
+
+  template <unsigned N>
+  using Signal = typename SEEED_CANSchemaAt<N, Signals...>::type;
+
+  static constexpr uint32_t id = Id;
+  static constexpr CANFormat format = Format;
+  static constexpr uint8_t dlc = Dlc;
+  // CAN Id | CAN_FRAME_IDE, as in SEEED_CANFrame::ident
+  static constexpr uint32_t key = Id | ((Format == CANExtended) ? CAN_FRAME_IDE : 0);
+
+  /**
+   * Returns the data word carrying the signals' raw values.
+   */
+  static constexpr uint64_t pack(typename Signals::Raw... raws) {
+    return SEEED_CANSchemaBits::any(Signals::insert(raws)...);
+  }
+
+  /**
+   * Returns the raw value of the N-th signal.
+   */
+  template <unsigned N>
+  static constexpr typename Signal<N>::Raw unpack(uint64_t word) {
+    return Signal<N>::extract(word);
+  }
+
+  /**
+   * Returns the TXBn register (SIDH, SIDL, EID8, EID0 or DLC, 0 to 4) for this CAN Id, format and DLC.
+   */
+  static constexpr uint8_t header(int reg) {
+    return (reg == 0)   ? (uint8_t)((Format == CANExtended) ? (Id >> 21) : (Id >> 3))
+           : (reg == 1) ? (uint8_t)((Format == CANExtended)
+                                        ? (((Id >> 13) & 0xE0) | MCP_TXB_EXIDE_M | ((Id >> 16) & 0x03))
+                                        : (Id << 5))
+           : (reg == 2) ? (uint8_t)((Format == CANExtended) ? (Id >> 8) : 0)
+           : (reg == 3) ? (uint8_t)((Format == CANExtended) ? Id : 0)
+                        : Dlc;
+  }
+
+  /**
+   * Fill a TXBn register image for SEEED_CAN::loadRaw().
+   */
+  static void encode(uint8_t regs[CAN_FRAME_REGS], uint64_t word) {
+    for (int i = 0; i < 5; i++) {
+      regs[i] = header(i);
+    }
+    store(&regs[5], word);
+  }
+
+  /**
+   * Returns the message for SEEED_CAN::write().
+   */
+  static SEEED_CANMessage message(uint64_t word) {
+    SEEED_CANMessage msg;
+    msg.id = Id;
+    msg.format = Format;
+    msg.len = Dlc;
+    store(msg.data, word);
+    return msg;
+  }
+
+  /**
+   * Returns the message as a SEEED_CANFrame.
+   */
+  static SEEED_CANFrame frame(uint64_t word) {
+    SEEED_CANFrame frame;
+    frame.ident = key;
+    frame.dlc = Dlc;
+    frame.filhit = 0;
+    frame.stamp = 0;
+    store(frame.data, word);
+    return frame;
+  }
+
+  /**
+   * Returns the data word of received data bytes.
+   */
+  static uint64_t word(const uint8_t data[8]) {
+    uint64_t w = 0;
+    for (int i = 0; i < 8; i++) {
+      w |= (uint64_t)data[i] << (8 * i);
+    }
+    return w;
+  }
+
+  /**
+   * Returns true if a received message has this schema's CAN Id and format and carries all of its signals.
+   */
+  static bool matches(const CAN_Message &msg) {
+    return (msg.id == Id) && (msg.format == Format) && (msg.type == CANData) && (msg.len >= Dlc);
+  }
+
+  /**
+   * Returns true if a SEEED_CANFrame has this schema's CAN Id and format and carries all of its signals.
+   */
+  static bool matches(const SEEED_CANFrame &frame) {
+    return ((frame.ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE | CAN_FRAME_RTR)) == key) && (frame.dlc >= Dlc);
+  }
+
+ private:
+  static void store(uint8_t data[8], uint64_t word) {  // Byte by byte, compilers merge this into one 64-bit store
+    for (int i = 0; i < 8; i++) {
+      data[i] = (uint8_t)(word >> (8 * i));
+    }
+  }
+};
+
+#endif  // SEEED_CAN_SCHEMA_H
@@ -0,0 +1,190 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_signals.h"
+#include <math.h>
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error "SEEED_CANSignals reads the data bytes as a little endian 64-bit word"
+#endif
+
+SEEED_CANSignals::SEEED_CANSignals() : _numSignals(0), _numIds(0) {}
+
+int SEEED_CANSignals::add(uint32_t id, CANFormat format, uint8_t startBit, uint8_t length, ByteOrder order,
+                          bool isSigned, float scale, float offset) {
+  int32_t lsb;
+
+  if ((_numSignals >= CAN_SIGNALS_MAX) || (startBit > 63) || (length < 1) || (length > 64)) {
+    return -1;
+  }
+  if (order == Motorola) {
+    // The start bit is the MSB; in the byte swapped word data byte k holds bits (7 - k) * 8 to (7 - k) * 8 + 7
+    lsb = (7 - (startBit / 8)) * 8 + (startBit % 8) - (length - 1);
+  } else {
+    lsb = ((uint32_t)startBit + length <= 64) ? startBit : -1;
+  }
+  if (lsb < 0) {
+    return -1;  // Runs off the end of the data bytes
+  }
+  Plan &p = _plans[_numSignals];
+  p.key = (id & CAN_FRAME_ID_MASK) | ((format == CANExtended) ? CAN_FRAME_IDE : 0);
+  p.mask = (length == 64) ? ~0ULL : ((1ULL << length) - 1);
+  p.shift = (uint8_t)lsb;
+  p.narrow = (length < 32) || ((length == 32) && isSigned);
+  p.isSigned = isSigned;
+  p.sext = isSigned ? (uint8_t)((p.narrow ? 32 : 64) - length) : 0;
+  p.minLen = (uint8_t)((order == Motorola) ? (8 - lsb / 8) : ((lsb + length + 7) / 8));
+  p.motorola = (order == Motorola);
+  p.scale = scale;
+  p.offset = offset;
+  _numIds = 0;  // Needs compile() again
+  return (int)_numSignals++;
+}
+
+int SEEED_CANSignals::compile(void) {
+  for (uint32_t i = 0; i < _numSignals; i++) {  // Insertion sort by CAN Id, keeps the order signals were added in
+    uint16_t h = (uint16_t)i;
+    uint32_t j = i;
+    while ((j > 0) && (_plans[_order[j - 1]].key > _plans[h].key)) {
+      _order[j] = _order[j - 1];
+      j--;
+    }
+    _order[j] = h;
+  }
+  _numIds = 0;
+  for (uint32_t i = 0; i < _numSignals; i++) {
+    uint32_t key = _plans[_order[i]].key;
+    if (_numIds && (_ids[_numIds - 1].key == key)) {
+      _ids[_numIds - 1].count++;
+    } else {
+      _ids[_numIds].key = key;
+      _ids[_numIds].first = (uint16_t)i;
+      _ids[_numIds].count = 1;
+      _numIds++;
+    }
+  }
+  return (int)_numIds;
+}
+
+const SEEED_CANSignals::IdEntry *SEEED_CANSignals::lookup(uint32_t key) {
+  uint32_t lo = 0;
+  uint32_t hi = _numIds;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (_ids[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return ((lo < _numIds) && (_ids[lo].key == key)) ? &_ids[lo] : NULL;
+}
+
+float SEEED_CANSignals::extract(const Plan &p, uint64_t word) {
+  uint64_t raw = (word >> p.shift) & p.mask;
+  if (p.narrow) {
+    return (float)((int32_t)((uint32_t)raw << p.sext) >> p.sext) * p.scale + p.offset;
+  }
+  // A 64-bit unsigned raw value does not fit an int64_t, smaller ones convert the same either way
+  return (p.isSigned ? (float)((int64_t)(raw << p.sext) >> p.sext) : (float)raw) * p.scale + p.offset;
+}
+
+int SEEED_CANSignals::decodeData(uint32_t key, uint8_t len, const uint8_t data[8], float values[]) {
+  const IdEntry *e = lookup(key);
+  uint64_t intel;
+  int n = 0;
+
+  if (!e) {
+    return 0;
+  }
+  memcpy(&intel, data, 8);
+  uint64_t motorola = __builtin_bswap64(intel);
+  for (uint32_t i = e->first; i < (uint32_t)(e->first + e->count); i++) {
+    const Plan &p = _plans[_order[i]];
+    if (len >= p.minLen) {
+      values[_order[i]] = extract(p, p.motorola ? motorola : intel);
+      n++;
+    }
+  }
+  return n;
+}
+
+int SEEED_CANSignals::decode(const CAN_Message &msg, float values[]) {
+  uint32_t key = (msg.id & CAN_FRAME_ID_MASK) | ((msg.format == CANExtended) ? CAN_FRAME_IDE : 0);
+  return decodeData(key, msg.len & 0x0F, msg.data, values);
+}
+
+int SEEED_CANSignals::decode(const SEEED_CANFrame &frame, float values[]) {
+  return decodeData(frame.ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE), frame.dlc, frame.data, values);
+}
+
+float SEEED_CANSignals::value(int signal, const uint8_t data[8]) {
+  uint64_t word;
+  if ((signal < 0) || ((uint32_t)signal >= _numSignals)) {
+    return NAN;
+  }
+  memcpy(&word, data, 8);
+  return extract(_plans[signal], _plans[signal].motorola ? __builtin_bswap64(word) : word);
+}
+
+/**
+ * Batch decode of one signal, specialised for byte order and width so that the loop body is straight line code.
+ */
+template <bool Motorola, bool Narrow>
+static uint32_t decodeBatch(uint32_t key, uint32_t minLen, uint64_t mask, uint32_t shift, uint32_t sext, bool isSigned,
+                            float scale, float offset, const SEEED_CANFrame *__restrict frames, uint32_t n,
+                            float *__restrict values) {
+  const float quiet = NAN;
+  uint32_t nan;
+  uint32_t hits = 0;
+
+  memcpy(&nan, &quiet, 4);
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t word;
+    memcpy(&word, frames[i].data, 8);
+    word = Motorola ? __builtin_bswap64(word) : word;
+    uint64_t raw = (word >> shift) & mask;
+    float v;
+    if (Narrow) {
+      v = (float)((int32_t)((uint32_t)raw << sext) >> sext) * scale + offset;
+    } else {
+      v = (isSigned ? (float)((int64_t)(raw << sext) >> sext) : (float)raw) * scale + offset;
+    }
+    uint32_t hit = ((frames[i].ident & (CAN_FRAME_ID_MASK | CAN_FRAME_IDE)) == key) & (frames[i].dlc >= minLen);
+    uint32_t bits;
+    memcpy(&bits, &v, 4);
+    bits = (bits & (0 - hit)) | (nan & (hit - 1));  // Select without a branch, a float ?: is not if-converted
+    memcpy(&values[i], &bits, 4);
+    hits += hit;
+  }
+  return hits;
+}
+
+uint32_t SEEED_CANSignals::decode(int signal, const SEEED_CANFrame frames[], uint32_t n, float values[]) {
+  if ((signal < 0) || ((uint32_t)signal >= _numSignals)) {
+    return 0;
+  }
+  const Plan &p = _plans[signal];
+  if (p.motorola) {
+    return p.narrow ? decodeBatch<true, true>(p.key, p.minLen, p.mask, p.shift, p.sext, p.isSigned, p.scale, p.offset,
+                                              frames, n, values)
+                    : decodeBatch<true, false>(p.key, p.minLen, p.mask, p.shift, p.sext, p.isSigned, p.scale, p.offset,
+                                               frames, n, values);
+  }
+  return p.narrow ? decodeBatch<false, true>(p.key, p.minLen, p.mask, p.shift, p.sext, p.isSigned, p.scale, p.offset,
+                                             frames, n, values)
+                  : decodeBatch<false, false>(p.key, p.minLen, p.mask, p.shift, p.sext, p.isSigned, p.scale, p.offset,
+                                              frames, n, values);
+}
@@ -0,0 +1,134 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_SIGNALS_H_
+#define _SEEED_CAN_SIGNALS_H_
+
+#include "seeed_can.h"
+
+// Maximum number of signals in one SEEED_CANSignals database
+#ifndef CAN_SIGNALS_MAX
+#define CAN_SIGNALS_MAX 64
+#endif
+
+/**
+ * DBC style signal database and decoder.
+ *
+ * Each signal (CAN Id, byte order, start bit, length, signedness, scale and offset) is turned into an extraction plan
+ * when it is added: the 8 data bytes are read as one 64-bit word (byte swapped for Motorola signals) and the raw value
+ * is a single shift and mask away. compile() then groups the plans by CAN Id so that decoding a received frame costs
+ * one binary search plus one extraction per signal of that frame.
+ *
+ * Start bits follow the DBC convention: the least significant bit of an Intel signal, the most significant bit of a
+ * Motorola signal, bit n being bit (n % 8) of data byte (n / 8).
+ */
+class SEEED_CANSignals {
+ public:
+  enum ByteOrder { Intel = 0, Motorola };
+
+  SEEED_CANSignals();
+
+  /**
+   * Add a signal.
+   *
+   * @param id CAN Id of the frames carrying the signal.
+   * @param format CANStandard or CANExtended.
+   * @param startBit DBC start bit (0 to 63).
+   * @param length Length in bits (1 to 64).
+   * @param order @p SEEED_CANSignals::Intel (little endian) or @p SEEED_CANSignals::Motorola (big endian).
+   * @param isSigned true for two's complement signals.
+   * @param scale Physical value = raw * scale + offset, @b default: @p 1.
+   * @param offset @b default: @p 0.
+   *
+   * @returns the signal's handle (0 or more), -1 if the signal does not fit in 8 bytes or the database is full
+   */
+  int add(uint32_t id, CANFormat format, uint8_t startBit, uint8_t length, ByteOrder order, bool isSigned,
+          float scale = 1.0f, float offset = 0.0f);
+
+  /**
+   * Group the signals by CAN Id. Must be called after the last add() and before decoding.
+   *
+   * @returns the number of distinct CAN Ids
+   */
+  int compile(void);
+
+  /**
+   * Decode every signal carried by a frame.
+   *
+   * @param msg The received frame.
+   * @param values Indexed by signal handle, only the entries of this frame's signals are written.
+   *
+   * @returns the number of signals decoded (signals beyond the frame's length are skipped)
+   */
+  int decode(const CAN_Message &msg, float values[]);
+
+  /**
+   * Decode every signal carried by a SEEED_CANFrame, see decode(const CAN_Message &, float[]).
+   */
+  int decode(const SEEED_CANFrame &frame, float values[]);
+
+  /**
+   * Decode one signal from a frame's data bytes, without checking the CAN Id or length.
+   */
+  float value(int signal, const uint8_t data[8]);
+
+  /**
+   * Decode one signal from a batch of frames, e.g. a captured trace.
+   *
+   * The loop has no data dependent branches. For signals of up to 32 bits compilers vectorise it on hosts with SIMD
+   * units (GCC -O3 does for x86-64, with SSE2 as well as AVX2); wider signals need a 64-bit integer to float
+   * conversion, which SSE2 and AVX2 do not have, so their loop stays scalar.
+   *
+   * @param signal The signal's handle.
+   * @param frames The frames.
+   * @param n Number of frames.
+   * @param values n values: the signal's value, or NAN where the frame has another CAN Id or is too short.
+   *
+   * @returns the number of frames that carried the signal
+   */
+  uint32_t decode(int signal, const SEEED_CANFrame frames[], uint32_t n, float values[]);
+
+ protected:
+  struct Plan {
+    uint64_t mask;  // Raw value mask, applied after the shift
+    uint32_t key;   // CAN Id | CAN_FRAME_IDE
+    float scale;
+    float offset;
+    uint8_t shift;   // Position of the least significant bit in the (byte swapped for Motorola) data word
+    uint8_t sext;    // Sign extension shift, 0 for unsigned signals
+    uint8_t minLen;  // Data bytes needed
+    bool motorola;   // Byte swap the data word first
+    bool narrow;     // The raw value fits a 32-bit integer
+    bool isSigned;
+  };
+
+  struct IdEntry {
+    uint32_t key;
+    uint16_t first;  // First entry in _order
+    uint16_t count;
+  };
+
+  const IdEntry *lookup(uint32_t key);
+  int decodeData(uint32_t key, uint8_t len, const uint8_t data[8], float values[]);
+  static float extract(const Plan &p, uint64_t word);
+
+  Plan _plans[CAN_SIGNALS_MAX];
+  uint16_t _order[CAN_SIGNALS_MAX];  // Signal handles sorted by CAN Id
+  IdEntry _ids[CAN_SIGNALS_MAX];
+  uint32_t _numSignals;
+  uint32_t _numIds;
+};
+
+#endif  // SEEED_CAN_SIGNALS_H
@@ -0,0 +1,680 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seeed_can_sim.h"
+#include "seeed_can_analyser.h"
+
+#ifdef SEEED_CAN_SIM  // Host builds only, nothing here is needed on the target
+
+// CANSTAT and CANCTRL appear at the end of every row of the register map
+#define SIM_ALIAS(a) ((((a)&0x0E) == 0x0E) ? ((a)&0x0F) : ((a)&0x7F))
+
+#define SIM_RXB_RXRTR 0x08  // RXBnCTRL: a remote frame was received
+#define SIM_RXB_BUKT1 0x02  // RXB0CTRL: read only copy of BUKT
+
+static SEEED_CANSimNode *simNodes = NULL;  // Every node, by chip select pin
+
+SEEED_CANSimNode *mcpSimNode(PinName ncs) { return SEEED_CANSimNode::at(ncs); }
+
+SEEED_CANSimNode::SEEED_CANSimNode(SEEED_CANSimBus &bus, PinName ncs)
+    : _bus(bus), _ncs(ncs), _next(simNodes), _txErrorPpm(0), _forcedOverflows(0) {
+  simNodes = this;
+  memset(&_stats, 0, sizeof(_stats));
+  reset();
+  _bus.attach(this);
+}
+
+SEEED_CANSimNode::~SEEED_CANSimNode() {
+  for (SEEED_CANSimNode **n = &simNodes; *n; n = &(*n)->_next) {
+    if (*n == this) {
+      *n = _next;
+      break;
+    }
+  }
+  _bus.detach(this);
+}
+
+SEEED_CANSimNode *SEEED_CANSimNode::at(PinName ncs) {
+  for (SEEED_CANSimNode *n = simNodes; n; n = n->_next) {
+    if (n->_ncs == ncs) {
+      return n;
+    }
+  }
+  return NULL;
+}
+
+void SEEED_CANSimNode::reset(void) {
+  memset(_regs, 0, sizeof(_regs));
+  _regs[MCP_CANSTAT] = MODE_CONFIG;
+  _regs[MCP_CANCTRL] = MCP_CANCTRL_RESET;
+  _hz = 0;
+  _tec = 0;
+  _rec = 0;
+  _recovery = 0;
+  _state = Active;
+  _cmd = 0;
+  _addr = 0;
+  _mask = 0;
+  _byte = 0;
+}
+
+void SEEED_CANSimNode::select(void) {
+  _cmd = 0;
+  _byte = 0;
+}
+
+uint8_t SEEED_CANSimNode::transfer(uint8_t mosi) {
+  uint32_t n = _byte++;
+  uint8_t a;
+
+  _stats.spiBytes++;
+
+  if (n == 0) {
+    _cmd = mosi;
+    if (mosi == MCP_RESET) {
+      reset();
+    } else if ((mosi & 0xF8) == 0x80) {  // RTS
+      for (uint8_t b = 0; b < 3; b++) {
+        if (mosi & (1 << b)) {
+          writeReg(MCP_TXB0CTRL + 0x10 * b, MCP_TXB_TXREQ_M, MCP_TXB_TXREQ_M);
+        }
+      }
+    } else if ((mosi & 0xF9) == 0x90) {  // READ RX BUFFER, from RXBnSIDH or RXBnD0
+      _addr = MCP_RXB0SIDH + ((mosi & 0x04) ? 0x10 : 0) + ((mosi & 0x02) ? 5 : 0);
+    } else if (((mosi & 0xF8) == 0x40) && ((mosi & 0x07) <= 5)) {  // LOAD TX BUFFER, from TXBnSIDH or TXBnD0
+      _addr = MCP_TXB0CTRL + 1 + 0x10 * ((mosi >> 1) & 0x03) + ((mosi & 0x01) ? 5 : 0);
+    }
+    return 0;
+  }
+  switch (_cmd) {
+    case MCP_READ:
+      if (n == 1) {
+        _addr = mosi;
+        return 0;
+      }
+      a = SIM_ALIAS(_addr);
+      _addr++;
+      return (a == MCP_CANSTAT) ? ((_regs[MCP_CANSTAT] & MODE_MASK) | (icod() << 1)) : _regs[a];
+    case MCP_WRITE:
+      if (n == 1) {
+        _addr = mosi;
+      } else {
+        writeReg(_addr++, 0xFF, mosi);
+      }
+      return 0;
+    case MCP_BITMOD:
+      if (n == 1) {
+        _addr = mosi;
+      } else if (n == 2) {
+        _mask = mosi;
+      } else if (n == 3) {
+        writeReg(_addr, _mask, mosi);
+      }
+      return 0;
+    case MCP_READ_STATUS:
+      return readStatus();
+    case MCP_RX_STATUS:
+      return rxStatus();
+    default:
+      break;
+  }
+  if ((_cmd & 0xF9) == 0x90) {
+    return _regs[_addr++ & 0x7F];
+  }
+  if (((_cmd & 0xF8) == 0x40) && ((_cmd & 0x07) <= 5)) {
+    _regs[_addr++ & 0x7F] = mosi;
+  }
+  return 0;
+}
+
+void SEEED_CANSimNode::deselect(void) {
+  if ((_cmd & 0xF9) == 0x90) {
+    _regs[MCP_CANINTF] &= (_cmd & 0x04) ? ~MCP_RX1IF : ~MCP_RX0IF;  // Reading a receive buffer frees it
+  }
+  _cmd = 0;
+}
+
+void SEEED_CANSimNode::writeReg(uint8_t address, uint8_t mask, uint8_t value) {
+  uint8_t a = SIM_ALIAS(address);
+  uint8_t writable = 0xFF;
+  bool configOnly = (a <= MCP_CNF1) && (((a & 0x0F) < 0x0C) || (a >= MCP_RXM0SIDH));  // Filters, Masks and CNF
+
+  if (configOnly && ((_regs[MCP_CANSTAT] & MODE_MASK) != MODE_CONFIG)) {
+    return;
+  }
+  if ((a == MCP_CANSTAT) || (a == MCP_TEC) || (a == MCP_REC) || ((a > MCP_RXB0CTRL) && (a <= MCP_RXB0CTRL + 13)) ||
+      ((a > MCP_RXB1CTRL) && (a <= MCP_RXB1CTRL + 13))) {
+    return;  // Read only
+  }
+  if (a == MCP_EFLG) {
+    writable = MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR;
+  } else if (a == MCP_RXB0CTRL) {
+    writable = MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK;
+  } else if (a == MCP_RXB1CTRL) {
+    writable = MCP_RXB_RX_MASK;
+  } else if ((a == MCP_TXB0CTRL) || (a == MCP_TXB1CTRL) || (a == MCP_TXB2CTRL)) {
+    writable = MCP_TXB_TXREQ_M | MCP_TXB_TXP10_M;
+  }
+  uint8_t old = _regs[a];
+  _regs[a] = (old & ~(mask & writable)) | (value & mask & writable);
+
+  if ((a == MCP_TXB0CTRL) || (a == MCP_TXB1CTRL) || (a == MCP_TXB2CTRL)) {
+    if (!(old & MCP_TXB_TXREQ_M) && (_regs[a] & MCP_TXB_TXREQ_M)) {
+      _regs[a] &= ~(MCP_TXB_ABTF_M | MCP_TXB_MLOA_M | MCP_TXB_TXERR_M);  // A new request clears the last outcome
+      loopback();
+    } else if ((old & MCP_TXB_TXREQ_M) && !(_regs[a] & MCP_TXB_TXREQ_M)) {
+      _regs[a] |= MCP_TXB_ABTF_M;
+    }
+  } else if (a == MCP_CANCTRL) {
+    if (_regs[a] & ABORT_TX) {
+      for (uint8_t b = 0; b < 3; b++) {
+        uint8_t &ctrl = _regs[MCP_TXB0CTRL + 0x10 * b];
+        ctrl = (ctrl & MCP_TXB_TXREQ_M) ? ((ctrl & ~MCP_TXB_TXREQ_M) | MCP_TXB_ABTF_M) : ctrl;
+      }
+    }
+    if ((_regs[a] & MODE_MASK) != (_regs[MCP_CANSTAT] & MODE_MASK)) {
+      modeChanged();
+    }
+  }
+}
+
+void SEEED_CANSimNode::modeChanged(void) {
+  uint8_t mode = _regs[MCP_CANCTRL] & MODE_MASK;
+
+  if (mode == MODE_POWERUP) {
+    return;  // Not a mode that can be requested
+  }
+  if ((_regs[MCP_CANSTAT] & MODE_MASK) == MODE_CONFIG) {
+    _hz = mcpTimingRate(&_regs[MCP_CNF3]);
+  }
+  _regs[MCP_CANSTAT] = (_regs[MCP_CANSTAT] & ~MODE_MASK) | mode;
+  loopback();  // Requests made in another mode go out as soon as the bus is not needed
+}
+
+uint8_t SEEED_CANSimNode::icod(void) const {
+  static const uint8_t order[7] = {MCP_ERRIF, MCP_WAKIF, MCP_TX0IF, MCP_TX1IF, MCP_TX2IF, MCP_RX0IF, MCP_RX1IF};
+  uint8_t pending = _regs[MCP_CANINTF] & _regs[MCP_CANINTE];
+
+  for (uint8_t i = 0; i < 7; i++) {
+    if (pending & order[i]) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+uint8_t SEEED_CANSimNode::readStatus(void) const {
+  uint8_t intf = _regs[MCP_CANINTF];
+  uint8_t status = intf & MCP_STAT_RXIF_MASK;
+
+  for (uint8_t b = 0; b < 3; b++) {
+    status |= (_regs[MCP_TXB0CTRL + 0x10 * b] & MCP_TXB_TXREQ_M) ? (MCP_STAT_TX0REQ << (2 * b)) : 0;
+    status |= (intf & (MCP_TX0IF << b)) ? (MCP_STAT_TX0IF << (2 * b)) : 0;
+  }
+  return status;
+}
+
+uint8_t SEEED_CANSimNode::rxStatus(void) const {
+  uint8_t intf = _regs[MCP_CANINTF];
+  uint8_t status = ((intf & MCP_RX0IF) ? MCP_RXSTAT_RXB0 : 0) | ((intf & MCP_RX1IF) ? MCP_RXSTAT_RXB1 : 0);
+  uint8_t ctrl;
+  uint8_t sidl;
+  uint8_t hit;
+
+  if (intf & MCP_RX0IF) {
+    ctrl = _regs[MCP_RXB0CTRL];
+    sidl = _regs[MCP_RXB0SIDH + 1];
+    hit = ctrl & 0x01;
+  } else if (intf & MCP_RX1IF) {
+    ctrl = _regs[MCP_RXB1CTRL];
+    sidl = _regs[MCP_RXB1SIDH + 1];
+    hit = ctrl & 0x07;
+    hit = (hit < 2) ? (hit + MCP_RXSTAT_RXROF0) : hit;  // RXF0 or RXF1 rolled over into RXB1
+  } else {
+    return status;
+  }
+  status |= (sidl & MCP_RXB_IDE_M) ? MCP_RXSTAT_IDE : 0;
+  status |= (ctrl & SIM_RXB_RXRTR) ? MCP_RXSTAT_RTR : 0;
+  return status | hit;
+}
+
+bool SEEED_CANSimNode::online(void) const {
+  uint8_t mode = _regs[MCP_CANSTAT] & MODE_MASK;
+  return ((mode == MODE_NORMAL) || (mode == MODE_LISTENONLY)) && (_state != BusOff);
+}
+
+bool SEEED_CANSimNode::transmitting(void) const {
+  return ((_regs[MCP_CANSTAT] & MODE_MASK) == MODE_NORMAL) && (_state != BusOff) && _bus.sameRate(this);
+}
+
+bool SEEED_CANSimNode::acknowledges(void) const { return transmitting(); }
+
+int SEEED_CANSimNode::pending(SEEED_CANFrame &frame) const {
+  int best = -1;
+
+  if (_regs[MCP_CANCTRL] & ABORT_TX) {
+    return -1;
+  }
+  for (int b = 2; b >= 0; b--) {  // The higher buffer wins between equal priorities
+    uint8_t ctrl = _regs[MCP_TXB0CTRL + 0x10 * b];
+    if ((ctrl & MCP_TXB_TXREQ_M) &&
+        ((best < 0) || ((ctrl & MCP_TXB_TXP10_M) > (_regs[MCP_TXB0CTRL + 0x10 * best] & MCP_TXB_TXP10_M)))) {
+      best = b;
+    }
+  }
+  if (best >= 0) {
+    const uint8_t *r = &_regs[MCP_TXB0CTRL + 1 + 0x10 * best];
+    frame.ident = SEEED_CANFrame::identFromRegs(r) & ~CAN_FRAME_RTR;  // TXBnSIDL has no SRR bit
+    frame.ident |= (r[4] & MCP_TXB_RTR_M) ? CAN_FRAME_RTR : 0;
+    frame.dlc = r[4] & MCP_DLC_MASK;
+    frame.filhit = 0;
+    frame.stamp = 0;
+    memcpy(frame.data, &r[5], 8);
+  }
+  return best;
+}
+
+void SEEED_CANSimNode::transmitted(int buffer) {
+  _regs[MCP_TXB0CTRL + 0x10 * buffer] &= ~(MCP_TXB_TXREQ_M | MCP_TXB_MLOA_M | MCP_TXB_TXERR_M);
+  _regs[MCP_CANINTF] |= MCP_TX0IF << buffer;
+  _tec -= (_tec > 0) ? 1 : 0;
+  _stats.transmitted++;
+  updateErrorState();
+}
+
+void SEEED_CANSimNode::failed(int buffer, bool ackError) {
+  uint8_t &ctrl = _regs[MCP_TXB0CTRL + 0x10 * buffer];
+
+  ctrl |= MCP_TXB_TXERR_M;
+  if (_regs[MCP_CANCTRL] & MODE_ONESHOT) {
+    ctrl = (ctrl & ~MCP_TXB_TXREQ_M) | MCP_TXB_ABTF_M;
+  }
+  _regs[MCP_CANINTF] |= MCP_MERRF;
+  _tec += (ackError && (_state == Passive)) ? 0 : 8;  // An error passive node's TEC stops at an acknowledge error
+  _stats.errors++;
+  updateErrorState();
+}
+
+void SEEED_CANSimNode::lostArbitration(int buffer) {
+  _regs[MCP_TXB0CTRL + 0x10 * buffer] |= MCP_TXB_MLOA_M;
+  _stats.arbitrationLost++;
+}
+
+bool SEEED_CANSimNode::matches(uint8_t filter, uint8_t mask, const SEEED_CANFrame &frame) const {
+  const uint8_t *f = &_regs[filter];
+  const uint8_t *m = &_regs[mask];
+  bool ext = (frame.ident & CAN_FRAME_IDE) != 0;
+  uint32_t fid = ((uint32_t)f[0] << 3) | (f[1] >> 5);
+  uint32_t mid = ((uint32_t)m[0] << 3) | (m[1] >> 5);
+
+  if (((f[1] & MCP_TXB_EXIDE_M) != 0) != ext) {
+    return false;
+  }
+  if (ext) {
+    fid = (fid << 18) | ((uint32_t)(f[1] & 0x03) << 16) | ((uint32_t)f[2] << 8) | f[3];
+    mid = (mid << 18) | ((uint32_t)(m[1] & 0x03) << 16) | ((uint32_t)m[2] << 8) | m[3];
+  }
+  return ((frame.id() ^ fid) & mid) == 0;
+}
+
+void SEEED_CANSimNode::receive(const SEEED_CANFrame &frame) {
+  static const uint8_t filters[6] = {MCP_RXF0SIDH, MCP_RXF1SIDH, MCP_RXF2SIDH,
+                                     MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
+  bool ext = (frame.ident & CAN_FRAME_IDE) != 0;
+  int hit[2] = {-1, -1};
+
+  if ((_regs[MCP_CANSTAT] & MODE_MASK) == MODE_NORMAL) {
+    _rec = (_rec > 127) ? 120 : ((_rec > 0) ? (_rec - 1) : 0);
+    updateErrorState();
+  }
+  for (uint8_t f = 0; f < 6; f++) {
+    uint8_t n = (f < 2) ? 0 : 1;
+    uint8_t rxm = _regs[n ? MCP_RXB1CTRL : MCP_RXB0CTRL] & MCP_RXB_RX_MASK;
+    if ((hit[n] < 0) && ((rxm == MCP_RXB_RX_ANY) ||
+                         (((rxm != MCP_RXB_RX_STD) || !ext) && ((rxm != MCP_RXB_RX_EXT) || ext) &&
+                          matches(filters[f], n ? MCP_RXM1SIDH : MCP_RXM0SIDH, frame)))) {
+      hit[n] = f;
+    }
+  }
+  int buffer = -1;
+  int filhit = hit[0];
+  uint8_t intf = _regs[MCP_CANINTF];
+  uint8_t overflow = 0;
+  if (hit[0] >= 0) {
+    buffer = !(intf & MCP_RX0IF) ? 0 : ((_regs[MCP_RXB0CTRL] & MCP_RXB_BUKT_MASK) ? 1 : -1);
+    overflow = (_regs[MCP_RXB0CTRL] & MCP_RXB_BUKT_MASK) ? MCP_EFLG_RX1OVR : MCP_EFLG_RX0OVR;
+  } else if (hit[1] >= 0) {
+    buffer = 1;
+    filhit = hit[1];
+    overflow = MCP_EFLG_RX1OVR;
+  } else {
+    return;  // Not accepted by any filter
+  }
+  if ((buffer == 1) && (intf & MCP_RX1IF)) {
+    buffer = -1;
+  }
+  if ((buffer < 0) || _forcedOverflows) {
+    _forcedOverflows -= _forcedOverflows ? 1 : 0;
+    _regs[MCP_EFLG] |= overflow;
+    _regs[MCP_CANINTF] |= MCP_ERRIF;
+    _stats.overflows++;
+    return;
+  }
+  uint8_t ctrl = buffer ? MCP_RXB1CTRL : MCP_RXB0CTRL;
+  uint8_t *r = &_regs[ctrl + 1];
+  bool rtr = (frame.ident & CAN_FRAME_RTR) != 0;
+  frame.toRegs(r);
+  if (rtr && !ext) {
+    r[1] |= MCP_RXB_SRR_M;  // A standard remote frame is flagged in RXBnSIDL, RXBnDLC.RTR is for extended frames
+    r[4] &= ~MCP_RXB_RTR_M;
+  }
+  if (buffer == 0) {
+    uint8_t bukt = (_regs[ctrl] & MCP_RXB_BUKT_MASK) ? SIM_RXB_BUKT1 : 0;
+    _regs[ctrl] = (_regs[ctrl] & (MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK)) | (rtr ? SIM_RXB_RXRTR : 0) | bukt | filhit;
+  } else {
+    _regs[ctrl] = (_regs[ctrl] & MCP_RXB_RX_MASK) | (rtr ? SIM_RXB_RXRTR : 0) | filhit;
+  }
+  _regs[MCP_CANINTF] |= MCP_RX0IF << buffer;
+  _stats.received++;
+}
+
+void SEEED_CANSimNode::rxError(void) {
+  _regs[MCP_CANINTF] |= MCP_MERRF;
+  if ((_regs[MCP_CANSTAT] & MODE_MASK) == MODE_NORMAL) {  // Listen Only mode leaves the error counters alone
+    _rec += (_rec < 255) ? 1 : 0;
+    updateErrorState();
+  }
+  _stats.errors++;
+}
+
+void SEEED_CANSimNode::busIdle(uint32_t occurrences) {
+  if (_state != BusOff) {
+    return;
+  }
+  _recovery -= (occurrences < _recovery) ? occurrences : _recovery;
+  if (!_recovery) {
+    _state = Active;
+    _tec = 0;
+    _rec = 0;
+    updateErrorState();
+  }
+}
+
+void SEEED_CANSimNode::loopback(void) {
+  SEEED_CANFrame frame;
+  int buffer;
+
+  if ((_regs[MCP_CANSTAT] & MODE_MASK) != MODE_LOOPBACK) {
+    return;
+  }
+  while ((buffer = pending(frame)) >= 0) {
+    _regs[MCP_TXB0CTRL + 0x10 * buffer] &= ~MCP_TXB_TXREQ_M;
+    _regs[MCP_CANINTF] |= MCP_TX0IF << buffer;
+    _stats.transmitted++;
+    receive(frame);
+  }
+}
+
+void SEEED_CANSimNode::updateErrorState(void) {
+  if ((_state != BusOff) && (_tec >= 256)) {
+    _state = BusOff;
+    _recovery = CAN_SIM_RECOVERY;
+    _stats.busOffs++;
+  } else if (_state != BusOff) {
+    _state = ((_tec >= 128) || (_rec >= 128)) ? Passive : Active;
+  }
+  uint8_t flags = ((_tec >= 96) || (_rec >= 96)) ? MCP_EFLG_EWARN : 0;
+  flags |= (_rec >= 96) ? MCP_EFLG_RXWAR : 0;
+  flags |= (_tec >= 96) ? MCP_EFLG_TXWAR : 0;
+  flags |= (_rec >= 128) ? MCP_EFLG_RXEP : 0;
+  flags |= (_tec >= 128) ? MCP_EFLG_TXEP : 0;
+  flags |= (_state == BusOff) ? MCP_EFLG_TXBO : 0;
+  uint8_t old = _regs[MCP_EFLG];
+  _regs[MCP_EFLG] = (old & (MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR)) | flags;
+  if ((old ^ _regs[MCP_EFLG]) & ~(MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR)) {
+    _regs[MCP_CANINTF] |= MCP_ERRIF;
+  }
+  _regs[MCP_TEC] = (_tec > 255) ? 255 : (uint8_t)_tec;
+  _regs[MCP_REC] = (_rec > 255) ? 255 : (uint8_t)_rec;
+}
+
+SEEED_CANSimBus::SEEED_CANSimBus(uint32_t bitRate, uint32_t seed)
+    : _bitRate(bitRate ? bitRate : 1),
+      _rng(seed ? seed : 1),
+      _bitErrorPpm(0),
+      _now(0),
+      _idleNs(0),
+      _numSources(0),
+      _monitor(NULL),
+      _context(NULL) {
+  memset(_nodes, 0, sizeof(_nodes));
+  memset(_sources, 0, sizeof(_sources));
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+bool SEEED_CANSimBus::attach(SEEED_CANSimNode *node) {
+  for (int i = 0; i < CAN_SIM_NODES; i++) {
+    if (!_nodes[i]) {
+      _nodes[i] = node;
+      return true;
+    }
+  }
+  return false;
+}
+
+void SEEED_CANSimBus::detach(SEEED_CANSimNode *node) {
+  for (int i = 0; i < CAN_SIM_NODES; i++) {
+    _nodes[i] = (_nodes[i] == node) ? NULL : _nodes[i];
+  }
+}
+
+int SEEED_CANSimBus::source(const SEEED_CANFrame &frame, uint32_t periodUs, uint32_t offsetUs, bool randomData) {
+  if (_numSources >= CAN_SIM_SOURCES) {
+    return -1;
+  }
+  Source &s = _sources[_numSources];
+  s.frame = frame;
+  s.periodNs = (uint64_t)periodUs * 1000;
+  s.dueNs = _now + (uint64_t)offsetUs * 1000;
+  s.randomData = randomData;
+  return (int)_numSources++;
+}
+
+void SEEED_CANSimBus::monitor(Monitor fn, void *context) {
+  _monitor = fn;
+  _context = context;
+}
+
+bool SEEED_CANSimBus::sameRate(const SEEED_CANSimNode *node) const {
+  uint32_t d = (node->_hz > _bitRate) ? (node->_hz - _bitRate) : (_bitRate - node->_hz);
+  return (uint64_t)d * 100 <= _bitRate;  // Within the 1% a CAN bit timing tolerates
+}
+
+uint32_t SEEED_CANSimBus::random(void) {
+  _rng ^= _rng << 13;  // xorshift32
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+
+bool SEEED_CANSimBus::chance(uint32_t ppm) { return ppm && ((random() % 1000000) < ppm); }
+
+uint64_t SEEED_CANSimBus::arbitration(const SEEED_CANFrame &frame) {
+  uint64_t rtr = (frame.ident & CAN_FRAME_RTR) ? 1 : 0;
+  uint32_t id = frame.id();
+
+  if (frame.ident & CAN_FRAME_IDE) {  // Base identifier, SRR, IDE, identifier extension, RTR
+    return ((uint64_t)(id >> 18) << 21) | (3ULL << 19) | ((uint64_t)(id & 0x3FFFF) << 1) | rtr;
+  }
+  return ((uint64_t)id << 21) | (rtr << 20);  // Identifier, RTR, IDE
+}
+
+void SEEED_CANSimBus::idle(uint64_t ns) {
+  uint64_t slot = bits(11);
+  _idleNs += ns;
+  if (_idleNs >= slot) {
+    uint32_t occurrences = (uint32_t)(_idleNs / slot);
+    _idleNs -= occurrences * slot;
+    for (int i = 0; i < CAN_SIM_NODES; i++) {
+      if (_nodes[i]) {
+        _nodes[i]->busIdle(occurrences);
+      }
+    }
+  }
+}
+
+uint64_t SEEED_CANSimBus::transfer(void) {
+  int pend[CAN_SIM_NODES];
+  SEEED_CANFrame frame;
+  uint64_t best = ~0ULL;
+  int winner = -1;  // A node index, or CAN_SIM_NODES + a source index
+  bool collision = false;
+  bool ack = false;
+  bool disturbed = false;
+
+  for (int i = 0; i < CAN_SIM_NODES; i++) {
+    pend[i] = -1;
+    if (_nodes[i]) {
+      _nodes[i]->loopback();
+    }
+    SEEED_CANFrame f;
+    if (!_nodes[i] || !_nodes[i]->transmitting() || ((pend[i] = _nodes[i]->pending(f)) < 0)) {
+      continue;
+    }
+    uint64_t key = arbitration(f);
+    collision = (key == best) ? (collision || (f.dlc != frame.dlc) || memcmp(f.data, frame.data, 8)) : collision;
+    if (key < best) {
+      best = key;
+      frame = f;
+      winner = i;
+      collision = false;
+    }
+  }
+  for (uint32_t s = 0; s < _numSources; s++) {
+    if (_sources[s].dueNs > _now) {
+      continue;
+    }
+    uint64_t key = arbitration(_sources[s].frame);
+    const SEEED_CANFrame &f = _sources[s].frame;
+    collision = (key == best) ? (collision || _sources[s].randomData || (f.dlc != frame.dlc) ||
+                                 memcmp(f.data, frame.data, 8))
+                              : collision;
+    if (key < best) {
+      best = key;
+      frame = _sources[s].frame;
+      winner = CAN_SIM_NODES + s;
+      collision = false;
+    }
+  }
+  if (winner < 0) {
+    return 0;
+  }
+  SEEED_CANSimNode *tx = (winner < CAN_SIM_NODES) ? _nodes[winner] : NULL;
+  if (!tx && _sources[winner - CAN_SIM_NODES].randomData) {
+    for (uint32_t i = 0; i < 8; i++) {
+      frame.data[i] = (uint8_t)random();
+    }
+    _sources[winner - CAN_SIM_NODES].frame = frame;
+  }
+  for (int i = 0; i < CAN_SIM_NODES; i++) {
+    if ((pend[i] >= 0) && (i != winner)) {
+      _nodes[i]->lostArbitration(pend[i]);
+    }
+    if (_nodes[i] && (i != winner)) {
+      ack = ack || _nodes[i]->acknowledges();
+      disturbed = disturbed || ((_nodes[i]->_regs[MCP_CANSTAT] & MODE_MASK) == MODE_NORMAL &&
+                                _nodes[i]->_state == SEEED_CANSimNode::Active && !sameRate(_nodes[i]));
+    }
+  }
+  ack = ack || (_numSources > (tx ? 0U : 1U));  // Sources acknowledge every frame but their own
+
+  CAN_Message msg;
+  frame.unpack(msg);
+  uint32_t n = SEEED_CANAnalyser::frameBits(msg, SEEED_CANAnalyser::Exact);
+  uint32_t errorAt = 0;  // Bit at which an error flag starts, 0 for none
+  bool ackError = false;
+  if (disturbed) {
+    errorAt = 1 + random() % 12;  // A receiver sampling at the wrong rate soon breaks the stuffing rule
+  } else if (collision || chance(_bitErrorPpm) || (tx && chance(tx->_txErrorPpm))) {
+    errorAt = 1 + random() % (n - 10);  // Anywhere up to the acknowledge delimiter
+  } else if (!ack) {
+    errorAt = n - 11;  // The acknowledge delimiter after a recessive acknowledge slot
+    ackError = true;
+  }
+
+  uint64_t t;
+  if (errorAt) {
+    bool suspend = tx && (tx->_state == SEEED_CANSimNode::Passive);
+    t = bits(errorAt + CAN_SIM_ERROR_BITS + (suspend ? CAN_SIM_SUSPEND_BITS : 0));
+    if (tx) {
+      tx->failed(pend[winner], ackError);
+    }
+    _stats.errorFrames++;
+  } else {
+    t = bits(n);
+    if (tx) {
+      tx->transmitted(pend[winner]);
+    } else {
+      Source &s = _sources[winner - CAN_SIM_NODES];
+      s.dueNs = s.periodNs ? (s.dueNs + s.periodNs) : (_now + t);
+    }
+    _stats.frames++;
+    _stats.stuffBits += n - SEEED_CANAnalyser::frameBits(msg, SEEED_CANAnalyser::NoStuffing);
+  }
+  for (int i = 0; i < CAN_SIM_NODES; i++) {
+    SEEED_CANSimNode *node = _nodes[i];
+    if (!node || (i == winner)) {
+      continue;
+    }
+    if (node->online()) {
+      (errorAt || !sameRate(node)) ? node->rxError() : node->receive(frame);
+    }
+    node->busIdle(1);  // Acknowledge (or error) delimiter, end of frame and intermission: 11 recessive bits
+  }
+  _stats.busyNs += t;
+  if (!errorAt && _monitor) {
+    _monitor(frame, _now + t, _context);
+  }
+  return t;
+}
+
+uint64_t SEEED_CANSimBus::run(uint64_t ns) {
+  uint64_t end = _now + ns;
+  uint64_t frames = _stats.frames;
+
+  while (_now < end) {
+    uint64_t t = transfer();
+    if (t) {
+      _now += t;
+      continue;
+    }
+    uint64_t next = end;  // Nothing wants the bus: idle until a source is due or a node leaves bus off
+    for (uint32_t s = 0; s < _numSources; s++) {
+      next = (_sources[s].dueNs < next) ? _sources[s].dueNs : next;
+    }
+    for (int i = 0; i < CAN_SIM_NODES; i++) {
+      if (_nodes[i] && (_nodes[i]->_state == SEEED_CANSimNode::BusOff)) {
+        uint64_t recovered = _now + bits(11 * _nodes[i]->_recovery);
+        next = (recovered < next) ? recovered : next;
+      }
+    }
+    next = (next > _now) ? next : end;
+    idle(next - _now);
+    _now = next;
+  }
+  return _stats.frames - frames;
+}
+
+#endif  // SEEED_CAN_SIM
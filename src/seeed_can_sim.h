@@ -0,0 +1,289 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_SIM_H_
+#define _SEEED_CAN_SIM_H_
+
+#include "seeed_can_frame.h"
+
+// Most emulated MCP2515s on one SEEED_CANSimBus
+#ifndef CAN_SIM_NODES
+#define CAN_SIM_NODES 8
+#endif
+
+// Most traffic sources on one SEEED_CANSimBus
+#ifndef CAN_SIM_SOURCES
+#define CAN_SIM_SOURCES 16
+#endif
+
+// Bit times from an error being detected to the bus being idle again: error flag (6), delimiter (8), intermission (3)
+#define CAN_SIM_ERROR_BITS 17
+
+// Extra bit times an error passive transmitter waits after an error (suspend transmission)
+#define CAN_SIM_SUSPEND_BITS 8
+
+// Occurrences of 11 recessive bits a bus off node waits for before it is error active again
+#define CAN_SIM_RECOVERY 128
+
+class SEEED_CANSimBus;
+
+/**
+ * An emulated MCP2515 on a SEEED_CANSimBus.
+ *
+ * The node decodes the SPI instructions the driver uses (RESET, READ, WRITE, BIT MODIFY, LOAD TX BUFFER, RTS, READ RX
+ * BUFFER, READ STATUS and RX STATUS) against a model of the MCP2515's registers: operation modes, bit timing, masks
+ * and filters with rollover, the three transmit buffers with their priorities, one shot mode and abort, interrupt
+ * flags, error flags and the TEC/REC error counters.
+ *
+ * Build the driver with SEEED_CAN_SIM defined and an unmodified SEEED_CAN whose chip select pin is the node's talks
+ * to the node instead of an SPI peripheral. The node does not drive the SEEED_CAN's interrupt pin itself: the host
+ * build in test/ gives the pin the level of interrupt(), elsewhere receive with read() or the polled receive mode.
+ */
+class SEEED_CANSimNode {
+ public:
+  struct Stats {
+    uint32_t transmitted;      // Frames sent successfully
+    uint32_t received;         // Frames stored in a receive buffer
+    uint32_t arbitrationLost;  // Arbitration rounds lost while a frame was pending
+    uint32_t errors;           // Errors seen while transmitting or receiving
+    uint32_t overflows;        // Frames lost because the receive buffer was still full
+    uint32_t busOffs;          // Times the node went bus off
+    uint32_t spiBytes;         // Bytes transferred over SPI, instructions and addresses included
+  };
+
+  /**
+   * Put an emulated MCP2515 on a bus.
+   *
+   * @param bus The bus, which must outlive the node.
+   * @param ncs The chip select pin of the SEEED_CAN that drives this node.
+   */
+  SEEED_CANSimNode(SEEED_CANSimBus &bus, PinName ncs);
+  ~SEEED_CANSimNode();
+
+  /**
+   * Returns the node wired to a chip select pin, NULL if there is none.
+   */
+  static SEEED_CANSimNode *at(PinName ncs);
+
+  /**
+   * SPI side: chip select asserted.
+   */
+  void select(void);
+
+  /**
+   * SPI side: exchange one byte.
+   *
+   * @returns the byte shifted out on MISO
+   */
+  uint8_t transfer(uint8_t mosi);
+
+  /**
+   * SPI side: chip select released, completing the instruction.
+   */
+  void deselect(void);
+
+  /**
+   * Returns true while the INT pin is asserted (an enabled interrupt flag is set).
+   */
+  bool interrupt(void) const { return (_regs[MCP_CANINTF] & _regs[MCP_CANINTE]) != 0; }
+
+  /**
+   * Returns a register's value without any side effect, for test assertions.
+   */
+  uint8_t peek(uint8_t address) const {
+    return _regs[((address & 0x0E) == 0x0E) ? (address & 0x0F) : (address & 0x7F)];  // CANSTAT, CANCTRL mirrors
+  }
+
+  /**
+   * Fault injection: each frame this node wins arbitration with suffers a bit error with this probability.
+   *
+   * @param ppm Probability in parts per million, 1000000 for every frame (which drives the node to bus off).
+   */
+  void txErrors(uint32_t ppm) { _txErrorPpm = ppm; }
+
+  /**
+   * Fault injection: the next frames accepted by a filter find their receive buffer full and are lost, as if the host
+   * had stopped reading.
+   */
+  void forceOverflow(uint32_t frames) { _forcedOverflows = frames; }
+
+  const Stats &stats(void) const { return _stats; }
+
+ protected:
+  friend class SEEED_CANSimBus;
+
+  enum State { Active = 0, Passive, BusOff };
+
+  void reset(void);
+  void writeReg(uint8_t address, uint8_t mask, uint8_t value);
+  uint8_t readStatus(void) const;
+  uint8_t rxStatus(void) const;
+  void modeChanged(void);
+  uint8_t icod(void) const;
+
+  // Bus side, called by SEEED_CANSimBus
+  bool online(void) const;
+  bool transmitting(void) const;
+  bool acknowledges(void) const;
+  int pending(SEEED_CANFrame &frame) const;
+  void transmitted(int buffer);
+  void failed(int buffer, bool ackError);
+  void lostArbitration(int buffer);
+  void receive(const SEEED_CANFrame &frame);
+  void rxError(void);
+  void busIdle(uint32_t occurrences);
+  void loopback(void);
+  void updateErrorState(void);
+  bool matches(uint8_t filter, uint8_t mask, const SEEED_CANFrame &frame) const;
+
+  SEEED_CANSimBus &_bus;
+  PinName _ncs;
+  SEEED_CANSimNode *_next;  // Chip select registry
+  uint8_t _regs[128];
+  uint32_t _hz;  // Bit rate from CNF1..3, worked out when leaving Configuration mode
+  uint16_t _tec;
+  uint16_t _rec;
+  uint32_t _recovery;  // Occurrences of 11 recessive bits still needed to leave bus off
+  State _state;
+  // SPI instruction in progress
+  uint8_t _cmd;
+  uint8_t _addr;
+  uint8_t _mask;
+  uint32_t _byte;
+  // Fault injection
+  uint32_t _txErrorPpm;
+  uint32_t _forcedOverflows;
+  Stats _stats;
+};
+
+/**
+ * A virtual CAN bus shared by emulated MCP2515s (SEEED_CANSimNode) and traffic sources, for load and fault testing on
+ * a host without any CAN hardware.
+ *
+ * Time is simulated, in nanoseconds, and only moves when run() is called, so hours of saturated traffic take seconds
+ * of host time. Whenever the bus is idle every node with a pending transmit buffer and every due source contends,
+ * the lowest arbitration field (standard before extended with the same base identifier, data before remote) wins,
+ * and the frame lasts its exact length at the bus bit rate: the real CRC is computed and the stuff bits counted.
+ *
+ * Errors end a frame early with an error frame, after which the frame is retried: a missing acknowledge (no other
+ * node is able to acknowledge), an error active node whose bit rate differs from the bus', or an injected bit error.
+ * Transmitters add 8 and receivers 1 to their error counters, success takes 1 off, and the nodes go error passive and
+ * bus off and recover as the MCP2515 does. All random choices come from one seeded generator, so a run is repeated
+ * exactly by using the same seed.
+ */
+class SEEED_CANSimBus {
+ public:
+  struct Stats {
+    uint64_t frames;       // Frames completed successfully
+    uint64_t errorFrames;  // Frames destroyed by an error
+    uint64_t busyNs;       // Time the bus was not idle
+    uint64_t stuffBits;    // Stuff bits in the completed frames
+  };
+
+  /**
+   * Called for every frame completed successfully.
+   *
+   * @param endNs When the frame ended, in simulated nanoseconds.
+   */
+  typedef void (*Monitor)(const SEEED_CANFrame &frame, uint64_t endNs, void *context);
+
+  /**
+   * Create a bus.
+   *
+   * @param bitRate The bus bit rate, nodes configured for another rate cannot take part.
+   * @param seed Seed of the fault injection and random data generator, @b default: @p 1.
+   */
+  SEEED_CANSimBus(uint32_t bitRate, uint32_t seed = 1);
+
+  /**
+   * Add a traffic source, an ideal node that transmits one frame periodically and acknowledges every frame.
+   *
+   * @param frame The frame to send.
+   * @param periodUs Transmit period in microseconds, 0 to transmit back to back (saturating the bus if the source
+   * wins arbitration).
+   * @param offsetUs Time of the first transmission.
+   * @param randomData Fill the data bytes with new random values for each transmission, so that the stuff bits vary.
+   *
+   * @returns the source's handle (0 or more), -1 if CAN_SIM_SOURCES are already in use
+   */
+  int source(const SEEED_CANFrame &frame, uint32_t periodUs, uint32_t offsetUs = 0, bool randomData = false);
+
+  /**
+   * Fault injection: each frame suffers a bit error with this probability.
+   *
+   * @param ppm Probability in parts per million.
+   */
+  void bitErrors(uint32_t ppm) { _bitErrorPpm = ppm; }
+
+  /**
+   * Call a function for every frame completed successfully (NULL to remove it).
+   */
+  void monitor(Monitor fn, void *context = NULL);
+
+  /**
+   * Advance simulated time.
+   *
+   * Frames that start before the end complete, so now() can end up past it by less than a frame.
+   *
+   * @param ns Time to simulate, in nanoseconds.
+   *
+   * @returns the number of frames completed successfully
+   */
+  uint64_t run(uint64_t ns);
+
+  /**
+   * Returns the simulated time, in nanoseconds.
+   */
+  uint64_t now(void) const { return _now; }
+
+  uint32_t bitRate(void) const { return _bitRate; }
+
+  const Stats &stats(void) const { return _stats; }
+
+ protected:
+  friend class SEEED_CANSimNode;
+
+  struct Source {
+    SEEED_CANFrame frame;
+    uint64_t periodNs;
+    uint64_t dueNs;
+    bool randomData;
+  };
+
+  bool attach(SEEED_CANSimNode *node);
+  void detach(SEEED_CANSimNode *node);
+  bool sameRate(const SEEED_CANSimNode *node) const;
+  uint32_t random(void);
+  bool chance(uint32_t ppm);
+  uint64_t bits(uint32_t n) const { return ((uint64_t)n * 1000000000ULL) / _bitRate; }
+  uint64_t transfer(void);
+  void idle(uint64_t ns);
+
+  static uint64_t arbitration(const SEEED_CANFrame &frame);
+
+  uint32_t _bitRate;
+  uint32_t _rng;
+  uint32_t _bitErrorPpm;
+  uint64_t _now;
+  uint64_t _idleNs;  // Idle time not yet counted towards bus off recovery
+  SEEED_CANSimNode *_nodes[CAN_SIM_NODES];
+  Source _sources[CAN_SIM_SOURCES];
+  uint32_t _numSources;
+  Monitor _monitor;
+  void *_context;
+  Stats _stats;
+};
+
+#endif  // SEEED_CAN_SIM_H
@@ -14,99 +14,184 @@
  */
 
 #include "seeed_can_spi.h"
+#ifdef SEEED_CAN_SIM
+#include "seeed_can_sim.h"
+#endif
 
-void mcpReset(mcp_can_t *obj) {
+// Every chip select framed transaction is a short critical section in RTOS builds, so that neither a thread switch
+// nor an interrupt can interleave its own bytes with another transaction. Without an RTOS it only counts as a
+// sequence, so that interrupt handlers put their work off (mcpDeferIsr) instead.
+static inline void mcpSelect(mcp_can_t *obj) {
+#ifdef SEEED_CAN_RTOS
+  core_util_critical_section_enter();
+#else
+  mcpLock(obj);
+#endif
   obj->ncs = 0;
-  obj->spi.write(MCP_RESET);
+#ifdef SEEED_CAN_SIM
+  if (obj->sim) {
+    obj->sim->select();
+  }
+#endif
+}
+
+static inline void mcpDeselect(mcp_can_t *obj) {
+#ifdef SEEED_CAN_SIM
+  if (obj->sim) {
+    obj->sim->deselect();
+  }
+#endif
   obj->ncs = 1;
-  wait_ms(10);
+#ifdef SEEED_CAN_RTOS
+  core_util_critical_section_exit();
+#else
+  mcpUnlock(obj);
+#endif
+}
+
+static inline uint8_t mcpTransfer(mcp_can_t *obj, const uint8_t value) {
+#ifdef SEEED_CAN_SIM
+  if (obj->sim) {
+    return obj->sim->transfer(value);
+  }
+#endif
+  return (uint8_t)obj->spi.write(value);
+}
+
+void mcpLock(mcp_can_t *obj) {
+  if (__get_IPSR() != 0) {  // Interrupt handlers cannot wait on a mutex, they use mcpDeferIsr
+    return;
+  }
+#ifdef SEEED_CAN_RTOS
+  obj->mutex.lock();
+#endif
+  obj->lockDepth++;
+}
+
+void mcpUnlock(mcp_can_t *obj) {
+  if (__get_IPSR() != 0) {
+    return;
+  }
+  obj->lockDepth--;
+#ifdef SEEED_CAN_RTOS
+  obj->mutex.unlock();
+#endif
+  if (!obj->lockDepth && obj->deferred) {  // Cleared first: the work may use the MCP2515, and so come back here
+    obj->deferred = 0;
+    obj->onUnlock.call();
+  }
+}
+
+uint8_t mcpDeferIsr(mcp_can_t *obj) {
+  if ((__get_IPSR() == 0) || !obj->lockDepth) {
+    return 0;
+  }
+  obj->deferred = 1;
+  return 1;
+}
+
+void mcpReset(mcp_can_t *obj) {
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_RESET);
+  mcpDeselect(obj);
+  // Poll for the reset values of CANSTAT and CANCTRL rather than always waiting the full 10 ms
+  for (uint32_t i = 0; i < 100; i++) {
+    uint8_t regs[2];
+    wait_us(100);
+    mcpReadMultiple(obj, MCP_CANSTAT, regs, 2);
+    if (((regs[0] & MODE_MASK) == MODE_CONFIG) && (regs[1] == MCP_CANCTRL_RESET)) {
+      return;
+    }
+  }
 }
 
 uint8_t mcpRead(mcp_can_t *obj, const uint8_t address) {
   uint8_t result;
-  obj->ncs = 0;
-  obj->spi.write(MCP_READ);
-  obj->spi.write(address);
-  result = obj->spi.write(0x00);
-  obj->ncs = 1;
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_READ);
+  mcpTransfer(obj, address);
+  result = mcpTransfer(obj, 0x00);
+  mcpDeselect(obj);
   return result;
 }
 
 void mcpReadMultiple(mcp_can_t *obj, const uint8_t address, uint8_t values[], const uint8_t n) {
-  obj->ncs = 0;
-  obj->spi.write(MCP_READ);
-  obj->spi.write(address);
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_READ);
+  mcpTransfer(obj, address);
   for (uint32_t i = 0; i < n; i++) {
-    values[i] = obj->spi.write(0x00);
+    values[i] = mcpTransfer(obj, 0x00);
   }
-  obj->ncs = 1;
+  mcpDeselect(obj);
 }
 
 void mcpReadBuffer(mcp_can_t *obj, const uint8_t command, uint8_t values[], const uint8_t n) {
-  obj->ncs = 0;
-  obj->spi.write(command);
+  MCP_PROFILE(_P_READ_BUFFER);
+  mcpSelect(obj);
+  mcpTransfer(obj, command);
   for (uint32_t i = 0; i < n; i++) {
-    values[i] = obj->spi.write(0x00);
+    values[i] = mcpTransfer(obj, 0x00);
   }
-  obj->ncs = 1;
+  mcpDeselect(obj);
 }
 
 void mcpWrite(mcp_can_t *obj, const uint8_t address, const uint8_t value) {
-  obj->ncs = 0;
-  obj->spi.write(MCP_WRITE);
-  obj->spi.write(address);
-  obj->spi.write(value);
-  obj->ncs = 1;
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_WRITE);
+  mcpTransfer(obj, address);
+  mcpTransfer(obj, value);
+  mcpDeselect(obj);
 }
 
 void mcpWriteMultiple(mcp_can_t *obj, const uint8_t address, const uint8_t values[], const uint8_t n) {
-  obj->ncs = 0;
-  obj->spi.write(MCP_WRITE);
-  obj->spi.write(address);
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_WRITE);
+  mcpTransfer(obj, address);
   for (uint32_t i = 0; i < n; i++) {
-    obj->spi.write(values[i]);
+    mcpTransfer(obj, values[i]);
   }
-  obj->ncs = 1;
+  mcpDeselect(obj);
 }
 
 void mcpWriteBuffer(mcp_can_t *obj, const uint8_t command, uint8_t values[], const uint8_t n) {
-  obj->ncs = 0;
-  obj->spi.write(command);
+  MCP_PROFILE(_P_WRITE_BUFFER);
+  mcpSelect(obj);
+  mcpTransfer(obj, command);
   for (uint32_t i = 0; i < n; i++) {
-    obj->spi.write(values[i]);
+    mcpTransfer(obj, values[i]);
   }
-  obj->ncs = 1;
+  mcpDeselect(obj);
 }
 
 void mcpBufferRTS(mcp_can_t *obj, const uint8_t command) {
-  obj->ncs = 0;
-  obj->spi.write(command);
-  obj->ncs = 1;
+  mcpSelect(obj);
+  mcpTransfer(obj, command);
+  mcpDeselect(obj);
 }
 
 uint8_t mcpStatus(mcp_can_t *obj) {
   uint8_t status;
-  obj->ncs = 0;
-  obj->spi.write(MCP_READ_STATUS);
-  status = obj->spi.write(0x00);
-  obj->ncs = 1;
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_READ_STATUS);
+  status = mcpTransfer(obj, 0x00);
+  mcpDeselect(obj);
   return status;
 }
 
 uint8_t mcpReceiveStatus(mcp_can_t *obj) {
   uint8_t status;
-  obj->ncs = 0;
-  obj->spi.write(MCP_RX_STATUS);
-  status = obj->spi.write(0x00);
-  obj->ncs = 1;
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_RX_STATUS);
+  status = mcpTransfer(obj, 0x00);
+  mcpDeselect(obj);
   return status;
 }
 
 void mcpBitModify(mcp_can_t *obj, const uint8_t address, const uint8_t mask, const uint8_t data) {
-  obj->ncs = 0;
-  obj->spi.write(MCP_BITMOD);
-  obj->spi.write(address);
-  obj->spi.write(mask);
-  obj->spi.write(data);
-  obj->ncs = 1;
+  mcpSelect(obj);
+  mcpTransfer(obj, MCP_BITMOD);
+  mcpTransfer(obj, address);
+  mcpTransfer(obj, mask);
+  mcpTransfer(obj, data);
+  mcpDeselect(obj);
 }
@@ -17,11 +17,41 @@
 #define _SEEED_CAN_SPI_H_
 
 #include "seeed_can_defs.h"
+#include "seeed_can_profile.h"
+
+// Define SEEED_CAN_RTOS when building against mbed-rtos to make every MCP2515 transaction and sequence thread safe
+#ifdef SEEED_CAN_RTOS
+#include "rtos.h"
+#endif
+
+// Define SEEED_CAN_SIM to talk to emulated MCP2515s on a virtual bus instead of SPI hardware, see seeed_can_sim.h
+#ifdef SEEED_CAN_SIM
+class SEEED_CANSimNode;
+
+/**
+ * Returns the emulated MCP2515 wired to a chip select pin, NULL if there is none
+ */
+SEEED_CANSimNode *mcpSimNode(PinName ncs);
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Size of the register shadow: Filters, Masks, CNF3..1 and CANINTE, indexed by their addresses (0x00 to 0x2B)
+#define MCP_SHADOW_SIZE (MCP_CANINTE + 1)
+
+/**
+ * RAM copy of the MCP2515's configuration registers, see mcpShadowSet() and mcpShadowRestore()
+ */
+struct MCP_Shadow {
+  uint8_t regs[MCP_SHADOW_SIZE];  // Filters, Masks, CNF3..1 and CANINTE at their own addresses
+  uint8_t rxbCtrl[2];             // RXB0CTRL, RXB1CTRL
+  uint8_t mode;                   // Operation mode (REQOP bits) last entered through mcpSetMode
+  uint64_t dirty;                 // Bit n set: regs[n] has not been written to the MCP2515 yet
+  uint8_t txImage[3][13];         // SIDH..D7 last loaded into each reserved TX buffer, written back after a reset
+};
+
 /**
  * CAN driver typedefs.  Type definition to hold a Seeed Studios CAN-BUS Shield connections and resources structure
  */
@@ -29,10 +59,58 @@ struct Seeed_MCP_CAN_Shield {
   SPI spi;
   DigitalOut ncs;
   InterruptIn irq;
-  Seeed_MCP_CAN_Shield(SPI _spi_, DigitalOut _ncs_, InterruptIn _irq_) : spi(_spi_), ncs(_ncs_), irq(_irq_) {}
+  uint8_t txReserved;          // Bit n set: TX buffer n is reserved (preloaded header) and skipped by mcpCanWrite
+  uint32_t bitRate;            // CAN bit rate actually configured by mcpSetBitRate (0 until then)
+  MCP_Shadow shadow;           // Configuration registers as last written (or about to be written)
+  volatile uint8_t lockDepth;  // mcpLock nesting in thread context, non-zero during a transaction or sequence
+  volatile uint8_t deferred;   // An interrupt handler put its work off until the sequence is over, see mcpDeferIsr
+  FunctionPointer onUnlock;    // Does the work put off by mcpDeferIsr, called by mcpUnlock in thread context
+#ifdef SEEED_CAN_RTOS
+  Mutex mutex;  // Serialises multi-transaction sequences between threads
+#endif
+#ifdef SEEED_CAN_SIM
+  SEEED_CANSimNode *sim;  // Emulated MCP2515 behind the chip select, used instead of spi when not NULL
+#endif
+  Seeed_MCP_CAN_Shield(SPI _spi_, PinName _ncs_, PinName _irq_)
+      : spi(_spi_), ncs(_ncs_), irq(_irq_), txReserved(0), bitRate(0), shadow(), lockDepth(0), deferred(0) {
+    shadow.mode = MODE_CONFIG;
+#ifdef SEEED_CAN_SIM
+    sim = mcpSimNode(_ncs_);
+#endif
+  }
+  // Pin objects instead of pin names, as before SEEED_CAN_SIM: such an mcp_can_t is never wired to an emulated MCP2515
+  Seeed_MCP_CAN_Shield(SPI _spi_, DigitalOut _ncs_, InterruptIn _irq_)
+      : spi(_spi_), ncs(_ncs_), irq(_irq_), txReserved(0), bitRate(0), shadow(), lockDepth(0), deferred(0) {
+    shadow.mode = MODE_CONFIG;
+#ifdef SEEED_CAN_SIM
+    sim = NULL;
+#endif
+  }
 };
 typedef struct Seeed_MCP_CAN_Shield mcp_can_t;
 
+/**
+ * Claim the MCP2515 for a sequence of transactions (nests, no-op in interrupt context)
+ *
+ * Other threads wait on a mutex (SEEED_CAN_RTOS only). Interrupt handlers cannot wait, so those that use the MCP2515
+ * must check mcpDeferIsr first.
+ */
+void mcpLock(mcp_can_t *obj);
+
+/**
+ * Release the MCP2515 after mcpLock, then call obj->onUnlock if an interrupt handler put its work off meanwhile
+ */
+void mcpUnlock(mcp_can_t *obj);
+
+/**
+ * From an interrupt handler, before using the MCP2515: the interrupted thread may be part way through a transaction or
+ * a sequence that the handler's own transactions would corrupt.
+ *
+ * @returns 1 if so, and obj->onUnlock will be called by the thread as soon as it is over; 0 if the handler may go
+ * ahead (always 0 in thread context)
+ */
+uint8_t mcpDeferIsr(mcp_can_t *obj);
+
 /**
  * MCP2515 spi instructions
  */
@@ -94,6 +172,18 @@ void mcpBitModify(mcp_can_t *obj, const uint8_t address, const uint8_t mask, con
 
 #ifdef __cplusplus
 };
+
+/**
+ * Holds mcpLock for the lifetime of the object
+ */
+class MCP_Lock {
+ public:
+  MCP_Lock(mcp_can_t *obj) : _obj(obj) { mcpLock(_obj); }
+  ~MCP_Lock() { mcpUnlock(_obj); }
+
+ private:
+  mcp_can_t *_obj;
+};
 #endif
 
 #endif  // SEEED_CAN_SPI_H
\ No newline at end of file
@@ -0,0 +1,94 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark: CAN Ids encoded on every write(msg) against headers encoded once by prepare() for write(hdr, ...)
+//
+// Prints the host time per frame of the encoding alone and of a whole write, and the SPI bytes per frame that the
+// MCP2515 sees (on a target the SPI transfer is the bigger cost). Only the frames sent are checked, not the times.
+
+#include <chrono>
+
+#include "harness.h"
+
+#define BENCH_IDS 8
+#define BENCH_ENCODES 10000000
+#define BENCH_WRITES 20000
+
+static const uint32_t ids[BENCH_IDS] = {0x100, 0x123, 0x7FF, 0x18FEF100, 0x0CF00400, 0x1FFFFFFF, 0x010, 0x18DAF110};
+
+static CANFormat formatOf(uint32_t id) { return (id > 0x7FF) ? CANExtended : CANStandard; }
+
+static double nsSince(std::chrono::steady_clock::time_point start, uint32_t n) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+// Time of write(msg), or of write(hdr, ...) when prepared, per frame; SPI bytes per frame in spi
+static double writes(bool prepared, double &spi) {
+  SimRig rig;
+  SEEED_CANHeader hdr[BENCH_IDS];
+  SEEED_CANMessage msg[BENCH_IDS];
+  double ns = 0;
+
+  CHECK(rig.open());
+  for (int i = 0; i < BENCH_IDS; i++) {
+    hdr[i] = rig.a.prepare(ids[i], formatOf(ids[i]));
+    msg[i] = message(ids[i], 8, formatOf(ids[i]));
+  }
+  uint32_t spiBefore = rig.n1.stats().spiBytes;
+  for (uint32_t i = 0; i < BENCH_WRITES; i++) {
+    const SEEED_CANMessage &m = msg[i % BENCH_IDS];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int ok = prepared ? rig.a.write(hdr[i % BENCH_IDS], (const char *)m.data, m.len) : rig.a.write(m);
+    ns += nsSince(start, BENCH_WRITES);
+    CHECK(ok);
+    rig.bus.run(300000);  // Longer than an extended frame at 500 kbit/s
+  }
+  spi = (double)(rig.n1.stats().spiBytes - spiBefore) / BENCH_WRITES;
+  CHECK(rig.n1.stats().transmitted == BENCH_WRITES);
+  return ns;
+}
+
+int main() {
+  volatile uint8_t sink = 0;
+  SEEED_CANHeader hdr[BENCH_IDS];
+
+  for (int i = 0; i < BENCH_IDS; i++) {
+    mcpEncodeId(&hdr[i], formatOf(ids[i]), ids[i]);
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_ENCODES; i++) {
+    CANid h;
+    uint32_t id = ids[i % BENCH_IDS];
+    mcpEncodeId(&h, formatOf(id), id);
+    sink = sink + h.sid10_3 + h.eid7_0;
+  }
+  double encodeNs = nsSince(start, BENCH_ENCODES);
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_ENCODES; i++) {
+    CANid h = hdr[i % BENCH_IDS];
+    sink = sink + h.sid10_3 + h.eid7_0;
+  }
+  double copyNs = nsSince(start, BENCH_ENCODES);
+
+  double spiMsg, spiHdr;
+  double writeMsgNs = writes(false, spiMsg);
+  double writeHdrNs = writes(true, spiHdr);
+  CHECK(spiHdr <= spiMsg);
+
+  printf("header: encoded %.1f ns, prepared %.1f ns\n", encodeNs, copyNs);
+  printf("write(msg): %.0f ns, %.1f SPI bytes\n", writeMsgNs, spiMsg);
+  printf("write(hdr): %.0f ns, %.1f SPI bytes\n", writeHdrNs, spiHdr);
+  return finish();
+}
@@ -0,0 +1,117 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_HARNESS_H_
+#define _SEEED_CAN_HARNESS_H_
+
+/**
+ * Helpers shared by the host tests.
+ *
+ * CHECK() reports a failed condition and carries on, finish() returns the test's exit status. SimRig puts emulated
+ * MCP2515s on a virtual bus and wires them to the host's clock and pins: a node's chip select pin is the one given to
+ * the SEEED_CAN, and its INT pin is the next pin number.
+ */
+
+#include "seeed_can.h"
+#include "seeed_can_sim.h"
+
+static int harnessFailures = 0;
+
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);      \
+      harnessFailures++;                                                   \
+    }                                                                      \
+  } while (0)
+
+static inline int finish(void) {
+  printf("%s\n", harnessFailures ? "FAILED" : "passed");
+  return harnessFailures ? 1 : 0;
+}
+
+/**
+ * A virtual bus (500 kbit/s by default) on the host clock with two nodes, chip select pins 10 and 20 and INT pins 11
+ * and 21, and the SEEED_CANs (or a class derived from SEEED_CAN with the same constructor) driving them.
+ */
+template <class CAN = SEEED_CAN>
+class SimRigFor {
+ public:
+  SimRigFor(uint32_t bitRate = 500000, uint32_t seed = 1)
+      : bus(bitRate, seed), n1(bus, 10), n2(bus, 20), a(10, 11, 1, 2, 3), b(20, 21, 1, 2, 3) {
+    host::onTime(&SimRigFor::follow, this);
+    host::pinLevel(&SimRigFor::irqLevel, this);
+  }
+
+  ~SimRigFor() {
+    host::onTime(NULL);
+    host::pinLevel(NULL);
+  }
+
+  /**
+   * Open both SEEED_CANs at the bus bit rate.
+   */
+  bool open(SEEED_CAN::Mode mode = SEEED_CAN::Normal) {
+    return a.open((int)bus.bitRate(), mode) && b.open((int)bus.bitRate(), mode);
+  }
+
+  SEEED_CANSimBus bus;
+  SEEED_CANSimNode n1;
+  SEEED_CANSimNode n2;
+  CAN a;
+  CAN b;
+
+ private:
+  static void follow(uint64_t nowUs, void *context) {
+    SEEED_CANSimBus &bus = ((SimRigFor *)context)->bus;
+    if (nowUs * 1000 > bus.now()) {
+      bus.run(nowUs * 1000 - bus.now());
+    }
+  }
+
+  static int irqLevel(PinName pin, void *context) {
+    SEEED_CANSimNode *node = SEEED_CANSimNode::at(pin - 1);
+    return (node && node->interrupt()) ? 0 : 1;
+  }
+};
+
+typedef SimRigFor<> SimRig;
+
+/**
+ * A SEEED_CAN that lets a test reach its mcp_can_t, e.g. to hold the MCP2515 with mcpLock().
+ */
+class ChipCAN : public SEEED_CAN {
+ public:
+  ChipCAN(PinName ncs, PinName irq, PinName mosi, PinName miso, PinName clk) : SEEED_CAN(ncs, irq, mosi, miso, clk) {}
+  mcp_can_t *chip(void) { return &_can; }
+};
+
+/**
+ * A CAN message with data bytes 0, 1, 2...
+ */
+static inline SEEED_CANMessage message(uint32_t id, uint8_t len = 8, CANFormat format = CANStandard,
+                                       CANType type = CANData) {
+  SEEED_CANMessage msg;
+  msg.id = id;
+  msg.len = len;
+  msg.format = format;
+  msg.type = type;
+  for (uint8_t i = 0; i < 8; i++) {
+    msg.data[i] = i;
+  }
+  return msg;
+}
+
+#endif  // SEEED_CAN_HARNESS_H
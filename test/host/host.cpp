@@ -0,0 +1,162 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "rtos.h"
+
+#include <algorithm>
+#include <vector>
+
+// Longest step of host::run() between two looks at the interrupt pins
+#define HOST_RUN_STEP 10
+
+namespace host {
+uint32_t tickStep = 1;
+uint32_t yields = 0;
+
+static uint32_t clockUs = 0;
+static uint32_t isrDepth = 0;
+static uint32_t dispatched = 0;
+static void (*timeFn)(uint64_t, void *) = NULL;
+static void *timeContext = NULL;
+static int (*levelFn)(PinName, void *) = NULL;
+static void *levelContext = NULL;
+
+// Construction order of globals is not defined, so the registries are created on first use
+static std::vector<InterruptIn *> &pins(void) {
+  static std::vector<InterruptIn *> registry;
+  return registry;
+}
+
+static std::vector<Ticker *> &tickers(void) {
+  static std::vector<Ticker *> registry;
+  return registry;
+}
+
+uint32_t now(void) { return clockUs; }
+
+void advance(uint32_t us) {
+  clockUs += us;
+  if (timeFn) {
+    timeFn(clockUs, timeContext);
+  }
+}
+
+void run(uint32_t us) {
+  uint32_t end = clockUs + us;
+
+  while (true) {
+    for (size_t i = 0; i < pins().size(); i++) {
+      pins()[i]->sample();
+    }
+    for (size_t i = 0; i < tickers().size(); i++) {
+      if (tickers()[i]->due(clockUs)) {
+        tickers()[i]->fire();
+      }
+    }
+    if ((int32_t)(end - clockUs) <= 0) {
+      break;
+    }
+    uint32_t step = std::min<uint32_t>(end - clockUs, HOST_RUN_STEP);
+    for (size_t i = 0; i < tickers().size(); i++) {
+      if (tickers()[i]->active() && ((int32_t)(tickers()[i]->dueTime() - clockUs) > 0)) {
+        step = std::min<uint32_t>(step, tickers()[i]->dueTime() - clockUs);
+      }
+    }
+    advance(step);
+  }
+}
+
+void onTime(void (*fn)(uint64_t, void *), void *context) {
+  timeFn = fn;
+  timeContext = context;
+}
+
+void pinLevel(int (*fn)(PinName, void *), void *context) {
+  levelFn = fn;
+  levelContext = context;
+}
+
+int level(PinName pin) { return levelFn ? levelFn(pin, levelContext) : 1; }
+
+uint32_t interrupts(void) { return dispatched; }
+
+bool inIsr(void) { return isrDepth != 0; }
+
+// Run an interrupt handler
+static void dispatch(FunctionPointer &fn) {
+  isrDepth++;
+  dispatched++;
+  fn.call();
+  isrDepth--;
+}
+
+template <typename T>
+static void unregister(std::vector<T *> &registry, T *p) {
+  registry.erase(std::remove(registry.begin(), registry.end(), p), registry.end());
+}
+}  // namespace host
+
+InterruptIn::InterruptIn(PinName pin) : _pin(pin), _last(1), _enabled(true) { host::pins().push_back(this); }
+
+InterruptIn::InterruptIn(const InterruptIn &other)
+    : _pin(other._pin), _last(other._last), _enabled(other._enabled), _fall(other._fall), _rise(other._rise) {
+  host::pins().push_back(this);
+}
+
+InterruptIn::~InterruptIn() { host::unregister(host::pins(), this); }
+
+void InterruptIn::sample(void) {
+  int level = host::level(_pin);
+  if (level == _last) {
+    return;
+  }
+  _last = level;
+  FunctionPointer &fn = level ? _rise : _fall;
+  if (_enabled && fn) {
+    host::dispatch(fn);
+  }
+}
+
+Ticker::Ticker() : _periodUs(0), _due(0), _active(false), _oneShot(false) { host::tickers().push_back(this); }
+
+Ticker::~Ticker() { host::unregister(host::tickers(), this); }
+
+void Ticker::start(uint32_t us) {
+  _periodUs = us ? us : 1;
+  _due = host::now() + _periodUs;
+  _active = true;
+}
+
+void Ticker::fire(void) {
+  _due += _periodUs;
+  if ((int32_t)(host::now() - _due) >= 0) {  // Fell behind: a real Ticker does not burst to catch up either
+    _due = host::now() + _periodUs;
+  }
+  _active = !_oneShot;
+  host::dispatch(_fn);
+}
+
+uint32_t us_ticker_read(void) {
+  host::advance(host::tickStep);
+  return host::now();
+}
+
+void wait_us(int us) { host::advance((uint32_t)((us > 0) ? us : 0)); }
+
+osStatus Thread::yield(void) {
+  host::yields++;
+  return osOK;
+}
@@ -0,0 +1,274 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_HOST_MBED_H_
+#define _SEEED_CAN_HOST_MBED_H_
+
+/**
+ * Host (Linux) stand-in for the parts of the mbed 2 API the driver uses, so that the library and its tests build
+ * without a target. Build with SEEED_CAN_SIM so that the MCP2515s are emulated by seeed_can_sim.h.
+ *
+ * Time is virtual and counted in microseconds. It only moves when the code under test waits (wait_us()) or reads the
+ * clock (us_ticker_read() adds host::tickStep), or when the test calls host::run(). Interrupts are never taken behind
+ * the code's back: InterruptIn falling edges and Ticker callbacks are only dispatched by host::run(), in "interrupt
+ * context" (__get_IPSR() is non-zero while they run).
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <functional>
+
+typedef int PinName;
+#define NC ((PinName)-1)
+
+namespace host {
+extern uint32_t tickStep;  // Microseconds added by each us_ticker_read(), @b default: @p 1
+
+/**
+ * Returns the virtual time in microseconds.
+ */
+uint32_t now(void);
+
+/**
+ * Move the virtual time on without dispatching any interrupt.
+ */
+void advance(uint32_t us);
+
+/**
+ * Move the virtual time on, dispatching InterruptIn falling edges and due Ticker callbacks on the way.
+ */
+void run(uint32_t us);
+
+/**
+ * Called whenever the virtual time moves, e.g. to run a SEEED_CANSimBus up to the same time (NULL to remove it).
+ */
+void onTime(void (*fn)(uint64_t nowUs, void *context), void *context = NULL);
+
+/**
+ * Gives the level of input pins, which are high when there is no function (NULL to remove it).
+ */
+void pinLevel(int (*fn)(PinName pin, void *context), void *context = NULL);
+
+/**
+ * Returns the level of an input pin.
+ */
+int level(PinName pin);
+
+/**
+ * Returns the number of interrupt handlers (InterruptIn and Ticker callbacks) dispatched so far.
+ */
+uint32_t interrupts(void);
+
+/**
+ * Returns true while an interrupt handler runs.
+ */
+bool inIsr(void);
+}  // namespace host
+
+class FunctionPointer {
+ public:
+  FunctionPointer(void (*fn)(void) = NULL) { attach(fn); }
+  template <typename T>
+  FunctionPointer(T *object, void (T::*method)(void)) {
+    attach(object, method);
+  }
+  void attach(void (*fn)(void)) { _fn = fn ? std::function<void()>(fn) : std::function<void()>(); }
+  template <typename T>
+  void attach(T *object, void (T::*method)(void)) {
+    _fn = [object, method]() { (object->*method)(); };
+  }
+  void call(void) {
+    if (_fn) {
+      _fn();
+    }
+  }
+  operator bool(void) const { return (bool)_fn; }
+
+ private:
+  std::function<void()> _fn;
+};
+
+class SPI {
+ public:
+  SPI(PinName mosi, PinName miso, PinName sclk) : _bits(8), _mode(0), _hz(1000000) {}
+  void format(int bits, int mode = 0) {
+    _bits = bits;
+    _mode = mode;
+  }
+  void frequency(int hz = 1000000) { _hz = hz; }
+  int write(int value) { return 0xFF; }  // Nothing on the bus: MISO floats high
+  int hz(void) const { return _hz; }
+
+ private:
+  int _bits;
+  int _mode;
+  int _hz;
+};
+
+class DigitalOut {
+ public:
+  DigitalOut(PinName pin, int value = 0) : _pin(pin), _value(value) {}
+  void write(int value) { _value = value ? 1 : 0; }
+  int read(void) { return _value; }
+  DigitalOut &operator=(int value) {
+    write(value);
+    return *this;
+  }
+  operator int(void) { return _value; }
+
+ private:
+  PinName _pin;
+  int _value;
+};
+
+class DigitalIn {
+ public:
+  DigitalIn(PinName pin) : _pin(pin) {}
+  int read(void) { return host::level(_pin); }
+  operator int(void) { return read(); }
+
+ private:
+  PinName _pin;
+};
+
+class InterruptIn {
+ public:
+  InterruptIn(PinName pin);
+  InterruptIn(const InterruptIn &other);
+  ~InterruptIn();
+  void fall(void (*fn)(void)) { _fall.attach(fn); }
+  template <typename T>
+  void fall(T *object, void (T::*method)(void)) {
+    _fall.attach(object, method);
+  }
+  void rise(void (*fn)(void)) { _rise.attach(fn); }
+  template <typename T>
+  void rise(T *object, void (T::*method)(void)) {
+    _rise.attach(object, method);
+  }
+  void enable_irq(void) { _enabled = true; }
+  void disable_irq(void) { _enabled = false; }
+  int read(void) { return host::level(_pin); }
+  operator int(void) { return read(); }
+
+  // Host side, called by host::run()
+  void sample(void);
+
+ private:
+  PinName _pin;
+  int _last;
+  bool _enabled;
+  FunctionPointer _fall;
+  FunctionPointer _rise;
+};
+
+class Ticker {
+ public:
+  Ticker();
+  virtual ~Ticker();
+  void attach_us(void (*fn)(void), uint32_t us) {
+    _fn.attach(fn);
+    start(us);
+  }
+  template <typename T>
+  void attach_us(T *object, void (T::*method)(void), uint32_t us) {
+    _fn.attach(object, method);
+    start(us);
+  }
+  void attach(void (*fn)(void), float s) { attach_us(fn, (uint32_t)(s * 1000000.0f)); }
+  template <typename T>
+  void attach(T *object, void (T::*method)(void), float s) {
+    attach_us(object, method, (uint32_t)(s * 1000000.0f));
+  }
+  void detach(void) { _active = false; }
+
+  // Host side, called by host::run()
+  bool due(uint32_t now) const { return _active && ((int32_t)(now - _due) >= 0); }
+  uint32_t dueTime(void) const { return _due; }
+  bool active(void) const { return _active; }
+  void fire(void);
+
+ protected:
+  void start(uint32_t us);
+
+  FunctionPointer _fn;
+  uint32_t _periodUs;
+  uint32_t _due;
+  bool _active;
+  bool _oneShot;
+};
+
+class Timeout : public Ticker {
+ public:
+  Timeout() { _oneShot = true; }
+};
+
+class Timer {
+ public:
+  Timer() : _start(0), _total(0), _running(false) {}
+  void start(void) {
+    if (!_running) {
+      _start = host::now();
+      _running = true;
+    }
+  }
+  void stop(void) {
+    _total = elapsed();
+    _running = false;
+  }
+  void reset(void) {
+    _start = host::now();
+    _total = 0;
+  }
+  int read_us(void) { return (int)elapsed(); }
+  int read_ms(void) { return (int)(elapsed() / 1000); }
+  float read(void) { return elapsed() / 1000000.0f; }
+
+ private:
+  uint32_t elapsed(void) { return _total + (_running ? (host::now() - _start) : 0); }
+
+  uint32_t _start;
+  uint32_t _total;
+  bool _running;
+};
+
+uint32_t us_ticker_read(void);
+void wait_us(int us);
+inline void wait_ms(int ms) { wait_us(ms * 1000); }
+inline void wait(float s) { wait_us((int)(s * 1000000.0f)); }
+
+// Cortex-M intrinsics and mbed critical sections: the host runs one thread, so they only need to exist
+inline void __disable_irq(void) {}
+inline void __enable_irq(void) {}
+inline void __DMB(void) { __sync_synchronize(); }
+inline uint32_t __get_IPSR(void) { return host::inIsr() ? 16 : 0; }
+inline void core_util_critical_section_enter(void) {}
+inline void core_util_critical_section_exit(void) {}
+inline bool core_util_atomic_cas_u32(uint32_t *ptr, uint32_t *expected, uint32_t desired) {
+  uint32_t seen = __sync_val_compare_and_swap(ptr, *expected, desired);
+  if (seen == *expected) {
+    return true;
+  }
+  *expected = seen;
+  return false;
+}
+inline uint32_t core_util_atomic_incr_u32(uint32_t *ptr, uint32_t delta) { return __sync_add_and_fetch(ptr, delta); }
+
+#endif  // SEEED_CAN_HOST_MBED_H
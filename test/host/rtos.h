@@ -0,0 +1,111 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SEEED_CAN_HOST_RTOS_H_
+#define _SEEED_CAN_HOST_RTOS_H_
+
+/**
+ * Host stand-in for the parts of the mbed-rtos API the driver uses with SEEED_CAN_RTOS. The host runs one thread: a
+ * Thread is created but never started, so tests call the driver thread's service functions themselves, and a Mutex
+ * only counts how deeply it is held.
+ */
+
+#include "mbed.h"
+
+typedef enum {
+  osPriorityIdle = -3,
+  osPriorityLow = -2,
+  osPriorityBelowNormal = -1,
+  osPriorityNormal = 0,
+  osPriorityAboveNormal = 1,
+  osPriorityHigh = 2,
+  osPriorityRealtime = 3
+} osPriority;
+
+typedef enum { osOK = 0, osEventSignal = 0x08, osEventTimeout = 0x40, osErrorResource = 0x81 } osStatus;
+
+#define osWaitForever 0xFFFFFFFF
+#define DEFAULT_STACK_SIZE 2048
+
+typedef struct {
+  osStatus status;
+  union {
+    uint32_t v;
+    int32_t signals;
+  } value;
+} osEvent;
+
+namespace host {
+extern uint32_t yields;  // Number of Thread::yield() calls
+}
+
+class Mutex {
+ public:
+  Mutex() : _depth(0) {}
+  osStatus lock(uint32_t millisec = osWaitForever) {
+    _depth++;
+    return osOK;
+  }
+  bool trylock(void) {
+    _depth++;
+    return true;
+  }
+  osStatus unlock(void) {
+    _depth--;
+    return osOK;
+  }
+  uint32_t depth(void) const { return _depth; }
+
+ private:
+  uint32_t _depth;
+};
+
+class Semaphore {
+ public:
+  Semaphore(int32_t count = 0) : _count(count) {}
+  int32_t wait(uint32_t millisec = osWaitForever) { return (_count > 0) ? _count-- : 0; }
+  osStatus release(void) {
+    _count++;
+    return osOK;
+  }
+
+ private:
+  int32_t _count;
+};
+
+class Thread {
+ public:
+  Thread(void (*task)(void const *argument), void *argument = NULL, osPriority priority = osPriorityNormal,
+         uint32_t stackSize = DEFAULT_STACK_SIZE, unsigned char *stackPointer = NULL)
+      : _signals(0) {}
+  int32_t signal_set(int32_t signals) { return _signals |= signals; }
+  int32_t signals(void) const { return _signals; }
+  static osEvent signal_wait(int32_t signals, uint32_t millisec = osWaitForever) {
+    osEvent evt;
+    evt.status = osEventTimeout;
+    evt.value.signals = 0;
+    return evt;
+  }
+  static osStatus wait(uint32_t millisec) {
+    wait_ms((int)millisec);
+    return osOK;
+  }
+  static osStatus yield(void);
+
+ private:
+  int32_t _signals;
+};
+
+#endif  // SEEED_CAN_HOST_RTOS_H
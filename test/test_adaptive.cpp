@@ -0,0 +1,64 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Adaptive receive mode: interrupts at low frame rates, polling at high ones
+
+#include "harness.h"
+
+// Send one frame every periodUs for durationUs, reading everything that arrives; returns the number of frames read
+static uint32_t traffic(SimRig &rig, uint32_t periodUs, uint32_t durationUs) {
+  SEEED_CANMessage r;
+  uint32_t n = 0;
+  for (uint32_t t = 0; t < durationUs; t += periodUs) {
+    CHECK(rig.a.write(message(0x100 + (t / periodUs) % 16)));
+    host::run(periodUs);
+    while (rig.b.read(r)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+int main() {
+  SimRig rig;
+  CHECK(rig.open());
+  rig.b.adaptive(true, 2000, 500, 400);  // Two receive buffers hold 460 us of back to back frames
+  uint32_t sent = rig.n1.stats().transmitted;
+
+  uint32_t read = traffic(rig, 2000, 100000);  // 500 frames a second: one interrupt each
+  SEEED_CAN::RxModeStats s = rig.b.rxModeStats();
+  CHECK(!s.polling && (s.toPolling == 0));
+  CHECK((s.irqFrames == 50) && (s.polledFrames == 0));
+
+  read += traffic(rig, 250, 100000);  // 4000 frames a second: polled, far fewer interrupts than frames
+  s = rig.b.rxModeStats();
+  CHECK(s.polling && (s.toPolling == 1));
+  CHECK(s.rate > 2000);
+  CHECK(s.polledFrames > 300);
+  uint32_t interrupts = host::interrupts();
+
+  read += traffic(rig, 5000, 100000);  // 200 frames a second: back to interrupts
+  s = rig.b.rxModeStats();
+  CHECK(!s.polling && (s.toIrq == 1));
+  CHECK(host::interrupts() - interrupts < 200);  // The poller stopped ticking
+
+  uint32_t frames = rig.n1.stats().transmitted - sent;
+  CHECK((frames == 50 + 400 + 20) && (read == frames));
+  CHECK(s.irqFrames + s.polledFrames == frames);
+  CHECK(rig.b.rxOverflows(SEEED_CAN::RxBulk) + rig.b.rxOverflows(SEEED_CAN::RxControl) == 0);
+  rig.b.adaptive(false);
+  CHECK(!rig.b.rxModeStats().polling);
+  return finish();
+}
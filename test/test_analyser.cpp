@@ -0,0 +1,51 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Bus load and per CAN Id bandwidth analyser, fed with the frames of a simulated bus
+
+#include "harness.h"
+#include "seeed_can_analyser.h"
+
+static uint64_t bits = 0;
+
+static void monitor(const SEEED_CANFrame &frame, uint64_t endNs, void *context) {
+  SEEED_CANMessage msg;
+  frame.unpack(msg);
+  bits += ((SEEED_CANAnalyser *)context)->add(msg, (uint32_t)(endNs / 1000));
+}
+
+int main() {
+  SimRig rig;
+  SEEED_CANAnalyser analyser(500000, SEEED_CANAnalyser::Exact, 100000);
+  CHECK(rig.open());
+  rig.bus.monitor(monitor, &analyser);
+
+  for (uint32_t t = 0; t < 100000; t += 500) {  // One window of traffic, a frame every 500 us
+    CHECK(rig.a.write(message((t % 1000) ? 0x100 : 0x200)));
+    host::run(500);
+  }
+  uint64_t bitNs = 1000000000ULL / rig.bus.bitRate();  // Exact lengths add up to the time the bus was busy
+  CHECK(bits * bitNs == rig.bus.stats().busyNs);
+  SEEED_CANAnalyser::IdStats s;
+  CHECK(analyser.find(0x200, CANStandard, s) && (s.frames == 100) && (s.period == 1000) && (s.jitter == 0));
+  uint32_t busy = (uint32_t)(bits * 1000 / (500000 / 10));  // Tenths of a percent of the 100 ms window
+
+  host::run(350000);  // Idle for several windows, then a single frame closes them all at once
+  CHECK(rig.a.write(message(0x100)));
+  host::run(1000);
+  CHECK(analyser.load() == 0);
+  CHECK((analyser.peakLoad() + 10 > busy) && (analyser.peakLoad() <= busy));
+  return finish();
+}
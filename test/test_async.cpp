@@ -0,0 +1,96 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Completion based asynchronous front end
+
+#include "harness.h"
+#include "seeed_can_async.h"
+
+static uint32_t completed[SEEED_CANRequest::Timeout + 1];
+static uint32_t slowCompletions = 0;
+
+static void done(SEEED_CANRequest *req) { completed[req->result]++; }
+
+// A completion function that takes a while, long enough for another frame to go out meanwhile
+static void slow(SEEED_CANRequest *req) {
+  done(req);
+  if (slowCompletions++ == 0) {
+    host::advance(300);
+  }
+}
+
+int main() {
+  {  // Writes, a read and configuration changes complete in submission order
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANAsync async(rig.b);
+    SEEED_CANRequest read, filter, write;
+    CHECK(async.read(read, done, 100000));
+    CHECK(!async.read(read, done));  // Already outstanding
+    CHECK(async.filter(filter, 0, 0x123, CANStandard, done));
+    CHECK(async.write(write, message(0x321), done));
+    async.start(100);
+    CHECK(rig.a.write(message(0x123)));
+    host::run(5000);
+    async.stop();
+    CHECK((read.result == SEEED_CANRequest::Received) && (read.msg.id == 0x123));
+    CHECK(filter.result == SEEED_CANRequest::Done);
+    CHECK((write.result == SEEED_CANRequest::Sent) && (write.txBuf == 0));
+    CHECK(async.process() == 0);
+  }
+  {  // A buffer whose frame went out after processWrites() looked at it is not reused over its unfinished request
+    memset(completed, 0, sizeof(completed));
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANAsync async(rig.a);
+    SEEED_CANRequest w[4];
+    for (int i = 0; i < 3; i++) {
+      CHECK(async.write(w[i], message(0x100), slow));
+    }
+    CHECK(async.process() == 3);  // All three loaded, buffer 2 goes first
+    host::advance(300);
+    CHECK(async.write(w[3], message(0x100), slow));
+    async.process();  // Completes buffer 2's write, another frame goes out meanwhile and w[3] is loaded after it
+    host::advance(1000);
+    CHECK(async.process() == 0);
+    for (int i = 0; i < 4; i++) {
+      CHECK(w[i].result == SEEED_CANRequest::Sent);
+    }
+    CHECK(completed[SEEED_CANRequest::Sent] == 4);
+    CHECK(rig.n1.stats().transmitted == 4);
+  }
+  {  // The Ticker leaves the MCP2515 alone while the main loop holds it, and mode changes to thread context
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    SEEED_CANAsync async(rig.a);
+    SEEED_CANRequest write, mode, filter;
+    CHECK(async.write(write, message(0x100), done));
+    CHECK(async.mode(mode, SEEED_CAN::Normal, done));
+    CHECK(async.filter(filter, 0, 0x123, CANStandard, done));
+    async.start(100);
+    mcpLock(rig.a.chip());
+    host::run(2000);
+    CHECK(write.result == SEEED_CANRequest::Pending);
+    CHECK(rig.n1.stats().transmitted == 0);
+    mcpUnlock(rig.a.chip());
+    host::run(2000);
+    CHECK(write.result == SEEED_CANRequest::Sent);
+    CHECK((mode.result == SEEED_CANRequest::Pending) && (filter.result == SEEED_CANRequest::Pending));
+    async.stop();
+    CHECK(async.process() == 0);  // The main loop
+    CHECK((mode.result == SEEED_CANRequest::Done) && (filter.result == SEEED_CANRequest::Done));
+  }
+  return finish();
+}
@@ -0,0 +1,65 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Automatic bit rate detection: candidates are probed in Listen Only mode, so wrong guesses never disturb the bus,
+// and the shield is left open in the requested mode at the rate found
+
+#include "harness.h"
+
+int main() {
+  {  // 500 kbit/s is tried and abandoned, 250 kbit/s locks, no node ever sees an error frame
+    SimRig rig(250000);
+    SEEED_CANFrame f;
+    memset(&f, 0, sizeof(f));
+    f.ident = 0x100;
+    f.dlc = 8;
+    rig.bus.source(f, 2000, 0, true);
+    f.ident = 0x1ABCDE | CAN_FRAME_IDE;
+    rig.bus.source(f, 3000, 100, true);
+
+    SEEED_CAN::BaudStep steps[CAN_BAUD_RATES];
+    CHECK(rig.a.autoBaud(SEEED_CAN::Normal, 100, NULL, 0, steps) == 250000);
+    CHECK((steps[0].hz == 500000) && (steps[0].frames == 0) && (steps[0].errors >= CAN_BAUD_ERRORS));
+    CHECK((steps[1].hz == 250000) && (steps[1].frames >= CAN_BAUD_FRAMES) && (steps[1].errors == 0));
+    CHECK(rig.bus.stats().errorFrames == 0);  // Listen Only mode sends neither error frames nor acknowledges
+    CHECK(rig.n1.stats().transmitted == 0);
+    CHECK(rig.n1.peek(MCP_TEC) == 0);
+    CHECK((rig.n1.peek(MCP_CANSTAT) & MODE_MASK) == MODE_NORMAL);
+
+    CHECK(rig.a.write(message(0x200, 1)));  // Open at the rate found
+    host::run(2000);
+    CHECK(rig.n1.stats().transmitted == 1);
+  }
+  {  // A mode asked for is entered once the rate is found
+    SimRig rig(125000);
+    SEEED_CANFrame f;
+    memset(&f, 0, sizeof(f));
+    f.ident = 0x300;
+    f.dlc = 2;
+    CHECK(rig.b.open(125000));  // Acknowledges the source, a Listen Only node does not
+    rig.bus.source(f, 1000);
+    static const int rates[] = {1000000, 125000};
+    CHECK(rig.a.autoBaud(SEEED_CAN::Monitor, 50, rates, 2) == 125000);
+    CHECK((rig.n1.peek(MCP_CANSTAT) & MODE_MASK) == MODE_LISTENONLY);
+    CHECK(rig.bus.stats().errorFrames == 0);
+  }
+  {  // A silent bus is not detected, the MCP2515 is left reset
+    SimRig rig;
+    CHECK(rig.a.autoBaud(SEEED_CAN::Normal, 10) == 0);
+    CHECK((rig.n1.peek(MCP_CANSTAT) & MODE_MASK) == MODE_CONFIG);
+    CHECK(rig.n1.peek(MCP_CNF1) == 0);
+  }
+  return finish();
+}
@@ -0,0 +1,94 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Batched reads: both receive buffers read in one call, oldest first, lost frames reported once, the on-change filter
+// applied, and the software queues emptied control first
+
+#include "harness.h"
+#include "seeed_can_change.h"
+
+// Send frames from a to b one after the other, without reading them
+static void send(SimRig &rig, uint32_t firstId, uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    CHECK(rig.a.write(message(firstId + i)));
+    host::run(400);
+  }
+}
+
+int main() {
+  {  // Both receive buffers in one call, the older message first
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANMessage msgs[8];
+    CHECK(rig.b.readBatch(msgs, 8) == 0);
+
+    send(rig, 0x100, 2);
+    CHECK(rig.b.readBatch(msgs, 8) == 2);
+    CHECK((msgs[0].id == 0x100) && (msgs[1].id == 0x101) && (msgs[1].len == 8) && (msgs[1].data[7] == 7));
+    CHECK(rig.b.readBatch(msgs, 8) == 0);
+
+    CHECK(rig.b.filter(2, 0, CANExtended));  // Filters 0 and 1 stay standard
+    CHECK(rig.a.write(message(0x1ABCDE, 3, CANExtended, CANRemote)));
+    host::run(400);
+    CHECK(rig.b.readBatch(msgs, 8) == 1);
+    CHECK((msgs[0].id == 0x1ABCDE) && (msgs[0].format == CANExtended) && (msgs[0].type == CANRemote));
+  }
+  {  // No room for RXB1: it stays for the next call
+    SimRig rig;
+    CHECK(rig.open());
+    send(rig, 0x200, 2);
+    SEEED_CANMessage msgs[2];
+    CHECK((rig.b.readBatch(msgs, 1) == 1) && (msgs[0].id == 0x200));
+    CHECK((rig.b.readBatch(msgs, 2) == 1) && (msgs[0].id == 0x201));
+  }
+  {  // Frames lost to full receive buffers are reported by the next batch only
+    SimRig rig;
+    CHECK(rig.open());
+    send(rig, 0x300, 3);
+    SEEED_CANMessage msgs[8];
+    unsigned int lost = 0;
+    CHECK(rig.b.readBatch(msgs, 8, &lost) == 2);
+    CHECK(lost == 1);
+    send(rig, 0x310, 1);
+    CHECK((rig.b.readBatch(msgs, 8, &lost) == 1) && (msgs[0].id == 0x310));
+    CHECK(lost == 0);
+  }
+  {  // The on-change filter applies as it does to read()
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANChangeFilter filter;
+    CHECK(filter.subscribe(0x400, CANStandard));
+    rig.b.changeFilter(&filter);
+    send(rig, 0x400, 1);
+    SEEED_CANMessage msgs[8];
+    CHECK(rig.b.readBatch(msgs, 8) == 1);
+    send(rig, 0x400, 1);
+    CHECK(rig.b.readBatch(msgs, 8) == 0);
+  }
+  {  // In priority mode the batch comes from the software queues, control traffic first
+    SimRig rig;
+    CHECK(rig.open());
+    CHECK(rig.b.mask(0, 0x7FF));
+    CHECK(rig.b.filter(0, 0x010));
+    rig.b.priority(true);
+    send(rig, 0x500, 3);
+    CHECK(rig.a.write(message(0x010)));
+    host::run(1000);
+    SEEED_CANMessage msgs[8];
+    CHECK(rig.b.readBatch(msgs, 8) == 4);
+    CHECK((msgs[0].id == 0x010) && (msgs[1].id == 0x500) && (msgs[2].id == 0x501) && (msgs[3].id == 0x502));
+  }
+  return finish();
+}
@@ -0,0 +1,242 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SLCAN bridge driven through a pseudo-terminal, as a PC would drive it through a serial port: first against a
+// test double of the CAN interface, then bridging a SEEED_CAN on the simulator
+
+#include "harness.h"
+#include "seeed_can_bridge.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+
+// The bridge's end of a pseudo-terminal, with the RawSerial calls pump() uses
+class PtySerial {
+ public:
+  explicit PtySerial(int fd) : _fd(fd) {}
+  bool readable(void) { return ready(POLLIN); }
+  int getc(void) {
+    uint8_t c = 0;
+    return (read(_fd, &c, 1) == 1) ? c : -1;
+  }
+  bool writeable(void) { return ready(POLLOUT); }
+  int putc(int c) {
+    uint8_t b = (uint8_t)c;
+    return (write(_fd, &b, 1) == 1) ? c : -1;
+  }
+
+ private:
+  bool ready(short events) {
+    struct pollfd p = {_fd, events, 0};
+    return (poll(&p, 1, 0) == 1) && (p.revents & events);
+  }
+
+  int _fd;
+};
+
+// A pseudo-terminal pair: master for the bridge, slave in raw mode for the "PC"
+class Pty {
+ public:
+  Pty() : master(-1), slave(-1) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || grantpt(master) || unlockpt(master)) {
+      return;
+    }
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios t;
+    if ((slave >= 0) && !tcgetattr(slave, &t)) {
+      cfmakeraw(&t);  // No CR to LF translation, no echo
+      tcsetattr(slave, TCSANOW, &t);
+    }
+  }
+  ~Pty() {
+    if (slave >= 0) {
+      close(slave);
+    }
+    if (master >= 0) {
+      close(master);
+    }
+  }
+
+  bool ok(void) { return (master >= 0) && (slave >= 0); }
+
+  void send(const std::string &text) { CHECK(write(slave, text.data(), text.size()) == (ssize_t)text.size()); }
+
+  // Everything the bridge has written so far
+  std::string receive(void) {
+    std::string text;
+    struct pollfd p = {slave, POLLIN, 0};
+    char buf[256];
+    while ((poll(&p, 1, 50) == 1) && (p.revents & POLLIN)) {
+      ssize_t n = read(slave, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      text.append(buf, (size_t)n);
+    }
+    return text;
+  }
+
+  int master;
+  int slave;
+};
+
+// CAN interface test double: records what the bridge asks for and hands out queued frames
+struct Double {
+  uint32_t bitRate;
+  bool open;
+  SEEED_CANFrame sent[4];
+  uint32_t nSent;
+  SEEED_CANFrame waiting[4];
+  uint32_t nWaiting;
+  int status;
+
+  static int handler(SEEED_CANBridge::Request request, SEEED_CANFrame *frame, uint32_t bitRate, void *context) {
+    Double *d = (Double *)context;
+    switch (request) {
+      case SEEED_CANBridge::Open:
+      case SEEED_CANBridge::Listen:
+        d->bitRate = bitRate;
+        d->open = true;
+        return 1;
+      case SEEED_CANBridge::Close:
+        d->open = false;
+        return 1;
+      case SEEED_CANBridge::Transmit:
+        if (d->nSent == 4) {
+          return 0;
+        }
+        d->sent[d->nSent++] = *frame;
+        return 1;
+      case SEEED_CANBridge::Status:
+        return d->status;
+      case SEEED_CANBridge::Receive:
+        if (!d->nWaiting) {
+          return 0;
+        }
+        *frame = d->waiting[0];
+        memmove(&d->waiting[0], &d->waiting[1], --d->nWaiting * sizeof(SEEED_CANFrame));
+        return 1;
+      default:
+        return 0;
+    }
+  }
+};
+
+static SEEED_CANFrame frame(uint32_t ident, uint8_t dlc) {
+  SEEED_CANFrame f;
+  memset(&f, 0, sizeof(f));
+  f.ident = ident;
+  f.dlc = dlc;
+  for (uint8_t i = 0; i < 8; i++) {
+    f.data[i] = (uint8_t)(0x11 * (i + 1));
+  }
+  return f;
+}
+
+// Send a command line and return the bridge's answer
+static std::string exchange(Pty &pty, SEEED_CANBridge &bridge, const std::string &text) {
+  PtySerial serial(pty.master);
+  pty.send(text);
+  std::string answer;
+  for (int i = 0; i < 4; i++) {  // Long answers take more than one pump()
+    bridge.pump(serial);
+    answer += pty.receive();
+  }
+  return answer;
+}
+
+int main() {
+  {  // The protocol against a test double
+    Pty pty;
+    CHECK(pty.ok());
+    Double d;
+    memset(&d, 0, sizeof(d));
+    d.status = SLCAN_ERROR_WARNING;
+    SEEED_CANBridge bridge;
+    bridge.attach(&Double::handler, &d);
+
+    CHECK(exchange(pty, bridge, "V\r") == "V0101\r");
+    CHECK(exchange(pty, bridge, "t1230\r") == "\a");  // Not open yet
+    CHECK(exchange(pty, bridge, "S4\r") == "\r");
+    CHECK(exchange(pty, bridge, "O\r") == "\r");
+    CHECK(d.open && (d.bitRate == 125000));
+    CHECK(exchange(pty, bridge, "S6\r") == "\a");  // Not while open
+
+    CHECK(exchange(pty, bridge, "t1232AABB\r") == "z\r");
+    CHECK(exchange(pty, bridge, "R01ABCDEF3\r\n") == "Z\r");  // Some terminals send CR LF
+    CHECK(exchange(pty, bridge, "t12329AABBCCDDEEFF001122\r") == "\a");  // DLC 9
+    CHECK(exchange(pty, bridge, "t1232AA\r") == "\a");                   // Data bytes missing
+    CHECK(d.nSent == 2);
+    CHECK((d.sent[0].ident == 0x123) && (d.sent[0].dlc == 2) && (d.sent[0].data[0] == 0xAA) &&
+          (d.sent[0].data[1] == 0xBB));
+    CHECK((d.sent[1].ident == (0x1ABCDEF | CAN_FRAME_IDE | CAN_FRAME_RTR)) && (d.sent[1].dlc == 3));
+    CHECK(exchange(pty, bridge, "F\r") == "F04\r");
+
+    d.waiting[d.nWaiting++] = frame(0x321, 2);
+    d.waiting[d.nWaiting++] = frame(0x1234567 | CAN_FRAME_IDE | CAN_FRAME_RTR, 4);
+    CHECK(exchange(pty, bridge, "") == "t32121122\rR012345674\r");
+
+    // Binary framing: one batch of two records, with its header and Fletcher-16 sums
+    CHECK(exchange(pty, bridge, "B1\r") == "\r");
+    CHECK(bridge.binary());
+    d.waiting[d.nWaiting++] = frame(0x100, 1);
+    d.waiting[d.nWaiting++] = frame(0x200, 0);
+    std::string batch = exchange(pty, bridge, "");
+    CHECK(batch.size() == CAN_BRIDGE_HEADER + (9 + 1) + 9 + CAN_BRIDGE_TRAILER);
+    if (batch.size() == CAN_BRIDGE_HEADER + (9 + 1) + 9 + CAN_BRIDGE_TRAILER) {
+      const uint8_t *b = (const uint8_t *)batch.data();
+      CHECK((b[0] == CAN_BRIDGE_SYNC0) && (b[1] == CAN_BRIDGE_SYNC1) && (b[2] == 2) && (b[3] == 0));
+      CHECK((b[4] == 0) && (b[5] == 0) && (b[6] == 0) && (b[7] == 0));  // Sequence number of the first frame
+      CHECK((b[12] == 0x00) && (b[13] == 0x01) && (b[16] == 1) && (b[17] == 0x11));
+      CHECK((b[22] == 0x00) && (b[23] == 0x02) && (b[26] == 0));
+      uint32_t sum1 = 0;
+      uint32_t sum2 = 0;
+      for (size_t i = 0; i < batch.size() - CAN_BRIDGE_TRAILER; i++) {
+        sum1 = (sum1 + b[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+      }
+      CHECK((b[batch.size() - 2] == sum1) && (b[batch.size() - 1] == sum2));
+    }
+    CHECK(exchange(pty, bridge, "C\r") == "\r");
+    CHECK(!d.open);
+  }
+  {  // Bridging a SEEED_CAN: frames go both ways between the pseudo-terminal and another node on the bus
+    Pty pty;
+    CHECK(pty.ok());
+    SimRig rig;
+    CHECK(rig.b.open(500000));
+    SEEED_CANBridge bridge;
+    bridge.attach(rig.a);
+
+    CHECK(exchange(pty, bridge, "S6\r") == "\r");
+    CHECK(exchange(pty, bridge, "O\r") == "\r");
+    CHECK(exchange(pty, bridge, "t2001AA\r") == "z\r");
+    host::run(1000);
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r) && (r.id == 0x200) && (r.len == 1) && (r.data[0] == 0xAA));
+
+    CHECK(rig.b.write(message(0x100, 3)));
+    host::run(1000);
+    CHECK(exchange(pty, bridge, "") == "t1003000102\r");
+    CHECK(exchange(pty, bridge, "F\r") == "F00\r");
+    CHECK(exchange(pty, bridge, "C\r") == "\r");
+  }
+  return finish();
+}
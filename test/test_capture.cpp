@@ -0,0 +1,128 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Raw capture ring: wrap and overflow, a producer thread and a consumer thread sharing it without locks, and frames
+// captured by the receive interrupt through the simulator
+
+#include "harness.h"
+#include "seeed_can_capture.h"
+
+#include <thread>
+
+#define CAPTURE_FRAMES 200000
+
+// Fill every register of a slot with the same sequence byte, so that a torn copy shows
+static void fill(SEEED_CANRawFrame &raw, uint32_t seq) {
+  raw.stampUs = seq;
+  raw.rxStatus = (uint8_t)seq;
+  memset(raw.regs, (uint8_t)seq, sizeof(raw.regs));
+}
+
+static bool whole(const SEEED_CANRawFrame &raw, uint32_t seq) {
+  if ((raw.stampUs != seq) || (raw.rxStatus != (uint8_t)seq)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < CAN_FRAME_REGS; i++) {
+    if (raw.regs[i] != (uint8_t)seq) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  {  // A full ring drops new frames, the slots come back in order as the consumer takes them
+    SEEED_CANCapture ring;
+    SEEED_CANRawFrame raw;
+    for (uint32_t i = 0; i < CAN_CAPTURE_DEPTH + 3; i++) {
+      SEEED_CANRawFrame *slot = ring.claim();
+      CHECK((slot != NULL) == (i < CAN_CAPTURE_DEPTH));
+      if (slot) {
+        fill(*slot, i);
+        ring.commit();
+      }
+    }
+    CHECK((ring.count() == CAN_CAPTURE_DEPTH) && (ring.overflows() == 3));
+    for (uint32_t i = 0; i < CAN_CAPTURE_DEPTH / 2; i++) {
+      CHECK(ring.pop(raw) && whole(raw, i));
+    }
+    for (uint32_t i = CAN_CAPTURE_DEPTH; i < CAN_CAPTURE_DEPTH + CAN_CAPTURE_DEPTH / 2; i++) {
+      SEEED_CANRawFrame *slot = ring.claim();  // Wraps round
+      CHECK(slot != NULL);
+      if (slot) {
+        fill(*slot, i);
+        ring.commit();
+      }
+    }
+    for (uint32_t i = CAN_CAPTURE_DEPTH / 2; i < CAN_CAPTURE_DEPTH + CAN_CAPTURE_DEPTH / 2; i++) {
+      CHECK(ring.pop(raw) && whole(raw, i));
+    }
+    CHECK(!ring.pop(raw) && (ring.count() == 0));
+  }
+  {  // One producer and one consumer thread: every frame arrives whole and in order
+    static SEEED_CANCapture ring;
+    std::thread producer([]() {
+      for (uint32_t seq = 0; seq < CAPTURE_FRAMES;) {
+        SEEED_CANRawFrame *slot = ring.claim();
+        if (slot) {
+          fill(*slot, seq++);
+          ring.commit();
+        }
+      }
+    });
+    uint32_t next = 0;
+    bool ok = true;
+    SEEED_CANRawFrame raw;
+    while (next < CAPTURE_FRAMES) {
+      if (ring.pop(raw)) {
+        ok = ok && whole(raw, next);
+        next++;
+      }
+    }
+    producer.join();
+    CHECK(ok);
+  }
+  {  // The receive interrupt fills the ring, read() decodes in bulk
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANCapture ring;
+    rig.b.capture(&ring);
+    rig.b.priority(true);
+    for (uint32_t i = 0; i < 10; i++) {
+      CHECK(rig.a.write(message(0x400 + i, (uint8_t)(i % 9))));
+      host::run(300);
+    }
+    CHECK(rig.a.write(message(0x1ABCDE, 2, CANExtended)));
+    host::run(1000);
+    SEEED_CANMessage r;
+    CHECK(!rig.b.read(r));  // Captured frames bypass the software queues
+    CHECK(ring.count() == 10);  // The extended frame matches none of the (standard) filters
+
+    SEEED_CANMessage msgs[16];
+    uint8_t filhit[16];
+    CHECK(ring.read(msgs, 4, filhit) == 4);
+    SEEED_CANFrame frames[16];
+    CHECK(ring.read(frames, 16) == 6);
+    for (uint32_t i = 0; i < 10; i++) {
+      uint32_t id = (i < 4) ? msgs[i].id : frames[i - 4].id();
+      uint8_t len = (i < 4) ? msgs[i].len : frames[i - 4].dlc;
+      const unsigned char *data = (i < 4) ? msgs[i].data : frames[i - 4].data;
+      CHECK((id == 0x400 + i) && (len == i % 9) && ((len == 0) || (data[len - 1] == len - 1)));
+    }
+    CHECK(filhit[0] <= 1);
+    CHECK(ring.overflows() == 0);
+  }
+  return finish();
+}
@@ -0,0 +1,138 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// On-change delivery filter: repeats held back, every N-th repeat and timeouts let through, and frames received
+// through the simulator filtered before read() in direct and priority receive mode
+
+#include "harness.h"
+#include "seeed_can_change.h"
+
+static SEEED_CANFrame frame(uint32_t ident, uint8_t dlc, uint8_t first) {
+  SEEED_CANFrame f;
+  memset(&f, 0, sizeof(f));
+  f.ident = ident;
+  f.dlc = dlc;
+  f.data[0] = first;
+  return f;
+}
+
+// Send a frame from a to b and count the messages read() gives b
+static uint32_t deliver(SimRig &rig, const SEEED_CANMessage &msg) {
+  CHECK(rig.a.write(msg));
+  host::run(500);
+  SEEED_CANMessage r;
+  uint32_t n = 0;
+  while (rig.b.read(r)) {
+    CHECK((r.id == msg.id) && (r.len == msg.len) && !memcmp(r.data, msg.data, msg.len));
+    n++;
+  }
+  return n;
+}
+
+int main() {
+  {  // Repeats are suppressed until the payload or the DLC changes
+    SEEED_CANChangeFilter filter;
+    CHECK(filter.subscribe(0x100, CANStandard));
+    CHECK(filter.pass(frame(0x100, 8, 1), 0));  // The first frame is always a change
+    CHECK(!filter.pass(frame(0x100, 8, 1), 10));
+    CHECK(!filter.pass(frame(0x100, 8, 1), 20));
+    CHECK(filter.pass(frame(0x100, 8, 2), 30));
+    CHECK(filter.pass(frame(0x100, 7, 2), 40));
+    CHECK(!filter.pass(frame(0x100, 7, 2), 50));
+    CHECK(filter.pass(frame(0x100 | CAN_FRAME_RTR, 7, 2), 60));  // Remote frames always pass
+    CHECK(filter.pass(frame(0x101, 8, 1), 70));                  // And so do CAN Ids not subscribed
+    CHECK(filter.pass(frame(0x101, 8, 1), 80));
+    CHECK(filter.pass(frame(0x100 | CAN_FRAME_IDE, 8, 2), 90));  // Extended 0x100 is another CAN Id
+    CHECK(filter.pass(frame(0x100 | CAN_FRAME_IDE, 8, 2), 100));
+
+    SEEED_CANChangeFilter::Stats stats;
+    CHECK(filter.stats(0x100, CANStandard, stats));
+    CHECK((stats.delivered == 3) && (stats.suppressed == 3) && (stats.changes == 3));
+    CHECK(!filter.stats(0x101, CANStandard, stats));
+    CHECK(filter.suppressed() == 3);
+  }
+  {  // Every N-th repeat, or a repeat once the timeout has passed since the last delivery, gets through
+    SEEED_CANChangeFilter filter;
+    CHECK(filter.subscribe(0x200, CANStandard, 3));
+    CHECK(filter.subscribe(0x1ABCDE, CANExtended, 0, 1000));
+    uint32_t passed = 0;
+    for (uint32_t i = 0; i < 10; i++) {
+      passed += filter.pass(frame(0x200, 8, 0), i);
+    }
+    CHECK(passed == 4);  // The first frame, then repeats 3, 6 and 9
+
+    uint32_t ident = 0x1ABCDE | CAN_FRAME_IDE;
+    CHECK(filter.pass(frame(ident, 1, 0), 0xFFFFFF00));  // The microsecond timer wraps in between
+    CHECK(!filter.pass(frame(ident, 1, 0), 0xFFFFFFFF));
+    CHECK(!filter.pass(frame(ident, 1, 0), 0x000002E7));
+    CHECK(filter.pass(frame(ident, 1, 0), 0x000002E8));
+    CHECK(!filter.pass(frame(ident, 1, 0), 0x000002E9));
+  }
+  {  // A full table refuses more CAN Ids, clear() empties it
+    SEEED_CANChangeFilter filter;
+    for (uint32_t i = 0; i < CAN_CHANGE_IDS; i++) {
+      CHECK(filter.subscribe(0x400 + i * 37, CANStandard));
+    }
+    CHECK(!filter.subscribe(0x7FF, CANStandard));
+    CHECK(filter.subscribe(0x400, CANStandard, 2));  // Settings of a subscribed CAN Id still change
+    filter.clear();
+    CHECK(filter.subscribe(0x7FF, CANStandard));
+  }
+  {  // Attached to a SEEED_CAN, repeats never reach read()
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANChangeFilter filter;
+    CHECK(filter.subscribe(0x123, CANStandard, 4));
+    rig.b.changeFilter(&filter);
+    SEEED_CANMessage msg = message(0x123);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < 9; i++) {
+      n += deliver(rig, msg);
+    }
+    CHECK(n == 3);  // The first frame, then repeats 4 and 8
+    msg.data[7] = 0x55;
+    CHECK(deliver(rig, msg) == 1);
+    CHECK(deliver(rig, message(0x124)) == 1);
+    CHECK(deliver(rig, message(0x124)) == 1);
+    CHECK(rig.n2.stats().received == 12);
+    CHECK(filter.suppressed() == 6);
+
+    rig.b.changeFilter(NULL);
+    CHECK(deliver(rig, msg) == 1);
+  }
+  {  // In priority mode the interrupt drops repeats before they fill the software queues
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANChangeFilter filter;
+    CHECK(filter.subscribe(0x300, CANStandard));
+    rig.b.changeFilter(&filter);
+    rig.b.priority(true);
+    SEEED_CANMessage msg = message(0x300);
+    for (uint32_t i = 0; i < 20; i++) {
+      msg.data[0] = (uint8_t)(i / 5);  // A change every fifth frame
+      CHECK(rig.a.write(msg));
+      host::run(300);
+    }
+    host::run(1000);
+    CHECK(rig.n2.stats().received == 20);
+    SEEED_CANMessage r;
+    for (uint8_t i = 0; i < 4; i++) {
+      CHECK(rig.b.read(r) && (r.id == 0x300) && (r.data[0] == i));
+    }
+    CHECK(!rig.b.read(r));
+    CHECK(filter.suppressed() == 16);
+  }
+  return finish();
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Fast open() from a precomputed configuration image
+
+#include "harness.h"
+
+static uint32_t received(SimRig &rig, uint32_t id) {
+  SEEED_CANMessage r;
+  uint32_t n = 0;
+  CHECK(rig.a.write(message(id)));
+  rig.bus.run(1000000);
+  while (rig.b.read(r)) {
+    n += (r.id == id) ? 1 : 0;
+  }
+  return n;
+}
+
+int main() {
+  SimRig rig;
+  CHECK(rig.a.open(500000));
+
+  SEEED_CANConfig bad(3000000);  // No bit timing for 3 Mbit/s: open() refuses it without touching the MCP2515
+  CHECK(!bad.valid());
+  uint32_t spi = rig.n2.stats().spiBytes;
+  CHECK(rig.b.open(bad) == 0);
+  CHECK(rig.n2.stats().spiBytes == spi);
+  CHECK(bad.frequency(500000) && bad.valid());
+  CHECK(!bad.frequency(0) && !bad.valid());
+
+  SEEED_CANConfig config(500000);
+  CHECK(config.valid());
+  CHECK(config.mask(0, 0x7FF) && config.mask(1, 0x7FF));
+  for (int f = 0; f < 6; f++) {
+    CHECK(config.filter(f, 0x123));
+  }
+  CHECK(!config.filter(6, 0x123));
+  spi = rig.n2.stats().spiBytes;
+  CHECK(rig.b.open(config));
+  uint32_t fast = rig.n2.stats().spiBytes - spi;
+  CHECK(rig.b.bitRate() == 500000);
+  CHECK((received(rig, 0x123) == 1) && (received(rig, 0x124) == 0));
+
+  spi = rig.n2.stats().spiBytes;
+  CHECK(rig.b.open(500000));
+  CHECK(fast < rig.n2.stats().spiBytes - spi);
+  CHECK(received(rig, 0x124) == 1);
+
+  SEEED_CAN fresh(30, 31, 1, 2, 3);  // Never opened, nothing to capture
+  SEEED_CANConfig captured;
+  fresh.snapshot(captured);
+  CHECK(!captured.valid() && !fresh.open(captured));
+
+  CHECK(rig.b.mask(0, 0x7FF) && rig.b.mask(1, 0x7FF) && rig.b.filter(0, 0x124) && rig.b.filter(2, 0x124));
+  rig.b.snapshot(captured);
+  CHECK(captured.valid());
+  CHECK(rig.b.open(500000));  // Accept everything again, then bring the captured filters back
+  CHECK(rig.b.open(captured));
+  CHECK((received(rig, 0x124) == 1) && (received(rig, 0x123) == 0));
+  return finish();
+}
@@ -0,0 +1,100 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reserved transmit buffers and the cyclic sender
+
+#include "harness.h"
+#include "seeed_can_cyclic.h"
+#include "seeed_can_responder.h"
+
+static uint32_t drain(SEEED_CAN &can, uint32_t id) {
+  SEEED_CANMessage r;
+  uint32_t n = 0;
+  while (can.read(r)) {
+    n += (r.id == id) ? 1 : 0;
+  }
+  return n;
+}
+
+int main() {
+  {  // A reservation survives a failed attempt to reserve its buffer again, and open() clears all reservations
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    CHECK(rig.a.reserveTxBuffer(2, message(0x321, 4)));
+    CHECK(rig.a.updateTxBuffer(2, NULL, 0));
+    CHECK(rig.a.txStatus(2) & MCP_TXB_TXREQ_M);  // Still on its way
+    CHECK(!rig.a.reserveTxBuffer(2, message(0x123, 4)));
+    CHECK(rig.a.chip()->txReserved == 0x04);
+    CHECK(!rig.a.reserveTxBuffer(1, message(0x123, 4)) || (rig.a.chip()->txReserved == 0x06));
+    rig.a.releaseTxBuffer(1);
+    rig.bus.run(1000000);
+    CHECK(drain(rig.b, 0x321) == 1);
+    CHECK(rig.a.updateTxBuffer(2, NULL, 0));  // The original header is still there
+    rig.bus.run(1000000);
+    CHECK(drain(rig.b, 0x321) == 1);
+    CHECK(rig.a.reserveTxBuffer(1, message(0x123, 4)));
+    CHECK(rig.open());
+    CHECK(rig.a.chip()->txReserved == 0);
+  }
+  {  // Ticks that find the main loop part way through an MCP2515 sequence leave the bus alone and retry
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    SEEED_CANCyclic cyclic(rig.a, 1000, 10000);
+    int fast = cyclic.add(message(0x100, 8), 5000);
+    int slow = cyclic.add(message(0x200, 8), 50000);
+    CHECK(cyclic.txBuffer(fast) == 2);
+    CHECK(cyclic.txBuffer(slow) == -1);
+    CHECK(!rig.a.isrBlocked());
+    cyclic.start();
+    mcpLock(rig.a.chip());
+    host::run(20000);
+    CHECK(rig.n1.stats().transmitted == 0);
+    CHECK((cyclic.stats(fast).sent == 0) && (cyclic.stats(fast).busy > 0));
+    CHECK((cyclic.stats(slow).sent == 0) && (cyclic.stats(slow).busy > 0));
+    mcpUnlock(rig.a.chip());
+    host::run(100000);
+    cyclic.stop();
+    CHECK(cyclic.stats(fast).sent >= 19);
+    CHECK(cyclic.stats(slow).sent >= 2);
+    rig.bus.run(1000000);
+    CHECK(rig.n1.stats().transmitted == cyclic.stats(fast).sent + cyclic.stats(slow).sent);
+  }
+  {  // A fast message never takes over the buffer of a responder's hot entry, and a DLC over 8 updates 8 bytes
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    SEEED_CANResponder table;
+    CHECK(rig.a.responder(&table, table.add(0x300, CANStandard, "abcd", 4)));
+    CHECK(rig.a.chip()->txReserved == 0x04);
+    SEEED_CANCyclic cyclic(rig.a, 1000, 10000);
+    int fast = cyclic.add(message(0x100, 8), 5000);
+    CHECK(cyclic.txBuffer(fast) == 1);
+    int next = cyclic.add(message(0x101, 8), 5000);
+    CHECK(cyclic.txBuffer(next) == -1);  // Only buffer 0 is left, and it stays with write()
+
+    SEEED_CANMessage msg = message(0x200, 12);
+    int slow = cyclic.add(msg, 50000);
+    char data[16];
+    memset(data, 0xAA, sizeof(data));
+    CHECK(cyclic.update(slow, data));
+    cyclic.remove(fast);
+    cyclic.remove(next);
+    cyclic.start();
+    host::run(60000);
+    cyclic.stop();
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r) && (r.id == 0x200) && (r.len == 12) && ((uint8_t)r.data[7] == 0xAA));
+  }
+  return finish();
+}
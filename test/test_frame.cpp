@@ -0,0 +1,60 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SEEED_CANFrame: conversions to and from CAN_Message and the MCP2515 register images
+
+#include "harness.h"
+
+int main() {
+  CHECK(sizeof(SEEED_CANFrame) == 16);
+  CHECK(alignof(SEEED_CANFrame) == 8);
+  CHECK(offsetof(SEEED_CANFrame, data) == 8);
+
+  SEEED_CANMessage cases[] = {message(0x7FF, 8), message(0x000, 0), message(0x1FFFFFFF, 3, CANExtended),
+                              message(0x123, 2, CANStandard, CANRemote), message(0x1ABCDE, 5, CANExtended, CANRemote)};
+  const int n = sizeof(cases) / sizeof(cases[0]);
+
+  for (int i = 0; i < n; i++) {  // CAN_Message round trip
+    SEEED_CANFrame f;
+    SEEED_CANMessage m;
+    f.pack(cases[i]);
+    CHECK((f.id() == cases[i].id) && (f.format() == cases[i].format) && (f.type() == cases[i].type));
+    CHECK((f.dlc == cases[i].len) && (f.filhit == 0) && (f.stamp == 0));
+    f.unpack(m);
+    CHECK((m.id == cases[i].id) && (m.format == cases[i].format) && (m.type == cases[i].type));
+    CHECK((m.len == cases[i].len) && !memcmp(m.data, cases[i].data, 8));
+  }
+
+  // Register images round trip through an emulated MCP2515: TX image loaded by one node, RX image read by the other
+  SimRig rig;
+  CHECK(rig.open());
+  CHECK(rig.b.filter(2, 0, CANExtended));
+  for (int i = 0; i < n; i++) {
+    SEEED_CANFrame out;
+    SEEED_CANFrame in;
+    uint8_t regs[CAN_FRAME_REGS];
+    out.pack(cases[i]);
+    out.toRegs(regs);
+    CHECK(rig.a.loadRaw(regs) >= 0);
+    rig.bus.run(1000000);
+    memset(regs, 0, sizeof(regs));
+    CHECK(rig.b.readRaw(regs));
+    in.fromRegs(regs);
+    CHECK(in.ident == out.ident);
+    CHECK(in.dlc == out.dlc);
+    CHECK((cases[i].type == CANRemote) || !memcmp(in.data, out.data, in.dlc));
+  }
+  return finish();
+}
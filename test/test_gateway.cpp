@@ -0,0 +1,122 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Multi-channel gateway between two simulated buses running at different bit rates
+
+#include "harness.h"
+#include "seeed_can_gateway.h"
+
+static SEEED_CANSimBus fast(500000);
+static SEEED_CANSimBus slow(125000);
+
+static void follow(uint64_t nowUs, void *context) {
+  SEEED_CANSimBus *buses[2] = {&fast, &slow};
+  for (int i = 0; i < 2; i++) {
+    if (nowUs * 1000 > buses[i]->now()) {
+      buses[i]->run(nowUs * 1000 - buses[i]->now());
+    }
+  }
+}
+
+static int irqLevel(PinName pin, void *context) {
+  SEEED_CANSimNode *node = SEEED_CANSimNode::at(pin - 1);
+  return (node && node->interrupt()) ? 0 : 1;
+}
+
+// Adds 1 to the first data byte, drops frames whose first data byte is 0xFF
+static bool bump(SEEED_CANFrame &frame, void *context) {
+  if (frame.data[0] == 0xFF) {
+    return false;
+  }
+  frame.data[0]++;
+  return true;
+}
+
+int main() {
+  SEEED_CANSimNode fastGw(fast, 10), fastNode(fast, 30);
+  SEEED_CANSimNode slowGw(slow, 20), slowNode(slow, 40);
+  SEEED_CAN gw0(10, 11, 1, 2, 3);
+  ChipCAN gw1(20, 21, 1, 2, 3);
+  SEEED_CAN a(30, 31, 1, 2, 3), b(40, 41, 1, 2, 3);
+  host::onTime(follow);
+  host::pinLevel(irqLevel);
+  CHECK(gw0.open(500000) && a.open(500000));
+  CHECK(gw1.open(125000) && b.open(125000));
+  CHECK(gw0.filter(2, 0, CANExtended) && gw1.filter(2, 0, CANExtended) && b.filter(2, 0, CANExtended));
+
+  SEEED_CANGateway gateway;
+  CHECK(gateway.addChannel(gw0) == 0);
+  CHECK(gateway.addChannel(gw1) == 1);
+  int plain = gateway.addRoute(0, 0x100, 0x7F0, CANStandard, 0x02);  // 0x100-0x10F
+  int moved = gateway.addRoute(0, 0x18FEF100, 0x1FFFFFFF, CANExtended, 0x02);
+  int bumped = gateway.addRoute(0, 0x200, 0x7FF, CANStandard, 0x02);
+  int back = gateway.addRoute(1, 0, 0, CANStandard, 0x01);  // Everything standard from the slow bus
+  CHECK((plain >= 0) && (moved >= 0) && (bumped >= 0) && (back >= 0));
+  CHECK(gateway.addRoute(2, 0, 0, CANStandard, 0x01) < 0);
+  CHECK(gateway.rewrite(moved, 0x00000F00, 0x0000FF00));
+  CHECK(gateway.transform(bumped, bump));
+  gateway.start(1000);
+
+  SEEED_CANMessage r;
+  CHECK(a.write(message(0x105)));
+  host::run(5000);
+  CHECK(b.read(r) && (r.id == 0x105) && (r.len == 8) && (r.data[7] == 7));
+
+  CHECK(a.write(message(0x18FEF100, 3, CANExtended)));
+  host::run(5000);
+  CHECK(b.read(r) && (r.id == 0x18FE0F00) && (r.format == CANExtended) && (r.len == 3));
+
+  SEEED_CANMessage m = message(0x200, 2);
+  CHECK(a.write(m));
+  host::run(5000);
+  CHECK(b.read(r) && (r.id == 0x200) && (r.data[0] == 1) && (r.data[1] == 1));
+  m.data[0] = 0xFF;
+  CHECK(a.write(m));
+  host::run(5000);
+  CHECK(!b.read(r));
+  CHECK((gateway.stats(bumped).matched == 2) && (gateway.stats(bumped).dropped == 1));
+
+  CHECK(a.write(message(0x555)));  // No route
+  CHECK(b.write(message(0x321)));  // The other way
+  host::run(5000);
+  CHECK(!b.read(r));
+  CHECK(gateway.unrouted(0) == 1);
+  CHECK(a.read(r) && (r.id == 0x321));
+
+  for (int i = 0; i < 3; i++) {  // Faster in than out: the slow side waits in the backlog and nothing is lost
+    for (int j = 0; j < 3; j++) {
+      CHECK(a.write(message(0x100 + j)));
+    }
+    host::run(1000);
+  }
+  host::run(50000);
+  SEEED_CANGateway::RouteStats s = gateway.stats(plain);
+  CHECK((s.matched == 10) && (s.forwarded == 10) && (s.dropped == 0));
+  CHECK((s.latencyMin <= s.latencyMax) && (s.latencySum >= 10 * s.latencyMin));
+  CHECK(slowGw.stats().transmitted == 1 + 1 + 1 + 9);
+
+  // A destination the main loop holds part way through a sequence is left alone, the frame waits in the backlog
+  mcpLock(gw1.chip());
+  CHECK(a.write(message(0x101)));
+  host::run(5000);
+  CHECK((slowGw.stats().transmitted == 12) && (gateway.stats(plain).forwarded == 10));
+  mcpUnlock(gw1.chip());
+  host::run(5000);  // Retried on the next tick
+  CHECK((slowGw.stats().transmitted == 13) && (gateway.stats(plain).forwarded == 11));
+  gateway.stop();
+  host::onTime(NULL);
+  host::pinLevel(NULL);
+  return finish();
+}
@@ -0,0 +1,76 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Interrupt service: a function attached for received frames is called once per frame, whether it reads the message
+// itself or leaves it for the main loop
+
+#include "harness.h"
+
+static SEEED_CAN *can = NULL;
+static uint32_t calls = 0;
+static uint32_t reads = 0;
+
+static void count(void) { calls++; }
+
+static void countAndRead(void) {
+  SEEED_CANMessage msg;
+  calls++;
+  while (can->read(msg)) {
+    reads++;
+  }
+}
+
+int main() {
+  {  // A function that leaves the message for later runs once, not once per pass of the interrupt routine
+    SimRig rig;
+    CHECK(rig.open());
+    rig.b.attach(&count);
+    calls = 0;
+    CHECK(rig.a.write(message(0x100)));
+    host::run(1000);
+    CHECK(calls == 1);
+
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r) && (r.id == 0x100));  // The main loop reads it, the next frame brings a new interrupt
+    CHECK(rig.a.write(message(0x101)));
+    host::run(1000);
+    CHECK(calls == 2);
+    CHECK(rig.b.read(r) && (r.id == 0x101));
+    CHECK(!rig.b.read(r));
+  }
+  {  // A function that reads the messages is called for each frame
+    SimRig rig;
+    CHECK(rig.open());
+    can = &rig.b;
+    rig.b.attach(&countAndRead);
+    calls = reads = 0;
+    for (uint32_t i = 0; i < 5; i++) {
+      CHECK(rig.a.write(message(0x200 + i)));
+      host::run(1000);
+    }
+    CHECK((calls == 5) && (reads == 5));
+    can = NULL;
+  }
+  {  // So is a handler of the receive buffer source alone
+    SimRig rig;
+    CHECK(rig.open());
+    CHECK(rig.b.handle(SEEED_CAN::Rx0Fill, &count));
+    calls = 0;
+    CHECK(rig.a.write(message(0x300)));
+    host::run(1000);
+    CHECK(calls == 1);
+  }
+  return finish();
+}
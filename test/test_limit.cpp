@@ -0,0 +1,125 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Transmit rate limits: token buckets over long quiet spells, and messages given to submit() that a limit holds
+// back without holding up other CAN Ids (SEEED_CAN_RTOS build)
+
+#include "harness.h"
+#include "rtos.h"
+#include "seeed_can_limit.h"
+
+// A SEEED_CAN whose driver thread work the test does itself: the host never runs the thread
+class SubmitCAN : public SEEED_CAN {
+ public:
+  SubmitCAN(PinName ncs, PinName irq, PinName mosi, PinName miso, PinName clk) : SEEED_CAN(ncs, irq, mosi, miso, clk) {}
+  void service(void) { serviceSubmit(); }
+};
+
+// Submit a message whose first data byte tells the messages with the same CAN Id apart
+static void submit(SubmitCAN &can, uint32_t id, uint8_t seq) {
+  SEEED_CANMessage msg = message(id, 1);
+  msg.data[0] = seq;
+  CHECK(can.submit(msg));
+}
+
+// Read everything b has received as "CAN Id << 8 | first data byte"
+static uint32_t collect(SubmitCAN &can, uint32_t *got, uint32_t max) {
+  SEEED_CANMessage r;
+  uint32_t n = 0;
+  while ((n < max) && can.read(r)) {
+    got[n++] = (r.id << 8) | (uint8_t)r.data[0];
+  }
+  return n;
+}
+
+int main() {
+  {  // Refills in time order, and a quiet spell longer than 2^31 microseconds still counts
+    SEEED_CANRateLimit limit(500000);
+    CHECK(limit.limit(0x100, 0x100, CANStandard, 1000, 1) == 0);  // One frame a millisecond
+    SEEED_CANMessage msg = message(0x100);
+    CHECK(limit.admit(msg));
+    CHECK(!limit.admit(msg));
+    host::advance(1000);
+    CHECK(limit.admit(msg));
+    CHECK(!limit.admit(msg));
+    host::advance(40 * 60 * 1000000U);  // 40 minutes
+    CHECK(limit.admit(msg));
+    CHECK((limit.throttled(0) == 2) && (limit.admitted() == 3));
+  }
+  {  // A throttled CAN Id is set aside, keeping its order, while other CAN Ids go ahead
+    SimRigFor<SubmitCAN> rig;
+    CHECK(rig.open());
+    rig.b.priority(true);  // b's receive queues hold more than its two receive buffers
+    SEEED_CANRateLimit limit;
+    CHECK(limit.limit(0x100, 0x100, CANStandard, 10, 1) == 0);  // One frame every 100 ms
+    rig.a.limiter(&limit);
+    CHECK(rig.a.startThread());
+
+    submit(rig.a, 0x100, 1);
+    submit(rig.a, 0x100, 2);
+    submit(rig.a, 0x200, 1);
+    submit(rig.a, 0x100, 3);
+    submit(rig.a, 0x200, 2);
+    rig.a.service();
+    host::run(5000);
+    uint32_t got[8];
+    CHECK(collect(rig.b, got, 8) == 3);
+    // Several loaded buffers go highest numbered first, so only the CAN Ids and the count are certain
+    CHECK((got[0] == 0x10001) && ((got[1] >> 8) == 0x200) && ((got[2] >> 8) == 0x200) && (got[1] != got[2]));
+    CHECK(limit.throttled(0) == 1);  // #3 is parked behind #2 without being tried
+
+    host::run(100000);
+    rig.a.service();
+    host::run(5000);
+    CHECK((collect(rig.b, got, 8) == 1) && (got[0] == 0x10002));
+    rig.a.service();  // #3 has to wait for the next token
+    host::run(5000);
+    CHECK(collect(rig.b, got, 8) == 0);
+    host::run(100000);
+    rig.a.service();
+    host::run(5000);
+    CHECK((collect(rig.b, got, 8) == 1) && (got[0] == 0x10003));
+  }
+  {  // With every parking place taken, a throttled message holds up the queue rather than being lost
+    SimRigFor<SubmitCAN> rig;
+    CHECK(rig.open());
+    rig.b.priority(true);
+    SEEED_CANRateLimit limit;
+    CHECK(limit.limit(0x100, 0x101 + CAN_TX_PARKED, CANStandard, 10, 1) == 0);  // One bucket for the whole range
+    rig.a.limiter(&limit);
+    CHECK(rig.a.startThread());
+
+    for (uint8_t i = 0; i <= CAN_TX_PARKED + 1; i++) {
+      submit(rig.a, 0x100 + i, 0);
+    }
+    submit(rig.a, 0x200, 0);
+    rig.a.service();
+    host::run(5000);
+    uint32_t got[8];
+    CHECK((collect(rig.b, got, 8) == 1) && (got[0] == 0x10000));  // 0x200 waits behind the one that found no room
+
+    host::run(100000);
+    rig.a.service();  // 0x101 leaves the parking, 0x101 + CAN_TX_PARKED takes its place and 0x200 goes
+    host::run(5000);
+    CHECK((collect(rig.b, got, 8) == 2) && (got[0] == 0x10100) && (got[1] == 0x20000));
+    for (uint32_t i = 0; i < CAN_TX_PARKED; i++) {
+      host::run(100000);
+      rig.a.service();
+      host::run(5000);
+      CHECK((collect(rig.b, got, 8) == 1) && (got[0] == ((0x102 + i) << 8)));
+    }
+  }
+  return finish();
+}
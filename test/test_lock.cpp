@@ -0,0 +1,78 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Interrupt handlers put their MCP2515 work off while a thread is part way through a sequence
+
+#include "harness.h"
+
+static SEEED_CAN *receiver = NULL;
+static uint32_t callbacks = 0;
+static uint32_t callbacksInIsr = 0;
+static uint32_t lastId = 0;
+
+static void received(void) {
+  SEEED_CANMessage r;
+  callbacks++;
+  callbacksInIsr += host::inIsr() ? 1 : 0;
+  while (receiver->read(r)) {
+    lastId = r.id;
+  }
+}
+
+int main() {
+  {  // Priority receive mode: the receive interrupt fills the queues, unless it interrupted a sequence
+    SimRigFor<ChipCAN> rig;
+    SEEED_CANMessage r;
+    CHECK(rig.open());
+    rig.a.priority(true);
+    CHECK(rig.b.write(message(0x101)));
+    host::run(2000);
+    CHECK(rig.a.read(r, SEEED_CAN::RxControl) && (r.id == 0x101));
+
+    mcpLock(rig.a.chip());  // As if the main program were in the middle of a write()
+    CHECK(rig.b.write(message(0x102)));
+    uint32_t before = host::interrupts();
+    host::run(2000);
+    CHECK(host::interrupts() == before + 1);  // The falling edge was taken...
+    CHECK(!rig.a.read(r, SEEED_CAN::RxControl) && !rig.a.read(r, SEEED_CAN::RxBulk));  // ...but nothing read
+    CHECK(rig.n1.interrupt());
+    CHECK(rig.a.chip()->deferred);
+    mcpUnlock(rig.a.chip());  // The interrupted code services it now
+    CHECK(!rig.n1.interrupt());
+    CHECK(!rig.a.chip()->deferred);
+    CHECK(rig.a.read(r, SEEED_CAN::RxControl) && (r.id == 0x102));
+  }
+  {  // Plain receive mode: the attached function is called once the sequence is over, in thread context
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    receiver = &rig.a;
+    rig.a.attach(&received, SEEED_CAN::RxAny);
+    CHECK(rig.b.write(message(0x201)));
+    host::run(2000);
+    CHECK((callbacks == 1) && (callbacksInIsr == 1) && (lastId == 0x201));
+
+    mcpLock(rig.a.chip());
+    mcpLock(rig.a.chip());  // Nested: only the outermost unlock does the work
+    CHECK(rig.b.write(message(0x202)));
+    host::run(2000);
+    CHECK(callbacks == 1);
+    mcpUnlock(rig.a.chip());
+    CHECK(callbacks == 1);
+    mcpUnlock(rig.a.chip());
+    CHECK((callbacks == 2) && (callbacksInIsr == 1) && (lastId == 0x202));
+    CHECK(rig.a.chip()->lockDepth == 0);
+  }
+  return finish();
+}
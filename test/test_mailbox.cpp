@@ -0,0 +1,89 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Latest-value mailboxes: the newest frame of each CAN Id received through the simulator, and a reader that gives up
+// (yielding between attempts, SEEED_CAN_RTOS build) on a mailbox whose update never finishes
+
+#include "harness.h"
+#include "rtos.h"
+#include "seeed_can_mailbox.h"
+
+// Mailboxes whose writer can be stopped part way through an update
+class StalledMailboxes : public SEEED_CANMailboxes {
+ public:
+  void stall(int mailbox) { _boxes[mailbox].seq |= 1; }
+  void resume(int mailbox) { _boxes[mailbox].seq++; }
+};
+
+int main() {
+  {  // Readers get the newest frame of each registered CAN Id, other frames are read as usual
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANMailboxes boxes;
+    int speed = boxes.add(0x100);
+    int gear = boxes.add(0x200);
+    CHECK((speed >= 0) && (gear >= 0) && (speed != gear));
+    CHECK(boxes.add(0x100) == speed);
+    CHECK(boxes.find(0x300) == -1);
+    rig.b.mailboxes(&boxes);
+
+    SEEED_CANFrame f;
+    CHECK(boxes.read(speed, f) == 0);
+    for (uint8_t i = 0; i < 5; i++) {
+      SEEED_CANMessage msg = message(0x100);
+      msg.data[0] = i;
+      CHECK(rig.a.write(msg));
+      host::run(500);
+      SEEED_CANMessage r;
+      CHECK(!rig.b.read(r));  // Frames for a mailbox never reach read()
+    }
+    CHECK(rig.a.write(message(0x300, 2)));
+    host::run(500);
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r) && (r.id == 0x300) && (r.len == 2));
+
+    uint32_t stamp = 0;
+    CHECK(boxes.read(speed, r, &stamp) == 5);
+    CHECK((r.id == 0x100) && (r.len == 8) && (r.data[0] == 4) && (r.data[7] == 7) && (stamp != 0));
+    CHECK(boxes.read(gear, r) == 0);
+    CHECK(boxes.read(-1, r) == 0);
+  }
+  {  // A mailbox whose update never finishes is given up on after CAN_MAILBOX_RETRIES attempts, not spun on
+    StalledMailboxes boxes;
+    int box = boxes.add(0x123);
+    SEEED_CANFrame f;
+    memset(&f, 0, sizeof(f));
+    f.ident = 0x123;
+    f.dlc = 1;
+    f.data[0] = 0xAA;
+    CHECK(boxes.update(f, 100));
+    boxes.stall(box);
+
+    SEEED_CANFrame out;
+    memset(&out, 0, sizeof(out));
+    uint32_t yields = host::yields;
+    CHECK(boxes.read(box, out) == 0);
+    CHECK(host::yields - yields == CAN_MAILBOX_RETRIES);
+    CHECK((out.ident == 0) && (out.data[0] == 0));  // Left alone
+    CHECK(boxes.sequence(box) != 0);                // There is a frame, it was only busy
+
+    boxes.resume(box);
+    yields = host::yields;
+    CHECK(boxes.read(box, out) == 2);  // The update that finished counts
+    CHECK((out.ident == 0x123) && (out.data[0] == 0xAA));
+    CHECK(host::yields == yields);
+  }
+  return finish();
+}
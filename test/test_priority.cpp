@@ -0,0 +1,80 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Priority receive mode: control and bulk traffic in separate software queues
+
+#include "harness.h"
+
+int main() {
+  {  // The ring keeps frames in order across the wrap and counts what it had to drop
+    SEEED_CANQueue<4> q;
+    SEEED_CANFrame f;
+    memset(&f, 0, sizeof(f));
+    for (uint32_t i = 0; i < 10; i++) {
+      f.ident = i;
+      CHECK(q.push(f));
+      CHECK(q.pop(f) && (f.ident == i));
+    }
+    for (uint32_t i = 10; i < 15; i++) {
+      f.ident = i;
+      CHECK(q.push(f) == (i < 14));
+    }
+    CHECK((q.count() == 4) && (q.overflows() == 1));
+    for (uint32_t i = 10; i < 14; i++) {
+      CHECK(q.pop(f) && (f.ident == i));
+    }
+    CHECK(q.empty() && !q.pop(f));
+  }
+  {  // Control frames (Filters 0 and 1) are read first and never lost to a flood of bulk frames
+    SimRig rig;
+    CHECK(rig.open());
+    CHECK(rig.b.mask(0, 0x7FF));
+    CHECK(rig.b.filter(0, 0x010));
+    CHECK(rig.b.filter(1, 0x011));
+    rig.b.priority(true);
+    for (uint32_t i = 0; i < 20; i++) {
+      CHECK(rig.a.write(message((i % 5 == 4) ? 0x010 + (i / 10) : 0x300 + i)));
+      host::run(300);
+    }
+    host::run(1000);
+    CHECK(rig.n2.stats().received == 20);
+    CHECK(rig.b.rxOverflows(SEEED_CAN::RxControl) == 0);
+    CHECK(rig.b.rxOverflows(SEEED_CAN::RxBulk) == 0);
+
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r, SEEED_CAN::RxControl) && (r.id == 0x010));
+    CHECK(rig.b.read(r) && (r.id == 0x010));
+    CHECK(rig.b.read(r) && (r.id == 0x011));
+    CHECK(rig.b.read(r) && (r.id == 0x011));
+    CHECK(!rig.b.read(r, SEEED_CAN::RxControl));
+    uint32_t bulk = 0;
+    uint32_t last = 0;
+    while (rig.b.read(r)) {
+      CHECK((r.id >= 0x300) && (r.id > last));
+      last = r.id;
+      bulk++;
+    }
+    CHECK(bulk == 16);
+
+    for (uint32_t i = 0; i < 20; i++) {  // Nobody reads: the bulk queue fills up, the control frame still gets in
+      CHECK(rig.a.write(message((i == 19) ? 0x010 : 0x300)));
+      host::run(300);
+    }
+    host::run(1000);
+    CHECK(rig.b.rxOverflows(SEEED_CAN::RxBulk) == 19 - CAN_RX_BULK_QUEUE);
+    CHECK(rig.b.read(r) && (r.id == 0x010));
+  }
+  return finish();
+}
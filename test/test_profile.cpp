@@ -0,0 +1,64 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Profiling hooks (SEEED_CAN_PROFILE build): each way of writing a message is timed by its own point, once
+
+#include "harness.h"
+
+static uint32_t calls(CANProfilePoint point) {
+  MCP_Profile p;
+  mcpProfileRead(point, &p);
+  return p.calls;
+}
+
+int main() {
+  SimRig rig;
+  CHECK(rig.open());
+  SEEED_CANMessage msg = message(0x123);
+  SEEED_CANHeader hdr = rig.a.prepare(0x124);
+  uint8_t regs[CAN_FRAME_REGS];
+  SEEED_CANFrame f;
+  f.pack(message(0x125));
+  f.toRegs(regs);
+
+  mcpProfileReset();
+  CHECK(rig.a.write(msg));
+  CHECK(rig.a.write(hdr, (const char *)msg.data, 8));
+  host::run(1000);  // Frees the transmit buffers
+  CHECK(rig.a.load(message(0x126)) >= 0);
+  CHECK(rig.a.loadRaw(regs) >= 0);
+  host::run(1000);
+
+  CHECK(calls(_P_CAN_WRITE) == 1);
+  CHECK(calls(_P_CAN_WRITE_ENCODED) == 1);  // Not counted again inside write(msg)
+  CHECK(calls(_P_CAN_LOAD) == 1);
+  CHECK(calls(_P_CAN_LOAD_RAW) == 1);  // Nor inside any of the others
+  CHECK(calls(_P_WRITE_BUFFER) == 4);  // One TXBn load per message
+  CHECK(rig.n1.stats().transmitted == 4);
+
+  MCP_Profile p;
+  mcpProfileRead(_P_CAN_WRITE, &p);
+  CHECK((p.min == p.max) && (p.total == p.min));
+  uint32_t histogram = 0;
+  for (uint32_t b = 0; b < CAN_PROFILE_BUCKETS; b++) {
+    histogram += p.histogram[b];
+  }
+  CHECK(histogram == 1);
+  mcpProfileDump();
+
+  mcpProfileReset();
+  CHECK(calls(_P_CAN_WRITE) == 0);
+  return finish();
+}
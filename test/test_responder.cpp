@@ -0,0 +1,79 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Automatic answers to remote frames and the transmit buffer of the hot entry
+
+#include "harness.h"
+#include "seeed_can_responder.h"
+
+// Ask a for 0x300 from b, let a's receive path answer, and return the number of answers b got
+static uint32_t request(SimRigFor<ChipCAN> &rig) {
+  SEEED_CANMessage r;
+  CHECK(rig.b.write(message(0x300, 4, CANStandard, CANRemote)));
+  rig.bus.run(1000000);
+  CHECK(!rig.a.read(r));  // Answered, never returned
+  rig.bus.run(1000000);
+  uint32_t n = 0;
+  while (rig.b.read(r)) {
+    n += ((r.id == 0x300) && (r.type == CANData) && (r.len == 4) && (r.data[0] == 'a')) ? 1 : 0;
+  }
+  return n;
+}
+
+int main() {
+  {  // The hot entry takes the highest numbered free buffer, never one already reserved
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    SEEED_CANResponder table;
+    int hot = table.add(0x300, CANStandard, "abcd", 4);
+    CHECK(rig.a.reserveTxBuffer(2, message(0x321, 4)));  // E.g. a cyclic schedule
+    CHECK(rig.a.responder(&table, hot));
+    CHECK(rig.a.chip()->txReserved == 0x06);
+    CHECK(request(rig) == 1);
+    CHECK((table.served(hot) == 1) && (table.missed(hot) == 0));
+    CHECK(rig.a.responder(NULL));  // Gives back buffer 1 only
+    CHECK(rig.a.chip()->txReserved == 0x04);
+
+    CHECK(!rig.a.responder(&table, hot, 2));  // Explicitly asking for the reserved buffer fails...
+    CHECK(rig.a.chip()->txReserved == 0x04);
+    CHECK(request(rig) == 1);  // ...but the table is still attached and answers through write()
+    CHECK(table.served(hot) == 2);
+
+    CHECK(rig.a.reserveTxBuffer(1, message(0x321, 4)) && rig.a.reserveTxBuffer(0, message(0x321, 4)));
+    CHECK(!rig.a.responder(&table, hot));  // Nothing left to pick
+    CHECK(rig.a.chip()->txReserved == 0x07);
+    CHECK(rig.a.responder(&table));  // No hot entry, nothing to reserve
+  }
+  {  // The hot buffer is only sent again once its previous frame is gone, and update() reloads it
+    SimRigFor<ChipCAN> rig;
+    CHECK(rig.open());
+    SEEED_CANResponder table;
+    int hot = table.add(0x300, CANStandard, "abcd", 4);
+    CHECK(rig.a.responder(&table, hot));
+    CHECK(rig.a.chip()->txReserved == 0x04);
+    CHECK(rig.a.updateTxBuffer(2, NULL, 0));
+    CHECK(!rig.a.updateTxBuffer(2, NULL, 0));  // TXREQ is still set
+    rig.bus.run(1000000);
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r) && (r.id == 0x300) && (r.type == CANData));
+    CHECK(rig.a.updateTxBuffer(2, NULL, 0));  // Sent, the buffer can go again
+    rig.bus.run(1000000);
+    CHECK(rig.b.read(r) && (r.id == 0x300));
+    CHECK(table.update(hot, "abcd", 4));
+    CHECK(request(rig) == 1);  // Reloaded after update()
+    CHECK((table.served(hot) == 1) && (table.missed(hot) == 0));
+  }
+  return finish();
+}
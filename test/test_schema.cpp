@@ -0,0 +1,84 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compile-time message schemas: byte layouts of known signals, pack and unpack round trips and frames sent through the
+// simulator with loadRaw() and write()
+
+#include "harness.h"
+#include "seeed_can_schema.h"
+
+typedef SEEED_CANSignal<0, 16> Rpm;                                       // Intel, unsigned, bytes 0 and 1
+typedef SEEED_CANSignal<23, 12, SEEED_CANSignals::Motorola, true> Torque;  // Motorola, signed, bytes 2 and 3
+typedef SEEED_CANSchema<0x123, CANStandard, 4, Rpm, Torque> EngineStatus;
+
+typedef SEEED_CANSignal<7, 8, SEEED_CANSignals::Motorola> Status;         // Motorola, byte 0
+typedef SEEED_CANSignal<8, 40> Odometer;                                  // Intel, unsigned, wider than 32 bits
+typedef SEEED_CANSignal<48, 16, SEEED_CANSignals::Intel, true> Current;  // Intel, signed
+typedef SEEED_CANSchema<0x1ABCDE, CANExtended, 8, Status, Odometer, Current> BatteryStatus;
+
+static_assert(EngineStatus::pack(0x1234, -5) == 0xB0FF1234ULL, "pack is a constant expression");
+static_assert(EngineStatus::unpack<1>(0xB0FF1234ULL) == -5, "unpack is a constant expression");
+
+int main() {
+  {  // Data bytes of known values, and the raw values back from them
+    uint8_t regs[CAN_FRAME_REGS];
+    EngineStatus::encode(regs, EngineStatus::pack(0x1234, -5));
+    CHECK((regs[0] == 0x24) && (regs[1] == 0x60) && (regs[4] == 4));  // 0x123 in SIDH and SIDL
+    CHECK((regs[5] == 0x34) && (regs[6] == 0x12) && (regs[7] == 0xFF) && (regs[8] == 0xB0));
+    uint64_t w = EngineStatus::word(&regs[5]);
+    CHECK((EngineStatus::unpack<0>(w) == 0x1234) && (EngineStatus::unpack<1>(w) == -5));
+
+    BatteryStatus::encode(regs, BatteryStatus::pack(0xA5, 0x123456789AULL, -2));
+    CHECK((regs[0] == (0x1ABCDE >> 21)) && (regs[1] & MCP_TXB_EXIDE_M) && (regs[4] == 8));
+    CHECK((regs[5] == 0xA5) && (regs[6] == 0x9A) && (regs[10] == 0x12) && (regs[11] == 0xFE) && (regs[12] == 0xFF));
+    w = BatteryStatus::word(&regs[5]);
+    CHECK(BatteryStatus::unpack<1>(w) == 0x123456789AULL);
+    CHECK(BatteryStatus::unpack<2>(w) == -2);
+  }
+  {  // Every raw value of the 12-bit signed signal survives a round trip and leaves its neighbour alone
+    bool same = true;
+    for (int32_t t = -2048; t < 2048; t++) {
+      uint64_t w = EngineStatus::pack(0xFFFF, t);
+      same = same && (EngineStatus::unpack<1>(w) == t) && (EngineStatus::unpack<0>(w) == 0xFFFF);
+    }
+    CHECK(same);
+    CHECK(EngineStatus::unpack<1>(EngineStatus::pack(0, 2048)) == -2048);  // Out of range values are truncated
+  }
+  {  // A register image sent with loadRaw() and a message sent with write() arrive as their schema
+    SimRig rig;
+    CHECK(rig.open());
+    CHECK(rig.b.filter(2, 0, CANExtended));  // Filters 0 and 1 stay standard
+    uint8_t regs[CAN_FRAME_REGS];
+    EngineStatus::encode(regs, EngineStatus::pack(3000, -700));
+    CHECK(rig.a.loadRaw(regs) >= 0);
+    CHECK(rig.a.write(BatteryStatus::message(BatteryStatus::pack(0x5A, 0xFFFFFFFFFFULL, -32768))));
+    rig.bus.run(2000000);
+
+    SEEED_CANMessage msg;
+    CHECK(rig.b.read(msg) && EngineStatus::matches(msg) && !BatteryStatus::matches(msg));
+    uint64_t w = EngineStatus::word(msg.data);
+    CHECK((EngineStatus::unpack<0>(w) == 3000) && (EngineStatus::unpack<1>(w) == -700));
+    CHECK(rig.b.read(msg) && BatteryStatus::matches(msg));
+    w = BatteryStatus::word(msg.data);
+    CHECK(BatteryStatus::unpack<0>(w) == 0x5A);
+    CHECK(BatteryStatus::unpack<1>(w) == 0xFFFFFFFFFFULL);
+    CHECK(BatteryStatus::unpack<2>(w) == -32768);
+    CHECK(!rig.b.read(msg));
+
+    SEEED_CANFrame f = BatteryStatus::frame(BatteryStatus::pack(1, 2, 3));
+    CHECK(BatteryStatus::matches(f) && !EngineStatus::matches(f));
+  }
+  return finish();
+}
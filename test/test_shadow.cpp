@@ -0,0 +1,94 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// RAM shadow of the MCP2515's configuration registers: skipped rewrites and recovery from an unexpected reset
+
+#include "harness.h"
+#include "seeed_can_cyclic.h"
+
+// Send three frames, returns the CAN Ids b received as a bit set (1: 0x123, 2: 0x456, 4: 0x789)
+static uint32_t traffic(SimRig &rig) {
+  static const uint32_t ids[3] = {0x123, 0x456, 0x789};
+  SEEED_CANMessage r;
+  uint32_t seen = 0;
+  for (int i = 0; i < 3; i++) {
+    CHECK(rig.a.write(message(ids[i])));
+    rig.bus.run(1000000);
+    while (rig.b.read(r)) {
+      seen |= (r.id == 0x123) ? 1 : ((r.id == 0x456) ? 2 : 4);
+    }
+  }
+  return seen;
+}
+
+int main() {
+  SimRig rig;
+  CHECK(rig.open());
+  CHECK(rig.b.mask(0, 0x7FF) && rig.b.mask(1, 0x7FF));
+  CHECK(rig.b.filter(0, 0x123) && rig.b.filter(1, 0x123));
+  for (int f = 2; f < 6; f++) {
+    CHECK(rig.b.filter(f, 0x456));
+  }
+  CHECK(traffic(rig) == 3);
+
+  uint32_t spi = rig.n2.stats().spiBytes;  // Nothing changes, so nothing is written and Normal mode is never left
+  CHECK(rig.b.filter(0, 0x123) && rig.b.mask(1, 0x7FF));
+  CHECK(rig.n2.stats().spiBytes == spi);
+  CHECK(rig.b.filter(1, 0x789));
+  CHECK(rig.n2.stats().spiBytes > spi);
+  CHECK((rig.n2.peek(MCP_CANSTAT) & MODE_MASK) == MODE_NORMAL);
+  CHECK(traffic(rig) == 7);
+
+  uint8_t cnf[3] = {rig.n2.peek(MCP_CNF3), rig.n2.peek(MCP_CNF2), rig.n2.peek(MCP_CNF1)};
+  CHECK(rig.b.checkReset() == 0);
+  rig.n2.select();  // A brown-out the driver knows nothing about
+  rig.n2.transfer(MCP_RESET);
+  rig.n2.deselect();
+  CHECK((rig.n2.peek(MCP_CANSTAT) & MODE_MASK) == MODE_CONFIG);
+  CHECK(rig.n2.peek(MCP_CNF1) == 0);
+  spi = rig.n2.stats().spiBytes;
+  CHECK(rig.b.checkReset() == 1);
+  CHECK(rig.n2.stats().spiBytes - spi < 100);  // A few bursts, not one transaction per register
+  CHECK(rig.b.checkReset() == 0);
+  CHECK((rig.n2.peek(MCP_CANSTAT) & MODE_MASK) == MODE_NORMAL);
+  CHECK((rig.n2.peek(MCP_CNF3) == cnf[0]) && (rig.n2.peek(MCP_CNF2) == cnf[1]) && (rig.n2.peek(MCP_CNF1) == cnf[2]));
+  CHECK(traffic(rig) == 7);
+
+  // A reset under a running cyclic message: its reserved buffer gets its header and latest data back
+  rig.b.priority(true);  // Queue more frames than b's two receive buffers hold
+  SEEED_CANCyclic cyclic(rig.a, 1000, 10000);
+  int fast = cyclic.add(message(0x123, 4), 5000);
+  CHECK(cyclic.txBuffer(fast) == 2);
+  CHECK(cyclic.update(fast, "wxyz"));
+  uint64_t sent = rig.n1.stats().transmitted;
+  cyclic.start();
+  host::run(20000);
+  rig.n1.select();
+  rig.n1.transfer(MCP_RESET);
+  rig.n1.deselect();
+  host::run(20000);  // Ticks while nobody knows, in Configuration mode nothing goes out
+  CHECK(rig.a.checkReset() == 1);
+  host::run(20000);
+  cyclic.stop();
+  host::run(5000);
+  SEEED_CANMessage r;
+  uint32_t good = 0, bad = 0;
+  while (rig.b.read(r)) {
+    ((r.id == 0x123) && (r.len == 4) && (r.data[0] == 'w')) ? good++ : bad++;
+  }
+  CHECK((good >= 6) && (bad == 0));
+  CHECK(rig.n1.stats().transmitted - sent == good);  // Nothing b's filters kept out either, such as CAN Id 0
+  return finish();
+}
@@ -0,0 +1,155 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// DBC style signal decoder, against a bit by bit reference and on frames received through the simulator
+
+#include "harness.h"
+#include "seeed_can_signals.h"
+
+#define SIGNAL_TRIALS 2000
+#define SIGNAL_FRAMES 64
+
+static uint32_t lfsr = 0x12345678;
+
+static uint32_t random32(void) {
+  lfsr ^= lfsr << 13;
+  lfsr ^= lfsr >> 17;
+  lfsr ^= lfsr << 5;
+  return lfsr;
+}
+
+// Raw value of a signal, walking its bits in DBC order; false if it does not fit in 8 bytes
+static bool reference(uint8_t startBit, uint8_t length, bool motorola, const uint8_t data[8], uint64_t &raw) {
+  int pos = startBit;
+  raw = 0;
+  for (int k = 0; k < length; k++) {
+    if ((pos < 0) || (pos > 63)) {
+      return false;
+    }
+    uint64_t bit = (data[pos / 8] >> (pos % 8)) & 1;
+    if (motorola) {
+      raw |= bit << (length - 1 - k);             // Most significant bit first
+      pos = (pos % 8) ? (pos - 1) : (pos + 15);  // Then down the byte and on to the next one's bit 7
+    } else {
+      raw |= bit << k;
+      pos++;
+    }
+  }
+  return true;
+}
+
+static float physical(uint64_t raw, uint8_t length, bool isSigned) {
+  if (isSigned && (length < 64) && (raw >> (length - 1))) {
+    raw |= ~0ULL << length;
+  }
+  return isSigned ? (float)(int64_t)raw : (float)raw;
+}
+
+static bool same(float a, float b) { return (a == b) || (isnan(a) && isnan(b)); }
+
+int main() {
+  {  // Known layouts
+    SEEED_CANSignals db;
+    int speed = db.add(0x100, CANStandard, 8, 16, SEEED_CANSignals::Intel, false, 0.1f, -40.0f);
+    int torque = db.add(0x100, CANStandard, 3, 12, SEEED_CANSignals::Motorola, true);
+    int word = db.add(0x18FEF100, CANExtended, 7, 64, SEEED_CANSignals::Motorola, false);
+    CHECK((speed == 0) && (torque == 1) && (word == 2));
+    CHECK(db.add(0x100, CANStandard, 60, 8, SEEED_CANSignals::Intel, false) < 0);  // Past the last data byte
+    CHECK(db.add(0x100, CANStandard, 57, 8, SEEED_CANSignals::Motorola, false) < 0);
+    CHECK(db.compile() == 2);
+
+    SEEED_CANMessage m = message(0x100, 3);
+    m.data[0] = 0x0F;  // torque = 0xF00 = -256
+    m.data[1] = 0x00;
+    m.data[2] = 0x04;  // speed = 0x0400 = 1024
+    float values[3] = {0, 0, 0};
+    CHECK(db.decode(m, values) == 2);
+    CHECK((fabsf(values[speed] - 62.4f) < 0.001f) && (values[torque] == -256.0f));
+    m.len = 2;
+    values[speed] = 0;
+    CHECK((db.decode(m, values) == 1) && (values[speed] == 0));  // Too short for speed
+    m.id = 0x101;
+    CHECK(db.decode(m, values) == 0);
+    uint8_t bytes[8] = {0x80, 0, 0, 0, 0, 0, 0, 1};
+    CHECK(db.value(word, bytes) == 9223372036854775808.0f);
+  }
+  {  // Random layouts: value(), decode() of a frame and the batch decode agree with the reference
+    for (int trial = 0; trial < SIGNAL_TRIALS; trial++) {
+      SEEED_CANSignals db;
+      uint8_t startBit = random32() % 64;
+      uint8_t length = 1 + random32() % 64;
+      bool motorola = random32() & 1;
+      bool isSigned = random32() & 1;
+      SEEED_CANFrame frames[SIGNAL_FRAMES];
+      uint64_t raw;
+      uint8_t zero[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+      bool fits = reference(startBit, length, motorola, zero, raw);
+      SEEED_CANSignals::ByteOrder order = motorola ? SEEED_CANSignals::Motorola : SEEED_CANSignals::Intel;
+      int s = db.add(0x123, CANStandard, startBit, length, order, isSigned);
+      CHECK((s >= 0) == fits);
+      if (s < 0) {
+        continue;
+      }
+      db.compile();
+      uint32_t carried = 0;
+      for (int i = 0; i < SIGNAL_FRAMES; i++) {
+        memset(&frames[i], 0, sizeof(frames[i]));
+        frames[i].ident = (random32() % 8) ? 0x123 : 0x124;
+        frames[i].dlc = (random32() % 8) ? 8 : (random32() % 9);
+        for (int b = 0; b < 8; b++) {
+          frames[i].data[b] = (uint8_t)random32();
+        }
+      }
+      float batch[SIGNAL_FRAMES];
+      uint32_t hits = db.decode(s, frames, SIGNAL_FRAMES, batch);
+      for (int i = 0; i < SIGNAL_FRAMES; i++) {
+        reference(startBit, length, motorola, frames[i].data, raw);
+        float expected = physical(raw, length, isSigned);
+        int minLen = 0;
+        for (int b = 0; b < 8; b++) {  // Bytes needed: up to the highest byte the signal touches
+          uint8_t only[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+          uint64_t r;
+          only[b] = 0xFF;
+          reference(startBit, length, motorola, only, r);
+          minLen = r ? (b + 1) : minLen;
+        }
+        bool carries = (frames[i].ident == 0x123) && (frames[i].dlc >= minLen);
+        float single = NAN;
+        CHECK(same(db.value(s, frames[i].data), expected));
+        CHECK((db.decode(frames[i], &single) == (carries ? 1 : 0)) && same(single, carries ? expected : NAN));
+        CHECK(same(batch[i], carries ? expected : NAN));
+        carried += carries ? 1 : 0;
+      }
+      CHECK(hits == carried);
+    }
+  }
+  {  // Frames received through the simulator
+    SimRig rig;
+    SEEED_CANSignals db;
+    int rpm = db.add(0x0CF00400, CANExtended, 24, 16, SEEED_CANSignals::Intel, false, 0.125f);
+    db.compile();
+    CHECK(rig.open());
+    CHECK(rig.b.filter(2, 0, CANExtended));
+    SEEED_CANMessage m = message(0x0CF00400, 8, CANExtended);
+    m.data[3] = 0x40;  // 0x1F40 * 0.125 = 1000 rpm
+    m.data[4] = 0x1F;
+    CHECK(rig.a.write(m));
+    rig.bus.run(1000000);
+    SEEED_CANMessage r;
+    float values[1] = {0};
+    CHECK(rig.b.read(r) && (db.decode(r, values) == 1) && (values[rpm] == 1000.0f));
+  }
+  return finish();
+}
@@ -0,0 +1,106 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Virtual CAN bus simulator: unmodified SEEED_CANs exchanging frames through emulated MCP2515s
+
+#include "harness.h"
+
+static uint64_t saturate(uint32_t seed, uint64_t &errorFrames) {
+  SEEED_CANSimBus bus(500000, seed);
+  SEEED_CANFrame f;
+  memset(&f, 0, sizeof(f));
+  f.ident = 0x100;
+  f.dlc = 8;
+  bus.source(f, 0, 0, true);
+  f.ident = 0x080;
+  bus.source(f, 10000, 0, false);
+  bus.bitErrors(1000);
+  bus.run(10ULL * 1000000000ULL);
+  CHECK(bus.stats().busyNs > bus.now() * 99 / 100);
+  errorFrames = bus.stats().errorFrames;
+  return bus.stats().frames;
+}
+
+int main() {
+  {  // Two nodes exchange data and remote frames, standard and extended
+    SimRig rig;
+    CHECK(rig.open());
+    CHECK(rig.a.write(message(0x123)));
+    rig.bus.run(1000000);
+    SEEED_CANMessage r;
+    CHECK(rig.b.read(r) && (r.id == 0x123) && (r.len == 8) && (r.data[7] == 7));
+    CHECK(rig.n1.stats().transmitted == 1);
+    CHECK(rig.n2.stats().received == 1);
+
+    CHECK(rig.a.filter(2, 0, CANExtended));  // Filters 0 and 1 stay standard
+    CHECK(rig.b.write(message(0x1ABCDE, 2, CANExtended, CANRemote)));
+    rig.bus.run(1000000);
+    CHECK(rig.a.read(r) && (r.id == 0x1ABCDE) && (r.format == CANExtended) && (r.type == CANRemote) && (r.len == 2));
+  }
+  {  // A lone node gets no acknowledge: error passive (TEC 128), never bus off
+    SEEED_CANSimBus bus(250000, 7);
+    SEEED_CANSimNode n(bus, 1);
+    SEEED_CAN a(1, 2, 3, 4, 5);
+    CHECK(a.open(250000));
+    CHECK(a.write(message(0x10, 1)));
+    bus.run(100000000);
+    CHECK(n.peek(MCP_TEC) == 128);
+    CHECK(n.stats().busOffs == 0);
+  }
+  {  // A bit error on every frame drives the transmitter bus off, it recovers once the errors stop
+    SimRig rig;
+    CHECK(rig.open());
+    rig.n1.txErrors(1000000);
+    CHECK(rig.a.write(message(0x10, 1)));
+    rig.bus.run(5000000);
+    CHECK(rig.n1.stats().busOffs == 1);
+    CHECK(rig.a.errors(SEEED_CAN::TxBOff));
+    rig.n1.txErrors(0);
+    rig.bus.run(100000000);
+    CHECK(rig.n1.stats().transmitted == 1);
+  }
+  {  // A node never wins arbitration against a saturating source with a lower CAN Id
+    SimRig rig;
+    CHECK(rig.open());
+    SEEED_CANFrame f;
+    memset(&f, 0, sizeof(f));
+    f.ident = 0x050;
+    f.dlc = 8;
+    rig.bus.source(f, 0);
+    CHECK(rig.a.write(message(0x100, 1)));
+    rig.bus.run(1000000);
+    CHECK(rig.n1.stats().transmitted == 0);
+    CHECK(rig.n1.stats().arbitrationLost > 0);
+  }
+  {  // Saturated traffic with injected errors keeps the bus busy, and a seed repeats a run exactly
+    uint64_t errors1, errors2;
+    uint64_t frames1 = saturate(5, errors1);
+    uint64_t frames2 = saturate(5, errors2);
+    CHECK(frames1 > 10 * 4000);  // At least 4000 frames a second at 500 kbit/s
+    CHECK(errors1 > 0);
+    CHECK((frames1 == frames2) && (errors1 == errors2));
+  }
+  {  // An mcp_can_t built from pin objects, as before the simulator, still works but never reaches a node
+    SEEED_CANSimBus bus(500000);
+    SEEED_CANSimNode n(bus, 30);
+    SPI spi(1, 2, 3);
+    mcp_can_t legacy(spi, DigitalOut(30), InterruptIn(31));
+    mcp_can_t wired(spi, 30, 31);
+    CHECK(legacy.sim == NULL);
+    CHECK(wired.sim == &n);
+    CHECK((legacy.txReserved == 0) && (legacy.bitRate == 0) && (legacy.shadow.mode == MODE_CONFIG));
+  }
+  return finish();
+}
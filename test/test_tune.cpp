@@ -0,0 +1,45 @@
+/* Copyright (c) 2017 Akila Perera, Sophie Dexter
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SPI clock auto-tuning: register patterns and loopback frames that never reach the bus
+
+#include "harness.h"
+
+int main() {
+  SimRigFor<ChipCAN> rig;
+  CHECK(rig.b.open(500000));
+  SEEED_CAN::SpiStep steps[CAN_SPI_STEPS];
+  memset(steps, 0, sizeof(steps));
+
+  CHECK(rig.a.tuneSpi(10000000, 16, steps) == 10000000);
+  CHECK(rig.a.spiFrequency() == 10000000);
+  for (int i = 0; i < CAN_SPI_STEPS; i++) {
+    CHECK(steps[i].passed && (steps[i].errors == 0) && (steps[i].hz > 0));
+  }
+  CHECK(rig.bus.stats().frames == 0);  // The test frames stayed inside the MCP2515
+  CHECK(rig.n2.stats().received == 0);
+  CHECK((mcpRead(rig.a.chip(), MCP_CANSTAT) & MODE_MASK) == MODE_CONFIG);
+  CHECK((rig.a.bitRate() == 0) && (rig.a.chip()->txReserved == 0));  // Not the loopback test's 1 Mbit/s
+  SEEED_CANConfig config;
+  rig.a.snapshot(config);
+  CHECK(!rig.a.open(config));  // No bit timing to capture
+
+  CHECK(rig.a.tuneSpi(4000000, 4) == 2000000);  // The step below the fastest one tried, for margin
+  CHECK(rig.a.open(500000));
+  CHECK(rig.a.write(message(0x123)));
+  host::run(1000);
+  CHECK(rig.n2.stats().received == 1);
+  return finish();
+}